@@ -8,6 +8,8 @@ import os.path
 import platform
 import shlex
 import signal
+import socket
+import struct
 import subprocess
 import tempfile
 import time
@@ -32,49 +34,139 @@ class TestCase:
         self.in_cmd = shlex.split(in_cmd)
         self.exp_resp = '\0'.join(shlex.split(exp_resp)).encode() + b'\0'
 
+    @staticmethod
+    def dump_failed(name, value):
+        """Dump the failed test case"""
+        print("# {}".format(name))
+        for argv in value.decode().split('\0'):
+            print("#\t {}".format(argv))
+        print()
+
+    def print_result(self, index, passed, prefix=''):
+        """Print the test case result and description"""
+        out = "ok {} - {}{}".format(index+1, prefix, self.desc)
+        if not passed:
+            out = "not " + out
+        print(out)
+
     def execute(self, index, suite):
         """Execute the test case and return the result in TAP format"""
-        def dump_failed(name, value):
-            """Dump the failed test case"""
-            print("# {}".format(name))
-            for argv in value.decode().split('\0'):
-                print("#\t {}".format(argv))
-            print()
-
-        def print_result(passed):
-            """Print the test case result and description"""
-            out = "ok {} - {}".format(index+1, self.desc)
-            if not passed:
-                out = "not " + out
-            print(out)
-
         cmd = [suite.find_control_program(),
                '-s', suite.command, '--',
                *self.in_cmd]
 
         testcase = subprocess.run(cmd, stdout=subprocess.PIPE, check=False)
         if testcase.returncode != 0:
-            print_result(False)
+            self.print_result(index, False)
             print("# x52ctl returned code: {}".format(testcase.returncode))
-            dump_failed("Expected", self.exp_resp)
-            dump_failed("Got", testcase.stdout)
+            self.dump_failed("Expected", self.exp_resp)
+            self.dump_failed("Got", testcase.stdout)
         elif testcase.stdout != self.exp_resp:
-            print_result(False)
-            dump_failed("Expected", self.exp_resp)
-            dump_failed("Got", testcase.stdout)
+            self.print_result(index, False)
+            self.dump_failed("Expected", self.exp_resp)
+            self.dump_failed("Got", testcase.stdout)
         else:
-            print_result(True)
+            self.print_result(index, True)
+
+    def framed_request(self):
+        """Return the command as a length prefixed frame"""
+        payload = b''.join(arg.encode() + b'\0' for arg in self.in_cmd)
+        return struct.pack('!I', len(payload)) + payload
+
+    def check_framed(self, index, response):
+        """Check the response to the framed request"""
+        if response != self.exp_resp:
+            self.print_result(index, False, 'framed: ')
+            self.dump_failed("Expected", self.exp_resp)
+            self.dump_failed("Got", response or b'')
+        else:
+            self.print_result(index, True, 'framed: ')
 
 
 class Test:
     """Test class runs a series of unit tests"""
 
+    # Steps run against the notify socket. Each step either sends a request
+    # on the notify socket and reads the acknowledgement ('request'), runs
+    # a command and checks its output ('command'), runs a command and reads
+    # the notification that it generates ('event'), or runs a command and
+    # skips notifications until the expected one arrives ('until'). Event
+    # steps without a command read the next pending notification. Edit steps
+    # write the lines to the configuration file, a line at a time, and read
+    # the notification that it generates.
+    NOTIFY_TESTS = [
+        ("Set notification overflow policy", 'request',
+         ['policy', 'coalesce'], ['OK', 'policy', 'coalesce']),
+        ("Set notification overflow policy, case insensitive", 'request',
+         ['policy', 'Drop-Oldest'], ['OK', 'policy', 'drop-oldest']),
+        ("Set invalid notification overflow policy", 'request',
+         ['policy', 'foo'], ['ERR', "Unknown policy 'foo'"]),
+        ("Send invalid notification request", 'request',
+         ['foo'], ['ERR', "Unknown request 'foo'"]),
+        ("Notify statistics with a client connected", 'command',
+         ['notify', 'stats'], ['DATA', 'notify', '1', '0', '0', '0', '0']),
+        ("Client statistics with a client on each socket", 'command',
+         ['stats', 'clients'],
+         ['DATA', 'clients', 'command', '1', 'notify', '1', 'queued', '0', 'dropped', '0']),
+        ("Subscribe without a topic", 'request',
+         ['subscribe'], ['ERR', "No topics given"]),
+        ("Subscribe to an invalid topic", 'request',
+         ['subscribe', 'config', 'foo'], ['ERR', "Unknown topic 'foo'"]),
+        ("Subscribe to configuration changes", 'request',
+         ['subscribe', 'Config'], ['OK', 'subscribe', 'Config']),
+        ("Notification of configuration change", 'event',
+         ['config', 'set', 'mouse', 'speed', '5'],
+         ['CONFIG', 'Mouse', 'Speed', '5']),
+        ("Reload configuration", 'until',
+         ['config', 'reload'], ['CONFIG_APPLIED']),
+        ("Reload of unchanged configuration applies no parameters", 'event',
+         ['config', 'reload'], ['CONFIG_APPLIED']),
+        ("Notification of configuration change before reload", 'event',
+         ['config', 'set', 'mouse', 'speed', '7'],
+         ['CONFIG', 'Mouse', 'Speed', '7']),
+        ("Reload only applies the changed parameter", 'event',
+         ['config', 'reload'], ['CONFIG', 'Mouse', 'Speed', '0']),
+        ("Reload completes after applying the changed parameter", 'event',
+         None, ['CONFIG_APPLIED']),
+        ("Editing the configuration file applies the changed parameter", 'edit',
+         ['[Mouse]', 'Enabled = yes', 'Speed = 9'], ['CONFIG', 'Mouse', 'Speed', '9']),
+        ("Edited configuration file is applied", 'event',
+         None, ['CONFIG_APPLIED']),
+        ("Edited configuration file is only applied once", 'event',
+         None, None),
+        ("Batch notifies each changed parameter", 'event',
+         ['config', 'batch', 'mouse', 'speed', '3', 'mouse', 'acceleration', '10'],
+         ['CONFIG', 'Mouse', 'Speed', '3']),
+        ("Batch notifies the next changed parameter", 'event',
+         None, ['CONFIG', 'Mouse', 'Acceleration', '10']),
+        ("Batch completes after applying the changed parameters", 'event',
+         None, ['CONFIG_APPLIED']),
+        ("Failed batch applies no parameters", 'event',
+         ['config', 'batch', 'mouse', 'speed', '4', 'mouse', 'acceleration', 'fast'], None),
+        ("Saving the configuration file does not reload it", 'event',
+         ['config', 'save'], None),
+        ("Notification of configuration change after saving", 'event',
+         ['config', 'set', 'mouse', 'speed', '6'],
+         ['CONFIG', 'Mouse', 'Speed', '6']),
+        ("Configuration change after saving is not reverted", 'event',
+         None, None),
+        ("Subscribe to input changes", 'request',
+         ['subscribe', 'input'], ['OK', 'subscribe', 'input']),
+        ("Unsubscribe from all topics", 'request',
+         ['unsubscribe', 'all'], ['OK', 'unsubscribe', 'all']),
+        ("Subscribe to device notifications", 'request',
+         ['subscribe', 'device'], ['OK', 'subscribe', 'device']),
+        ("No notification of configuration change when unsubscribed", 'event',
+         ['config', 'set', 'mouse', 'speed', '6'], None),
+    ]
+
     def __init__(self):
         """Create a new instance of the Test class"""
         self.program = self.find_daemon_program()
         self.tmpdir = tempfile.TemporaryDirectory() # pylint: disable=consider-using-with
         self.command = os.path.join(self.tmpdir.name, "x52d.cmd")
         self.notify = os.path.join(self.tmpdir.name, "x52d.notify")
+        self.config = os.path.join(self.tmpdir.name, "x52d.cfg")
         self.daemon = None
         self.testcases = []
 
@@ -123,15 +215,16 @@ class Test:
             self.program,
             "-f", # Run in foreground
             "-q", # Quiet logging
-            "-c", os.path.join(self.tmpdir.name, "x52d.cfg"), # Default config file
+            "-c", self.config, # Default config file
             "-l", os.path.join(self.tmpdir.name, "x52d.log"), # Output logs to log file
             "-p", os.path.join(self.tmpdir.name, "x52d.pid"), # PID file
             "-s", self.command, # Command socket path
             "-b", self.notify, # Notification socket path
+            "-m", os.path.join(self.tmpdir.name, "x52d.state"), # State page path
         ]
 
         # Create empty config file
-        with open(daemon_cmdline[4], 'w', encoding='utf-8'):
+        with open(self.config, 'w', encoding='utf-8'):
             pass
 
         self.daemon = subprocess.Popen(daemon_cmdline) # pylint: disable=consider-using-with
@@ -170,12 +263,170 @@ class Test:
             print("#\t {}".format(argv))
         print()
 
+    @staticmethod
+    def recv_exact(sock, length):
+        """Read exactly length bytes from the socket"""
+        data = b''
+        while len(data) < length:
+            chunk = sock.recv(length - len(data))
+            if not chunk:
+                raise ConnectionResetError("Daemon closed the connection")
+            data += chunk
+        return data
+
+    def run_framed_tests(self, offset):
+        """Run all the test cases again, pipelined on a single connection
+           in framed mode"""
+        responses = []
+        try:
+            with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+                sock.settimeout(10)
+                sock.connect(self.command)
+                sock.sendall(b'protocol\0framed\0')
+                if sock.recv(1024) != b'OK\0protocol\0framed\0':
+                    raise ConnectionError("Unable to switch to framed mode")
+
+                # Send every request without waiting for the responses, and
+                # split the stream in the middle of a frame, to verify that
+                # the daemon reassembles it.
+                data = b''.join(tc.framed_request() for tc in self.testcases)
+                split = len(data) // 2 + 1
+                sock.sendall(data[:split])
+                time.sleep(0.1)
+                sock.sendall(data[split:])
+
+                for _ in self.testcases:
+                    length, = struct.unpack('!I', self.recv_exact(sock, 4))
+                    responses.append(self.recv_exact(sock, length))
+        except OSError as err:
+            print("# Error in framed mode: {}".format(err))
+
+        for index, testcase in enumerate(self.testcases):
+            response = responses[index] if index < len(responses) else None
+            testcase.check_framed(offset + index, response)
+
+    def run_stalled_tests(self, offset):
+        """Check that a framed client that isn't reading its responses
+           doesn't hold up other clients, and still gets all of them"""
+        # Use the request with the largest response, to fill the socket fast
+        testcase = max(self.testcases, key=lambda tc: len(tc.exp_resp))
+        count = 4096
+        responses = []
+        elapsed = None
+        try:
+            with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+                sock.settimeout(10)
+                sock.connect(self.command)
+                sock.sendall(b'protocol\0framed\0')
+                if sock.recv(1024) != b'OK\0protocol\0framed\0':
+                    raise ConnectionError("Unable to switch to framed mode")
+
+                sock.sendall(testcase.framed_request() * count)
+                time.sleep(0.1)
+
+                start = time.monotonic()
+                testcase.execute(offset, self)
+                elapsed = time.monotonic() - start
+
+                for _ in range(count):
+                    length, = struct.unpack('!I', self.recv_exact(sock, 4))
+                    responses.append(self.recv_exact(sock, length))
+        except OSError as err:
+            print("# Error with stalled client: {}".format(err))
+
+        out = "ok {} - Stalled client gets all its responses".format(offset + 2)
+        if responses != [testcase.exp_resp] * count or elapsed is None or elapsed > 0.5:
+            print("not " + out)
+            print("# Got {} of {} responses, other client took {} seconds".format(
+                len(responses), count, elapsed))
+        else:
+            print(out)
+
+    def run_notify_tests(self, offset):
+        """Run the steps in NOTIFY_TESTS on a single notify connection"""
+        def frame(args):
+            payload = b''.join(arg.encode() + b'\0' for arg in args)
+            return struct.pack('!I', len(payload)) + payload
+
+        def recv_frame(sock):
+            length, = struct.unpack('!I', self.recv_exact(sock, 4))
+            return self.recv_exact(sock, length)
+
+        def run_command(args):
+            cmd = [self.find_control_program(), '-s', self.command, '--', *args]
+            return subprocess.run(cmd, stdout=subprocess.PIPE, check=False).stdout
+
+        try:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.settimeout(10)
+            sock.connect(self.notify)
+        except OSError as err:
+            print("# Error connecting to notify socket: {}".format(err))
+            sock = None
+
+        for index, (desc, kind, args, expected) in enumerate(self.NOTIFY_TESTS):
+            response = b''
+            try:
+                if kind == 'command':
+                    # Give the daemon a chance to update its statistics
+                    time.sleep(0.1)
+                    response = run_command(args)
+                elif sock is None:
+                    pass
+                elif kind == 'request':
+                    sock.sendall(frame(args))
+                    response = recv_frame(sock)
+                elif kind == 'edit':
+                    # Rewrite the file in several steps, like an editor
+                    for count in range(1, len(args) + 1):
+                        with open(self.config, 'w', encoding='utf-8') as cfg:
+                            cfg.write('\n'.join(args[:count]) + '\n')
+                        time.sleep(0.05)
+                    response = recv_frame(sock)
+                elif kind == 'until':
+                    run_command(args)
+                    while response != frame(expected)[4:]:
+                        response = recv_frame(sock)
+                elif expected is None:
+                    if args is not None:
+                        run_command(args)
+                    sock.settimeout(0.5)
+                    try:
+                        response = recv_frame(sock)
+                    except socket.timeout:
+                        response = None
+                    sock.settimeout(10)
+                else:
+                    if args is not None:
+                        run_command(args)
+                    response = recv_frame(sock)
+            except OSError as err:
+                print("# Error on notify socket: {}".format(err))
+
+            if expected is not None:
+                expected = frame(expected)[4:]
+
+            out = "ok {} - {}".format(offset + index + 1, desc)
+            if response != expected:
+                print("not " + out)
+                self.dump_failed("Expected", expected or b'')
+                self.dump_failed("Got", response or b'')
+            else:
+                print(out)
+
+        if sock is not None:
+            sock.close()
+
     def run_tests(self):
         """Run test cases"""
-        print("1..{}".format(len(self.testcases)))
+        print("1..{}".format(2 * len(self.testcases) + 2 + len(self.NOTIFY_TESTS)))
         for index, testcase in enumerate(self.testcases):
             testcase.execute(index, self)
 
+        self.run_framed_tests(len(self.testcases))
+        self.run_stalled_tests(2 * len(self.testcases))
+        self.run_notify_tests(2 * len(self.testcases) + 2)
+
     def find_and_parse_testcase_files(self):
         """Find and parse *.tc files"""
         basedir = os.path.dirname(os.path.realpath(__file__))
@@ -14,7 +14,7 @@
 \endhtmlonly
 
 # SYNOPSIS
-<tt>\b x52ctl [\a -i] [\a -s socket-path] [command] </tt>
+<tt>\b x52ctl [\a -i | \a -b] [\a -s socket-path] [command] </tt>
 
 # DESCRIPTION
 
@@ -30,11 +30,20 @@ will exit with a failure exit code. If running interactively, the program will
 request input and send that to the daemon, until the user either enters the
 string "quit", or terminates input by using Ctrl+D.
 
+In batch mode, the program reads commands from standard input, one per line,
+and sends them to the daemon without waiting for each response, which is much
+faster than running x52ctl once per command. Blank lines and lines starting
+with \c # are ignored. The responses are written in the same order as the
+commands, each followed by a newline.
+
 # OPTIONS
 
 - <tt>\b -i</tt>
   Run in interactive mode. Any additional non-option arguments are ignored.
 
+- <tt>\b -b</tt>
+  Run in batch mode. Any additional non-option arguments are ignored.
+
 - <tt>\b -s < \a socket-path ></tt>
   Use the socket at the given path. If this is not specified, then it uses a
   default socket.
@@ -52,12 +61,16 @@ string "quit", or terminates input by using Ctrl+D.
 #include "x52dcomm.h"
 
 #define APP_NAME "x52ctl"
+
+/* Maximum number of commands awaiting a response in batch mode */
+#define BATCH_WINDOW 32
+
 #if HAVE_FUNC_ATTRIBUTE_NORETURN
 __attribute__((noreturn))
 #endif
 static void usage(int exit_code)
 {
-    fprintf(stderr, _("Usage: %s [-i] [-s socket-path] [command]\n"), APP_NAME);
+    fprintf(stderr, _("Usage: %s [-i | -b] [-s socket-path] [command]\n"), APP_NAME);
     exit(exit_code);
 }
 
@@ -89,9 +102,101 @@ static int send_command(int sock_fd, int argc, char **argv)
     return 0;
 }
 
+/* Break the line into argc/argv, and return the number of arguments */
+static int split_line(char *buffer, char **sargv)
+{
+    int sargc = 0;
+    int pos = 0;
+
+    while (buffer[pos]) {
+        if (isspace(buffer[pos])) {
+            buffer[pos] = '\0';
+            pos++;
+        } else {
+            sargv[sargc] = &buffer[pos];
+            sargc++;
+            for (; buffer[pos] && !isspace(buffer[pos]); pos++);
+        }
+    }
+
+    return sargc;
+}
+
+static int recv_response(int sock_fd)
+{
+    char buffer[1024];
+    int rc;
+
+    rc = x52d_recv_frame(sock_fd, buffer, sizeof(buffer));
+    if (rc < 0) {
+        perror("x52d_recv_frame");
+        return -1;
+    }
+
+    if (write(STDOUT_FILENO, buffer, rc) < 0 || write(STDOUT_FILENO, "\n", 1) < 0) {
+        perror("write");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int run_batch(int sock_fd)
+{
+    char line[1024];
+    char buffer[1024];
+    int outstanding = 0;
+
+    if (x52d_command_framed(sock_fd) < 0) {
+        perror("x52d_command_framed");
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        int sargc;
+        char *sargv[512] = { 0 };
+        int buflen;
+
+        sargc = split_line(line, sargv);
+        if (sargc == 0 || sargv[0][0] == '#') {
+            continue;
+        }
+
+        buflen = x52d_format_command(sargc, (const char **)sargv, buffer, sizeof(buffer));
+        if (buflen < 0) {
+            if (errno == E2BIG) {
+                fprintf(stderr, _("Argument length too long\n"));
+            }
+            return -1;
+        }
+
+        if (x52d_send_frame(sock_fd, buffer, buflen) < 0) {
+            perror("x52d_send_frame");
+            return -1;
+        }
+
+        /* Don't let the responses pile up in the socket */
+        if (++outstanding == BATCH_WINDOW) {
+            if (recv_response(sock_fd)) {
+                return -1;
+            }
+            outstanding--;
+        }
+    }
+
+    for (; outstanding > 0; outstanding--) {
+        if (recv_response(sock_fd)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     bool interactive = false;
+    bool batch = false;
     char *socket_path = NULL;
     int opt;
     int sock_fd;
@@ -103,14 +208,19 @@ int main(int argc, char **argv)
      * Parse command line arguments
      *
      * -i   Interactive
+     * -b   Batch
      * -s   Socket path
      */
-    while ((opt = getopt(argc, argv, "is:h")) != -1) {
+    while ((opt = getopt(argc, argv, "ibs:h")) != -1) {
         switch (opt) {
         case 'i':
             interactive = true;
             break;
 
+        case 'b':
+            batch = true;
+            break;
+
         case 's':
             socket_path = optarg;
             break;
@@ -125,7 +235,11 @@ int main(int argc, char **argv)
         }
     }
 
-    if (!interactive && optind >= argc) {
+    if (interactive && batch) {
+        usage(EXIT_FAILURE);
+    }
+
+    if (!interactive && !batch && optind >= argc) {
         usage(EXIT_FAILURE);
     }
 
@@ -146,25 +260,12 @@ int main(int argc, char **argv)
         while (fgets(buffer, sizeof(buffer), stdin) != NULL) {
             int sargc;
             char *sargv[512] = { 0 };
-            int pos;
 
             if (strcasecmp(buffer, "quit\n") == 0) {
                 break;
             }
 
-            /* Break the buffer into argc/argv */
-            sargc = 0;
-            pos = 0;
-            while (buffer[pos]) {
-                if (isspace(buffer[pos])) {
-                    buffer[pos] = '\0';
-                    pos++;
-                } else {
-                    sargv[sargc] = &buffer[pos];
-                    sargc++;
-                    for (; buffer[pos] && !isspace(buffer[pos]); pos++);
-                }
-            }
+            sargc = split_line(buffer, sargv);
 
             if (send_command(sock_fd, sargc, sargv)) {
                 rc = EXIT_FAILURE;
@@ -174,6 +275,16 @@ int main(int argc, char **argv)
             fputs("\n> ", stdout);
         }
 
+    } else if (batch) {
+        if (optind < argc) {
+            fprintf(stderr,
+                    _("Running in batch mode, ignoring extra arguments\n"));
+        }
+
+        if (run_batch(sock_fd)) {
+            rc = EXIT_FAILURE;
+            goto cleanup;
+        }
     } else {
         if (send_command(sock_fd, argc - optind, &argv[optind])) {
             rc = EXIT_FAILURE;
@@ -6,141 +6,384 @@
  * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
  */
 
+#include "config.h"
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#if HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
 #include "pinelog.h"
 #include "x52d_client.h"
 #include "x52dcomm-internal.h"
 
-void x52d_client_init(int client_fd[X52D_MAX_CLIENTS])
+/* Maximum number of events handled in a single wait */
+#define MAX_EVENTS  64
+
+#if HAVE_SYS_EPOLL_H
+static int epoll_update(struct x52d_client_set *set, int op, struct x52d_client *client)
 {
-    for (int i = 0; i < X52D_MAX_CLIENTS; i++) {
-        client_fd[i] = INVALID_CLIENT;
+    struct epoll_event ev = { 0 };
+
+    if (client->events & X52D_CLIENT_READ) {
+        ev.events |= EPOLLIN;
+    }
+    if (client->events & X52D_CLIENT_WRITE) {
+        ev.events |= EPOLLOUT;
     }
+    ev.data.ptr = client;
+
+    return epoll_ctl(set->poll_fd, op, client->fd, &ev);
 }
+#endif
 
-bool x52d_client_register(int client_fd[X52D_MAX_CLIENTS], int sock_fd)
+int x52d_client_init(struct x52d_client_set *set, int listen_fd, size_t client_size,
+                     x52d_client_fn on_connect, x52d_client_fn on_disconnect)
 {
-    int fd;
-    int i;
+    memset(set, 0, sizeof(*set));
+    set->client_size = client_size;
+    set->on_connect = on_connect;
+    set->on_disconnect = on_disconnect;
+    set->listener.fd = listen_fd;
+    set->listener.events = X52D_CLIENT_READ;
 
-    fd = accept(sock_fd, NULL, NULL);
-    if (fd < 0) {
-        PINELOG_ERROR(_("Error accepting client connection on socket fd %d: %s"),
-                      sock_fd, strerror(errno));
-        return false;
+    #if HAVE_SYS_EPOLL_H
+    set->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (set->poll_fd < 0) {
+        PINELOG_ERROR(_("Error %d creating epoll instance: %s"),
+                      errno, strerror(errno));
+        return -1;
     }
+    #else
+    set->poll_fd = -1;
+    #endif
 
-    if (x52d_set_socket_nonblocking(fd) < 0) {
-        PINELOG_ERROR(_("Error marking client fd %d as nonblocking: %s"),
-                      fd, strerror(errno));
-        goto error;
+    if (x52d_client_watch(set, &set->listener) < 0) {
+        x52d_client_exit(set);
+        return -1;
     }
 
-    for (i = 0; i < X52D_MAX_CLIENTS; i++) {
-        if (client_fd[i] == INVALID_CLIENT) {
-            PINELOG_TRACE("Accepted client %d on socket %d, slot %d", fd, sock_fd, i);
-            client_fd[i] = fd;
-            return true;
-        }
+    return 0;
+}
+
+void x52d_client_exit(struct x52d_client_set *set)
+{
+    struct x52d_client *client;
+
+    while ((client = x52d_client_next(set, NULL)) != NULL) {
+        x52d_client_close(set, client);
     }
 
-    /*
-     * At this point, we've looped through the entirity of client_fd, but
-     * have not registered an empty slot. We need to close the socket and
-     * tell the caller that we haven't been able to register the client.
-     */
-    PINELOG_TRACE("Maximum connections reached, closing socket %d", fd);
-error:
-    close(fd);
+    while ((client = set->closed) != NULL) {
+        set->closed = client->closed;
+        free(client);
+    }
 
-    return false;
+    if (set->poll_fd >= 0) {
+        close(set->poll_fd);
+        set->poll_fd = -1;
+    }
 }
 
-bool x52d_client_deregister(int client_fd[X52D_MAX_CLIENTS], int fd)
+/* Watch a descriptor other than a client, such as a pipe */
+int x52d_client_watch(struct x52d_client_set *set, struct x52d_client *watch)
 {
-    bool deregistered = false;
+    watch->watched = true;
 
-    for (int i = 0; i < X52D_MAX_CLIENTS; i++) {
-        if (client_fd[i] == fd) {
-            client_fd[i] = INVALID_CLIENT;
-            deregistered = true;
-            close(fd);
+    #if HAVE_SYS_EPOLL_H
+    if (epoll_update(set, EPOLL_CTL_ADD, watch) < 0) {
+        PINELOG_ERROR(_("Error %d watching descriptor %d: %s"),
+                      errno, watch->fd, strerror(errno));
+        return -1;
+    }
+    #else
+    if (set->watch_count == sizeof(set->watched) / sizeof(set->watched[0])) {
+        errno = ENOSPC;
+        PINELOG_ERROR(_("Error %d watching descriptor %d: %s"),
+                      errno, watch->fd, strerror(errno));
+        return -1;
+    }
+    set->watched[set->watch_count++] = watch;
+    #endif
 
-            PINELOG_TRACE("Disconnected client %d from socket", fd);
-            break;
-        }
+    return 0;
+}
+
+void x52d_client_set_events(struct x52d_client_set *set, struct x52d_client *client,
+                            unsigned int events)
+{
+    if (client->fd == INVALID_CLIENT || client->events == events) {
+        return;
+    }
+
+    client->events = events;
+
+    #if HAVE_SYS_EPOLL_H
+    if (epoll_update(set, EPOLL_CTL_MOD, client) < 0) {
+        PINELOG_ERROR(_("Error %d watching descriptor %d: %s"),
+                      errno, client->fd, strerror(errno));
+    }
+    #endif
+}
+
+/*
+ * Close a client connection. The client state is only freed once all the
+ * events from the current wait have been handled, and the client keeps its
+ * link to the next client, so that any iteration over the clients can safely
+ * continue past it.
+ */
+void x52d_client_close(struct x52d_client_set *set, struct x52d_client *client)
+{
+    if (client->fd == INVALID_CLIENT || client->watched) {
+        return;
+    }
+
+    #if HAVE_SYS_EPOLL_H
+    epoll_ctl(set->poll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    #endif
+    close(client->fd);
+    PINELOG_TRACE("Disconnected client %d from socket", client->fd);
+    client->fd = INVALID_CLIENT;
+
+    if (client->prev != NULL) {
+        client->prev->next = client->next;
+    } else {
+        set->head = client->next;
+    }
+    if (client->next != NULL) {
+        client->next->prev = client->prev;
+    }
+    set->count--;
+
+    client->closed = set->closed;
+    set->closed = client;
+
+    if (set->on_disconnect != NULL) {
+        set->on_disconnect(client);
+    }
+}
+
+/* Return the connected client after the given one, or the first if NULL */
+struct x52d_client *x52d_client_next(struct x52d_client_set *set, struct x52d_client *client)
+{
+    client = (client == NULL) ? set->head : client->next;
+    while (client != NULL && client->fd == INVALID_CLIENT) {
+        client = client->next;
     }
 
-    return deregistered;
+    return client;
+}
+
+static void accept_clients(struct x52d_client_set *set)
+{
+    struct x52d_client *client;
+    int sock_fd = set->listener.fd;
+    int fd;
+
+    for (;;) {
+        fd = accept(sock_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                PINELOG_ERROR(_("Error accepting client connection on socket fd %d: %s"),
+                              sock_fd, strerror(errno));
+            }
+            return;
+        }
+
+        if (set->count >= X52D_MAX_CLIENTS) {
+            PINELOG_TRACE("Maximum connections reached, closing socket %d", fd);
+            goto error;
+        }
+
+        if (x52d_set_socket_nonblocking(fd) < 0) {
+            PINELOG_ERROR(_("Error marking client fd %d as nonblocking: %s"),
+                          fd, strerror(errno));
+            goto error;
+        }
+
+        client = calloc(1, set->client_size);
+        if (client == NULL) {
+            PINELOG_ERROR(_("Error allocating state for client %d"), fd);
+            goto error;
+        }
+
+        client->fd = fd;
+        client->events = X52D_CLIENT_READ;
+
+        #if HAVE_SYS_EPOLL_H
+        if (epoll_update(set, EPOLL_CTL_ADD, client) < 0) {
+            PINELOG_ERROR(_("Error %d watching descriptor %d: %s"),
+                          errno, fd, strerror(errno));
+            free(client);
+            goto error;
+        }
+        #endif
+
+        client->next = set->head;
+        if (set->head != NULL) {
+            set->head->prev = client;
+        }
+        set->head = client;
+        set->count++;
+
+        PINELOG_TRACE("Accepted client %d on socket %d, %d clients connected",
+                      fd, sock_fd, set->count);
+        if (set->on_connect != NULL) {
+            set->on_connect(client);
+        }
+        continue;
+
+error:
+        close(fd);
+    }
 }
 
-bool x52d_client_error(int client_fd[X52D_MAX_CLIENTS], int fd)
+static void client_error(struct x52d_client_set *set, struct x52d_client *client)
 {
-    int error;
+    int error = 0;
     socklen_t errlen = sizeof(error);
 
-    getsockopt(fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
+    getsockopt(client->fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
     PINELOG_ERROR(_("Error when polling socket: FD %d, error %d, len %lu"),
-                  fd, error, (unsigned long int)errlen);
-    return x52d_client_deregister(client_fd, fd);
+                  client->fd, error, (unsigned long int)errlen);
+    x52d_client_close(set, client);
+}
+
+static void dispatch(struct x52d_client_set *set, struct x52d_client *client,
+                     unsigned int ready, bool error, bool hangup,
+                     x52d_client_handler handler)
+{
+    if (client->fd == INVALID_CLIENT) {
+        // Closed while handling an earlier event
+        return;
+    }
+
+    if (client == &set->listener) {
+        accept_clients(set);
+        return;
+    }
+
+    if (error && !client->watched) {
+        client_error(set, client);
+        return;
+    }
+
+    /* Read anything the client sent before hanging up */
+    if (ready != 0 && handler != NULL) {
+        handler(client, ready);
+    }
+
+    if (hangup) {
+        x52d_client_close(set, client);
+    }
 }
 
-int x52d_client_poll(int client_fd[X52D_MAX_CLIENTS], struct pollfd pfd[MAX_CONN], int listen_fd)
+/*
+ * Wait for events on the clients, accept any new clients, and call the
+ * handler for every other client or watched descriptor that is ready. Returns
+ * the number of events handled, or -1 on error.
+ */
+int x52d_client_wait(struct x52d_client_set *set, x52d_client_handler handler, int timeout)
 {
-    int pfd_count;
+    struct x52d_client *client;
     int rc;
 
-    memset(pfd, 0, sizeof(*pfd) * MAX_CONN);
+    #if HAVE_SYS_EPOLL_H
+    struct epoll_event events[MAX_EVENTS];
 
-    pfd_count = 1;
-    pfd[0].fd = listen_fd;
-    pfd[0].events = POLLIN | POLLERR;
-    for (int i = 0; i < X52D_MAX_CLIENTS; i++) {
-        if (client_fd[i] != INVALID_CLIENT) {
-            pfd[pfd_count].fd = client_fd[i];
-            pfd[pfd_count].events = POLLIN | POLLERR | POLLHUP;
-            pfd_count++;
+    do {
+        rc = epoll_wait(set->poll_fd, events, MAX_EVENTS, timeout);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0) {
+        PINELOG_ERROR(_("Error %d when waiting for client events: %s"),
+                      errno, strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < rc; i++) {
+        uint32_t ev = events[i].events;
+        unsigned int ready = 0;
+
+        if (ev & EPOLLIN) {
+            ready |= X52D_CLIENT_READ;
+        }
+        if (ev & EPOLLOUT) {
+            ready |= X52D_CLIENT_WRITE;
         }
+
+        dispatch(set, events[i].data.ptr, ready, ev & EPOLLERR, ev & EPOLLHUP, handler);
     }
+    #else
+    /* Without epoll, fall back to polling every descriptor */
+    int nfds = set->watch_count + set->count;
+    struct pollfd pfd[nfds];
+    struct x52d_client *pclient[nfds];
+    int n = 0;
 
-    PINELOG_TRACE("Polling %d file descriptors", pfd_count);
+    for (int i = 0; i < set->watch_count; i++) {
+        pclient[n++] = set->watched[i];
+    }
+    for (client = x52d_client_next(set, NULL); client != NULL;
+         client = x52d_client_next(set, client)) {
+        pclient[n++] = client;
+    }
 
-retry_poll:
-    rc = poll(pfd, pfd_count, -1);
-    if (rc < 0) {
-        if (errno == EINTR) {
-            goto retry_poll;
+    for (int i = 0; i < nfds; i++) {
+        pfd[i].fd = pclient[i]->fd;
+        pfd[i].events = 0;
+        pfd[i].revents = 0;
+        if (pclient[i]->events & X52D_CLIENT_READ) {
+            pfd[i].events |= POLLIN;
+        }
+        if (pclient[i]->events & X52D_CLIENT_WRITE) {
+            pfd[i].events |= POLLOUT;
         }
-        PINELOG_ERROR(_("Error %d when polling %d descriptors: %s"),
-                      errno, pfd_count, strerror(errno));
-    } else if (rc == 0) {
-        PINELOG_INFO(_("Timed out when polling"));
     }
 
-    return rc;
-}
+    do {
+        rc = poll(pfd, nfds, timeout);
+    } while (rc < 0 && errno == EINTR);
 
-void x52d_client_handle(int client_fd[X52D_MAX_CLIENTS], struct pollfd *pfd, int listen_fd, x52d_poll_handler handler)
-{
-    for (int i = 0; i < MAX_CONN; i++) {
-        if (pfd[i].revents & POLLHUP) {
-            /* Remote hungup */
-            x52d_client_deregister(client_fd, pfd[i].fd);
-        } else if (pfd[i].revents & POLLERR) {
-            /* Error reading from the socket */
-            x52d_client_error(client_fd, pfd[i].fd);
-        } else if (pfd[i].revents & POLLIN) {
-            if (pfd[i].fd == listen_fd) {
-                x52d_client_register(client_fd, listen_fd);
-            } else {
-                if (handler != NULL) {
-                    handler(pfd[i].fd);
-                }
-            }
+    if (rc < 0) {
+        PINELOG_ERROR(_("Error %d when waiting for client events: %s"),
+                      errno, strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < nfds; i++) {
+        short ev = pfd[i].revents;
+        unsigned int ready = 0;
+
+        if (ev == 0) {
+            continue;
+        }
+        if (ev & POLLIN) {
+            ready |= X52D_CLIENT_READ;
         }
+        if (ev & POLLOUT) {
+            ready |= X52D_CLIENT_WRITE;
+        }
+
+        dispatch(set, pclient[i], ready, ev & (POLLERR | POLLNVAL), ev & POLLHUP, handler);
+    }
+    #endif
+
+    /* No events refer to the closed clients any more */
+    while ((client = set->closed) != NULL) {
+        set->closed = client->closed;
+        free(client);
     }
+
+    return rc;
 }
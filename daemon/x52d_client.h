@@ -10,21 +10,72 @@
 #define X52D_CLIENT_H
 
 #include <stdbool.h>
-#include <poll.h>
+#include <stddef.h>
 
 #include "x52d_const.h"
 
-#define MAX_CONN    (X52D_MAX_CLIENTS + 1)
-
 #define INVALID_CLIENT  -1
 
-typedef void (*x52d_poll_handler)(int);
+/* Events that a client waits for, or that are ready */
+#define X52D_CLIENT_READ    0x1
+#define X52D_CLIENT_WRITE   0x2
+
+/*
+ * A connected client, or another descriptor watched by the client set. The
+ * users of the client set embed this as the first member of their per-client
+ * state, which the client set allocates when the client connects.
+ */
+struct x52d_client {
+    int fd;
+
+    /* Events that the client is waiting for */
+    unsigned int events;
+
+    /* Descriptor added with x52d_client_watch, rather than a client */
+    bool watched;
+
+    /* List of connected clients */
+    struct x52d_client *next;
+    struct x52d_client *prev;
+
+    /* List of clients that have been closed, but not yet freed */
+    struct x52d_client *closed;
+};
+
+typedef void (*x52d_client_fn)(struct x52d_client *client);
+typedef void (*x52d_client_handler)(struct x52d_client *client, unsigned int ready);
+
+/*
+ * Set of clients connected to a listening socket. With epoll, the descriptors
+ * stay registered for as long as the clients are connected, and waiting for
+ * events only touches the clients that are ready.
+ */
+struct x52d_client_set {
+    int poll_fd;
+    struct x52d_client listener;
+
+    /* Size of the per-client state, and its constructor and destructor */
+    size_t client_size;
+    x52d_client_fn on_connect;
+    x52d_client_fn on_disconnect;
+
+    int count;
+    struct x52d_client *head;
+    struct x52d_client *closed;
+
+    /* Other descriptors, only used when epoll is not available */
+    struct x52d_client *watched[4];
+    int watch_count;
+};
 
-void x52d_client_init(int client_fd[X52D_MAX_CLIENTS]);
-bool x52d_client_register(int client_fd[X52D_MAX_CLIENTS], int sock_fd);
-bool x52d_client_deregister(int client_fd[X52D_MAX_CLIENTS], int fd);
-bool x52d_client_error(int client_fd[X52D_MAX_CLIENTS], int fd);
-int x52d_client_poll(int client_fd[X52D_MAX_CLIENTS], struct pollfd pfd[MAX_CONN], int listen_fd);
-void x52d_client_handle(int client_fd[X52D_MAX_CLIENTS], struct pollfd *pfd, int listen_fd, x52d_poll_handler handler);
+int x52d_client_init(struct x52d_client_set *set, int listen_fd, size_t client_size,
+                     x52d_client_fn on_connect, x52d_client_fn on_disconnect);
+void x52d_client_exit(struct x52d_client_set *set);
+int x52d_client_watch(struct x52d_client_set *set, struct x52d_client *watch);
+void x52d_client_set_events(struct x52d_client_set *set, struct x52d_client *client,
+                            unsigned int events);
+void x52d_client_close(struct x52d_client_set *set, struct x52d_client *client);
+struct x52d_client *x52d_client_next(struct x52d_client_set *set, struct x52d_client *client);
+int x52d_client_wait(struct x52d_client_set *set, x52d_client_handler handler, int timeout);
 
 #endif //!defined X52D_CLIENT_H
@@ -19,6 +19,7 @@
 #include "x52d_clock.h"
 #include "x52d_const.h"
 #include "x52d_device.h"
+#include "x52d_stats.h"
 
 static bool clock_enabled = false;
 static int clock_primary_is_local = false;
@@ -172,6 +173,7 @@ static void * x52_clock_thr(void *param)
         time_t cur_time;
 
         sleep(1);
+        x52d_stats_inc(X52D_STAT_WAKE_CLOCK);
         if (!clock_enabled) {
             /* Clock thread is disabled, check again next time */
             continue;
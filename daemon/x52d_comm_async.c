@@ -0,0 +1,475 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Asynchronous client communication
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "x52dcomm.h"
+#include "x52dcomm-internal.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * The switch to framed mode is sent and acknowledged unframed, so nothing
+ * else may be sent until the acknowledgement has been read.
+ */
+static const char framed_request[] = "protocol\0framed";
+static const char framed_reply[] = "OK\0protocol\0framed";
+
+struct pending {
+    int ticket;
+    x52d_conn_response_fn callback;
+    void *param;
+};
+
+struct x52d_conn {
+    int fd;
+    bool notify;
+    bool framed;
+
+    /* errno value of the failure, 0 while the connection is usable */
+    int error;
+
+    x52d_conn_notify_fn notify_cb;
+    void *notify_param;
+
+    int next_ticket;
+
+    /* Commands waiting to be sent */
+    char *out;
+    size_t out_off;
+    size_t out_len;
+    size_t out_cap;
+
+    /* Commands awaiting a response, as a ring buffer */
+    struct pending *pending;
+    unsigned int pending_head;
+    unsigned int pending_count;
+    unsigned int pending_cap;
+
+    /* Received data, which always has room for at least one more frame */
+    char in[2 * (X52D_FRAME_HDRSZ + X52D_FRAME_MAX)];
+    size_t in_len;
+
+    /* Payload of the frame being delivered, and its arguments */
+    char msg[X52D_FRAME_MAX + 1];
+    char *argv[X52D_FRAME_MAX];
+};
+
+static struct x52d_conn *conn_new(int fd)
+{
+    struct x52d_conn *conn;
+    int saved_errno;
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (x52d_set_socket_nonblocking(fd) < 0) {
+        /* The descriptor has already been closed */
+        return NULL;
+    }
+
+    conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    conn->fd = fd;
+    return conn;
+}
+
+/* Make room for len more bytes in the output buffer */
+static int reserve_out(struct x52d_conn *conn, size_t len)
+{
+    char *out;
+    size_t cap;
+
+    if (conn->out_off > 0) {
+        memmove(conn->out, conn->out + conn->out_off, conn->out_len - conn->out_off);
+        conn->out_len -= conn->out_off;
+        conn->out_off = 0;
+    }
+
+    if (conn->out_len + len <= conn->out_cap) {
+        return 0;
+    }
+
+    cap = conn->out_cap ? conn->out_cap : X52D_BUFSZ;
+    while (cap < conn->out_len + len) {
+        cap *= 2;
+    }
+
+    out = realloc(conn->out, cap);
+    if (out == NULL) {
+        return -1;
+    }
+
+    conn->out = out;
+    conn->out_cap = cap;
+    return 0;
+}
+
+static int push_pending(struct x52d_conn *conn, int ticket,
+                        x52d_conn_response_fn callback, void *param)
+{
+    struct pending *entry;
+
+    if (conn->pending_count == conn->pending_cap) {
+        struct pending *pending;
+        unsigned int cap = conn->pending_cap ? conn->pending_cap * 2 : 32;
+        unsigned int i;
+
+        pending = malloc(cap * sizeof(*pending));
+        if (pending == NULL) {
+            return -1;
+        }
+
+        // Unwrap the ring into the start of the new array
+        for (i = 0; i < conn->pending_count; i++) {
+            pending[i] = conn->pending[(conn->pending_head + i) % conn->pending_cap];
+        }
+
+        free(conn->pending);
+        conn->pending = pending;
+        conn->pending_head = 0;
+        conn->pending_cap = cap;
+    }
+
+    entry = &conn->pending[(conn->pending_head + conn->pending_count) % conn->pending_cap];
+    entry->ticket = ticket;
+    entry->callback = callback;
+    entry->param = param;
+    conn->pending_count++;
+
+    return 0;
+}
+
+static struct pending pop_pending(struct x52d_conn *conn)
+{
+    struct pending entry = conn->pending[conn->pending_head];
+
+    conn->pending_head = (conn->pending_head + 1) % conn->pending_cap;
+    conn->pending_count--;
+
+    return entry;
+}
+
+/*
+ * Mark the connection as failed, and complete all the commands awaiting a
+ * response with the error. The callbacks may submit more commands, which
+ * are rejected.
+ */
+static int conn_fail(struct x52d_conn *conn, int error)
+{
+    if (conn->error == 0) {
+        conn->error = error;
+
+        while (conn->pending_count > 0) {
+            struct pending entry = pop_pending(conn);
+
+            if (entry.callback != NULL) {
+                entry.callback(entry.param, entry.ticket, error, 0, NULL);
+            }
+        }
+    }
+
+    errno = conn->error;
+    return -1;
+}
+
+struct x52d_conn *x52d_conn_dial_command(const char *sock_path)
+{
+    struct x52d_conn *conn;
+
+    conn = conn_new(x52d_dial_command(sock_path));
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    if (reserve_out(conn, sizeof(framed_request)) < 0) {
+        x52d_conn_close(conn);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    memcpy(conn->out, framed_request, sizeof(framed_request));
+    conn->out_len = sizeof(framed_request);
+
+    return conn;
+}
+
+struct x52d_conn *x52d_conn_dial_notify(const char *sock_path,
+                                        x52d_conn_notify_fn callback,
+                                        void *param)
+{
+    struct x52d_conn *conn;
+
+    if (callback == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    conn = conn_new(x52d_dial_notify(sock_path));
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    conn->notify = true;
+    conn->framed = true;
+    conn->notify_cb = callback;
+    conn->notify_param = param;
+
+    return conn;
+}
+
+void x52d_conn_close(struct x52d_conn *conn)
+{
+    if (conn == NULL) {
+        return;
+    }
+
+    (void)conn_fail(conn, ECANCELED);
+
+    close(conn->fd);
+    free(conn->out);
+    free(conn->pending);
+    free(conn);
+}
+
+int x52d_conn_fd(struct x52d_conn *conn)
+{
+    return conn->fd;
+}
+
+/* Number of bytes in the output buffer that may be sent right now */
+static size_t sendable(struct x52d_conn *conn)
+{
+    if (!conn->framed && conn->out_len > sizeof(framed_request)) {
+        return sizeof(framed_request);
+    }
+
+    return conn->out_len;
+}
+
+short x52d_conn_events(struct x52d_conn *conn)
+{
+    short events = POLLIN;
+
+    if (conn->error == 0 && conn->out_off < sendable(conn)) {
+        events |= POLLOUT;
+    }
+
+    return events;
+}
+
+int x52d_conn_pending(struct x52d_conn *conn)
+{
+    return (int)conn->pending_count;
+}
+
+int x52d_conn_submit(struct x52d_conn *conn, int argc, const char **argv,
+                     x52d_conn_response_fn callback, void *param)
+{
+    char buffer[X52D_BUFSZ];
+    uint32_t header;
+    int ticket;
+    int len;
+
+    if (conn == NULL || (conn->notify && callback != NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (conn->error != 0) {
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    len = x52d_format_command(argc, argv, buffer, sizeof(buffer));
+    if (len < 0) {
+        return -1;
+    }
+
+    if (reserve_out(conn, X52D_FRAME_HDRSZ + len) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ticket = conn->next_ticket;
+    if (!conn->notify && push_pending(conn, ticket, callback, param) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    conn->next_ticket = (ticket == INT_MAX) ? 0 : ticket + 1;
+
+    header = htonl((uint32_t)len);
+    memcpy(conn->out + conn->out_len, &header, X52D_FRAME_HDRSZ);
+    memcpy(conn->out + conn->out_len + X52D_FRAME_HDRSZ, buffer, len);
+    conn->out_len += X52D_FRAME_HDRSZ + len;
+
+    return ticket;
+}
+
+static int flush_out(struct x52d_conn *conn)
+{
+    ssize_t rc;
+    size_t limit = sendable(conn);
+
+    while (conn->out_off < limit) {
+        rc = send(conn->fd, conn->out + conn->out_off, limit - conn->out_off, MSG_NOSIGNAL);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                // System call interrupted due to signal. Try again
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Socket is full, wait for the daemon to read it
+                break;
+            }
+            return conn_fail(conn, errno);
+        }
+
+        conn->out_off += rc;
+    }
+
+    if (conn->out_off == conn->out_len) {
+        conn->out_off = 0;
+        conn->out_len = 0;
+    }
+
+    return 0;
+}
+
+static int deliver(struct x52d_conn *conn, const char *payload, int len)
+{
+    int argc = 0;
+
+    // Terminate the payload, in case the last argument isn't
+    memcpy(conn->msg, payload, len);
+    conn->msg[len] = '\0';
+    x52d_split_args(&argc, conn->argv, X52D_FRAME_MAX, conn->msg, len);
+
+    if (conn->notify) {
+        conn->notify_cb(conn->notify_param, argc, conn->argv);
+    } else {
+        struct pending entry;
+
+        if (conn->pending_count == 0) {
+            // The daemon never sends a response without a command
+            return conn_fail(conn, EPROTO);
+        }
+
+        entry = pop_pending(conn);
+        if (entry.callback != NULL) {
+            entry.callback(entry.param, entry.ticket, 0, argc, conn->argv);
+        }
+    }
+
+    return 0;
+}
+
+/* Consume all the complete frames, or the reply to the framed request */
+static int parse_in(struct x52d_conn *conn)
+{
+    size_t pos = 0;
+    int len;
+
+    if (!conn->framed) {
+        if (conn->in_len < sizeof(framed_reply)) {
+            return 0;
+        }
+
+        if (memcmp(conn->in, framed_reply, sizeof(framed_reply))) {
+            /* Older daemons don't recognize the protocol command */
+            return conn_fail(conn, EPROTONOSUPPORT);
+        }
+
+        conn->framed = true;
+        pos = sizeof(framed_reply);
+    }
+
+    while ((len = x52d_frame_next(conn->in + pos, conn->in_len - pos, NULL)) > 0) {
+        if (deliver(conn, conn->in + pos + X52D_FRAME_HDRSZ, len) < 0) {
+            return -1;
+        }
+        pos += X52D_FRAME_HDRSZ + len;
+    }
+
+    if (len < 0) {
+        return conn_fail(conn, EPROTO);
+    }
+
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+
+    return 0;
+}
+
+static int read_in(struct x52d_conn *conn)
+{
+    ssize_t rc;
+
+    for (;;) {
+        rc = recv(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                // System call interrupted due to signal. Try again
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Nothing more to read
+                return 0;
+            }
+            return conn_fail(conn, errno);
+        }
+
+        if (rc == 0) {
+            return conn_fail(conn, ECONNRESET);
+        }
+
+        conn->in_len += rc;
+        if (parse_in(conn) < 0) {
+            return -1;
+        }
+    }
+}
+
+int x52d_conn_process(struct x52d_conn *conn)
+{
+    if (conn->error != 0) {
+        errno = conn->error;
+        return -1;
+    }
+
+    if (flush_out(conn) < 0 || read_in(conn) < 0) {
+        return -1;
+    }
+
+    /*
+     * Send anything submitted by the callbacks, or held back until the
+     * daemon switched to framed mode
+     */
+    return flush_out(conn);
+}
@@ -0,0 +1,442 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Asynchronous client test harness
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "x52dcomm.h"
+#include "x52dcomm-internal.h"
+
+static char sock_dir[] = "/tmp/x52d-conn-test.XXXXXX";
+static char sock_path[sizeof(sock_dir) + 8];
+static int listen_fd;
+
+/* The test plays the part of the daemon on this descriptor */
+static int server_fd;
+
+#define MAX_RESPONSES 8
+
+static struct response {
+    int ticket;
+    int error;
+    int argc;
+    char argv0[16];
+    char argv1[16];
+} responses[MAX_RESPONSES];
+static int response_count;
+
+static void response_cb(void *param, int ticket, int error, int argc, char **argv)
+{
+    struct response *r;
+
+    assert_ptr_equal(param, &responses);
+    assert_true(response_count < MAX_RESPONSES);
+    r = &responses[response_count++];
+    r->ticket = ticket;
+    r->error = error;
+    r->argc = argc;
+    if (argc > 0) {
+        snprintf(r->argv0, sizeof(r->argv0), "%s", argv[0]);
+    }
+    if (argc > 1) {
+        snprintf(r->argv1, sizeof(r->argv1), "%s", argv[1]);
+    }
+}
+
+static void notify_cb(void *param, int argc, char **argv)
+{
+    response_cb(param, -1, 0, argc, argv);
+}
+
+static int setup(void **state)
+{
+    struct sockaddr_un local;
+    int len;
+
+    assert_non_null(mkdtemp(sock_dir));
+    snprintf(sock_path, sizeof(sock_path), "%s/sock", sock_dir);
+
+    len = x52d_setup_command_sock(sock_path, &local);
+    assert_true(len > 0);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert_true(listen_fd >= 0);
+    assert_int_equal(x52d_listen_socket(&local, len, listen_fd), 0);
+
+    memset(responses, 0, sizeof(responses));
+    response_count = 0;
+    server_fd = -1;
+    return 0;
+}
+
+static int teardown(void **state)
+{
+    if (server_fd >= 0) {
+        close(server_fd);
+    }
+    close(listen_fd);
+    unlink(sock_path);
+    rmdir(sock_dir);
+    strcpy(sock_dir + strlen(sock_dir) - 6, "XXXXXX");
+    return 0;
+}
+
+static void server_accept(void)
+{
+    server_fd = accept(listen_fd, NULL, NULL);
+    assert_true(server_fd >= 0);
+}
+
+static void server_recv(void *buffer, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t rc = recv(server_fd, (char *)buffer + done, len - done, 0);
+        assert_true(rc > 0);
+        done += rc;
+    }
+}
+
+static void server_send(const void *buffer, size_t len)
+{
+    assert_int_equal(send(server_fd, buffer, len, 0), len);
+}
+
+static void server_send_frame(const char *payload, uint32_t len)
+{
+    uint32_t header = htonl(len);
+
+    server_send(&header, sizeof(header));
+    server_send(payload, len);
+}
+
+/* Receive a command frame, and check that it matches the expected payload */
+static void server_expect_frame(const char *payload, uint32_t len)
+{
+    uint32_t header;
+    char buffer[X52D_BUFSZ];
+
+    server_recv(&header, sizeof(header));
+    assert_int_equal(ntohl(header), len);
+    server_recv(buffer, len);
+    assert_memory_equal(buffer, payload, len);
+}
+
+/* Dial the command socket, and complete the switch to framed mode */
+static struct x52d_conn *dial_framed(void)
+{
+    static const char request[] = "protocol\0framed";
+    static const char reply[] = "OK\0protocol\0framed";
+    struct x52d_conn *conn;
+    char buffer[sizeof(request)];
+
+    conn = x52d_conn_dial_command(sock_path);
+    assert_non_null(conn);
+    server_accept();
+
+    assert_int_equal(x52d_conn_events(conn), POLLIN | POLLOUT);
+    assert_int_equal(x52d_conn_process(conn), 0);
+    assert_int_equal(x52d_conn_events(conn), POLLIN);
+    server_recv(buffer, sizeof(buffer));
+    assert_memory_equal(buffer, request, sizeof(request));
+
+    server_send(reply, sizeof(reply));
+    assert_int_equal(x52d_conn_process(conn), 0);
+
+    return conn;
+}
+
+static void test_pipeline(void **state)
+{
+    static const char request[] = "protocol\0framed";
+    static const char reply[] = "OK\0protocol\0framed";
+    const char *cmd1[] = { "config", "get", "clock", "enabled" };
+    const char *cmd2[] = { "stats", "uptime" };
+    struct x52d_conn *conn;
+    char buffer[sizeof(request)];
+
+    conn = x52d_conn_dial_command(sock_path);
+    assert_non_null(conn);
+    assert_true(x52d_conn_fd(conn) >= 0);
+    server_accept();
+
+    // Commands are held back until the daemon switches to framed mode
+    assert_int_equal(x52d_conn_submit(conn, 4, cmd1, response_cb, &responses), 0);
+    assert_int_equal(x52d_conn_submit(conn, 2, cmd2, response_cb, &responses), 1);
+    assert_int_equal(x52d_conn_submit(conn, 2, cmd2, NULL, NULL), 2);
+    assert_int_equal(x52d_conn_pending(conn), 3);
+
+    assert_int_equal(x52d_conn_process(conn), 0);
+    assert_int_equal(x52d_conn_events(conn), POLLIN);
+    server_recv(buffer, sizeof(buffer));
+    assert_memory_equal(buffer, request, sizeof(request));
+
+    server_send(reply, sizeof(reply));
+    assert_int_equal(x52d_conn_process(conn), 0);
+    server_expect_frame("config\0get\0clock\0enabled", 25);
+    server_expect_frame("stats\0uptime", 13);
+    server_expect_frame("stats\0uptime", 13);
+
+    // Responses are matched to the commands in order
+    server_send_frame("DATA\0clock\0enabled\0true", 24);
+    server_send_frame("ERR\0oops", 9);
+    assert_int_equal(x52d_conn_process(conn), 0);
+    assert_int_equal(response_count, 2);
+    assert_int_equal(responses[0].ticket, 0);
+    assert_int_equal(responses[0].error, 0);
+    assert_int_equal(responses[0].argc, 4);
+    assert_string_equal(responses[0].argv0, "DATA");
+    assert_string_equal(responses[0].argv1, "clock");
+    assert_int_equal(responses[1].ticket, 1);
+    assert_int_equal(responses[1].argc, 2);
+    assert_string_equal(responses[1].argv0, "ERR");
+    assert_string_equal(responses[1].argv1, "oops");
+    assert_int_equal(x52d_conn_pending(conn), 1);
+
+    // A response without a callback is consumed silently
+    server_send_frame("OK\0stats\0uptime", 16);
+    assert_int_equal(x52d_conn_process(conn), 0);
+    assert_int_equal(response_count, 2);
+    assert_int_equal(x52d_conn_pending(conn), 0);
+
+    x52d_conn_close(conn);
+}
+
+static void test_partial_frames(void **state)
+{
+    const char *cmd[] = { "stats", "uptime" };
+    static const char frames[] = "\0\0\0\x03OK\0\0\0\0\x04" "ERR\0";
+    struct x52d_conn *conn = dial_framed();
+
+    assert_int_equal(x52d_conn_submit(conn, 2, cmd, response_cb, &responses), 0);
+    assert_int_equal(x52d_conn_submit(conn, 2, cmd, response_cb, &responses), 1);
+    assert_int_equal(x52d_conn_process(conn), 0);
+
+    // Split the responses in the middle of the second header
+    server_send(frames, 9);
+    assert_int_equal(x52d_conn_process(conn), 0);
+    assert_int_equal(response_count, 1);
+    assert_string_equal(responses[0].argv0, "OK");
+
+    server_send(frames + 9, sizeof(frames) - 1 - 9);
+    assert_int_equal(x52d_conn_process(conn), 0);
+    assert_int_equal(response_count, 2);
+    assert_string_equal(responses[1].argv0, "ERR");
+
+    x52d_conn_close(conn);
+}
+
+static void test_many_commands(void **state)
+{
+    const char *cmd[] = { "stats", "uptime" };
+    struct x52d_conn *conn = dial_framed();
+    int i;
+
+    // The pending ring grows beyond its initial size
+    for (i = 0; i < 100; i++) {
+        assert_int_equal(x52d_conn_submit(conn, 2, cmd, NULL, NULL), i);
+    }
+    assert_int_equal(x52d_conn_submit(conn, 2, cmd, response_cb, &responses), 100);
+    assert_int_equal(x52d_conn_process(conn), 0);
+
+    for (i = 0; i <= 100; i++) {
+        server_expect_frame("stats\0uptime", 13);
+        server_send_frame("OK", 3);
+    }
+
+    while (x52d_conn_pending(conn) > 0) {
+        struct pollfd pfd = { x52d_conn_fd(conn), x52d_conn_events(conn), 0 };
+
+        assert_int_equal(poll(&pfd, 1, 1000), 1);
+        assert_int_equal(x52d_conn_process(conn), 0);
+    }
+
+    assert_int_equal(response_count, 1);
+    assert_int_equal(responses[0].ticket, 100);
+
+    x52d_conn_close(conn);
+}
+
+static void test_not_supported(void **state)
+{
+    static const char reply[] = "ERR\0Unknown command 'protocol'";
+    const char *cmd[] = { "stats", "uptime" };
+    struct x52d_conn *conn;
+
+    conn = x52d_conn_dial_command(sock_path);
+    assert_non_null(conn);
+    server_accept();
+
+    assert_int_equal(x52d_conn_submit(conn, 2, cmd, response_cb, &responses), 0);
+    assert_int_equal(x52d_conn_process(conn), 0);
+    server_send(reply, sizeof(reply));
+
+    assert_int_equal(x52d_conn_process(conn), -1);
+    assert_int_equal(errno, EPROTONOSUPPORT);
+    assert_int_equal(response_count, 1);
+    assert_int_equal(responses[0].error, EPROTONOSUPPORT);
+    assert_int_equal(responses[0].argc, 0);
+
+    x52d_conn_close(conn);
+}
+
+static void test_disconnect(void **state)
+{
+    const char *cmd[] = { "stats", "uptime" };
+    struct x52d_conn *conn = dial_framed();
+
+    assert_int_equal(x52d_conn_submit(conn, 2, cmd, response_cb, &responses), 0);
+    assert_int_equal(x52d_conn_submit(conn, 2, cmd, response_cb, &responses), 1);
+    assert_int_equal(x52d_conn_process(conn), 0);
+    server_send_frame("OK", 3);
+    close(server_fd);
+    server_fd = -1;
+
+    assert_int_equal(x52d_conn_process(conn), -1);
+    assert_int_equal(errno, ECONNRESET);
+    assert_int_equal(response_count, 2);
+    assert_int_equal(responses[0].error, 0);
+    assert_int_equal(responses[1].ticket, 1);
+    assert_int_equal(responses[1].error, ECONNRESET);
+    assert_int_equal(x52d_conn_pending(conn), 0);
+
+    // The connection stays failed
+    assert_int_equal(x52d_conn_process(conn), -1);
+    assert_int_equal(errno, ECONNRESET);
+    assert_int_equal(x52d_conn_submit(conn, 2, cmd, response_cb, &responses), -1);
+    assert_int_equal(errno, ENOTCONN);
+
+    x52d_conn_close(conn);
+    assert_int_equal(response_count, 2);
+}
+
+static void test_invalid_frame(void **state)
+{
+    const char *cmd[] = { "stats", "uptime" };
+    static const char empty[4] = { 0 };
+    struct x52d_conn *conn = dial_framed();
+
+    assert_int_equal(x52d_conn_submit(conn, 2, cmd, response_cb, &responses), 0);
+    server_send(empty, sizeof(empty));
+
+    assert_int_equal(x52d_conn_process(conn), -1);
+    assert_int_equal(errno, EPROTO);
+    assert_int_equal(responses[0].error, EPROTO);
+
+    x52d_conn_close(conn);
+}
+
+static void test_unexpected_response(void **state)
+{
+    struct x52d_conn *conn = dial_framed();
+
+    server_send_frame("OK", 3);
+    assert_int_equal(x52d_conn_process(conn), -1);
+    assert_int_equal(errno, EPROTO);
+
+    x52d_conn_close(conn);
+}
+
+static void test_close_cancels(void **state)
+{
+    const char *cmd[] = { "stats", "uptime" };
+    struct x52d_conn *conn = dial_framed();
+
+    assert_int_equal(x52d_conn_submit(conn, 2, cmd, response_cb, &responses), 0);
+    x52d_conn_close(conn);
+
+    assert_int_equal(response_count, 1);
+    assert_int_equal(responses[0].error, ECANCELED);
+}
+
+static void test_bad_arguments(void **state)
+{
+    const char *cmd[] = { "stats", "uptime" };
+    const char *big[] = { "x", NULL };
+    char arg[X52D_BUFSZ];
+    struct x52d_conn *conn;
+
+    assert_null(x52d_conn_dial_notify(sock_path, NULL, NULL));
+    assert_int_equal(errno, EINVAL);
+
+    conn = dial_framed();
+    assert_int_equal(x52d_conn_submit(NULL, 2, cmd, NULL, NULL), -1);
+    assert_int_equal(errno, EINVAL);
+    assert_int_equal(x52d_conn_submit(conn, 0, cmd, NULL, NULL), -1);
+    assert_int_equal(errno, EINVAL);
+
+    memset(arg, 'x', sizeof(arg) - 1);
+    arg[sizeof(arg) - 1] = '\0';
+    big[1] = arg;
+    assert_int_equal(x52d_conn_submit(conn, 2, big, NULL, NULL), -1);
+    assert_int_equal(errno, E2BIG);
+    assert_int_equal(x52d_conn_pending(conn), 0);
+
+    x52d_conn_close(conn);
+}
+
+static void test_notify(void **state)
+{
+    const char *request[] = { "subscribe", "all" };
+    struct x52d_conn *conn;
+
+    conn = x52d_conn_dial_notify(sock_path, notify_cb, &responses);
+    assert_non_null(conn);
+    server_accept();
+
+    // Requests are acknowledged by a notification, not a callback
+    assert_int_equal(x52d_conn_submit(conn, 2, request, response_cb, &responses), -1);
+    assert_int_equal(errno, EINVAL);
+    assert_int_equal(x52d_conn_submit(conn, 2, request, NULL, NULL), 0);
+    assert_int_equal(x52d_conn_pending(conn), 0);
+    assert_int_equal(x52d_conn_events(conn), POLLIN | POLLOUT);
+    assert_int_equal(x52d_conn_process(conn), 0);
+    server_expect_frame("subscribe\0all", 14);
+
+    server_send_frame("OK\0subscribe\0all", 17);
+    server_send_frame("CONNECTED", 10);
+    assert_int_equal(x52d_conn_process(conn), 0);
+    assert_int_equal(response_count, 2);
+    assert_string_equal(responses[0].argv0, "OK");
+    assert_string_equal(responses[0].argv1, "subscribe");
+    assert_int_equal(responses[1].argc, 1);
+    assert_string_equal(responses[1].argv0, "CONNECTED");
+
+    x52d_conn_close(conn);
+}
+
+const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_pipeline, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_partial_frames, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_many_commands, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_not_supported, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_disconnect, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_invalid_frame, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_unexpected_response, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_close_cancels, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_bad_arguments, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_notify, setup, teardown),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, NULL, NULL);
+    return 0;
+}
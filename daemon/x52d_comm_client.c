@@ -9,10 +9,13 @@
 #include "config.h"
 
 #include <errno.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <arpa/inet.h>
 #include <unistd.h>
 
 #include "x52dcomm.h"
@@ -141,37 +144,180 @@ int x52d_send_command(int sock_fd, char *buffer, size_t bufin, size_t bufout)
     return rc;
 }
 
-int x52d_recv_notification(int sock_fd, x52d_notify_callback_fn callback)
+int x52d_command_framed(int sock_fd)
 {
-    int rc;
+    static const char request[] = "protocol\0framed";
+    static const char expected[] = "OK\0protocol\0framed";
     char buffer[X52D_BUFSZ];
-    int argc;
-    char *argv[X52D_BUFSZ];
+    int rc;
 
-    if (callback == NULL) {
+    memcpy(buffer, request, sizeof(request));
+    rc = x52d_send_command(sock_fd, buffer, sizeof(request), sizeof(buffer));
+    if (rc < 0) {
+        return -1;
+    }
+
+    if (rc != sizeof(expected) || memcmp(buffer, expected, sizeof(expected))) {
+        /* Older daemons don't recognize the protocol command */
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+
+    return 0;
+}
+
+int x52d_send_frame(int sock_fd, const char *buffer, size_t buflen)
+{
+    uint32_t header;
+    struct iovec iov[2];
+    int iovcnt = 2;
+    struct iovec *vec = iov;
+    ssize_t rc;
+
+    if (buffer == NULL || buflen == 0) {
         errno = EINVAL;
         return -1;
     }
 
-    /* Wait till we get a response */
-    for (;;) {
-        rc = recv(sock_fd, buffer, sizeof(buffer), 0);
+    if (buflen > X52D_FRAME_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    header = htonl((uint32_t)buflen);
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)buffer;
+    iov[1].iov_len = buflen;
+
+    while (iovcnt > 0) {
+        rc = writev(sock_fd, vec, iovcnt);
         if (rc < 0) {
-            // Error
             if (errno == EINTR) {
                 // System call interrupted due to signal. Try again
                 continue;
-            } else {
-                // Failed. Return early
-                return -1;
             }
+            return -1;
         }
 
-        break;
+        // Skip over whatever was written
+        while (iovcnt > 0 && (size_t)rc >= vec->iov_len) {
+            rc -= vec->iov_len;
+            vec++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            vec->iov_base = (char *)vec->iov_base + rc;
+            vec->iov_len -= rc;
+        }
+    }
+
+    return 0;
+}
+
+/* Read exactly len bytes, discarding them if buffer is NULL */
+static int _recv_exact(int sock_fd, char *buffer, size_t len)
+{
+    char discard[256];
+    size_t done = 0;
+    ssize_t rc;
+
+    while (done < len) {
+        if (buffer != NULL) {
+            rc = recv(sock_fd, buffer + done, len - done, 0);
+        } else {
+            size_t chunk = len - done;
+            if (chunk > sizeof(discard)) {
+                chunk = sizeof(discard);
+            }
+            rc = recv(sock_fd, discard, chunk, 0);
+        }
+
+        if (rc < 0) {
+            if (errno == EINTR) {
+                // System call interrupted due to signal. Try again
+                continue;
+            }
+            return -1;
+        }
+
+        if (rc == 0) {
+            // The daemon closed the connection mid-frame
+            errno = ECONNRESET;
+            return -1;
+        }
+
+        done += rc;
+    }
+
+    return 0;
+}
+
+int x52d_recv_frame(int sock_fd, char *buffer, size_t buflen)
+{
+    uint32_t header;
+    uint32_t len;
+
+    if (buffer == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (_recv_exact(sock_fd, (char *)&header, sizeof(header)) < 0) {
+        return -1;
+    }
+
+    len = ntohl(header);
+    if (len > buflen) {
+        // Drop the payload, so that the next frame can still be read
+        if (_recv_exact(sock_fd, NULL, len) < 0) {
+            return -1;
+        }
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (_recv_exact(sock_fd, buffer, len) < 0) {
+        return -1;
+    }
+
+    return (int)len;
+}
+
+int x52d_notify_request(int sock_fd, int argc, const char **argv)
+{
+    char buffer[X52D_BUFSZ];
+    int len;
+
+    len = x52d_format_command(argc, argv, buffer, sizeof(buffer));
+    if (len < 0) {
+        return -1;
+    }
+
+    return x52d_send_frame(sock_fd, buffer, len);
+}
+
+int x52d_recv_notification(int sock_fd, x52d_notify_callback_fn callback)
+{
+    int rc;
+    char buffer[X52D_BUFSZ];
+    int argc;
+    char *argv[X52D_BUFSZ];
+
+    if (callback == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Wait till we get a notification */
+    rc = x52d_recv_frame(sock_fd, buffer, sizeof(buffer));
+    if (rc < 0) {
+        return -1;
     }
 
     /* Split into individual arguments */
-    x52d_split_args(&argc, argv, buffer, rc);
+    argc = 0;
+    x52d_split_args(&argc, argv, X52D_BUFSZ, buffer, rc);
 
     return callback(argc, argv);
 }
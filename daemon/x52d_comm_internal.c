@@ -9,9 +9,11 @@
 #include "config.h"
 
 #include <errno.h>
+#include <stdint.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <arpa/inet.h>
 
 #include "x52dcomm-internal.h"
 #include "x52d_const.h"
@@ -34,6 +36,15 @@ const char * x52d_notify_sock_path(const char *sock_path)
     return sock_path;
 }
 
+const char * x52d_state_path(const char *state_path)
+{
+    if (state_path == NULL) {
+        state_path = X52D_STATE_FILE;
+    }
+
+    return state_path;
+}
+
 static int _setup_sockaddr(struct sockaddr_un *remote, const char *sock_path)
 {
     int len;
@@ -105,23 +116,59 @@ int x52d_listen_socket(struct sockaddr_un *local, int len, int sock_fd)
     return 0;
 }
 
-void x52d_split_args(int *argc, char **argv, char *buffer, int buflen)
+/*
+ * Split the buffer into NUL terminated arguments. argc is set to the total
+ * number of arguments, but only the first maxargs are stored in argv.
+ */
+void x52d_split_args(int *argc, char **argv, int maxargs, char *buffer, int buflen)
 {
     int i = 0;
 
     while (i < buflen) {
-        if (buffer[i]) {
+        if (*argc < maxargs) {
             argv[*argc] = buffer + i;
-            (*argc)++;
+        }
+        (*argc)++;
+
+        if (buffer[i]) {
             for (; i < buflen && buffer[i]; i++);
             // At this point, buffer[i] = '\0'
             // Skip to the next character.
             i++;
         } else {
             // We should never reach here, unless we have two NULs in a row
-            argv[*argc] = buffer + i;
-            (*argc)++;
             i++;
         }
     }
 }
+
+/*
+ * Check for a complete frame at the start of the buffer. Returns the length
+ * of the payload, which follows the frame header, 0 if the frame is not yet
+ * complete, or -1 if the frame length is invalid. The length of an invalid
+ * frame is returned in framelen, if it is not NULL.
+ */
+int x52d_frame_next(const char *buffer, int buflen, uint32_t *framelen)
+{
+    uint32_t len;
+
+    if (buflen < X52D_FRAME_HDRSZ) {
+        return 0;
+    }
+
+    memcpy(&len, buffer, sizeof(len));
+    len = ntohl(len);
+    if (framelen != NULL) {
+        *framelen = len;
+    }
+
+    if (len == 0 || len > X52D_FRAME_MAX) {
+        return -1;
+    }
+
+    if ((uint32_t)(buflen - X52D_FRAME_HDRSZ) < len) {
+        return 0;
+    }
+
+    return (int)len;
+}
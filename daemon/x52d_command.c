@@ -8,16 +8,19 @@
 
 #include "config.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
 #include <pthread.h>
-#include <poll.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <arpa/inet.h>
 
 #define PINELOG_MODULE X52D_MOD_COMMAND
 #include "pinelog.h"
@@ -25,9 +28,62 @@
 #include "x52d_command.h"
 #include "x52d_config.h"
 #include "x52d_client.h"
+#include "x52d_latency.h"
+#include "x52d_notify.h"
+#include "x52d_stats.h"
+#include "x52d_trace.h"
 #include "x52dcomm-internal.h"
+#include "usdt.h"
 
-static int client_fd[X52D_MAX_CLIENTS];
+/*
+ * Most commands only have a handful of arguments, but a configuration batch
+ * has three for every parameter. Anything beyond this is counted, but not
+ * stored.
+ */
+#define MAX_ARGS    128
+
+/*
+ * Per-client state, allocated by the client set. A framed client may send
+ * commands faster than they can be read, so the incomplete frame at the end
+ * of each read is carried over to the next one.
+ *
+ * Responses that the client hasn't read yet are kept in the backlog, and
+ * nothing more is read from the client until it has caught up, so that a
+ * client that isn't reading doesn't hold up the others. Any commands that
+ * were received but not yet processed are kept in unread in the meantime.
+ */
+struct command_client {
+    struct x52d_client base;
+    bool framed;
+    int pending;
+    char partial[X52D_FRAME_HDRSZ + X52D_FRAME_MAX];
+
+    char *backlog;
+    int backlog_off;
+    int backlog_len;
+
+    char *unread;
+    int unread_len;
+};
+
+static struct x52d_client_set command_clients;
+
+/*
+ * The command thread handles one client at a time, so the read and response
+ * buffers are shared by all clients. Commands are parsed in place in the read
+ * buffer, and the responses to all the commands in a single read are sent
+ * with a single system call.
+ */
+#define RX_BUFSZ    (64 * 1024)
+#define TX_BUFSZ    (64 * 1024)
+
+static char rx_buffer[RX_BUFSZ + 1];
+static char tx_buffer[TX_BUFSZ];
+static int tx_len;
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 static pthread_t command_thr;
 static int command_sock_fd;
@@ -91,6 +147,33 @@ static void response_strings(char *buffer, int *buflen, const char *type, int co
     *buflen = resplen;
 }
 
+static void response_array(char *buffer, int *buflen, const char *type,
+                           int count, const char **args)
+{
+    char response[X52D_BUFSZ];
+    int resplen;
+    int arglen;
+    int i;
+
+    arglen = strlen(type) + 1;
+    strcpy(response, type);
+    resplen = arglen;
+
+    for (i = 0; i < count; i++) {
+        arglen = strlen(args[i]) + 1;
+        if ((size_t)(arglen + resplen) >= sizeof(response)) {
+            PINELOG_ERROR("Too many arguments for response_array %s", type);
+            break;
+        }
+
+        strcpy(response + resplen, args[i]);
+        resplen += arglen;
+    }
+
+    memcpy(buffer, response, resplen);
+    *buflen = resplen;
+}
+
 #define NUMARGS(...) (sizeof((const char *[]){__VA_ARGS__}) / sizeof(const char *))
 #define ERR(...) response_strings(buffer, buflen, "ERR", NUMARGS(__VA_ARGS__), ##__VA_ARGS__)
 #define ERR_fmt(fmt, ...) response_formatted(buffer, buflen, "ERR", fmt, ##__VA_ARGS__)
@@ -100,7 +183,7 @@ static void response_strings(char *buffer, int *buflen, const char *type, int co
 
 #define DATA(...) response_strings(buffer, buflen, "DATA", NUMARGS(__VA_ARGS__), ##__VA_ARGS__)
 
-#define MATCH(idx, cmd) if (strcasecmp(argv[idx], cmd) == 0)
+#define MATCH(cmd, sub) if (subcommand == X52D_CMD_ ## cmd ## _ ## sub)
 
 static bool check_file(const char *file_path, int mode)
 {
@@ -115,14 +198,101 @@ static bool check_file(const char *file_path, int mode)
     return true;
 }
 
+/*
+ * Collects the section, key and value of each parameter in a multi-parameter
+ * response. The values returned by the configuration module may be held in a
+ * static buffer, so they are copied before fetching the next one. The response
+ * must fit in a single frame, so resplen tracks its size as it is built.
+ */
+struct config_values {
+    const char *args[MAX_ARGS];
+    int count;
+    char values[X52D_BUFSZ];
+    int len;
+    int resplen;
+};
+
+static bool config_values_add(struct config_values *cv, const char *section,
+                              const char *key, const char *value)
+{
+    int vlen = strlen(value) + 1;
+    int resplen = cv->resplen + strlen(section) + strlen(key) + 2 + vlen;
+
+    if (cv->resplen == 0) {
+        resplen += sizeof("DATA");
+    }
+
+    if (cv->count + 3 > MAX_ARGS || resplen >= X52D_BUFSZ) {
+        return false;
+    }
+
+    cv->resplen = resplen;
+
+    memcpy(cv->values + cv->len, value, vlen);
+    cv->args[cv->count++] = section;
+    cv->args[cv->count++] = key;
+    cv->args[cv->count++] = cv->values + cv->len;
+    cv->len += vlen;
+    return true;
+}
+
+static void config_get_params(char *buffer, int *buflen, int count, char **params)
+{
+    struct config_values cv = {0};
+    const char *rv;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        rv = x52d_config_get(params[2 * i], params[2 * i + 1]);
+        if (rv == NULL) {
+            ERR_fmt("Error getting '%s.%s'", params[2 * i], params[2 * i + 1]);
+            return;
+        }
+
+        if (!config_values_add(&cv, params[2 * i], params[2 * i + 1], rv)) {
+            ERR("Response too long for 'config get' command");
+            return;
+        }
+    }
+
+    response_array(buffer, buflen, "DATA", cv.count, cv.args);
+}
+
+static void config_get_section(char *buffer, int *buflen, const char *section)
+{
+    struct config_values cv = {0};
+    const char *rv;
+
+    #define CFG(c_sec, c_key, name, type, def) \
+        if (strcasecmp(section, #c_sec) == 0) { \
+            rv = x52d_config_get(#c_sec, #c_key); \
+            if (rv == NULL || !config_values_add(&cv, #c_sec, #c_key, rv)) { \
+                ERR_fmt("Error getting section '%s'", section); \
+                return; \
+            } \
+        }
+    #include "x52d_config.def"
+
+    if (cv.count == 0) {
+        ERR_fmt("Unknown section '%s' for 'config get' command", section);
+        return;
+    }
+
+    response_array(buffer, buflen, "DATA", cv.count, cv.args);
+}
+
 static void cmd_config(char *buffer, int *buflen, int argc, char **argv)
 {
+    int subcommand;
+
     if (argc < 2) {
         ERR("Insufficient arguments for 'config' command");
         return;
     }
 
-    MATCH(1, "load") {
+    subcommand = x52d_subcommand_lookup(X52D_CMD_config, argv[1]);
+
+    MATCH(config, load) {
         if (argc == 3) {
             if (!check_file(argv[2], R_OK)) {
                 ERR_fmt("Invalid file '%s' for 'config load' command", argv[2]);
@@ -139,9 +309,10 @@ static void cmd_config(char *buffer, int *buflen, int argc, char **argv)
         return;
     }
 
-    MATCH(1, "reload") {
+    MATCH(config, reload) {
         if (argc == 2) {
-            raise(SIGHUP);
+            // Only the main thread handles signals, so signal the process
+            kill(getpid(), SIGHUP);
             OK("config", "reload");
         } else {
             ERR_fmt("Unexpected arguments for 'config reload' command; got %d, expected 2", argc);
@@ -149,7 +320,7 @@ static void cmd_config(char *buffer, int *buflen, int argc, char **argv)
         return;
     }
 
-    MATCH(1, "dump") {
+    MATCH(config, dump) {
         if (argc == 3) {
             if (!check_file(argv[2], 0)) {
                 ERR_fmt("Invalid file '%s' for 'config dump' command", argv[2]);
@@ -165,9 +336,9 @@ static void cmd_config(char *buffer, int *buflen, int argc, char **argv)
         return;
     }
 
-    MATCH(1, "save") {
+    MATCH(config, save) {
         if (argc == 2) {
-            raise(SIGUSR1);
+            kill(getpid(), SIGUSR1);
             OK("config", "save");
         } else {
             ERR_fmt("Unexpected arguments for 'config save' command; got %d, expected 2", argc);
@@ -175,7 +346,7 @@ static void cmd_config(char *buffer, int *buflen, int argc, char **argv)
         return;
     }
 
-    MATCH(1, "set") {
+    MATCH(config, set) {
         if (argc == 5) {
             int rc = x52d_config_set(argv[2], argv[3], argv[4]);
             if (rc != 0) {
@@ -191,7 +362,31 @@ static void cmd_config(char *buffer, int *buflen, int argc, char **argv)
         return;
     }
 
-    MATCH(1, "get") {
+    MATCH(config, batch) {
+        if (argc >= 5 && (argc - 2) % 3 == 0) {
+            int failed = 0;
+            int rc = x52d_config_set_batch((argc - 2) / 3, argv + 2, &failed);
+            char **param = argv + 2 + 3 * failed;
+
+            if (rc == ENOENT) {
+                ERR_fmt("Unknown parameter '%s.%s' for 'config batch' command",
+                        param[0], param[1]);
+            } else if (rc != 0) {
+                ERR_fmt("Error %d setting '%s.%s'='%s': %s", rc,
+                        param[0], param[1], param[2], strerror(rc));
+            } else {
+                char count[16];
+                snprintf(count, sizeof(count), "%d", (argc - 2) / 3);
+                OK("config", "batch", count);
+            }
+        } else {
+            ERR_fmt("Unexpected arguments for 'config batch' command; got %d, "
+                    "expected section, key and value for each parameter", argc);
+        }
+        return;
+    }
+
+    MATCH(config, get) {
         if (argc == 4) {
             const char *rv = x52d_config_get(argv[2], argv[3]);
             if (rv == NULL) {
@@ -199,8 +394,13 @@ static void cmd_config(char *buffer, int *buflen, int argc, char **argv)
             } else {
                 DATA(argv[2], argv[3], rv);
             }
+        } else if (argc == 3) {
+            config_get_section(buffer, buflen, argv[2]);
+        } else if (argc > 4 && argc % 2 == 0) {
+            config_get_params(buffer, buflen, (argc - 2) / 2, argv + 2);
         } else {
-            ERR_fmt("Unexpected arguments for 'config get' command; got %d, expected 4", argc);
+            ERR_fmt("Unexpected arguments for 'config get' command; got %d, "
+                    "expected a section, or a section and key for each parameter", argc);
         }
         return;
     }
@@ -264,6 +464,8 @@ static void cmd_logging(char *buffer, int *buflen, int argc, char **argv)
         [X52D_MOD_COMMAND] = "command",
         [X52D_MOD_CLIENT] = "client",
         [X52D_MOD_NOTIFY] = "notify",
+        [X52D_MOD_KEYMAP] = "keymap",
+        [X52D_MOD_GAMEPAD] = "gamepad",
     };
 
     // This corresponds to the levels in pinelog
@@ -279,13 +481,17 @@ static void cmd_logging(char *buffer, int *buflen, int argc, char **argv)
         {0, NULL},
     };
 
+    int subcommand;
+
     if (argc < 2) {
         ERR("Insufficient arguments for 'logging' command");
         return;
     }
 
+    subcommand = x52d_subcommand_lookup(X52D_CMD_logging, argv[1]);
+
     // logging show [module]
-    MATCH(1, "show") {
+    MATCH(logging, show) {
         if (argc == 2) {
             // Show default logging level
             DATA("global", lmap_get_string(loglevels, pinelog_get_level()));
@@ -304,7 +510,7 @@ static void cmd_logging(char *buffer, int *buflen, int argc, char **argv)
     }
 
     // logging set [module] <level>
-    MATCH(1, "set") {
+    MATCH(logging, set) {
         if (argc == 3) {
             int level = lmap_get_level(loglevels, argv[2], INT_MAX);
             if (level == INT_MAX) {
@@ -340,65 +546,727 @@ static void cmd_logging(char *buffer, int *buflen, int argc, char **argv)
     ERR_fmt("Unknown subcommand '%s' for 'logging' command", argv[1]);
 }
 
-static void command_parser(char *buffer, int *buflen)
+static void cmd_latency(char *buffer, int *buflen, int argc, char **argv)
+{
+    int subcommand;
+
+    if (argc < 2) {
+        ERR("Insufficient arguments for 'latency' command");
+        return;
+    }
+
+    subcommand = x52d_subcommand_lookup(X52D_CMD_latency, argv[1]);
+
+    // latency show <stage>
+    MATCH(latency, show) {
+        if (argc == 3) {
+            struct x52d_latency_stats stats;
+            uint64_t fields[X52D_LAT_BUCKETS + 4];
+            char values[X52D_LAT_BUCKETS + 4][24];
+            const char *args[X52D_LAT_BUCKETS + 5];
+            int stage = x52d_latency_stage(argv[2]);
+            int n;
+
+            if (stage < 0) {
+                ERR_fmt("Unknown stage '%s' for 'latency show' command", argv[2]);
+                return;
+            }
+
+            x52d_latency_get(stage, &stats);
+            fields[0] = stats.count;
+            fields[1] = stats.min;
+            fields[2] = stats.count ? stats.sum / stats.count : 0;
+            fields[3] = stats.max;
+            memcpy(&fields[4], stats.buckets, sizeof(stats.buckets));
+
+            // Stage name, followed by the statistics and the histogram
+            args[0] = argv[2];
+            for (n = 0; n < X52D_LAT_BUCKETS + 4; n++) {
+                snprintf(values[n], sizeof(values[n]), "%llu", (unsigned long long)fields[n]);
+                args[n + 1] = values[n];
+            }
+
+            response_array(buffer, buflen, "DATA", n + 1, args);
+        } else {
+            ERR_fmt("Unexpected arguments for 'latency show' command; got %d, expected 3", argc);
+        }
+
+        return;
+    }
+
+    // latency reset
+    MATCH(latency, reset) {
+        if (argc == 2) {
+            x52d_latency_reset();
+            OK("latency", "reset");
+        } else {
+            ERR_fmt("Unexpected arguments for 'latency reset' command; got %d, expected 2", argc);
+        }
+
+        return;
+    }
+
+    ERR_fmt("Unknown subcommand '%s' for 'latency' command", argv[1]);
+}
+
+static void cmd_notify(char *buffer, int *buflen, int argc, char **argv)
+{
+    int subcommand;
+
+    if (argc < 2) {
+        ERR("Insufficient arguments for 'notify' command");
+        return;
+    }
+
+    subcommand = x52d_subcommand_lookup(X52D_CMD_notify, argv[1]);
+
+    // notify stats
+    MATCH(notify, stats) {
+        if (argc == 2) {
+            struct x52d_notify_stats stats;
+            char values[5][24];
+
+            x52d_notify_get_stats(&stats);
+            snprintf(values[0], sizeof(values[0]), "%u", stats.clients);
+            snprintf(values[1], sizeof(values[1]), "%u", stats.queued);
+            snprintf(values[2], sizeof(values[2]), "%llu", (unsigned long long)stats.dropped);
+            snprintf(values[3], sizeof(values[3]), "%llu", (unsigned long long)stats.coalesced);
+            snprintf(values[4], sizeof(values[4]), "%llu", (unsigned long long)stats.disconnected);
+
+            DATA("notify", values[0], values[1], values[2], values[3], values[4]);
+        } else {
+            ERR_fmt("Unexpected arguments for 'notify stats' command; got %d, expected 2", argc);
+        }
+
+        return;
+    }
+
+    ERR_fmt("Unknown subcommand '%s' for 'notify' command", argv[1]);
+}
+
+/* Respond with the group name, followed by a name and value for each statistic */
+static void stats_response(char *buffer, int *buflen, const char *group,
+                           int count, const char **names, const uint64_t *values)
+{
+    char strings[X52D_STAT_MAX][24];
+    const char *args[2 * X52D_STAT_MAX + 1];
+    int i;
+
+    args[0] = group;
+    for (i = 0; i < count && i < X52D_STAT_MAX; i++) {
+        snprintf(strings[i], sizeof(strings[i]), "%llu", (unsigned long long)values[i]);
+        args[2 * i + 1] = names[i];
+        args[2 * i + 2] = strings[i];
+    }
+
+    response_array(buffer, buflen, "DATA", 2 * i + 1, args);
+}
+
+/* Respond with the descriptor, queue depth and dropped count of each client */
+static void stats_queues(char *buffer, int *buflen)
+{
+    struct x52d_notify_client_stats clients[MAX_ARGS / 3];
+    char strings[MAX_ARGS][24];
+    const char *args[MAX_ARGS];
+    int resplen = sizeof("DATA") + sizeof("queues");
+    int count;
+    int n = 0;
+    int len;
+    int i;
+
+    count = x52d_notify_get_client_stats(clients, MAX_ARGS / 3);
+
+    // Only report as many clients as fit in a single response
+    args[n++] = "queues";
+    for (i = 0; i < count; i++) {
+        len = snprintf(strings[n], sizeof(strings[n]), "%d", clients[i].fd);
+        len += snprintf(strings[n + 1], sizeof(strings[n + 1]), "%u", clients[i].depth);
+        len += snprintf(strings[n + 2], sizeof(strings[n + 2]), "%llu",
+                        (unsigned long long)clients[i].dropped);
+        if (resplen + len + 3 >= X52D_BUFSZ) {
+            break;
+        }
+
+        resplen += len + 3;
+        args[n] = strings[n];
+        args[n + 1] = strings[n + 1];
+        args[n + 2] = strings[n + 2];
+        n += 3;
+    }
+
+    response_array(buffer, buflen, "DATA", n, args);
+}
+
+static void cmd_stats(char *buffer, int *buflen, int argc, char **argv)
+{
+    int subcommand;
+    uint64_t values[X52D_STAT_MAX];
+
+    if (argc < 2) {
+        ERR("Insufficient arguments for 'stats' command");
+        return;
+    }
+
+    if (argc != 2) {
+        ERR_fmt("Unexpected arguments for 'stats %s' command; got %d, expected 2",
+                argv[1], argc);
+        return;
+    }
+
+    subcommand = x52d_subcommand_lookup(X52D_CMD_stats, argv[1]);
+
+    // stats threads
+    MATCH(stats, threads) {
+        static const char *names[] = {
+            "device", "clock", "io", "mouse", "keymap", "command", "notify",
+        };
+
+        x52d_stats_get(values);
+        stats_response(buffer, buflen, "threads", X52D_STAT_WAKE_NOTIFY + 1,
+                       names, &values[X52D_STAT_WAKE_DEVICE]);
+        return;
+    }
+
+    // stats device
+    MATCH(stats, device) {
+        static const char *names[] = { "updates", "p50", "p90", "p99" };
+        uint64_t fields[4];
+
+        x52d_stats_get_latency(X52D_LAT_DEVICE, &fields[0], &fields[1],
+                               &fields[2], &fields[3]);
+        stats_response(buffer, buflen, "device", 4, names, fields);
+        return;
+    }
+
+    // stats input
+    MATCH(stats, input) {
+        static const char *names[] = { "reports", "rate", "errors", "mouseticks" };
+        uint64_t fields[4];
+        uint64_t elapsed = x52d_stats_elapsed();
+
+        x52d_stats_get(values);
+        fields[0] = values[X52D_STAT_HID_REPORTS];
+        fields[1] = elapsed ? values[X52D_STAT_HID_REPORTS] * 1000 / elapsed : 0;
+        fields[2] = values[X52D_STAT_HID_ERRORS];
+        fields[3] = values[X52D_STAT_MOUSE_TICKS];
+        stats_response(buffer, buflen, "input", 4, names, fields);
+        return;
+    }
+
+    // stats clients
+    MATCH(stats, clients) {
+        static const char *names[] = { "command", "notify", "queued", "dropped" };
+        struct x52d_notify_stats notify;
+        uint64_t fields[4];
+
+        x52d_notify_get_stats(&notify);
+        fields[0] = command_clients.count;
+        fields[1] = notify.clients;
+        fields[2] = notify.queued;
+        fields[3] = notify.dropped;
+        stats_response(buffer, buflen, "clients", 4, names, fields);
+        return;
+    }
+
+    // stats queues
+    MATCH(stats, queues) {
+        stats_queues(buffer, buflen);
+        return;
+    }
+
+    // stats uptime
+    MATCH(stats, uptime) {
+        static const char *names[] = { "seconds", "elapsed" };
+        uint64_t fields[2];
+
+        fields[0] = x52d_stats_uptime() / 1000;
+        fields[1] = x52d_stats_elapsed() / 1000;
+        stats_response(buffer, buflen, "uptime", 2, names, fields);
+        return;
+    }
+
+    // stats reset
+    MATCH(stats, reset) {
+        x52d_stats_reset();
+        OK("stats", "reset");
+        return;
+    }
+
+    ERR_fmt("Unknown subcommand '%s' for 'stats' command", argv[1]);
+}
+
+static void cmd_trace(char *buffer, int *buflen, int argc, char **argv)
+{
+    int subcommand;
+
+    if (argc < 2) {
+        ERR("Insufficient arguments for 'trace' command");
+        return;
+    }
+
+    subcommand = x52d_subcommand_lookup(X52D_CMD_trace, argv[1]);
+
+    // trace dump <file>
+    MATCH(trace, dump) {
+        if (argc == 3) {
+            int rc;
+
+            if (!check_file(argv[2], 0)) {
+                ERR_fmt("Invalid file '%s' for 'trace dump' command", argv[2]);
+                return;
+            }
+
+            rc = x52d_trace_dump(argv[2]);
+            if (rc != 0) {
+                ERR_fmt("Error %d writing trace to '%s': %s", rc, argv[2], strerror(rc));
+            } else {
+                OK("trace", "dump", argv[2]);
+            }
+        } else {
+            ERR_fmt("Unexpected arguments for 'trace dump' command; got %d, expected 3", argc);
+        }
+
+        return;
+    }
+
+    ERR_fmt("Unknown subcommand '%s' for 'trace' command", argv[1]);
+}
+
+static void cmd_protocol(struct command_client *client, char *buffer, int *buflen,
+                         int argc, char **argv)
+{
+    int subcommand;
+
+    if (argc < 2) {
+        ERR("Insufficient arguments for 'protocol' command");
+        return;
+    }
+
+    subcommand = x52d_subcommand_lookup(X52D_CMD_protocol, argv[1]);
+
+    // protocol framed
+    MATCH(protocol, framed) {
+        if (argc == 2) {
+            client->framed = true;
+            OK("protocol", "framed");
+        } else {
+            ERR_fmt("Unexpected arguments for 'protocol framed' command; got %d, expected 2", argc);
+        }
+
+        return;
+    }
+
+    ERR_fmt("Unknown subcommand '%s' for 'protocol' command", argv[1]);
+}
+
+static void command_parser(struct command_client *client, char *request,
+                           int reqlen, char *buffer, int *buflen)
 {
     int argc = 0;
-    char *argv[X52D_BUFSZ] = { 0 };
+    char *argv[MAX_ARGS];
+    int command;
+
+    x52d_split_args(&argc, argv, MAX_ARGS, request, reqlen);
+    if (argc == 0) {
+        ERR("Empty command");
+        return;
+    }
+
+    if (argc > MAX_ARGS) {
+        ERR_fmt("Too many arguments for command '%s'; got %d", argv[0], argc);
+        return;
+    }
 
-    x52d_split_args(&argc, argv, buffer, *buflen);
+    command = x52d_command_lookup(argv[0]);
+    x52d_trace(X52D_TRACE_COMMAND, (uint32_t)command, argc, client->base.fd);
+    X52_PROBE3(x52d, command, command, argc, argv[0]);
 
-    MATCH(0, "config") {
+    switch (command) {
+    case X52D_CMD_config:
         cmd_config(buffer, buflen, argc, argv);
-    } else MATCH(0, "logging") {
+        break;
+
+    case X52D_CMD_logging:
         cmd_logging(buffer, buflen, argc, argv);
-    } else {
+        break;
+
+    case X52D_CMD_latency:
+        cmd_latency(buffer, buflen, argc, argv);
+        break;
+
+    case X52D_CMD_notify:
+        cmd_notify(buffer, buflen, argc, argv);
+        break;
+
+    case X52D_CMD_stats:
+        cmd_stats(buffer, buflen, argc, argv);
+        break;
+
+    case X52D_CMD_trace:
+        cmd_trace(buffer, buflen, argc, argv);
+        break;
+
+    case X52D_CMD_protocol:
+        cmd_protocol(client, buffer, buflen, argc, argv);
+        break;
+
+    default:
         ERR_fmt("Unknown command '%s'", argv[0]);
+        break;
     }
 }
 
-static void client_handler(int fd)
+/* Send as much as the socket accepts, and return the number of bytes sent */
+static int send_available(int fd, const char *data, int len)
 {
-    char buffer[X52D_BUFSZ] = { 0 };
+    int sent = 0;
+    int rc;
+
+    while (sent < len) {
+        rc = send(fd, data + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            PINELOG_ERROR(_("Short write to client %d; expected %d bytes, wrote %d bytes"),
+                          fd, len, sent);
+            return -1;
+        }
+
+        sent += rc;
+    }
+
+    return sent;
+}
+
+static bool append_backlog(struct command_client *client, const char *data, int len)
+{
+    char *backlog;
+    int unsent = client->backlog_len - client->backlog_off;
+
+    memmove(client->backlog, client->backlog + client->backlog_off, unsent);
+    client->backlog_off = 0;
+    client->backlog_len = unsent;
+
+    backlog = realloc(client->backlog, unsent + len);
+    if (backlog == NULL) {
+        PINELOG_ERROR(_("Error allocating response backlog for client %d"),
+                      client->base.fd);
+        return false;
+    }
+
+    memcpy(backlog + unsent, data, len);
+    client->backlog = backlog;
+    client->backlog_len += len;
+    return true;
+}
+
+static void clear_backlog(struct command_client *client)
+{
+    free(client->backlog);
+    client->backlog = NULL;
+    client->backlog_off = 0;
+    client->backlog_len = 0;
+}
+
+static bool backlogged(struct command_client *client)
+{
+    return client->backlog_len > 0;
+}
+
+/*
+ * Send the queued responses to the client, without waiting for it to read
+ * them. Anything that doesn't fit in the socket is added to the backlog, and
+ * sent once the client is writable. Returns false if the client failed.
+ */
+static bool flush_responses(struct command_client *client)
+{
+    int sent = 0;
+
+    // Responses must be sent in order, so they go behind any backlog
+    if (!backlogged(client)) {
+        sent = send_available(client->base.fd, tx_buffer, tx_len);
+        if (sent < 0) {
+            tx_len = 0;
+            return false;
+        }
+    }
+
+    if (sent < tx_len) {
+        PINELOG_TRACE("Client %d is not reading, keeping %d bytes of responses",
+                      client->base.fd, tx_len - sent);
+        if (!append_backlog(client, tx_buffer + sent, tx_len - sent)) {
+            tx_len = 0;
+            return false;
+        }
+    } else {
+        PINELOG_TRACE("Sent %d bytes of responses to client %d", tx_len, client->base.fd);
+    }
+
+    tx_len = 0;
+    return true;
+}
+
+/*
+ * Return a pointer to the response buffer for the next command, flushing the
+ * queued responses if there is not enough space for another one.
+ */
+static char *response_buffer(struct command_client *client)
+{
+    if (tx_len + X52D_FRAME_HDRSZ + X52D_BUFSZ > TX_BUFSZ) {
+        if (!flush_responses(client)) {
+            return NULL;
+        }
+    }
+
+    return tx_buffer + tx_len + (client->framed ? X52D_FRAME_HDRSZ : 0);
+}
+
+static void queue_response(struct command_client *client, bool framed, int resplen)
+{
+    if (framed) {
+        uint32_t header = htonl((uint32_t)resplen);
+        memcpy(tx_buffer + tx_len, &header, sizeof(header));
+        tx_len += sizeof(header);
+    }
+
+    tx_len += resplen;
+}
+
+static bool process_command(struct command_client *client, char *request, int reqlen)
+{
+    /* A protocol switch only applies to subsequent commands */
+    bool framed = client->framed;
+    char *buffer;
+    int resplen;
+    int *buflen = &resplen;
+
+    buffer = response_buffer(client);
+    if (buffer == NULL) {
+        return false;
+    }
+
+    if (framed && request[reqlen - 1] != '\0') {
+        ERR("Command is not NUL terminated");
+    } else {
+        command_parser(client, request, reqlen, buffer, &resplen);
+    }
+
+    queue_response(client, framed, resplen);
+    return true;
+}
+
+static void disconnect_client(struct command_client *client)
+{
+    x52d_client_close(&command_clients, &client->base);
+}
+
+static void client_disconnected(struct x52d_client *base)
+{
+    struct command_client *client = (struct command_client *)base;
+
+    clear_backlog(client);
+    free(client->unread);
+    client->unread = NULL;
+    client->unread_len = 0;
+}
+
+static bool legacy_handler(struct command_client *client, int len)
+{
+    /* In legacy mode, each read is exactly one command */
+    rx_buffer[len] = '\0';
+    if (!process_command(client, rx_buffer, len)) {
+        disconnect_client(client);
+        return false;
+    }
+
+    return true;
+}
+
+/* Returns false if the client was disconnected */
+static bool framed_handler(struct command_client *client, int len)
+{
+    char *buffer;
+    int resplen;
+    int *buflen = &resplen;
+    uint32_t framelen;
+    int pos = 0;
+    int rc;
+
+    for (;;) {
+        if (backlogged(client) && pos < len) {
+            // Keep the remaining commands until the client catches up
+            client->unread = malloc(len - pos);
+            if (client->unread == NULL) {
+                PINELOG_ERROR(_("Error allocating command buffer for client %d"),
+                              client->base.fd);
+                disconnect_client(client);
+                return false;
+            }
+            memcpy(client->unread, rx_buffer + pos, len - pos);
+            client->unread_len = len - pos;
+            client->pending = 0;
+            return true;
+        }
+
+        rc = x52d_frame_next(rx_buffer + pos, len - pos, &framelen);
+        if (rc == 0) {
+            // Incomplete frame
+            break;
+        }
+
+        if (rc < 0) {
+            /* There is no way to find the next frame, so give up */
+            PINELOG_ERROR(_("Invalid frame length %u from client %d"),
+                          framelen, client->base.fd);
+            buffer = response_buffer(client);
+            if (buffer != NULL) {
+                ERR_fmt("Invalid frame length %u", framelen);
+                queue_response(client, true, resplen);
+                flush_responses(client);
+            }
+            disconnect_client(client);
+            return false;
+        }
+
+        if (!process_command(client, rx_buffer + pos + X52D_FRAME_HDRSZ, rc)) {
+            disconnect_client(client);
+            return false;
+        }
+        pos += X52D_FRAME_HDRSZ + rc;
+    }
+
+    client->pending = len - pos;
+    memcpy(client->partial, rx_buffer + pos, client->pending);
+    return true;
+}
+
+/* Only read commands from the client while it is reading the responses */
+static void update_events(struct command_client *client)
+{
+    x52d_client_set_events(&command_clients, &client->base,
+                           backlogged(client) ? X52D_CLIENT_WRITE : X52D_CLIENT_READ);
+}
+
+/* Returns false if the client was disconnected */
+static bool send_backlog(struct command_client *client)
+{
+    int len;
     int sent;
+
+    len = client->backlog_len - client->backlog_off;
+    sent = send_available(client->base.fd, client->backlog + client->backlog_off, len);
+    if (sent < 0) {
+        disconnect_client(client);
+        return false;
+    }
+
+    client->backlog_off += sent;
+    if (sent < len) {
+        return true;
+    }
+
+    clear_backlog(client);
+    PINELOG_TRACE("Client %d has caught up with its responses", client->base.fd);
+
+    // Process the commands that were held back
+    if (client->unread != NULL) {
+        len = client->unread_len;
+        memcpy(rx_buffer, client->unread, len);
+        free(client->unread);
+        client->unread = NULL;
+        client->unread_len = 0;
+
+        if (!framed_handler(client, len)) {
+            return false;
+        }
+
+        if (tx_len > 0 && !flush_responses(client)) {
+            disconnect_client(client);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void read_commands(struct command_client *client)
+{
+    int fd = client->base.fd;
+    bool framed;
+    int len;
     int rc;
 
-    rc = recv(fd, buffer, sizeof(buffer), 0);
+    framed = client->framed;
+    len = client->pending;
+    memcpy(rx_buffer, client->partial, len);
+
+    rc = recv(fd, rx_buffer + len, framed ? RX_BUFSZ - len : X52D_BUFSZ, 0);
     if (rc < 0) {
-        PINELOG_ERROR(_("Error reading from client %d: %s"),
-                      fd, strerror(errno));
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            PINELOG_ERROR(_("Error reading from client %d: %s"),
+                          fd, strerror(errno));
+        }
+        return;
+    }
+
+    if (rc == 0) {
+        // Client closed the connection
+        disconnect_client(client);
         return;
     }
 
-    // Parse and handle command.
-    command_parser(buffer, &rc);
+    // Parse and handle commands
+    if (framed) {
+        if (!framed_handler(client, len + rc)) {
+            return;
+        }
+    } else if (!legacy_handler(client, rc)) {
+        return;
+    }
 
-    PINELOG_TRACE("Sending %d bytes in response '%s'", rc, buffer);
-    sent = send(fd, buffer, rc, 0);
-    if (sent != rc) {
-        PINELOG_ERROR(_("Short write to client %d; expected %d bytes, wrote %d bytes"),
-                      fd, rc, sent);
+    if (tx_len > 0 && !flush_responses(client)) {
+        disconnect_client(client);
     }
 }
 
-int x52d_command_loop(int sock_fd)
+static void client_handler(struct x52d_client *base, unsigned int ready)
 {
-    struct pollfd pfd[MAX_CONN];
-    int rc;
+    struct command_client *client = (struct command_client *)base;
 
-    rc = x52d_client_poll(client_fd, pfd, sock_fd);
-    if (rc <= 0) {
-        return -1;
+    if (backlogged(client)) {
+        if (!(ready & X52D_CLIENT_WRITE) || !send_backlog(client)) {
+            return;
+        }
+    } else if (ready & X52D_CLIENT_READ) {
+        read_commands(client);
+    }
+
+    if (client->base.fd != INVALID_CLIENT) {
+        update_events(client);
     }
+}
 
-    x52d_client_handle(client_fd, pfd, sock_fd, client_handler);
+int x52d_command_loop(void)
+{
+    if (x52d_client_wait(&command_clients, client_handler, -1) < 0) {
+        return -1;
+    }
 
     return 0;
 }
 
 static void * x52d_command_thread(void *param)
 {
+    x52d_trace_thread_init("command");
     for (;;) {
-        if (x52d_command_loop(command_sock_fd) < 0) {
+        x52d_stats_inc(X52D_STAT_WAKE_COMMAND);
+        if (x52d_command_loop() < 0) {
             PINELOG_FATAL(_("Error %d during command loop: %s"),
                           errno, strerror(errno));
         }
@@ -413,8 +1281,6 @@ int x52d_command_init(const char *sock_path)
     int len;
     struct sockaddr_un local;
 
-    x52d_client_init(client_fd);
-
     command_sock = sock_path;
     command_sock_fd = -1;
 
@@ -444,6 +1310,11 @@ int x52d_command_init(const char *sock_path)
         goto listen_failure;
     }
 
+    if (x52d_client_init(&command_clients, sock_fd, sizeof(struct command_client),
+                         NULL, client_disconnected) < 0) {
+        goto listen_failure;
+    }
+
     PINELOG_INFO(_("Starting command processing thread"));
     pthread_create(&command_thr, NULL, x52d_command_thread, NULL);
 
@@ -463,10 +1334,13 @@ sock_failure:
 void x52d_command_exit(void)
 {
     PINELOG_INFO(_("Shutting down command processing thread"));
-    pthread_cancel(command_thr);
 
     // Close the socket and remove the socket file
     if (command_sock_fd >= 0) {
+        pthread_cancel(command_thr);
+        pthread_join(command_thr, NULL);
+        x52d_client_exit(&command_clients);
+
         command_sock = x52d_command_sock_path(command_sock);
         PINELOG_TRACE("Closing command socket %s", command_sock);
 
@@ -9,8 +9,33 @@
 #ifndef X52D_COMMAND_H
 #define X52D_COMMAND_H
 
+/* Command IDs, in the order of x52d_command.def */
+enum x52d_command_id {
+    #define COMMAND(cmd) X52D_CMD_ ## cmd,
+    #define SUBCOMMAND(cmd, sub)
+    #include "x52d_command.def"
+
+    X52D_CMD_MAX
+};
+
+/* Subcommand IDs, in the order of x52d_command.def */
+enum x52d_subcommand_id {
+    #define COMMAND(cmd)
+    #define SUBCOMMAND(cmd, sub) X52D_CMD_ ## cmd ## _ ## sub,
+    #include "x52d_command.def"
+
+    X52D_SUBCMD_MAX
+};
+
+/*
+ * Case insensitive lookup of commands and subcommands, generated from
+ * x52d_command.def. These return the ID, or -1 if the name is unknown.
+ */
+int x52d_command_lookup(const char *command);
+int x52d_subcommand_lookup(enum x52d_command_id command, const char *subcommand);
+
 int x52d_command_init(const char *sock_path);
 void x52d_command_exit(void);
-int x52d_command_loop(int sock_fd);
+int x52d_command_loop(void);
 
 #endif // !defined X52D_COMMAND_H
@@ -8,39 +8,58 @@
 
 #include "config.h"
 #include <errno.h>
+#include <string.h>
+#include <pthread.h>
 
 #define PINELOG_MODULE X52D_MOD_CONFIG
 #include "pinelog.h"
 #include "x52d_config.h"
 #include "x52d_const.h"
+#include "x52d_device.h"
+#include "x52d_notify.h"
 
 static struct x52d_config x52d_config;
 
+/*
+ * Protects the configuration, which is changed by the command thread, and
+ * reloaded by the main thread, as well as the applied configuration below.
+ */
+static pthread_mutex_t apply_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The file is parsed into a copy of the configuration, so that the command
+ * thread never sees the defaults or a partially loaded file.
+ */
 void x52d_config_load(const char *cfg_file)
 {
+    struct x52d_config staged;
     int rc;
 
     if (cfg_file == NULL) {
         cfg_file = X52D_SYS_CFG_FILE;
     }
 
-    rc = x52d_config_set_defaults(&x52d_config);
+    rc = x52d_config_set_defaults(&staged);
     if (rc != 0) {
         PINELOG_FATAL(_("Error %d setting configuration defaults: %s"),
                       rc, strerror(rc));
     }
 
-    rc = x52d_config_load_file(&x52d_config, cfg_file);
+    rc = x52d_config_load_file(&staged, cfg_file);
     if (rc != 0) {
         exit(EXIT_FAILURE);
     }
 
     // Apply overrides
-    rc = x52d_config_apply_overrides(&x52d_config);
+    rc = x52d_config_apply_overrides(&staged);
     x52d_config_clear_overrides();
     if (rc != 0) {
         exit(EXIT_FAILURE);
     }
+
+    pthread_mutex_lock(&apply_mutex);
+    memcpy(&x52d_config, &staged, sizeof(x52d_config));
+    pthread_mutex_unlock(&apply_mutex);
 }
 
 void x52d_config_save(const char *cfg_file)
@@ -51,22 +70,32 @@ void x52d_config_save(const char *cfg_file)
         cfg_file = X52D_SYS_CFG_FILE;
     }
 
+    pthread_mutex_lock(&apply_mutex);
     rc = x52d_config_save_file(&x52d_config, cfg_file);
+    pthread_mutex_unlock(&apply_mutex);
     if (rc != 0) {
         PINELOG_ERROR(_("Error %d saving configuration file: %s"),
                       rc, strerror(rc));
+    } else {
+        x52d_config_watch_saved(cfg_file);
     }
 }
 
 int x52d_config_set(const char *section, const char *key, const char *value)
 {
+    int rc;
+
     if (section == NULL || key == NULL || value == NULL) {
         return EINVAL;
     }
 
     PINELOG_TRACE("Processing config set '%s.%s'='%s'", section, key, value);
 
-    return x52d_config_process_kv(&x52d_config, section, key, value);
+    pthread_mutex_lock(&apply_mutex);
+    rc = x52d_config_process_kv(&x52d_config, section, key, value);
+    pthread_mutex_unlock(&apply_mutex);
+
+    return rc;
 }
 
 const char *x52d_config_get(const char *section, const char *key)
@@ -76,37 +105,162 @@ const char *x52d_config_get(const char *section, const char *key)
         return NULL;
     }
 
+    pthread_mutex_lock(&apply_mutex);
     value = x52d_config_get_param(&x52d_config, section, key);
+    pthread_mutex_unlock(&apply_mutex);
     PINELOG_TRACE("Processed config get '%s.%s'='%s'", section, key, value);
 
     return value;
 }
 
-/* Callback stubs
- * TODO: Remove the ones below when their implementation is complete
+/*
+ * Configuration that was last passed to the callbacks. Reloading the
+ * configuration only calls the callbacks for the parameters that differ from
+ * it, so that reloading an unchanged configuration doesn't update the device.
  */
-void x52d_cfg_set_Profiles_Directory(char* param) { (void)param; }
-void x52d_cfg_set_Profiles_ClutchEnabled(bool param) { (void)param; }
-void x52d_cfg_set_Profiles_ClutchLatched(bool param) { (void)param; }
+static struct x52d_config applied_config;
+static bool applied_valid;
+
+#define CFG_CHANGED(name) \
+    (memcmp(&x52d_config . name, &applied_config . name, sizeof(x52d_config . name)) != 0)
+
+#define CFG_APPLY(c_sec, c_key, name) do { \
+    PINELOG_TRACE("Calling configuration callback for " #c_sec "." #c_key); \
+    x52d_cfg_set_ ## c_sec ## _ ## c_key(x52d_config . name); \
+    memcpy(&applied_config . name, &x52d_config . name, sizeof(x52d_config . name)); \
+} while (0)
 
 void x52d_config_apply_immediate(const char *section, const char *key)
 {
+    pthread_mutex_lock(&apply_mutex);
+    switch (x52d_config_lookup(section, key)) {
 #define CFG(c_sec, c_key, name, parser, def) \
-    if (!strcasecmp(section, #c_sec) && !strcasecmp(key, #c_key)) { \
-        PINELOG_TRACE("Invoking " #c_sec "." #c_key " callback"); \
-        x52d_cfg_set_ ## c_sec ## _ ## c_key(x52d_config . name); \
-    } else
+    case X52D_CFG_ ## c_sec ## _ ## c_key: \
+        CFG_APPLY(c_sec, c_key, name); \
+        X52D_NOTIFY(X52D_TOPIC_CONFIG, "CONFIG", #c_sec, #c_key, \
+                    x52d_config_get_param(&x52d_config, #c_sec, #c_key)); \
+        break;
 
 #include "x52d_config.def"
-    // Dummy to capture the trailing else
-    // Wrap it in braces in case tracing has been disabled
-    { PINELOG_TRACE("Ignoring apply_immediate(%s.%s)", section, key); }
+
+    default:
+        PINELOG_TRACE("Ignoring apply_immediate(%s.%s)", section, key);
+        break;
+    }
+    pthread_mutex_unlock(&apply_mutex);
 }
 
-void x52d_config_apply(void)
+/*
+ * Apply the parameters that differ from the applied configuration, and notify
+ * each of them. Must be called with apply_mutex held.
+ */
+static int apply_changed(void)
 {
+    int changed = 0;
+
     #define CFG(section, key, name, parser, def) \
-        PINELOG_TRACE("Calling configuration callback for " #section "." #key); \
-        x52d_cfg_set_ ## section ## _ ## key(x52d_config . name);
+        if (CFG_CHANGED(name)) { \
+            CFG_APPLY(section, key, name); \
+            X52D_NOTIFY(X52D_TOPIC_CONFIG, "CONFIG", #section, #key, \
+                        x52d_config_get_param(&x52d_config, #section, #key)); \
+            changed++; \
+        }
     #include "x52d_config.def"
+
+    return changed;
+}
+
+void x52d_config_apply(void)
+{
+    int changed;
+
+    pthread_mutex_lock(&apply_mutex);
+    if (!applied_valid) {
+        pthread_mutex_unlock(&apply_mutex);
+        x52d_config_apply_all();
+        return;
+    }
+
+    x52d_dev_hold_updates();
+    changed = apply_changed();
+    x52d_dev_release_updates();
+    pthread_mutex_unlock(&apply_mutex);
+
+    PINELOG_DEBUG(_("Applied %d changed configuration parameters"), changed);
+    X52D_NOTIFY(X52D_TOPIC_CONFIG, "CONFIG_APPLIED");
+}
+
+void x52d_config_apply_all(void)
+{
+    pthread_mutex_lock(&apply_mutex);
+    x52d_dev_hold_updates();
+    #define CFG(section, key, name, parser, def) CFG_APPLY(section, key, name);
+    #include "x52d_config.def"
+    x52d_dev_release_updates();
+    applied_valid = true;
+    pthread_mutex_unlock(&apply_mutex);
+
+    X52D_NOTIFY(X52D_TOPIC_CONFIG, "CONFIG_APPLIED");
+}
+
+/*
+ * Set a batch of parameters, given as consecutive section, key and value
+ * strings. Every value is parsed into a copy of the configuration first, so
+ * if any of them are invalid, nothing is changed, and *failed is set to the
+ * index of the offending parameter. Otherwise, the changed parameters are
+ * applied together, and written to the device with a single update.
+ */
+int x52d_config_set_batch(int count, char **params, int *failed)
+{
+    struct x52d_config staged;
+    const char *section;
+    const char *key;
+    const char *value;
+    int changed;
+    int rc;
+    int i;
+
+    if (params == NULL || count <= 0) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&apply_mutex);
+    memcpy(&staged, &x52d_config, sizeof(staged));
+
+    for (i = 0; i < count; i++) {
+        section = params[3 * i];
+        key = params[3 * i + 1];
+        value = params[3 * i + 2];
+
+        PINELOG_TRACE("Processing config batch '%s.%s'='%s'", section, key, value);
+        if (x52d_config_lookup(section, key) < 0) {
+            rc = ENOENT;
+        } else {
+            rc = x52d_config_process_kv(&staged, section, key, value);
+        }
+
+        if (rc != 0) {
+            pthread_mutex_unlock(&apply_mutex);
+            if (failed != NULL) {
+                *failed = i;
+            }
+            return rc;
+        }
+    }
+
+    memcpy(&x52d_config, &staged, sizeof(x52d_config));
+    if (!applied_valid) {
+        // The initial apply will pick up the new values
+        pthread_mutex_unlock(&apply_mutex);
+        return 0;
+    }
+
+    x52d_dev_hold_updates();
+    changed = apply_changed();
+    x52d_dev_release_updates();
+    pthread_mutex_unlock(&apply_mutex);
+
+    PINELOG_DEBUG(_("Applied %d changed configuration parameters"), changed);
+    X52D_NOTIFY(X52D_TOPIC_CONFIG, "CONFIG_APPLIED");
+    return 0;
 }
@@ -40,13 +40,35 @@ struct x52d_config {
     bool mouse_enabled;
     int mouse_speed;
     bool mouse_reverse_scroll;
+    int mouse_accel;
+
+    bool gamepad_enabled;
+    char gamepad_axes[NAME_MAX];
+    char gamepad_buttons[NAME_MAX];
+
+    int notify_input_rate;
 
     bool clutch_enabled;
     bool clutch_latched;
 
     char profiles_dir[NAME_MAX];
+    char profile_name[NAME_MAX];
+};
+
+/* Configuration IDs, in the order of x52d_config.def */
+enum x52d_config_id {
+    #define CFG(section, key, name, type, def) X52D_CFG_ ## section ## _ ## key,
+    #include "x52d_config.def"
+
+    X52D_CFG_MAX
 };
 
+/*
+ * Case insensitive lookup of a configuration key, generated from
+ * x52d_config.def. Returns the ID, or -1 if the key is unknown.
+ */
+int x52d_config_lookup(const char *section, const char *key);
+
 /* Callback functions for configuration */
 // These functions are defined in the individual modules
 void x52d_cfg_set_Clock_Enabled(bool param);
@@ -73,7 +95,13 @@ void x52d_cfg_set_Brightness_LED(uint16_t param);
 void x52d_cfg_set_Mouse_Enabled(bool param);
 void x52d_cfg_set_Mouse_Speed(int param);
 void x52d_cfg_set_Mouse_ReverseScroll(bool param);
+void x52d_cfg_set_Mouse_Acceleration(int param);
+void x52d_cfg_set_Gamepad_Enabled(bool param);
+void x52d_cfg_set_Gamepad_Axes(char* param);
+void x52d_cfg_set_Gamepad_Buttons(char* param);
+void x52d_cfg_set_Notify_InputRate(int param);
 void x52d_cfg_set_Profiles_Directory(char* param);
+void x52d_cfg_set_Profiles_Default(char* param);
 void x52d_cfg_set_Profiles_ClutchEnabled(bool param);
 void x52d_cfg_set_Profiles_ClutchLatched(bool param);
 
@@ -93,11 +121,18 @@ void x52d_config_clear_overrides(void);
 void x52d_config_load(const char *cfg_file);
 void x52d_config_apply_immediate(const char *section, const char *key);
 void x52d_config_apply(void);
+void x52d_config_apply_all(void);
 
 int x52d_config_save_file(struct x52d_config *cfg, const char *cfg_file);
 void x52d_config_save(const char *cfg_file);
 
+void x52d_config_watch_init(const char *cfg_file);
+bool x52d_config_watch_wait(void);
+void x52d_config_watch_saved(const char *cfg_file);
+void x52d_config_watch_exit(void);
+
 int x52d_config_set(const char *section, const char *key, const char *value);
+int x52d_config_set_batch(int count, char **params, int *failed);
 const char *x52d_config_get(const char *section, const char *key);
 
 #endif // !defined X52D_CONFIG_H
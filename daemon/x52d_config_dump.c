@@ -140,12 +140,13 @@ exit_dump:
 
 const char *x52d_config_get_param(struct x52d_config *cfg, const char *section, const char *key)
 {
-    #define CFG(section_c, key_c, name, type, def) do { \
-        if (strcasecmp(section, #section_c) == 0 && strcasecmp(key, #key_c) == 0) { \
-            return type ## _dumper(section, key, cfg, offsetof(struct x52d_config, name)); \
-        } \
-    } while (0);
+    switch (x52d_config_lookup(section, key)) {
+    #define CFG(section_c, key_c, name, type, def) \
+    case X52D_CFG_ ## section_c ## _ ## key_c: \
+        return type ## _dumper(section, key, cfg, offsetof(struct x52d_config, name));
     #include "x52d_config.def"
 
-    return NULL;
+    default:
+        return NULL;
+    }
 }
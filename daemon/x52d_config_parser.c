@@ -134,45 +134,33 @@ static int date_format_parser(struct x52d_config *cfg, size_t offset, const char
 #undef CHECK_PARAMS
 #undef CONFIG_PTR
 
-/* Map for config->param */
-#define CFG(section, key, name, type, def) {#section, #key, type ## _parser, offsetof(struct x52d_config, name)},
+/* Map for config->param, indexed by the configuration ID */
+#define CFG(section, key, name, type, def) \
+    [X52D_CFG_ ## section ## _ ## key] = {#section, #key, type ## _parser, offsetof(struct x52d_config, name)},
 static const struct config_map {
     const char *section;
     const char *key;
     parser_fn parser;
     size_t offset;
-} config_map[] = {
+} config_map[X52D_CFG_MAX] = {
     #include "x52d_config.def"
-
-    // Terminating entry
-    {NULL, NULL, NULL, 0}
 };
 
 int x52d_config_process_kv(void *user, const char *section, const char *key, const char *value)
 {
-    int i;
-    int rc = 0;
-    bool found = false;
+    int id;
     struct x52d_config *cfg = (struct x52d_config*)user;
 
-    for (i = 0; config_map[i].key != NULL; i++) {
-        rc = 0;
-        if (!strcasecmp(config_map[i].key, key) &&
-            !strcasecmp(config_map[i].section, section)) {
-            found = true;
-            PINELOG_TRACE("Setting '%s.%s'='%s'",
-                          config_map[i].section, config_map[i].key, value);
-            rc = config_map[i].parser(cfg, config_map[i].offset, value);
-            break;
-        }
-    }
-
-    if (!found) {
+    id = x52d_config_lookup(section, key);
+    if (id < 0) {
         // Print error message, but continue
         PINELOG_INFO(_("Ignoring unknown key '%s.%s'"), section, key);
+        return 0;
     }
 
-    return rc;
+    PINELOG_TRACE("Setting '%s.%s'='%s'",
+                  config_map[id].section, config_map[id].key, value);
+    return config_map[id].parser(cfg, config_map[id].offset, value);
 }
 
 /**
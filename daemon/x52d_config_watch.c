@@ -0,0 +1,254 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Configuration file watcher
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#define PINELOG_MODULE X52D_MOD_CONFIG
+#include "pinelog.h"
+#include "x52d_config.h"
+#include "x52d_const.h"
+
+static int watch_fd = -1;
+static char *watch_file;
+static char *watch_name;
+
+/* Time at which the pending reload is due, or 0 if there is none */
+static uint64_t reload_due;
+
+/*
+ * The configuration file as the daemon last saved it. The command thread may
+ * save the configuration too, so this and watch_file are protected by
+ * saved_mutex.
+ */
+static struct stat saved_stat;
+static bool saved_valid;
+static pthread_mutex_t saved_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Watch the directory rather than the file, since most editors save a file
+ * by replacing it, which would silently drop a watch on the file itself.
+ */
+void x52d_config_watch_init(const char *cfg_file)
+{
+    #if HAVE_SYS_INOTIFY_H
+    char *dir_copy;
+    char *name_copy;
+
+    if (cfg_file == NULL) {
+        cfg_file = X52D_SYS_CFG_FILE;
+    }
+
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd < 0) {
+        PINELOG_WARN(_("Error %d initializing inotify, configuration will only be reloaded on request: %s"),
+                     errno, strerror(errno));
+        return;
+    }
+
+    pthread_mutex_lock(&saved_mutex);
+    watch_file = strdup(cfg_file);
+    pthread_mutex_unlock(&saved_mutex);
+    dir_copy = strdup(cfg_file);
+    name_copy = strdup(cfg_file);
+    if (watch_file == NULL || dir_copy == NULL || name_copy == NULL) {
+        PINELOG_ERROR(_("Failed to allocate memory for configuration watch"));
+        goto fail;
+    }
+
+    watch_name = strdup(basename(name_copy));
+    if (watch_name == NULL) {
+        PINELOG_ERROR(_("Failed to allocate memory for configuration watch"));
+        goto fail;
+    }
+
+    if (inotify_add_watch(watch_fd, dirname(dir_copy), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        PINELOG_WARN(_("Unable to watch configuration file %s: %s"),
+                     cfg_file, strerror(errno));
+        goto fail;
+    }
+
+    PINELOG_TRACE("Watching configuration file %s", cfg_file);
+    free(dir_copy);
+    free(name_copy);
+    return;
+
+fail:
+    free(dir_copy);
+    free(name_copy);
+    x52d_config_watch_exit();
+    #else
+    (void)cfg_file;
+    #endif
+}
+
+void x52d_config_watch_exit(void)
+{
+    if (watch_fd >= 0) {
+        close(watch_fd);
+        watch_fd = -1;
+    }
+
+    free(watch_name);
+    watch_name = NULL;
+    reload_due = 0;
+
+    pthread_mutex_lock(&saved_mutex);
+    free(watch_file);
+    watch_file = NULL;
+    saved_valid = false;
+    pthread_mutex_unlock(&saved_mutex);
+}
+
+/*
+ * Record that the daemon has just written the configuration to cfg_file. If
+ * that is the watched file, then the reload that the write triggers is
+ * skipped, as long as the file hasn't been modified since, so that it
+ * doesn't revert any parameters that were set after the save.
+ */
+void x52d_config_watch_saved(const char *cfg_file)
+{
+    struct stat cfg_stat;
+    struct stat watch_stat;
+
+    pthread_mutex_lock(&saved_mutex);
+    if (watch_file != NULL &&
+        stat(cfg_file, &cfg_stat) == 0 && stat(watch_file, &watch_stat) == 0 &&
+        cfg_stat.st_dev == watch_stat.st_dev && cfg_stat.st_ino == watch_stat.st_ino) {
+        saved_stat = cfg_stat;
+        saved_valid = true;
+    }
+    pthread_mutex_unlock(&saved_mutex);
+}
+
+#if HAVE_SYS_INOTIFY_H
+static bool same_file(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/* Check if the watched file is still as the daemon last saved it */
+static bool unchanged_since_save(void)
+{
+    struct stat watch_stat;
+    bool unchanged;
+
+    pthread_mutex_lock(&saved_mutex);
+    unchanged = saved_valid && stat(watch_file, &watch_stat) == 0 &&
+                same_file(&saved_stat, &watch_stat);
+    pthread_mutex_unlock(&saved_mutex);
+
+    return unchanged;
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Read all pending events, and return true if any refer to the config file */
+static bool read_events(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    bool changed = false;
+    ssize_t len;
+    char *ptr;
+
+    while ((len = read(watch_fd, buf, sizeof(buf))) > 0) {
+        for (ptr = buf; ptr < buf + len; ptr += sizeof(*event) + event->len) {
+            event = (const struct inotify_event *)ptr;
+            if (event->len > 0 && !strcmp(event->name, watch_name)) {
+                changed = true;
+            }
+        }
+    }
+
+    return changed;
+}
+#endif
+
+/*
+ * Wait until a signal is received, or the configuration file has been
+ * modified. Editors may write a file in several steps, so the reload is only
+ * due once the file has been left alone for X52D_RELOAD_DELAY_MS. Returns
+ * true if the configuration file should be reloaded.
+ */
+bool x52d_config_watch_wait(void)
+{
+    #if HAVE_SYS_INOTIFY_H
+    struct pollfd pfd;
+    int timeout = -1;
+    uint64_t now;
+
+    if (watch_fd < 0) {
+        pause();
+        return false;
+    }
+
+    if (reload_due != 0) {
+        now = now_ms();
+        timeout = (reload_due > now) ? (int)(reload_due - now) : 0;
+    }
+
+    pfd.fd = watch_fd;
+    pfd.events = POLLIN;
+    switch (poll(&pfd, 1, timeout)) {
+    case -1:
+        // Interrupted by a signal
+        return false;
+
+    case 0:
+        reload_due = 0;
+        if (access(watch_file, R_OK) != 0) {
+            PINELOG_WARN(_("Unable to reload configuration file %s: %s"),
+                         watch_file, strerror(errno));
+            return false;
+        }
+        if (unchanged_since_save()) {
+            PINELOG_TRACE("Configuration file %s was saved by the daemon, not reloading",
+                          watch_file);
+            return false;
+        }
+        PINELOG_INFO(_("Configuration file %s modified, reloading"), watch_file);
+        return true;
+
+    default:
+        if (read_events()) {
+            PINELOG_TRACE("Configuration file %s modified, reloading in %d ms",
+                          watch_file, X52D_RELOAD_DELAY_MS);
+            reload_due = now_ms() + X52D_RELOAD_DELAY_MS;
+        }
+        return false;
+    }
+    #else
+    pause();
+    return false;
+    #endif
+}
@@ -19,12 +19,22 @@
 
 #define X52D_SOCK_COMMAND   RUNDIR "/" X52D_APP_NAME ".cmd"
 #define X52D_SOCK_NOTIFY    RUNDIR "/" X52D_APP_NAME ".notify"
+#define X52D_STATE_FILE     RUNDIR "/" X52D_APP_NAME ".state"
+
+#define X52D_PROFILE_CACHE_DIR  RUNDIR "/" X52D_APP_NAME ".profiles"
 
 #include "gettext.h"
 #define N_(x) gettext_noop(x)
 #define _(x) gettext(x)
 
-#define X52D_MAX_CLIENTS    63
+/*
+ * Maximum number of clients on each socket. The client state is allocated as
+ * clients connect, so this only guards against running out of descriptors.
+ */
+#define X52D_MAX_CLIENTS    1024
+
+/* Delay after the last write to a watched file before it is reloaded */
+#define X52D_RELOAD_DELAY_MS    250
 
 enum {
     X52D_MOD_CONFIG,
@@ -36,6 +46,8 @@ enum {
     X52D_MOD_COMMAND,
     X52D_MOD_CLIENT,
     X52D_MOD_NOTIFY,
+    X52D_MOD_KEYMAP,
+    X52D_MOD_GAMEPAD,
 
     X52D_MOD_MAX
 };
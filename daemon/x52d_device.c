@@ -15,7 +15,11 @@
 #include "x52d_const.h"
 #include "x52d_config.h"
 #include "x52d_device.h"
+#include "x52d_latency.h"
 #include "x52d_notify.h"
+#include "x52d_state.h"
+#include "x52d_stats.h"
+#include "x52d_trace.h"
 #include "libx52.h"
 #include "pinelog.h"
 
@@ -26,6 +30,12 @@ static pthread_mutex_t device_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_t device_thr;
 static volatile bool device_update_needed;
 
+/*
+ * Number of callers holding back device updates. Changes made while updates
+ * are held are only written to the device once the last hold is released.
+ */
+static volatile int device_hold;
+
 static void *x52_dev_thr(void *param)
 {
     int rc;
@@ -34,7 +44,9 @@ static void *x52_dev_thr(void *param)
     #define DEV_UPD_DELAY 50000 // microseconds
 
     PINELOG_INFO(_("Starting X52 device manager thread"));
+    x52d_trace_thread_init("device");
     for (;;) {
+        x52d_stats_inc(X52D_STAT_WAKE_DEVICE);
         if (!libx52_is_connected(x52_dev)) {
             PINELOG_TRACE("Attempting to connect to X52 device");
             rc = libx52_connect(x52_dev);
@@ -50,11 +62,14 @@ static void *x52_dev_thr(void *param)
             } else {
                 /* Successfully connected */
                 PINELOG_INFO(_("Device connected, writing configuration"));
-                X52D_NOTIFY("CONNECTED");
-                x52d_config_apply();
+                pthread_mutex_lock(&device_mutex);
+                x52d_state_set_connected(true);
+                pthread_mutex_unlock(&device_mutex);
+                X52D_NOTIFY(X52D_TOPIC_DEVICE, "CONNECTED");
+                x52d_config_apply_all();
             }
         } else {
-            if (!device_update_needed) {
+            if (!device_update_needed || device_hold > 0) {
                 usleep(DEV_UPD_DELAY);
                 continue;
             }
@@ -69,6 +84,11 @@ static void *x52_dev_thr(void *param)
     return NULL;
 }
 
+static void trace_command(void *param, uint16_t index, uint16_t value, int rc)
+{
+    x52d_trace(X52D_TRACE_VENDOR_COMMAND, index, value, (uint32_t)rc);
+}
+
 void x52d_dev_init(void)
 {
     int rc;
@@ -80,6 +100,8 @@ void x52d_dev_init(void)
                       rc, libx52_strerror(rc));
     }
 
+    libx52_set_command_hook(x52_dev, trace_command, NULL);
+
     // Create and initialize the thread
     pthread_create(&device_thr, NULL, x52_dev_thr, NULL);
 }
@@ -93,10 +115,17 @@ void x52d_dev_exit(void)
     libx52_exit(x52_dev);
 }
 
-#define WRAP_LIBX52(func) \
+/*
+ * The shadow statement records a successful update in the shared state page,
+ * and runs with the device mutex held.
+ */
+#define WRAP_LIBX52_SHADOW(func, shadow) \
     int rc; \
     pthread_mutex_lock(&device_mutex); \
     rc = func; \
+    if (rc == LIBX52_SUCCESS) { \
+        shadow; \
+    } \
     pthread_mutex_unlock(&device_mutex); \
     if (rc != LIBX52_SUCCESS) { \
         if (rc != LIBX52_ERROR_TRY_AGAIN) { \
@@ -108,14 +137,18 @@ void x52d_dev_exit(void)
     } \
     return rc
 
+#define WRAP_LIBX52(func) WRAP_LIBX52_SHADOW(func, )
+
 int x52d_dev_set_text(uint8_t line, const char *text, uint8_t length)
 {
-    WRAP_LIBX52(libx52_set_text(x52_dev, line, text, length));
+    WRAP_LIBX52_SHADOW(libx52_set_text(x52_dev, line, text, length),
+                       x52d_state_set_text(line, text, length));
 }
 int x52d_dev_set_led_state(libx52_led_id led, libx52_led_state state)
 {
     if (libx52_check_feature(x52_dev, LIBX52_FEATURE_LED) != LIBX52_ERROR_NOT_SUPPORTED) {
-        WRAP_LIBX52(libx52_set_led_state(x52_dev, led, state));
+        WRAP_LIBX52_SHADOW(libx52_set_led_state(x52_dev, led, state),
+                           x52d_state_set_led(led, state));
     }
 
     // If the target device does not support setting individual LEDs,
@@ -149,23 +182,58 @@ int x52d_dev_set_date_format(libx52_date_format format)
 }
 int x52d_dev_set_brightness(uint8_t mfd, uint16_t brightness)
 {
-    WRAP_LIBX52(libx52_set_brightness(x52_dev, mfd, brightness));
+    WRAP_LIBX52_SHADOW(libx52_set_brightness(x52_dev, mfd, brightness),
+                       x52d_state_set_brightness(mfd, brightness));
 }
 int x52d_dev_set_shift(uint8_t state)
 {
-    WRAP_LIBX52(libx52_set_shift(x52_dev, state));
+    WRAP_LIBX52_SHADOW(libx52_set_shift(x52_dev, state),
+                       x52d_state_set_shift(state));
 }
 int x52d_dev_set_blink(uint8_t state)
 {
-    WRAP_LIBX52(libx52_set_blink(x52_dev, state));
+    WRAP_LIBX52_SHADOW(libx52_set_blink(x52_dev, state),
+                       x52d_state_set_blink(state));
+}
+
+void x52d_dev_hold_updates(void)
+{
+    pthread_mutex_lock(&device_mutex);
+    device_hold++;
+    pthread_mutex_unlock(&device_mutex);
+}
+
+void x52d_dev_release_updates(void)
+{
+    pthread_mutex_lock(&device_mutex);
+    if (device_hold > 0) {
+        device_hold--;
+    }
+    pthread_mutex_unlock(&device_mutex);
 }
 
 int x52d_dev_update(void)
 {
+    uint64_t start;
     int rc;
 
     pthread_mutex_lock(&device_mutex);
+    if (device_hold > 0) {
+        // The device thread will write the changes once the hold is released
+        pthread_mutex_unlock(&device_mutex);
+        PINELOG_TRACE("Deferring device update while updates are held");
+        return LIBX52_SUCCESS;
+    }
+
+    start = x52d_latency_now();
+    x52d_trace(X52D_TRACE_DEVICE_UPDATE_BEGIN, 0, 0, 0);
     rc = libx52_update(x52_dev);
+    x52d_trace(X52D_TRACE_DEVICE_UPDATE_END, (uint32_t)rc, 0, 0);
+    if (rc == LIBX52_SUCCESS) {
+        x52d_latency_record(X52D_LAT_DEVICE, x52d_latency_now() - start);
+        x52d_stats_inc(X52D_STAT_DEVICE_UPDATES);
+        x52d_state_count_update();
+    }
     pthread_mutex_unlock(&device_mutex);
 
     if (rc != LIBX52_SUCCESS) {
@@ -174,7 +242,10 @@ int x52d_dev_update(void)
             // pick it up.
             PINELOG_TRACE("Disconnecting detached device");
             libx52_disconnect(x52_dev);
-            X52D_NOTIFY("DISCONNECTED");
+            pthread_mutex_lock(&device_mutex);
+            x52d_state_set_connected(false);
+            pthread_mutex_unlock(&device_mutex);
+            X52D_NOTIFY(X52D_TOPIC_DEVICE, "DISCONNECTED");
         } else {
             PINELOG_ERROR(_("Error %d when updating X52 device: %s"),
                           rc, libx52_strerror(rc));
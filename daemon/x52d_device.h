@@ -28,4 +28,11 @@ int x52d_dev_set_shift(uint8_t state);
 int x52d_dev_set_blink(uint8_t state);
 int x52d_dev_update(void);
 
+/*
+ * Hold back device updates while a group of parameters is changed, so that
+ * they are all written to the device with a single update once released.
+ */
+void x52d_dev_hold_updates(void);
+void x52d_dev_release_updates(void);
+
 #endif // !defined X52D_DEVICE_H
@@ -0,0 +1,121 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Virtual gamepad
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+#define PINELOG_MODULE X52D_MOD_GAMEPAD
+#include "pinelog.h"
+#include "x52d_config.h"
+#include "x52d_const.h"
+#include "x52d_gamepad.h"
+
+static char gamepad_axes[NAME_MAX];
+static char gamepad_buttons[NAME_MAX];
+
+void x52d_gamepad_map_init(struct x52d_gamepad_map *map)
+{
+    int i;
+
+    for (i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        map->axis[i] = X52D_GAMEPAD_UNMAPPED;
+    }
+
+    for (i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        map->button[i] = X52D_GAMEPAD_UNMAPPED;
+    }
+}
+
+int x52d_gamepad_map_axis(struct x52d_gamepad_map *map,
+                          libx52io_axis axis, uint16_t code)
+{
+    if (axis < 0 || axis >= LIBX52IO_AXIS_MAX) {
+        return EINVAL;
+    }
+
+    map->axis[axis] = code;
+    return 0;
+}
+
+int x52d_gamepad_map_button(struct x52d_gamepad_map *map,
+                            libx52io_button button, uint16_t code)
+{
+    if (button < 0 || button >= LIBX52IO_BUTTON_MAX) {
+        return EINVAL;
+    }
+
+    map->button[button] = code;
+    return 0;
+}
+
+/*
+ * Build the frame for a report, containing only the mapped axes and buttons
+ * that changed since the previous report, so that the driver can send the
+ * entire frame with a single write.
+ */
+int x52d_gamepad_frame(const struct x52d_gamepad_map *map,
+                       const libx52io_report *old_report,
+                       const libx52io_report *new_report,
+                       struct x52d_gamepad_event *events)
+{
+    int n = 0;
+    int i;
+
+    for (i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        if (map->axis[i] != X52D_GAMEPAD_UNMAPPED &&
+            old_report->axis[i] != new_report->axis[i]) {
+            events[n].type = X52D_GAMEPAD_EV_AXIS;
+            events[n].code = map->axis[i];
+            events[n].value = new_report->axis[i];
+            n++;
+        }
+    }
+
+    for (i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        if (map->button[i] != X52D_GAMEPAD_UNMAPPED &&
+            old_report->button[i] != new_report->button[i]) {
+            events[n].type = X52D_GAMEPAD_EV_BUTTON;
+            events[n].code = map->button[i];
+            events[n].value = new_report->button[i];
+            n++;
+        }
+    }
+
+    return n;
+}
+
+void x52d_cfg_set_Gamepad_Enabled(bool enabled)
+{
+    PINELOG_DEBUG(_("Setting gamepad enable to %s"),
+                  enabled ? _("on") : _("off"));
+    #if defined HAVE_EVDEV
+    x52d_gamepad_evdev_set_enabled(enabled);
+    #endif
+}
+
+void x52d_cfg_set_Gamepad_Axes(char *param)
+{
+    PINELOG_DEBUG(_("Setting gamepad axis mapping to '%s'"), param);
+    strncpy(gamepad_axes, param, sizeof(gamepad_axes) - 1);
+    #if defined HAVE_EVDEV
+    x52d_gamepad_evdev_set_mapping(gamepad_axes, gamepad_buttons);
+    #endif
+}
+
+void x52d_cfg_set_Gamepad_Buttons(char *param)
+{
+    PINELOG_DEBUG(_("Setting gamepad button mapping to '%s'"), param);
+    strncpy(gamepad_buttons, param, sizeof(gamepad_buttons) - 1);
+    #if defined HAVE_EVDEV
+    x52d_gamepad_evdev_set_mapping(gamepad_axes, gamepad_buttons);
+    #endif
+}
@@ -0,0 +1,58 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Virtual gamepad
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#ifndef X52D_GAMEPAD_H
+#define X52D_GAMEPAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "libx52io.h"
+
+/* Axis or button is not mapped, and is not reported by the virtual gamepad */
+#define X52D_GAMEPAD_UNMAPPED   0xFFFF
+
+/* Event codes of the virtual gamepad, indexed by the X52 axis or button */
+struct x52d_gamepad_map {
+    uint16_t axis[LIBX52IO_AXIS_MAX];
+    uint16_t button[LIBX52IO_BUTTON_MAX];
+};
+
+enum {
+    X52D_GAMEPAD_EV_AXIS,
+    X52D_GAMEPAD_EV_BUTTON,
+};
+
+/* Single event in a frame, translated to EV_ABS or EV_KEY by the driver */
+struct x52d_gamepad_event {
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+};
+
+/* Every axis and button can change in a single report */
+#define X52D_GAMEPAD_MAX_EVENTS (LIBX52IO_AXIS_MAX + LIBX52IO_BUTTON_MAX)
+
+void x52d_gamepad_map_init(struct x52d_gamepad_map *map);
+int x52d_gamepad_map_axis(struct x52d_gamepad_map *map,
+                          libx52io_axis axis, uint16_t code);
+int x52d_gamepad_map_button(struct x52d_gamepad_map *map,
+                            libx52io_button button, uint16_t code);
+int x52d_gamepad_frame(const struct x52d_gamepad_map *map,
+                       const libx52io_report *old_report,
+                       const libx52io_report *new_report,
+                       struct x52d_gamepad_event *events);
+
+/* Implemented in x52d_gamepad_evdev.c */
+void x52d_gamepad_evdev_init(void);
+void x52d_gamepad_evdev_exit(void);
+void x52d_gamepad_evdev_set_enabled(bool enabled);
+void x52d_gamepad_evdev_set_mapping(const char *axes, const char *buttons);
+void x52d_gamepad_evdev_connect(libx52io_context *ctx);
+void x52d_gamepad_report_event(libx52io_report *report);
+
+#endif // !defined X52D_GAMEPAD_H
@@ -0,0 +1,371 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Virtual gamepad driver
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "libevdev/libevdev.h"
+#include "libevdev/libevdev-uinput.h"
+#include "libx52io.h"
+
+#define PINELOG_MODULE X52D_MOD_GAMEPAD
+#include "pinelog.h"
+#include "x52d_const.h"
+#include "x52d_gamepad.h"
+#include "x52d_latency.h"
+#include "x52d_uinput.h"
+
+/*
+ * The gamepad is only created once the joystick is connected, since the axis
+ * ranges depend on the model. It is recreated whenever the ranges or the
+ * mapping change. The mutex is only contended at those times, the rest of
+ * the time it is only taken by the I/O thread.
+ */
+static pthread_mutex_t gamepad_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct libevdev_uinput *gamepad_uidev;
+static bool gamepad_enabled;
+static struct x52d_gamepad_map gamepad_map;
+static libx52io_report gamepad_last;
+
+static bool gamepad_ranges_valid;
+static int32_t gamepad_axis_min[LIBX52IO_AXIS_MAX];
+static int32_t gamepad_axis_max[LIBX52IO_AXIS_MAX];
+
+/*
+ * The default layout follows the HID descriptor of the joystick, except for
+ * the thumbstick, which drives the virtual mouse.
+ */
+static const uint16_t default_axes[LIBX52IO_AXIS_MAX] = {
+    [LIBX52IO_AXIS_X] = ABS_X,
+    [LIBX52IO_AXIS_Y] = ABS_Y,
+    [LIBX52IO_AXIS_RZ] = ABS_RZ,
+    [LIBX52IO_AXIS_Z] = ABS_Z,
+    [LIBX52IO_AXIS_RX] = ABS_RX,
+    [LIBX52IO_AXIS_RY] = ABS_RY,
+    [LIBX52IO_AXIS_SLIDER] = ABS_THROTTLE,
+    [LIBX52IO_AXIS_THUMBX] = X52D_GAMEPAD_UNMAPPED,
+    [LIBX52IO_AXIS_THUMBY] = X52D_GAMEPAD_UNMAPPED,
+    [LIBX52IO_AXIS_HATX] = ABS_HAT0X,
+    [LIBX52IO_AXIS_HATY] = ABS_HAT0Y,
+};
+
+/* Buttons use the joystick range, followed by the extra trigger buttons */
+#define JOYSTICK_BUTTONS    (BTN_BASE6 - BTN_JOYSTICK + 1)
+
+static void default_map(struct x52d_gamepad_map *map)
+{
+    int i;
+
+    x52d_gamepad_map_init(map);
+    for (i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        x52d_gamepad_map_axis(map, i, default_axes[i]);
+    }
+
+    for (i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        if (i < JOYSTICK_BUTTONS) {
+            x52d_gamepad_map_button(map, i, BTN_JOYSTICK + i);
+        } else {
+            x52d_gamepad_map_button(map, i,
+                                    BTN_TRIGGER_HAPPY1 + i - JOYSTICK_BUTTONS);
+        }
+    }
+}
+
+static int find_axis(const char *name)
+{
+    int axis;
+
+    for (axis = 0; axis < LIBX52IO_AXIS_MAX; axis++) {
+        if (!strcasecmp(libx52io_axis_to_str(axis), name)) {
+            return axis;
+        }
+    }
+
+    return -1;
+}
+
+static int find_button(const char *name)
+{
+    int btn;
+
+    for (btn = 0; btn < LIBX52IO_BUTTON_MAX; btn++) {
+        if (!strcasecmp(libx52io_button_to_str(btn), name)) {
+            return btn;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Parse a list of mappings of the form <X52 name>=<event code name>,
+ * separated by commas or spaces, and apply them on top of the map.
+ */
+static void parse_mapping(struct x52d_gamepad_map *map, const char *value,
+                          bool axes)
+{
+    char buf[NAME_MAX];
+    char *saveptr = NULL;
+    char *entry;
+    char *target;
+    int src;
+    int code;
+
+    strncpy(buf, value, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    for (entry = strtok_r(buf, ", ", &saveptr); entry != NULL;
+         entry = strtok_r(NULL, ", ", &saveptr)) {
+        target = strchr(entry, '=');
+        if (target == NULL) {
+            PINELOG_WARN(_("Ignoring invalid gamepad mapping '%s'"), entry);
+            continue;
+        }
+        *target++ = '\0';
+
+        src = axes ? find_axis(entry) : find_button(entry);
+        if (src < 0) {
+            PINELOG_WARN(_("Ignoring gamepad mapping for unknown input '%s'"),
+                         entry);
+            continue;
+        }
+
+        if (!strcasecmp(target, "none")) {
+            code = X52D_GAMEPAD_UNMAPPED;
+        } else {
+            code = libevdev_event_code_from_name(axes ? EV_ABS : EV_KEY, target);
+            if (code < 0) {
+                PINELOG_WARN(_("Ignoring unsupported gamepad mapping '%s=%s'"),
+                             entry, target);
+                continue;
+            }
+        }
+
+        if (axes) {
+            x52d_gamepad_map_axis(map, src, code);
+        } else {
+            x52d_gamepad_map_button(map, src, code);
+        }
+    }
+}
+
+/* Must be called with the gamepad mutex held */
+static void write_frame(const struct x52d_gamepad_event *events, int nevents)
+{
+    struct x52d_uinput_frame frame;
+    int rc;
+    int i;
+
+    if (gamepad_uidev == NULL || nevents == 0) {
+        return;
+    }
+
+    x52d_uinput_frame_init(&frame, gamepad_uidev);
+    for (i = 0; i < nevents; i++) {
+        x52d_uinput_frame_add(&frame,
+            (events[i].type == X52D_GAMEPAD_EV_AXIS) ? EV_ABS : EV_KEY,
+            events[i].code, events[i].value);
+    }
+
+    rc = x52d_uinput_frame_flush(&frame);
+    if (rc != 0) {
+        PINELOG_ERROR(_("Error %d writing gamepad events: %s"),
+                      rc, strerror(rc));
+    }
+}
+
+static struct libevdev_uinput *create_device(void)
+{
+    struct libevdev_uinput *uidev = NULL;
+    struct libevdev *dev;
+    struct input_absinfo absinfo;
+    int i;
+    int rc;
+
+    dev = libevdev_new();
+    libevdev_set_name(dev, "X52 virtual gamepad");
+    libevdev_enable_event_type(dev, EV_ABS);
+    for (i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        if (gamepad_map.axis[i] != X52D_GAMEPAD_UNMAPPED) {
+            memset(&absinfo, 0, sizeof(absinfo));
+            absinfo.minimum = gamepad_axis_min[i];
+            absinfo.maximum = gamepad_axis_max[i];
+            libevdev_enable_event_code(dev, EV_ABS, gamepad_map.axis[i],
+                                       &absinfo);
+        }
+    }
+
+    libevdev_enable_event_type(dev, EV_KEY);
+    for (i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        if (gamepad_map.button[i] != X52D_GAMEPAD_UNMAPPED) {
+            libevdev_enable_event_code(dev, EV_KEY, gamepad_map.button[i], NULL);
+        }
+    }
+
+    rc = libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED,
+                                            &uidev);
+    if (rc != 0) {
+        PINELOG_ERROR(_("Error %d creating X52 virtual gamepad: %s"),
+                      -rc, strerror(-rc));
+        uidev = NULL;
+    }
+    libevdev_free(dev);
+
+    return uidev;
+}
+
+/* Release the buttons that are still pressed, the axes are left as is */
+static void release_buttons(void)
+{
+    struct x52d_gamepad_event events[X52D_GAMEPAD_MAX_EVENTS];
+    libx52io_report released;
+    int nevents;
+
+    memcpy(&released, &gamepad_last, sizeof(released));
+    memset(released.button, 0, sizeof(released.button));
+    nevents = x52d_gamepad_frame(&gamepad_map, &gamepad_last, &released, events);
+    write_frame(events, nevents);
+    memcpy(&gamepad_last, &released, sizeof(gamepad_last));
+}
+
+/* Must be called with the gamepad mutex held */
+static void gamepad_update(void)
+{
+    int i;
+
+    if (gamepad_uidev != NULL) {
+        release_buttons();
+        libevdev_uinput_destroy(gamepad_uidev);
+        gamepad_uidev = NULL;
+    }
+
+    if (!gamepad_enabled || !gamepad_ranges_valid) {
+        return;
+    }
+
+    PINELOG_INFO(_("Creating X52 virtual gamepad"));
+    gamepad_uidev = create_device();
+
+    /* Force the next report to send the full state of the joystick */
+    memset(&gamepad_last, 0, sizeof(gamepad_last));
+    for (i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        gamepad_last.axis[i] = INT32_MIN;
+    }
+}
+
+void x52d_gamepad_evdev_set_enabled(bool enabled)
+{
+    pthread_mutex_lock(&gamepad_mutex);
+    if (gamepad_enabled != enabled) {
+        gamepad_enabled = enabled;
+        gamepad_update();
+    }
+    pthread_mutex_unlock(&gamepad_mutex);
+}
+
+void x52d_gamepad_evdev_set_mapping(const char *axes, const char *buttons)
+{
+    struct x52d_gamepad_map map;
+
+    default_map(&map);
+    parse_mapping(&map, axes, true);
+    parse_mapping(&map, buttons, false);
+
+    pthread_mutex_lock(&gamepad_mutex);
+    if (memcmp(&map, &gamepad_map, sizeof(map)) != 0) {
+        if (gamepad_uidev != NULL) {
+            /* Release the buttons with the codes they were pressed with */
+            release_buttons();
+        }
+        memcpy(&gamepad_map, &map, sizeof(gamepad_map));
+        gamepad_update();
+    }
+    pthread_mutex_unlock(&gamepad_mutex);
+}
+
+/* Called by the I/O thread whenever the joystick is connected */
+void x52d_gamepad_evdev_connect(libx52io_context *ctx)
+{
+    int32_t axis_min[LIBX52IO_AXIS_MAX];
+    int32_t axis_max[LIBX52IO_AXIS_MAX];
+    int cancel_state;
+    int i;
+
+    for (i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        if (libx52io_get_axis_range(ctx, i, &axis_min[i], &axis_max[i]) !=
+            LIBX52IO_SUCCESS) {
+            return;
+        }
+    }
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    pthread_mutex_lock(&gamepad_mutex);
+    if (!gamepad_ranges_valid ||
+        memcmp(axis_min, gamepad_axis_min, sizeof(axis_min)) != 0 ||
+        memcmp(axis_max, gamepad_axis_max, sizeof(axis_max)) != 0) {
+        memcpy(gamepad_axis_min, axis_min, sizeof(gamepad_axis_min));
+        memcpy(gamepad_axis_max, axis_max, sizeof(gamepad_axis_max));
+        gamepad_ranges_valid = true;
+        gamepad_update();
+    }
+    pthread_mutex_unlock(&gamepad_mutex);
+    pthread_setcancelstate(cancel_state, NULL);
+}
+
+void x52d_gamepad_report_event(libx52io_report *report)
+{
+    struct x52d_gamepad_event events[X52D_GAMEPAD_MAX_EVENTS];
+    int nevents = 0;
+    int cancel_state;
+
+    /*
+     * Writing the events is a cancellation point, and the I/O thread must
+     * not be cancelled with the mutex held.
+     */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    pthread_mutex_lock(&gamepad_mutex);
+    if (gamepad_uidev != NULL) {
+        if (report) {
+            nevents = x52d_gamepad_frame(&gamepad_map, &gamepad_last, report,
+                                         events);
+            write_frame(events, nevents);
+            memcpy(&gamepad_last, report, sizeof(gamepad_last));
+        } else {
+            /* Device was disconnected, don't leave any buttons pressed */
+            release_buttons();
+        }
+    }
+    pthread_mutex_unlock(&gamepad_mutex);
+    pthread_setcancelstate(cancel_state, NULL);
+
+    if (nevents) {
+        x52d_latency_mark(X52D_LAT_UINPUT);
+    }
+}
+
+void x52d_gamepad_evdev_init(void)
+{
+    pthread_mutex_lock(&gamepad_mutex);
+    default_map(&gamepad_map);
+    pthread_mutex_unlock(&gamepad_mutex);
+}
+
+void x52d_gamepad_evdev_exit(void)
+{
+    pthread_mutex_lock(&gamepad_mutex);
+    gamepad_enabled = false;
+    gamepad_update();
+    pthread_mutex_unlock(&gamepad_mutex);
+}
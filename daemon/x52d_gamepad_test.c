@@ -0,0 +1,167 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Virtual gamepad test harness
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#define PINELOG_MODULE X52D_MOD_GAMEPAD
+#include "pinelog.h"
+#include "x52d_config.h"
+#include "x52d_const.h"
+#include "x52d_gamepad.h"
+
+/* Arbitrary event codes, the frame builder doesn't interpret them */
+#define CODE_X      0
+#define CODE_Y      1
+#define CODE_FIRE   0x120
+
+#if defined HAVE_EVDEV
+/* Stubs for evdev */
+void x52d_gamepad_evdev_set_enabled(bool enabled)
+{
+    function_called();
+    check_expected(enabled);
+}
+
+void x52d_gamepad_evdev_set_mapping(const char *axes, const char *buttons)
+{
+    function_called();
+    check_expected(axes);
+    check_expected(buttons);
+}
+#endif
+
+struct test_state {
+    struct x52d_gamepad_map map;
+    libx52io_report old_report;
+    libx52io_report new_report;
+    struct x52d_gamepad_event events[X52D_GAMEPAD_MAX_EVENTS];
+};
+
+static int test_setup(void **state)
+{
+    static struct test_state ts;
+
+    memset(&ts, 0, sizeof(ts));
+    x52d_gamepad_map_init(&ts.map);
+    x52d_gamepad_map_axis(&ts.map, LIBX52IO_AXIS_X, CODE_X);
+    x52d_gamepad_map_axis(&ts.map, LIBX52IO_AXIS_Y, CODE_Y);
+    x52d_gamepad_map_button(&ts.map, LIBX52IO_BTN_FIRE, CODE_FIRE);
+
+    *state = &ts;
+    return 0;
+}
+
+static void test_gamepad_map_invalid(void **state)
+{
+    struct test_state *ts = *state;
+
+    assert_int_equal(x52d_gamepad_map_axis(&ts->map, -1, CODE_X), EINVAL);
+    assert_int_equal(x52d_gamepad_map_axis(&ts->map, LIBX52IO_AXIS_MAX, CODE_X),
+                     EINVAL);
+    assert_int_equal(x52d_gamepad_map_button(&ts->map, -1, CODE_FIRE), EINVAL);
+    assert_int_equal(x52d_gamepad_map_button(&ts->map, LIBX52IO_BUTTON_MAX,
+                                             CODE_FIRE), EINVAL);
+}
+
+static void test_gamepad_frame_unchanged(void **state)
+{
+    struct test_state *ts = *state;
+
+    assert_int_equal(x52d_gamepad_frame(&ts->map, &ts->old_report,
+                                        &ts->new_report, ts->events), 0);
+}
+
+static void test_gamepad_frame_changed(void **state)
+{
+    struct test_state *ts = *state;
+
+    ts->new_report.axis[LIBX52IO_AXIS_Y] = 512;
+    ts->new_report.button[LIBX52IO_BTN_FIRE] = true;
+
+    assert_int_equal(x52d_gamepad_frame(&ts->map, &ts->old_report,
+                                        &ts->new_report, ts->events), 2);
+    assert_int_equal(ts->events[0].type, X52D_GAMEPAD_EV_AXIS);
+    assert_int_equal(ts->events[0].code, CODE_Y);
+    assert_int_equal(ts->events[0].value, 512);
+    assert_int_equal(ts->events[1].type, X52D_GAMEPAD_EV_BUTTON);
+    assert_int_equal(ts->events[1].code, CODE_FIRE);
+    assert_int_equal(ts->events[1].value, 1);
+
+    /* Releasing the button only sends the button */
+    memcpy(&ts->old_report, &ts->new_report, sizeof(ts->old_report));
+    ts->new_report.button[LIBX52IO_BTN_FIRE] = false;
+    assert_int_equal(x52d_gamepad_frame(&ts->map, &ts->old_report,
+                                        &ts->new_report, ts->events), 1);
+    assert_int_equal(ts->events[0].code, CODE_FIRE);
+    assert_int_equal(ts->events[0].value, 0);
+}
+
+static void test_gamepad_frame_unmapped(void **state)
+{
+    struct test_state *ts = *state;
+
+    ts->new_report.axis[LIBX52IO_AXIS_SLIDER] = 100;
+    ts->new_report.button[LIBX52IO_BTN_TRIGGER] = true;
+    assert_int_equal(x52d_gamepad_frame(&ts->map, &ts->old_report,
+                                        &ts->new_report, ts->events), 0);
+
+    /* Removing a mapping stops reporting the axis */
+    ts->new_report.axis[LIBX52IO_AXIS_X] = 100;
+    x52d_gamepad_map_axis(&ts->map, LIBX52IO_AXIS_X, X52D_GAMEPAD_UNMAPPED);
+    assert_int_equal(x52d_gamepad_frame(&ts->map, &ts->old_report,
+                                        &ts->new_report, ts->events), 0);
+}
+
+static void test_gamepad_enabled(void **state)
+{
+    #if defined HAVE_EVDEV
+    expect_function_calls(x52d_gamepad_evdev_set_enabled, 1);
+    expect_value(x52d_gamepad_evdev_set_enabled, enabled, true);
+    #endif
+
+    x52d_cfg_set_Gamepad_Enabled(true);
+}
+
+static void test_gamepad_mapping(void **state)
+{
+    #if defined HAVE_EVDEV
+    expect_function_calls(x52d_gamepad_evdev_set_mapping, 2);
+    expect_string(x52d_gamepad_evdev_set_mapping, axes, "ABS_SLIDER=ABS_THROTTLE");
+    expect_string(x52d_gamepad_evdev_set_mapping, buttons, "");
+    expect_string(x52d_gamepad_evdev_set_mapping, axes, "ABS_SLIDER=ABS_THROTTLE");
+    expect_string(x52d_gamepad_evdev_set_mapping, buttons, "BTN_CLUTCH=none");
+    #endif
+
+    x52d_cfg_set_Gamepad_Axes("ABS_SLIDER=ABS_THROTTLE");
+    x52d_cfg_set_Gamepad_Buttons("BTN_CLUTCH=none");
+}
+
+#define TEST(tc) cmocka_unit_test_setup(tc, test_setup)
+const struct CMUnitTest tests[] = {
+    TEST(test_gamepad_map_invalid),
+    TEST(test_gamepad_frame_unchanged),
+    TEST(test_gamepad_frame_changed),
+    TEST(test_gamepad_frame_unmapped),
+    cmocka_unit_test(test_gamepad_enabled),
+    cmocka_unit_test(test_gamepad_mapping),
+};
+#undef TEST
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, NULL, NULL);
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Live input notifications
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "x52d_input.h"
+#include "x52d_notify.h"
+
+#define NSEC_PER_SEC    1000000000ULL
+#define NSEC_PER_MSEC   1000000ULL
+
+/* Last state seen, whether or not it was sent */
+static libx52io_report input_last;
+
+/* Axes that changed since the last axis notification */
+static uint32_t input_pending;
+
+/* Earliest time that the next axis notification may be sent */
+static uint64_t input_next;
+
+static void send_axes(uint64_t now)
+{
+    const char *argv[1 + 2 * LIBX52IO_AXIS_MAX] = {"AXIS"};
+    char values[LIBX52IO_AXIS_MAX][12];
+    int argc = 1;
+
+    for (int i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        if (input_pending & (1u << i)) {
+            snprintf(values[i], sizeof(values[i]), "%d", input_last.axis[i]);
+            argv[argc++] = libx52io_axis_to_str(i);
+            argv[argc++] = values[i];
+        }
+    }
+
+    input_pending = 0;
+    input_next = now + NSEC_PER_SEC / x52d_notify_input_rate();
+    x52d_notify_send(X52D_TOPIC_INPUT, argc, argv);
+}
+
+/*
+ * Edges are never delayed or merged. Any axis changes that are still pending
+ * stay pending until the interval is over, so that frequent button changes
+ * don't raise the rate of axis notifications.
+ */
+static void send_edge(const char *type, const char *name, int value)
+{
+    char buf[12];
+
+    snprintf(buf, sizeof(buf), "%d", value);
+    if (name != NULL) {
+        X52D_NOTIFY(X52D_TOPIC_INPUT, type, name, buf);
+    } else {
+        X52D_NOTIFY(X52D_TOPIC_INPUT, type, buf);
+    }
+}
+
+void x52d_input_report_event(const libx52io_report *report, uint64_t now)
+{
+    if (!x52d_notify_wanted(X52D_TOPIC_INPUT)) {
+        // Nobody is listening, but track the state for when they start
+        memcpy(&input_last, report, sizeof(input_last));
+        input_pending = 0;
+        input_next = 0;
+        return;
+    }
+
+    for (int i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        if (report->axis[i] != input_last.axis[i]) {
+            input_pending |= 1u << i;
+        }
+    }
+
+    for (int i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        if (report->button[i] != input_last.button[i]) {
+            send_edge("BUTTON", libx52io_button_to_str(i),
+                      report->button[i]);
+        }
+    }
+
+    if (report->hat != input_last.hat) {
+        send_edge("HAT", NULL, report->hat);
+    }
+
+    if (report->mode != input_last.mode) {
+        send_edge("MODE", NULL, report->mode);
+    }
+
+    memcpy(&input_last, report, sizeof(input_last));
+    x52d_input_flush(now);
+}
+
+int x52d_input_timeout(uint64_t now)
+{
+    if (!input_pending) {
+        return -1;
+    }
+
+    if (now >= input_next) {
+        return 0;
+    }
+
+    // Round up, so that the poll doesn't wake up just before the deadline
+    return (int)((input_next - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC);
+}
+
+void x52d_input_flush(uint64_t now)
+{
+    if (input_pending && now >= input_next) {
+        send_axes(now);
+    }
+}
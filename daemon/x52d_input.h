@@ -0,0 +1,32 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Live input notifications
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#ifndef X52D_INPUT_H
+#define X52D_INPUT_H
+
+#include <stdint.h>
+#include "libx52io.h"
+
+/*
+ * Publish the changes in the joystick state on the input notification topic.
+ * Button, hat and mode changes are sent as soon as they are seen. Axis changes
+ * are merged, and sent at most once per interval of the configured input rate,
+ * with the latest value of every axis that changed in that interval.
+ *
+ * Timestamps are in nanoseconds, from x52d_latency_now. These must only be
+ * called from the I/O thread.
+ */
+void x52d_input_report_event(const libx52io_report *report, uint64_t now);
+
+/* Milliseconds until the pending axis changes are due, or -1 if none */
+int x52d_input_timeout(uint64_t now);
+
+/* Send the pending axis changes, if they are due */
+void x52d_input_flush(uint64_t now);
+
+#endif // !defined X52D_INPUT_H
@@ -0,0 +1,178 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Live input notifications test harness
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "x52d_input.h"
+#include "x52d_notify.h"
+
+#define MSEC    1000000ULL
+
+/* Notifications sent by the module under test, with the arguments joined */
+#define MAX_SENT    8
+static char sent[MAX_SENT][256];
+static int sent_count;
+
+atomic_uint x52d_notify_topics;
+
+void x52d_notify_send(enum x52d_notify_topic topic, int argc, const char **argv)
+{
+    char *buf;
+
+    assert_int_equal(topic, X52D_TOPIC_INPUT);
+    assert_true(sent_count < MAX_SENT);
+
+    buf = sent[sent_count++];
+    buf[0] = '\0';
+    for (int i = 0; i < argc; i++) {
+        if (i > 0) {
+            strcat(buf, " ");
+        }
+        strcat(buf, argv[i]);
+    }
+}
+
+/* 100 Hz, or one axis notification every 10ms */
+unsigned int x52d_notify_input_rate(void)
+{
+    return 100;
+}
+
+static libx52io_report report;
+
+static int setup(void **state)
+{
+    // Reset the module state, with nothing subscribed
+    memset(&report, 0, sizeof(report));
+    atomic_store(&x52d_notify_topics, 0);
+    x52d_input_report_event(&report, 0);
+
+    atomic_store(&x52d_notify_topics, 1u << X52D_TOPIC_INPUT);
+    memset(sent, 0, sizeof(sent));
+    sent_count = 0;
+    return 0;
+}
+
+static void test_unsubscribed(void **state)
+{
+    atomic_store(&x52d_notify_topics, 1u << X52D_TOPIC_DEVICE);
+
+    report.button[LIBX52IO_BTN_TRIGGER] = true;
+    report.axis[LIBX52IO_AXIS_X] = 100;
+    x52d_input_report_event(&report, 1 * MSEC);
+
+    assert_int_equal(sent_count, 0);
+    assert_int_equal(x52d_input_timeout(1 * MSEC), -1);
+
+    // Changes made while unsubscribed are not reported later
+    atomic_store(&x52d_notify_topics, 1u << X52D_TOPIC_INPUT);
+    x52d_input_report_event(&report, 2 * MSEC);
+    assert_int_equal(sent_count, 0);
+}
+
+static void test_button_edges(void **state)
+{
+    report.button[LIBX52IO_BTN_TRIGGER] = true;
+    x52d_input_report_event(&report, 1 * MSEC);
+    report.button[LIBX52IO_BTN_TRIGGER] = false;
+    x52d_input_report_event(&report, 1 * MSEC);
+    report.hat = 3;
+    report.mode = 2;
+    x52d_input_report_event(&report, 1 * MSEC);
+
+    assert_int_equal(sent_count, 4);
+    assert_string_equal(sent[0], "BUTTON BTN_TRIGGER 1");
+    assert_string_equal(sent[1], "BUTTON BTN_TRIGGER 0");
+    assert_string_equal(sent[2], "HAT 3");
+    assert_string_equal(sent[3], "MODE 2");
+    assert_int_equal(x52d_input_timeout(1 * MSEC), -1);
+}
+
+static void test_axis_coalesce(void **state)
+{
+    // The first change goes out immediately, and starts the interval
+    report.axis[LIBX52IO_AXIS_X] = 100;
+    x52d_input_report_event(&report, 1 * MSEC);
+    assert_int_equal(sent_count, 1);
+    assert_string_equal(sent[0], "AXIS ABS_X 100");
+
+    // Changes within the interval are merged, with the latest value winning
+    report.axis[LIBX52IO_AXIS_X] = 200;
+    x52d_input_report_event(&report, 2 * MSEC);
+    report.axis[LIBX52IO_AXIS_Y] = 50;
+    report.axis[LIBX52IO_AXIS_X] = 300;
+    x52d_input_report_event(&report, 3 * MSEC);
+    assert_int_equal(sent_count, 1);
+    assert_int_equal(x52d_input_timeout(3 * MSEC), 8);
+
+    // Nothing is sent before the interval is over
+    x52d_input_flush(10 * MSEC);
+    assert_int_equal(sent_count, 1);
+    assert_int_equal(x52d_input_timeout(10 * MSEC + 1), 1);
+
+    x52d_input_flush(11 * MSEC);
+    assert_int_equal(sent_count, 2);
+    assert_string_equal(sent[1], "AXIS ABS_X 300 ABS_Y 50");
+    assert_int_equal(x52d_input_timeout(11 * MSEC), -1);
+
+    // A change that returns to the sent value is still sent
+    report.axis[LIBX52IO_AXIS_Y] = 60;
+    x52d_input_report_event(&report, 12 * MSEC);
+    report.axis[LIBX52IO_AXIS_Y] = 50;
+    x52d_input_report_event(&report, 13 * MSEC);
+    x52d_input_report_event(&report, 21 * MSEC);
+    assert_int_equal(sent_count, 3);
+    assert_string_equal(sent[2], "AXIS ABS_Y 50");
+}
+
+static void test_edge_order(void **state)
+{
+    report.axis[LIBX52IO_AXIS_Z] = 10;
+    x52d_input_report_event(&report, 1 * MSEC);
+    report.axis[LIBX52IO_AXIS_Z] = 20;
+    x52d_input_report_event(&report, 2 * MSEC);
+
+    // The button is sent at once, but pending axes wait for the interval
+    report.axis[LIBX52IO_AXIS_Z] = 30;
+    report.button[LIBX52IO_BTN_FIRE] = true;
+    x52d_input_report_event(&report, 3 * MSEC);
+    report.button[LIBX52IO_BTN_FIRE] = false;
+    x52d_input_report_event(&report, 4 * MSEC);
+
+    assert_int_equal(sent_count, 3);
+    assert_string_equal(sent[0], "AXIS ABS_Z 10");
+    assert_string_equal(sent[1], "BUTTON BTN_FIRE 1");
+    assert_string_equal(sent[2], "BUTTON BTN_FIRE 0");
+    assert_int_equal(x52d_input_timeout(4 * MSEC), 7);
+
+    x52d_input_flush(11 * MSEC);
+    assert_int_equal(sent_count, 4);
+    assert_string_equal(sent[3], "AXIS ABS_Z 30");
+}
+
+#define TEST(fn) cmocka_unit_test_setup(fn, setup)
+
+const struct CMUnitTest tests[] = {
+    TEST(test_unsubscribed),
+    TEST(test_button_edges),
+    TEST(test_axis_coalesce),
+    TEST(test_edge_order),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, NULL, NULL);
+    return 0;
+}
@@ -8,13 +8,22 @@
 
 #include "config.h"
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 
 #include "x52d_const.h"
 #include "x52d_config.h"
+#include "x52d_gamepad.h"
+#include "x52d_input.h"
 #include "x52d_io.h"
+#include "x52d_keymap.h"
+#include "x52d_latency.h"
 #include "x52d_mouse.h"
+#include "x52d_report.h"
+#include "x52d_state.h"
+#include "x52d_stats.h"
+#include "x52d_trace.h"
 #include "libx52io.h"
 
 #define PINELOG_MODULE X52D_MOD_IO
@@ -23,37 +32,86 @@
 static libx52io_context *io_ctx;
 
 static pthread_t io_thr;
+static bool io_thr_created;
+
+/* Latest report, for consumers that run on their own threads */
+static struct x52d_report_slot io_latest;
+
+unsigned int x52d_io_read_report(libx52io_report *report)
+{
+    return x52d_report_slot_read(&io_latest, report);
+}
+
+/* Report the joystick at rest, with the thumbstick centered */
+static void publish_rest_report(void)
+{
+    libx52io_report report;
+    uint64_t now = x52d_latency_now();
+
+    memset(&report, 0, sizeof(report));
+    report.axis[LIBX52IO_AXIS_THUMBX] = 8;
+    report.axis[LIBX52IO_AXIS_THUMBY] = 8;
+    x52d_report_slot_write(&io_latest, &report);
+    x52d_state_set_report(&report, now);
+    x52d_input_report_event(&report, now);
+}
 
 static void process_report(libx52io_report *report, libx52io_report *prev)
 {
-    // TODO: Process changes
+    x52d_report_slot_write(&io_latest, report);
+    x52d_state_set_report(report, libx52io_get_report_timestamp(io_ctx));
+    x52d_latency_mark(X52D_LAT_DISPATCH);
+    x52d_trace(X52D_TRACE_DISPATCH, 0, 0, 0);
+    x52d_gamepad_report_event(report);
+    x52d_keymap_report_event(report);
     x52d_mouse_report_event(report);
+    x52d_input_report_event(report, x52d_latency_now());
     memcpy(prev, report, sizeof(*prev));
 }
 
 static void *x52_io_thr(void *param)
 {
     int rc;
+    int timeout;
+    int input_timeout;
     libx52io_report report;
     libx52io_report prev_report;
 
     #define IO_READ_TIMEOUT 50 /* milliseconds */
     #define IO_ACQ_TIMEOUT 5 /* seconds */
     PINELOG_INFO(_("Starting X52 I/O thread"));
+    x52d_trace_thread_init("io");
 
     // Reset the previous report, so that process_report  can handle changes.
     memset(&prev_report, 0, sizeof(prev_report));
 
     for (;;) {
-        rc = libx52io_read_timeout(io_ctx, &report, IO_READ_TIMEOUT);
+        /*
+         * A directly opened device blocks in poll, which is a cancellation
+         * point, so there is no need to wake up periodically, unless there
+         * are input notifications waiting to be sent.
+         */
+        timeout = (libx52io_get_fd(io_ctx) >= 0) ? -1 : IO_READ_TIMEOUT;
+        input_timeout = x52d_input_timeout(x52d_latency_now());
+        if (input_timeout >= 0 && (timeout < 0 || input_timeout < timeout)) {
+            timeout = input_timeout;
+        }
+        rc = libx52io_read_timeout(io_ctx, &report, timeout);
+        x52d_stats_inc(X52D_STAT_WAKE_IO);
+        x52d_trace(X52D_TRACE_HID_READ, (uint32_t)rc, 0, 0);
         switch (rc) {
         case LIBX52IO_SUCCESS:
             // Found a report
+            x52d_stats_inc(X52D_STAT_HID_REPORTS);
+            x52d_latency_begin(libx52io_get_report_timestamp(io_ctx));
+            x52d_latency_mark(X52D_LAT_PARSE);
             process_report(&report, &prev_report);
+            x52d_latency_end();
             break;
 
         case LIBX52IO_ERROR_TIMEOUT:
             // No report received within the timeout
+            x52d_input_flush(x52d_latency_now());
             break;
 
         case LIBX52IO_ERROR_NO_DEVICE:
@@ -68,10 +126,13 @@ static void *x52_io_thr(void *param)
                                   IO_ACQ_TIMEOUT);
                 }
                 sleep(IO_ACQ_TIMEOUT);
+            } else {
+                x52d_gamepad_evdev_connect(io_ctx);
             }
             break;
 
         default:
+            x52d_stats_inc(X52D_STAT_HID_ERRORS);
             PINELOG_ERROR(_("Error %d reading from X52 I/O device: %s"),
                           rc, libx52io_strerror(rc));
 
@@ -81,7 +142,13 @@ static void *x52_io_thr(void *param)
              */
             libx52io_close(io_ctx);
 
-            /* Report a NULL report to reset the mouse to default state */
+            /*
+             * Report a NULL report to reset the mouse to default state, and
+             * release any mapped keys
+             */
+            publish_rest_report();
+            x52d_gamepad_report_event(NULL);
+            x52d_keymap_report_event(NULL);
             x52d_mouse_report_event(NULL);
             break;
         }
@@ -97,6 +164,9 @@ void x52d_io_init(void)
     int rc;
 
     PINELOG_TRACE("Initializing I/O driver");
+    x52d_report_slot_init(&io_latest);
+    publish_rest_report();
+
     rc = libx52io_init(&io_ctx);
     if (rc != LIBX52IO_SUCCESS) {
         PINELOG_FATAL(_("Error %d initializing X52 I/O library: %s"),
@@ -108,12 +178,18 @@ void x52d_io_init(void)
         PINELOG_FATAL(_("Error %d initializing I/O driver thread: %s"),
                       rc, strerror(rc));
     }
+    io_thr_created = true;
 }
 
 void x52d_io_exit(void)
 {
     PINELOG_INFO(_("Shutting down X52 I/O driver thread"));
-    pthread_cancel(io_thr);
+    if (io_thr_created) {
+        // The thread must be stopped before the modules it reports to
+        pthread_cancel(io_thr);
+        pthread_join(io_thr, NULL);
+        io_thr_created = false;
+    }
 
     libx52io_exit(io_ctx);
 }
@@ -9,7 +9,10 @@
 #ifndef X52D_IO_H
 #define X52D_IO_H
 
+#include "libx52io.h"
+
 void x52d_io_init(void);
 void x52d_io_exit(void);
+unsigned int x52d_io_read_report(libx52io_report *report);
 
 #endif // !defined X52D_IO_H
@@ -0,0 +1,252 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Key mapping engine
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <string.h>
+
+#include "x52d_keymap.h"
+
+/* The button state of a report is tracked as a bitmap */
+_Static_assert(LIBX52IO_BUTTON_MAX <= 64, "Too many buttons for bitmap");
+
+#define BUTTON_BIT(btn) (UINT64_C(1) << (btn))
+
+void x52d_keymap_init(struct x52d_keymap *map)
+{
+    int mode;
+    int shift;
+    int btn;
+
+    for (mode = 0; mode < X52D_KEYMAP_MODES; mode++) {
+        for (shift = 0; shift < 2; shift++) {
+            for (btn = 0; btn < LIBX52IO_BUTTON_MAX; btn++) {
+                map->code[mode][shift][btn] = X52D_KEYMAP_LINKED;
+            }
+        }
+    }
+
+    map->shift_enabled = false;
+    map->shift_latched = false;
+}
+
+int x52d_keymap_set(struct x52d_keymap *map, int mode, bool shift,
+                    libx52io_button button, uint16_t code)
+{
+    if (mode < 1 || mode > X52D_KEYMAP_MODES) {
+        return EINVAL;
+    }
+
+    if (button < 0 || button >= LIBX52IO_BUTTON_MAX) {
+        return EINVAL;
+    }
+
+    map->code[mode - 1][shift][button] = code;
+    return 0;
+}
+
+/*
+ * Modes 2 and 3 are linked to mode 1, and each shifted keymap is linked to
+ * the keymap of its own mode. Resolving the base keymaps first means that a
+ * shifted mode 2 button which isn't mapped in mode 2 falls back to mode 1.
+ */
+void x52d_keymap_compile(struct x52d_keymap *map)
+{
+    int mode;
+    int btn;
+
+    for (btn = 0; btn < LIBX52IO_BUTTON_MAX; btn++) {
+        if (map->code[0][0][btn] == X52D_KEYMAP_LINKED) {
+            map->code[0][0][btn] = X52D_KEYMAP_UNMAPPED;
+        }
+    }
+
+    for (mode = 1; mode < X52D_KEYMAP_MODES; mode++) {
+        for (btn = 0; btn < LIBX52IO_BUTTON_MAX; btn++) {
+            if (map->code[mode][0][btn] == X52D_KEYMAP_LINKED) {
+                map->code[mode][0][btn] = map->code[0][0][btn];
+            }
+        }
+    }
+
+    for (mode = 0; mode < X52D_KEYMAP_MODES; mode++) {
+        for (btn = 0; btn < LIBX52IO_BUTTON_MAX; btn++) {
+            if (map->code[mode][1][btn] == X52D_KEYMAP_LINKED) {
+                map->code[mode][1][btn] = map->code[mode][0][btn];
+            }
+        }
+    }
+}
+
+void x52d_keymap_state_init(struct x52d_keymap_state *st)
+{
+    bool clutch_enabled = st->clutch_enabled;
+    bool clutch_latched = st->clutch_latched;
+
+    memset(st, 0, sizeof(*st));
+    st->clutch_enabled = clutch_enabled;
+    st->clutch_latched = clutch_latched;
+}
+
+int x52d_keymap_release_all(struct x52d_keymap_state *st,
+                            struct x52d_keymap_event *events)
+{
+    int btn;
+    int n = 0;
+
+    for (btn = 0; btn < LIBX52IO_BUTTON_MAX; btn++) {
+        if (st->active[btn] != X52D_KEYMAP_UNMAPPED) {
+            events[n].code = st->active[btn];
+            events[n].value = 0;
+            n++;
+            st->active[btn] = X52D_KEYMAP_UNMAPPED;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Compute the new state of a modifier button (shift or clutch). A latched
+ * modifier toggles on each press, an unlatched one follows the button.
+ */
+static bool modifier_state(bool current, bool latched, bool pressed)
+{
+    if (latched) {
+        return pressed ? !current : current;
+    }
+
+    return pressed;
+}
+
+int x52d_keymap_process(const struct x52d_keymap *map,
+                        struct x52d_keymap_state *st,
+                        const libx52io_report *report,
+                        struct x52d_keymap_event *events,
+                        int *nevents)
+{
+    uint64_t buttons = 0;
+    uint64_t changed;
+    int flags = 0;
+    int n = 0;
+    int mode;
+    int shift;
+    int btn;
+
+    for (btn = 0; btn < LIBX52IO_BUTTON_MAX; btn++) {
+        buttons |= (uint64_t)report->button[btn] << btn;
+    }
+
+    changed = buttons ^ st->buttons;
+    st->buttons = buttons;
+
+    /* Drop out of any modifier that has been disabled since the last report */
+    if (st->clutch && !st->clutch_enabled) {
+        st->clutch = false;
+        flags |= X52D_KEYMAP_CLUTCH_CHANGED;
+    }
+    if (st->shift && !map->shift_enabled) {
+        st->shift = false;
+        flags |= X52D_KEYMAP_SHIFT_CHANGED;
+    }
+
+    if (st->clutch_enabled && (changed & BUTTON_BIT(LIBX52IO_BTN_CLUTCH))) {
+        bool clutch = modifier_state(st->clutch, st->clutch_latched,
+                                     buttons & BUTTON_BIT(LIBX52IO_BTN_CLUTCH));
+        changed &= ~BUTTON_BIT(LIBX52IO_BTN_CLUTCH);
+
+        if (clutch != st->clutch) {
+            st->clutch = clutch;
+            flags |= X52D_KEYMAP_CLUTCH_CHANGED;
+
+            /* Buttons held while entering clutch mode must not stay pressed */
+            if (clutch) {
+                n += x52d_keymap_release_all(st, events + n);
+            }
+        }
+    }
+
+    if (map->shift_enabled && (changed & BUTTON_BIT(LIBX52IO_BTN_PINKY))) {
+        bool shift = modifier_state(st->shift, map->shift_latched,
+                                    buttons & BUTTON_BIT(LIBX52IO_BTN_PINKY));
+        changed &= ~BUTTON_BIT(LIBX52IO_BTN_PINKY);
+
+        if (shift != st->shift) {
+            st->shift = shift;
+            flags |= X52D_KEYMAP_SHIFT_CHANGED;
+        }
+    }
+
+    /*
+     * In clutch mode, the buttons are captured by the daemon, and the hat
+     * selects the profile. The hat reports 1 for North, increasing clockwise.
+     */
+    if (st->clutch) {
+        if (report->hat != st->hat) {
+            switch (report->hat) {
+            case 1:
+                flags |= X52D_KEYMAP_PROFILE_PREV;
+                break;
+
+            case 3:
+                flags |= X52D_KEYMAP_PROFILE_APPLY;
+                break;
+
+            case 5:
+                flags |= X52D_KEYMAP_PROFILE_NEXT;
+                break;
+
+            case 7:
+                flags |= X52D_KEYMAP_PROFILE_CLEAR;
+                break;
+
+            default:
+                break;
+            }
+        }
+        st->hat = report->hat;
+
+        *nevents = n;
+        return flags;
+    }
+    st->hat = report->hat;
+
+    mode = report->mode - 1;
+    if (mode < 0 || mode >= X52D_KEYMAP_MODES) {
+        mode = 0;
+    }
+    shift = st->shift;
+
+    while (changed) {
+        btn = __builtin_ctzll(changed);
+        changed &= changed - 1;
+
+        if (buttons & BUTTON_BIT(btn)) {
+            uint16_t code = map->code[mode][shift][btn];
+
+            if (code != X52D_KEYMAP_UNMAPPED) {
+                events[n].code = code;
+                events[n].value = 1;
+                n++;
+                st->active[btn] = code;
+            }
+        } else if (st->active[btn] != X52D_KEYMAP_UNMAPPED) {
+            /*
+             * Release whatever was pressed, even if the mode or shift state
+             * has changed since.
+             */
+            events[n].code = st->active[btn];
+            events[n].value = 0;
+            n++;
+            st->active[btn] = X52D_KEYMAP_UNMAPPED;
+        }
+    }
+
+    *nevents = n;
+    return flags;
+}
@@ -0,0 +1,134 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Key mapping engine
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#ifndef X52D_KEYMAP_H
+#define X52D_KEYMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "libx52io.h"
+
+#define X52D_KEYMAP_MODES   3
+
+/* Button is not mapped, no event is sent when it changes state */
+#define X52D_KEYMAP_UNMAPPED    0
+
+/* Button takes the mapping of the linked keymap, only valid before compiling */
+#define X52D_KEYMAP_LINKED      0xFFFF
+
+/*
+ * A compiled keymap is a flat table of event codes, indexed by the mode
+ * (0-2), the shift state and the button. Compiling resolves all the links,
+ * so that the input path is a single lookup per changed button.
+ */
+struct x52d_keymap {
+    uint16_t code[X52D_KEYMAP_MODES][2][LIBX52IO_BUTTON_MAX];
+
+    /* Pinky button acts as the shift key, and is not mapped */
+    bool shift_enabled;
+
+    /* Shift is toggled by each press of the pinky, rather than held */
+    bool shift_latched;
+};
+
+/* Runtime state of the mapper, owned by the I/O thread */
+struct x52d_keymap_state {
+    /* Bitmap of the buttons pressed in the last report */
+    uint64_t buttons;
+
+    /* Event code sent on press, so that the release matches it */
+    uint16_t active[LIBX52IO_BUTTON_MAX];
+
+    bool shift;
+    bool clutch;
+
+    /* Hat position in the last report, used to select profiles */
+    uint8_t hat;
+
+    /* Clutch configuration, from the Profiles section */
+    bool clutch_enabled;
+    bool clutch_latched;
+};
+
+/* Single event written to the uinput device, always of type EV_KEY */
+struct x52d_keymap_event {
+    uint16_t code;
+    int16_t value;
+};
+
+/*
+ * Every button can generate at most one event per report, and entering
+ * clutch mode can release every button.
+ */
+#define X52D_KEYMAP_MAX_EVENTS  (LIBX52IO_BUTTON_MAX * 2)
+
+/* Flags returned by x52d_keymap_process */
+#define X52D_KEYMAP_SHIFT_CHANGED   (1 << 0)
+#define X52D_KEYMAP_CLUTCH_CHANGED  (1 << 1)
+
+/* Profile selection with the hat, only reported in clutch mode */
+#define X52D_KEYMAP_PROFILE_PREV    (1 << 2)
+#define X52D_KEYMAP_PROFILE_NEXT    (1 << 3)
+#define X52D_KEYMAP_PROFILE_APPLY   (1 << 4)
+#define X52D_KEYMAP_PROFILE_CLEAR   (1 << 5)
+
+/*
+ * Compiled profile image, as stored in the profile cache. The image is only
+ * used if the header matches the running daemon and the source profile has
+ * not been modified since it was compiled, so it can be mapped directly into
+ * memory without any further parsing.
+ */
+#define X52D_KEYMAP_IMAGE_MAGIC     0x50323558 /* X52P */
+#define X52D_KEYMAP_IMAGE_VERSION   1
+
+struct x52d_keymap_image {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t button_max;
+    uint32_t keymap_size;
+
+    /* Identity, modification time and size of the source profile */
+    uint64_t src_dev;
+    uint64_t src_ino;
+    int64_t src_mtime_sec;
+    int64_t src_mtime_nsec;
+    int64_t src_size;
+
+    struct x52d_keymap map;
+};
+
+void x52d_keymap_init(struct x52d_keymap *map);
+int x52d_keymap_set(struct x52d_keymap *map, int mode, bool shift,
+                    libx52io_button button, uint16_t code);
+void x52d_keymap_compile(struct x52d_keymap *map);
+
+void x52d_keymap_state_init(struct x52d_keymap_state *st);
+int x52d_keymap_process(const struct x52d_keymap *map,
+                        struct x52d_keymap_state *st,
+                        const libx52io_report *report,
+                        struct x52d_keymap_event *events,
+                        int *nevents);
+int x52d_keymap_release_all(struct x52d_keymap_state *st,
+                            struct x52d_keymap_event *events);
+
+/* Implemented in x52d_keymap_cache.c */
+#define X52D_KEYMAP_CACHE_MAX   64
+
+void x52d_keymap_cache_begin(void);
+const struct x52d_keymap *x52d_keymap_cache_load(const char *dir, const char *name);
+void x52d_keymap_cache_prune(const struct x52d_keymap *active);
+
+/* Implemented in x52d_keymap_evdev.c */
+void x52d_keymap_evdev_init(void);
+void x52d_keymap_evdev_exit(void);
+void x52d_keymap_evdev_set_clutch(bool enabled, bool latched);
+void x52d_keymap_evdev_load(const char *dir, const char *name);
+int x52d_keymap_evdev_device(uint16_t code);
+void x52d_keymap_report_event(libx52io_report *report);
+
+#endif // !defined X52D_KEYMAP_H
@@ -0,0 +1,429 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Compiled profile cache
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libevdev/libevdev.h"
+#include "libx52io.h"
+#include "ini.h"
+
+#define PINELOG_MODULE X52D_MOD_KEYMAP
+#include "pinelog.h"
+#include "x52d_const.h"
+#include "x52d_keymap.h"
+
+/*
+ * Each profile is compiled into an image file in the cache directory, which
+ * is then mapped read-only into memory. The images are reused across
+ * restarts of the daemon, so a profile is only parsed when it is modified.
+ *
+ * The cache is only accessed by the profile manager thread.
+ */
+struct cache_entry {
+    char name[NAME_MAX];
+    const struct x52d_keymap_image *image;
+    bool used;
+};
+
+static struct cache_entry cache[X52D_KEYMAP_CACHE_MAX];
+
+/*
+ * Images that have been replaced, but may still be in use. Every entry can be
+ * replaced at most once between prunes, plus the active image that is kept.
+ */
+static const struct x52d_keymap_image *retired[X52D_KEYMAP_CACHE_MAX + 1];
+static int nretired;
+
+#define IMAGE_SIZE sizeof(struct x52d_keymap_image)
+
+static bool parse_bool(const char *value, bool *result)
+{
+    if (!strcasecmp(value, "yes") || !strcasecmp(value, "true")) {
+        *result = true;
+    } else if (!strcasecmp(value, "no") || !strcasecmp(value, "false")) {
+        *result = false;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/* Parse a section of the form Mode<n> or Mode<n>Shift */
+static bool parse_mode_section(const char *section, int *mode, bool *shift)
+{
+    if (strncasecmp(section, "Mode", 4) != 0 ||
+        section[4] < '1' || section[4] > '0' + X52D_KEYMAP_MODES) {
+        return false;
+    }
+
+    *mode = section[4] - '0';
+    if (section[5] == '\0') {
+        *shift = false;
+    } else if (!strcasecmp(section + 5, "Shift")) {
+        *shift = true;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static int parse_button(const char *name)
+{
+    int btn;
+
+    for (btn = 0; btn < LIBX52IO_BUTTON_MAX; btn++) {
+        if (!strcasecmp(libx52io_button_to_str(btn), name)) {
+            return btn;
+        }
+    }
+
+    return -1;
+}
+
+static int profile_handler(void *user, const char *section, const char *key,
+                           const char *value)
+{
+    struct x52d_keymap *map = user;
+    int mode;
+    bool shift;
+    int btn;
+    int code;
+
+    if (!strcasecmp(section, "Profile")) {
+        if (!strcasecmp(key, "ShiftEnabled") &&
+            parse_bool(value, &map->shift_enabled)) {
+            return 1;
+        }
+        if (!strcasecmp(key, "ShiftLatched") &&
+            parse_bool(value, &map->shift_latched)) {
+            return 1;
+        }
+
+        PINELOG_WARN(_("Ignoring invalid profile setting '%s=%s'"), key, value);
+        return 0;
+    }
+
+    if (!parse_mode_section(section, &mode, &shift)) {
+        PINELOG_WARN(_("Ignoring unknown profile section '%s'"), section);
+        return 0;
+    }
+
+    btn = parse_button(key);
+    if (btn < 0) {
+        PINELOG_WARN(_("Ignoring unknown button '%s' in profile section '%s'"),
+                     key, section);
+        return 0;
+    }
+
+    if (!strcasecmp(value, "none")) {
+        code = X52D_KEYMAP_UNMAPPED;
+    } else {
+        code = libevdev_event_code_from_name(EV_KEY, value);
+        if (code < 0 || x52d_keymap_evdev_device(code) < 0) {
+            PINELOG_WARN(_("Ignoring unsupported key '%s' for button '%s' in profile section '%s'"),
+                         value, key, section);
+            return 0;
+        }
+    }
+
+    x52d_keymap_set(map, mode, shift, btn, code);
+    return 1;
+}
+
+static void image_set_source(struct x52d_keymap_image *image, const struct stat *src)
+{
+    image->magic = X52D_KEYMAP_IMAGE_MAGIC;
+    image->version = X52D_KEYMAP_IMAGE_VERSION;
+    image->button_max = LIBX52IO_BUTTON_MAX;
+    image->keymap_size = sizeof(image->map);
+    image->src_dev = src->st_dev;
+    image->src_ino = src->st_ino;
+    image->src_mtime_sec = src->st_mtim.tv_sec;
+    image->src_mtime_nsec = src->st_mtim.tv_nsec;
+    image->src_size = src->st_size;
+}
+
+/* Check that the image was compiled by this daemon from the current source */
+static bool image_valid(const struct x52d_keymap_image *image, const struct stat *src)
+{
+    struct x52d_keymap_image expected;
+
+    image_set_source(&expected, src);
+    return image->magic == expected.magic &&
+           image->version == expected.version &&
+           image->button_max == expected.button_max &&
+           image->keymap_size == expected.keymap_size &&
+           image->src_dev == expected.src_dev &&
+           image->src_ino == expected.src_ino &&
+           image->src_mtime_sec == expected.src_mtime_sec &&
+           image->src_mtime_nsec == expected.src_mtime_nsec &&
+           image->src_size == expected.src_size;
+}
+
+/*
+ * The header only shows that the image was compiled from the same profile,
+ * so check that every code in it can be written, in case the file was
+ * corrupted or written by a daemon that accepted different codes.
+ */
+static bool image_codes_valid(const struct x52d_keymap_image *image)
+{
+    const uint16_t *code = &image->map.code[0][0][0];
+    size_t count = sizeof(image->map.code) / sizeof(*code);
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (code[i] != X52D_KEYMAP_UNMAPPED && x52d_keymap_evdev_device(code[i]) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static const struct x52d_keymap_image *image_map(const char *path, const struct stat *src)
+{
+    struct x52d_keymap_image *image;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != IMAGE_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    image = mmap(NULL, IMAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (!image_valid(image, src) || !image_codes_valid(image)) {
+        munmap(image, IMAGE_SIZE);
+        return NULL;
+    }
+
+    return image;
+}
+
+/*
+ * Write the image to the cache, replacing any existing image atomically, so
+ * that other mappings of the old image remain intact.
+ */
+static int image_write(const char *path, const struct x52d_keymap_image *image)
+{
+    char tmp_path[PATH_MAX];
+    ssize_t rc;
+    int fd;
+
+    if (mkdir(X52D_PROFILE_CACHE_DIR, 0755) < 0 && errno != EEXIST) {
+        return errno;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return errno;
+    }
+
+    rc = write(fd, image, IMAGE_SIZE);
+    close(fd);
+    if (rc != (ssize_t)IMAGE_SIZE || rename(tmp_path, path) < 0) {
+        rc = errno;
+        unlink(tmp_path);
+        return rc ? rc : EIO;
+    }
+
+    return 0;
+}
+
+/* Keep the image in anonymous memory if it can't be written to the cache */
+static const struct x52d_keymap_image *image_anonymous(const struct x52d_keymap_image *src)
+{
+    void *image;
+
+    image = mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (image == MAP_FAILED) {
+        return NULL;
+    }
+
+    memcpy(image, src, IMAGE_SIZE);
+    mprotect(image, IMAGE_SIZE, PROT_READ);
+    return image;
+}
+
+static const struct x52d_keymap_image *image_compile(const char *src_path,
+                                                     const struct stat *src,
+                                                     const char *cache_path)
+{
+    const struct x52d_keymap_image *mapped;
+    struct x52d_keymap_image image;
+    int rc;
+
+    memset(&image, 0, sizeof(image));
+    x52d_keymap_init(&image.map);
+    rc = ini_parse(src_path, profile_handler, &image.map);
+    if (rc < 0) {
+        PINELOG_ERROR(_("Unable to read profile %s"), src_path);
+        return NULL;
+    }
+    x52d_keymap_compile(&image.map);
+    image_set_source(&image, src);
+
+    rc = image_write(cache_path, &image);
+    if (rc == 0) {
+        mapped = image_map(cache_path, src);
+        if (mapped != NULL) {
+            PINELOG_INFO(_("Compiled profile %s"), src_path);
+            return mapped;
+        }
+    } else {
+        PINELOG_WARN(_("Error %d writing compiled profile %s: %s"),
+                     rc, cache_path, strerror(rc));
+    }
+
+    return image_anonymous(&image);
+}
+
+static struct cache_entry *cache_find(const char *name)
+{
+    struct cache_entry *free_entry = NULL;
+    int i;
+
+    for (i = 0; i < X52D_KEYMAP_CACHE_MAX; i++) {
+        if (cache[i].image != NULL) {
+            if (!strcmp(cache[i].name, name)) {
+                return &cache[i];
+            }
+        } else if (free_entry == NULL) {
+            free_entry = &cache[i];
+        }
+    }
+
+    if (free_entry != NULL) {
+        strncpy(free_entry->name, name, sizeof(free_entry->name) - 1);
+        free_entry->name[sizeof(free_entry->name) - 1] = '\0';
+    }
+    return free_entry;
+}
+
+static void cache_retire(struct cache_entry *entry)
+{
+    if (entry->image == NULL) {
+        return;
+    }
+
+    if (nretired < (int)(sizeof(retired) / sizeof(retired[0]))) {
+        retired[nretired++] = entry->image;
+    } else {
+        /* Leak the image rather than unmap something that may be in use */
+        PINELOG_WARN(_("Too many replaced profiles, not unmapping %s"), entry->name);
+    }
+    entry->image = NULL;
+}
+
+void x52d_keymap_cache_begin(void)
+{
+    int i;
+
+    for (i = 0; i < X52D_KEYMAP_CACHE_MAX; i++) {
+        cache[i].used = false;
+    }
+}
+
+const struct x52d_keymap *x52d_keymap_cache_load(const char *dir, const char *name)
+{
+    char src_path[PATH_MAX];
+    char cache_path[PATH_MAX];
+    const struct x52d_keymap_image *image;
+    struct cache_entry *entry;
+    struct stat src;
+
+    entry = cache_find(name);
+    if (entry == NULL) {
+        PINELOG_WARN(_("Too many profiles, ignoring profile %s"), name);
+        return NULL;
+    }
+
+    snprintf(src_path, sizeof(src_path), "%s/%s.conf", dir, name);
+    if (stat(src_path, &src) < 0) {
+        PINELOG_INFO(_("Unable to load profile %s: %s"), src_path, strerror(errno));
+        cache_retire(entry);
+        return NULL;
+    }
+
+    /* Fast path, the profile hasn't changed since it was last loaded */
+    if (entry->image != NULL && image_valid(entry->image, &src)) {
+        entry->used = true;
+        return &entry->image->map;
+    }
+
+    snprintf(cache_path, sizeof(cache_path), "%s/%s.x52p",
+             X52D_PROFILE_CACHE_DIR, name);
+    image = image_map(cache_path, &src);
+    if (image != NULL) {
+        PINELOG_DEBUG(_("Loaded compiled profile %s"), cache_path);
+    } else {
+        image = image_compile(src_path, &src, cache_path);
+        if (image == NULL) {
+            cache_retire(entry);
+            return NULL;
+        }
+    }
+
+    cache_retire(entry);
+    entry->image = image;
+    entry->used = true;
+    return &image->map;
+}
+
+/*
+ * Unmap all the images that have been replaced, and the profiles that were
+ * not loaded since x52d_keymap_cache_begin. The caller must ensure that none
+ * of these images are in use, other than the active keymap.
+ */
+void x52d_keymap_cache_prune(const struct x52d_keymap *active)
+{
+    int i;
+    int n = 0;
+
+    for (i = 0; i < X52D_KEYMAP_CACHE_MAX; i++) {
+        if (cache[i].image != NULL && !cache[i].used &&
+            &cache[i].image->map != active) {
+            munmap((void *)cache[i].image, IMAGE_SIZE);
+            cache[i].image = NULL;
+        }
+    }
+
+    for (i = 0; i < nretired; i++) {
+        if (&retired[i]->map == active) {
+            /* Still in use, keep it until the next prune */
+            retired[n++] = retired[i];
+        } else {
+            munmap((void *)retired[i], IMAGE_SIZE);
+        }
+    }
+    nretired = n;
+}
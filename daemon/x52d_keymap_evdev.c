@@ -0,0 +1,663 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Key mapping driver
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include "libevdev/libevdev.h"
+#include "libevdev/libevdev-uinput.h"
+#include "libx52io.h"
+
+#define PINELOG_MODULE X52D_MOD_KEYMAP
+#include "pinelog.h"
+#include "x52d_const.h"
+#include "x52d_device.h"
+#include "x52d_keymap.h"
+#include "x52d_latency.h"
+#include "x52d_stats.h"
+#include "x52d_trace.h"
+#include "x52d_uinput.h"
+
+/*
+ * Mapped buttons are sent to one of two virtual devices, so that joystick
+ * buttons are not mixed in with the keyboard, and are picked up by games
+ * that enumerate joysticks.
+ */
+enum {
+    KEYMAP_DEV_KEYBOARD,
+    KEYMAP_DEV_JOYSTICK,
+
+    KEYMAP_DEV_MAX
+};
+
+static const char *keymap_dev_names[KEYMAP_DEV_MAX] = {
+    [KEYMAP_DEV_KEYBOARD] = "X52 virtual keyboard",
+    [KEYMAP_DEV_JOYSTICK] = "X52 virtual joystick",
+};
+
+static struct libevdev_uinput *keymap_uidev[KEYMAP_DEV_MAX];
+
+/*
+ * The mapper state is owned by the I/O thread. The mutex is only contended
+ * when the virtual devices are created or destroyed.
+ */
+static pthread_mutex_t keymap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct x52d_keymap_state keymap_state;
+static const struct x52d_keymap *keymap_last;
+static const struct x52d_keymap keymap_empty;
+
+/*
+ * The active keymap points into a compiled profile image, and is switched
+ * by the profile manager thread with a single pointer swap. The I/O thread
+ * publishes the keymap it is using in the hazard pointer, so that the
+ * manager knows when it is safe to unmap a replaced image.
+ */
+static _Atomic(const struct x52d_keymap *) keymap_active;
+static _Atomic(const struct x52d_keymap *) keymap_hazard;
+
+static atomic_bool keymap_clutch_enabled;
+static atomic_bool keymap_clutch_latched;
+
+/*
+ * Requests to the profile manager thread, from the I/O thread and the
+ * configuration callbacks. The flags are the X52D_KEYMAP_* flags returned
+ * by x52d_keymap_process, or the reload flag below.
+ */
+struct keymap_request {
+    int flags;
+    bool shift;
+    bool clutch;
+};
+
+#define KEYMAP_RELOAD   (1 << 8)
+
+static pthread_t manager_thr;
+static bool manager_thr_created;
+static int manager_pipe[2] = { -1, -1 };
+
+/* Profile configuration, guarded by the profile mutex */
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char profile_dir[NAME_MAX];
+static char profile_default[NAME_MAX];
+
+/* Profile manager state, only accessed by the manager thread */
+static char manager_dir[NAME_MAX];
+static char active_name[NAME_MAX];
+static char profiles[X52D_KEYMAP_CACHE_MAX][NAME_MAX];
+static int nprofiles;
+static int active_index = -1;
+static int selected_index = -1;
+static int inotify_fd = -1;
+static int inotify_wd = -1;
+
+/* Time at which the modified profiles are due to be reloaded, or 0 */
+static uint64_t rescan_due;
+
+int x52d_keymap_evdev_device(uint16_t code)
+{
+    if ((code >= BTN_JOYSTICK && code <= BTN_THUMBR) ||
+        (code >= BTN_TRIGGER_HAPPY && code < KEY_CNT)) {
+        return KEYMAP_DEV_JOYSTICK;
+    }
+
+    /* Mouse and digitizer buttons don't belong on either device */
+    if (code > KEY_RESERVED && code < KEY_CNT &&
+        (code < BTN_MISC || code >= KEY_OK)) {
+        return KEYMAP_DEV_KEYBOARD;
+    }
+
+    return -1;
+}
+
+/* Must be called with the keymap mutex held */
+static void write_events(const struct x52d_keymap_event *events, int nevents)
+{
+    struct x52d_uinput_frame frame[KEYMAP_DEV_MAX];
+    int i;
+    int dev;
+    int rc;
+
+    for (dev = 0; dev < KEYMAP_DEV_MAX; dev++) {
+        x52d_uinput_frame_init(&frame[dev], keymap_uidev[dev]);
+    }
+
+    for (i = 0; i < nevents; i++) {
+        dev = x52d_keymap_evdev_device(events[i].code);
+        if (dev < 0 || keymap_uidev[dev] == NULL) {
+            continue;
+        }
+
+        rc = x52d_uinput_frame_add(&frame[dev], EV_KEY,
+                                   events[i].code, events[i].value);
+        if (rc != 0) {
+            PINELOG_ERROR(_("Error writing key event (code %d, state %d)"),
+                          events[i].code, events[i].value);
+        }
+    }
+
+    for (dev = 0; dev < KEYMAP_DEV_MAX; dev++) {
+        rc = x52d_uinput_frame_flush(&frame[dev]);
+        if (rc != 0) {
+            PINELOG_ERROR(_("Error %d writing key events to %s: %s"),
+                          rc, keymap_dev_names[dev], strerror(rc));
+        }
+    }
+}
+
+static void post_request(int flags, bool shift, bool clutch)
+{
+    struct keymap_request req = { flags, shift, clutch };
+
+    /*
+     * The request is smaller than PIPE_BUF, so the write is atomic. If the
+     * manager has fallen that far behind, dropping the request is better
+     * than blocking the caller.
+     */
+    if (write(manager_pipe[1], &req, sizeof(req)) != sizeof(req)) {
+        PINELOG_WARN(_("Unable to queue profile request 0x%x"), flags);
+    }
+}
+
+/* Get the active keymap, and mark it as in use by the I/O thread */
+static const struct x52d_keymap *keymap_acquire(void)
+{
+    const struct x52d_keymap *map = atomic_load(&keymap_active);
+    const struct x52d_keymap *check;
+
+    for (;;) {
+        atomic_store(&keymap_hazard, map);
+        check = atomic_load(&keymap_active);
+        if (check == map) {
+            return map;
+        }
+        map = check;
+    }
+}
+
+void x52d_keymap_report_event(libx52io_report *report)
+{
+    struct x52d_keymap_event events[X52D_KEYMAP_MAX_EVENTS];
+    const struct x52d_keymap *map;
+    int nevents = 0;
+    int n;
+    int flags = 0;
+    bool shift;
+    bool clutch;
+    int cancel_state;
+
+    /*
+     * Writing the events is a cancellation point, and the I/O thread must
+     * not be cancelled with the mutex held.
+     */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    pthread_mutex_lock(&keymap_mutex);
+
+    map = keymap_acquire();
+    if (map != keymap_last) {
+        /* Profile was switched, release the keys from the old profile */
+        nevents = x52d_keymap_release_all(&keymap_state, events);
+        keymap_last = map;
+    }
+    if (map == NULL) {
+        map = &keymap_empty;
+    }
+
+    keymap_state.clutch_enabled = atomic_load(&keymap_clutch_enabled);
+    keymap_state.clutch_latched = atomic_load(&keymap_clutch_latched);
+
+    if (report) {
+        flags = x52d_keymap_process(map, &keymap_state, report,
+                                    events + nevents, &n);
+        nevents += n;
+    } else {
+        /* Device was disconnected, release everything and reset modifiers */
+        nevents += x52d_keymap_release_all(&keymap_state, events + nevents);
+        if (keymap_state.shift) {
+            flags |= X52D_KEYMAP_SHIFT_CHANGED;
+        }
+        if (keymap_state.clutch) {
+            flags |= X52D_KEYMAP_CLUTCH_CHANGED;
+        }
+        x52d_keymap_state_init(&keymap_state);
+    }
+    atomic_store(&keymap_hazard, NULL);
+
+    write_events(events, nevents);
+    shift = keymap_state.shift;
+    clutch = keymap_state.clutch;
+    pthread_mutex_unlock(&keymap_mutex);
+    pthread_setcancelstate(cancel_state, NULL);
+
+    if (nevents) {
+        x52d_latency_mark(X52D_LAT_UINPUT);
+    }
+
+    /* Device updates and profile switches are left to the manager thread */
+    if (flags) {
+        post_request(flags, shift, clutch);
+    }
+}
+
+void x52d_keymap_evdev_set_clutch(bool enabled, bool latched)
+{
+    atomic_store(&keymap_clutch_enabled, enabled);
+    atomic_store(&keymap_clutch_latched, latched);
+}
+
+void x52d_keymap_evdev_load(const char *dir, const char *name)
+{
+    pthread_mutex_lock(&profile_mutex);
+    strncpy(profile_dir, dir, sizeof(profile_dir) - 1);
+    strncpy(profile_default, name, sizeof(profile_default) - 1);
+    pthread_mutex_unlock(&profile_mutex);
+
+    post_request(KEYMAP_RELOAD, false, false);
+}
+
+/* Switch the active keymap, and unmap any images that are no longer used */
+static void keymap_activate(const struct x52d_keymap *map)
+{
+    const struct x52d_keymap *prev = atomic_exchange(&keymap_active, map);
+
+    /* The I/O thread holds on to a keymap for the duration of a report */
+    while (prev != NULL && atomic_load(&keymap_hazard) == prev) {
+        sched_yield();
+    }
+
+    x52d_keymap_cache_prune(map);
+}
+
+static bool is_profile_name(const char *name)
+{
+    size_t len = strlen(name);
+
+    return name[0] != '.' && len > 5 && len < NAME_MAX &&
+           !strcmp(name + len - 5, ".conf");
+}
+
+static int profile_filter(const struct dirent *entry)
+{
+    return is_profile_name(entry->d_name);
+}
+
+/*
+ * Load all the profiles in the directory, compiling any that have changed,
+ * and activate the current profile.
+ */
+static void profile_rescan(void)
+{
+    const struct x52d_keymap *active = NULL;
+    const struct x52d_keymap *map;
+    struct dirent **list;
+    int count;
+    int i;
+
+    x52d_keymap_cache_begin();
+    rescan_due = 0;
+    nprofiles = 0;
+    active_index = -1;
+
+    count = scandir(manager_dir, &list, profile_filter, alphasort);
+    if (count < 0) {
+        PINELOG_INFO(_("Unable to read profile directory %s: %s"),
+                     manager_dir, strerror(errno));
+        count = 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        char *name = list[i]->d_name;
+
+        name[strlen(name) - 5] = '\0';
+        if (nprofiles < X52D_KEYMAP_CACHE_MAX) {
+            map = x52d_keymap_cache_load(manager_dir, name);
+            if (map != NULL) {
+                if (!strcmp(name, active_name)) {
+                    active = map;
+                    active_index = nprofiles;
+                }
+                strcpy(profiles[nprofiles], name);
+                nprofiles++;
+            }
+        }
+        free(list[i]);
+    }
+    free(list);
+
+    if (active_name[0] != '\0' && active == NULL) {
+        PINELOG_INFO(_("Profile %s not found, buttons will not be mapped"),
+                     active_name);
+    }
+
+    keymap_activate(active);
+}
+
+static void profile_watch(void)
+{
+    #if HAVE_SYS_INOTIFY_H
+    if (inotify_fd < 0) {
+        return;
+    }
+
+    if (inotify_wd >= 0) {
+        inotify_rm_watch(inotify_fd, inotify_wd);
+    }
+
+    inotify_wd = inotify_add_watch(inotify_fd, manager_dir,
+                                   IN_CLOSE_WRITE | IN_MOVED_TO |
+                                   IN_MOVED_FROM | IN_DELETE);
+    if (inotify_wd < 0) {
+        PINELOG_DEBUG(_("Unable to watch profile directory %s: %s"),
+                      manager_dir, strerror(errno));
+    }
+    #endif
+}
+
+static void profile_reload(void)
+{
+    pthread_mutex_lock(&profile_mutex);
+    memcpy(manager_dir, profile_dir, sizeof(manager_dir));
+    memcpy(active_name, profile_default, sizeof(active_name));
+    pthread_mutex_unlock(&profile_mutex);
+
+    PINELOG_DEBUG(_("Loading profiles from %s"), manager_dir);
+    profile_watch();
+    profile_rescan();
+}
+
+/* Display the selected profile on the MFD, marking the active profile */
+static void profile_show_selection(void)
+{
+    char text[17];
+
+    if (selected_index < 0) {
+        snprintf(text, sizeof(text), "%c%.15s", (active_index < 0) ? '*' : ' ',
+                 _("No profile"));
+    } else {
+        snprintf(text, sizeof(text), "%c%.15s",
+                 (selected_index == active_index) ? '*' : ' ',
+                 profiles[selected_index]);
+    }
+
+    x52d_dev_set_text(0, text, strlen(text));
+}
+
+static void profile_apply(void)
+{
+    const struct x52d_keymap *map = NULL;
+
+    if (selected_index >= 0) {
+        strcpy(active_name, profiles[selected_index]);
+        map = x52d_keymap_cache_load(manager_dir, active_name);
+        PINELOG_INFO(_("Switching to profile %s"), active_name);
+    } else {
+        active_name[0] = '\0';
+        PINELOG_INFO(_("Clearing active profile"));
+    }
+
+    keymap_activate(map);
+    active_index = (map != NULL) ? selected_index : -1;
+}
+
+static void handle_request(const struct keymap_request *req)
+{
+    int flags = req->flags;
+
+    if (flags & KEYMAP_RELOAD) {
+        profile_reload();
+    }
+
+    if (flags & X52D_KEYMAP_SHIFT_CHANGED) {
+        x52d_dev_set_shift(req->shift);
+    }
+
+    if (flags & X52D_KEYMAP_CLUTCH_CHANGED) {
+        x52d_dev_set_blink(req->clutch);
+        if (req->clutch) {
+            /* Pick up any profiles that were added or modified */
+            profile_rescan();
+            selected_index = active_index;
+            profile_show_selection();
+        } else {
+            x52d_dev_set_text(0, "", 0);
+        }
+    }
+
+    if ((flags & X52D_KEYMAP_PROFILE_PREV) && nprofiles > 0) {
+        selected_index = (selected_index <= 0 ? nprofiles : selected_index) - 1;
+        profile_show_selection();
+    }
+
+    if ((flags & X52D_KEYMAP_PROFILE_NEXT) && nprofiles > 0) {
+        selected_index = (selected_index + 1) % nprofiles;
+        profile_show_selection();
+    }
+
+    if (flags & X52D_KEYMAP_PROFILE_CLEAR) {
+        selected_index = -1;
+    }
+
+    if (flags & (X52D_KEYMAP_PROFILE_APPLY | X52D_KEYMAP_PROFILE_CLEAR)) {
+        profile_apply();
+        profile_show_selection();
+    }
+
+    if (flags & ~KEYMAP_RELOAD) {
+        x52d_dev_update();
+    }
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Editors may write a profile in several steps, so the profiles are only
+ * reloaded once the directory has been left alone for X52D_RELOAD_DELAY_MS.
+ * The rescan only recompiles the profiles that were modified.
+ */
+static void handle_inotify(void)
+{
+    #if HAVE_SYS_INOTIFY_H
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    bool changed = false;
+    ssize_t len;
+    char *ptr;
+
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (ptr = buf; ptr < buf + len; ptr += sizeof(*event) + event->len) {
+            event = (const struct inotify_event *)ptr;
+            if (event->len > 0 && is_profile_name(event->name)) {
+                changed = true;
+            }
+        }
+    }
+
+    if (changed) {
+        rescan_due = now_ms() + X52D_RELOAD_DELAY_MS;
+    }
+    #endif
+}
+
+/* Return the poll timeout until the pending rescan is due */
+static int rescan_timeout(void)
+{
+    uint64_t now;
+
+    if (rescan_due == 0) {
+        return -1;
+    }
+
+    now = now_ms();
+    return (rescan_due > now) ? (int)(rescan_due - now) : 0;
+}
+
+static void *x52_keymap_manager_thr(void *param)
+{
+    struct keymap_request req;
+    struct pollfd pfd[2];
+    int cancel_state;
+
+    PINELOG_INFO(_("Starting X52 profile manager thread"));
+    x52d_trace_thread_init("keymap");
+
+    pfd[0].fd = manager_pipe[0];
+    pfd[0].events = POLLIN;
+    pfd[1].fd = inotify_fd;
+    pfd[1].events = POLLIN;
+
+    for (;;) {
+        int rc = poll(pfd, 2, rescan_timeout());
+
+        x52d_stats_inc(X52D_STAT_WAKE_KEYMAP);
+        if (rc < 0) {
+            continue;
+        }
+
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+        if (rc == 0) {
+            PINELOG_DEBUG(_("Profile directory %s modified, reloading"), manager_dir);
+            profile_rescan();
+        }
+        if (pfd[0].revents & POLLIN) {
+            while (read(manager_pipe[0], &req, sizeof(req)) == sizeof(req)) {
+                handle_request(&req);
+            }
+        }
+        if (pfd[1].revents & POLLIN) {
+            handle_inotify();
+        }
+        pthread_setcancelstate(cancel_state, NULL);
+    }
+
+    return NULL;
+}
+
+static struct libevdev_uinput *create_device(int type)
+{
+    struct libevdev_uinput *uidev = NULL;
+    struct libevdev *dev;
+    int code;
+    int rc;
+
+    dev = libevdev_new();
+    libevdev_set_name(dev, keymap_dev_names[type]);
+    libevdev_enable_event_type(dev, EV_KEY);
+    for (code = 0; code < KEY_CNT; code++) {
+        if (x52d_keymap_evdev_device(code) == type) {
+            libevdev_enable_event_code(dev, EV_KEY, code, NULL);
+        }
+    }
+
+    rc = libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED,
+                                            &uidev);
+    if (rc != 0) {
+        PINELOG_ERROR(_("Error %d creating %s: %s"),
+                      -rc, keymap_dev_names[type], strerror(-rc));
+        uidev = NULL;
+    }
+    libevdev_free(dev);
+
+    return uidev;
+}
+
+void x52d_keymap_evdev_init(void)
+{
+    struct libevdev_uinput *uidev[KEYMAP_DEV_MAX];
+    int dev;
+    int rc;
+    int i;
+
+    for (dev = 0; dev < KEYMAP_DEV_MAX; dev++) {
+        uidev[dev] = create_device(dev);
+    }
+
+    pthread_mutex_lock(&keymap_mutex);
+    memcpy(keymap_uidev, uidev, sizeof(keymap_uidev));
+    pthread_mutex_unlock(&keymap_mutex);
+
+    if (pipe(manager_pipe) < 0) {
+        PINELOG_FATAL(_("Error %d creating profile manager pipe: %s"),
+                      errno, strerror(errno));
+    }
+    for (i = 0; i < 2; i++) {
+        fcntl(manager_pipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(manager_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    #if HAVE_SYS_INOTIFY_H
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        PINELOG_WARN(_("Error %d initializing inotify, profiles will only be reloaded in clutch mode: %s"),
+                     errno, strerror(errno));
+    }
+    #endif
+
+    rc = pthread_create(&manager_thr, NULL, x52_keymap_manager_thr, NULL);
+    if (rc != 0) {
+        PINELOG_FATAL(_("Error %d initializing profile manager thread: %s"),
+                      rc, strerror(rc));
+    }
+    manager_thr_created = true;
+}
+
+void x52d_keymap_evdev_exit(void)
+{
+    struct x52d_keymap_event events[X52D_KEYMAP_MAX_EVENTS];
+    int nevents;
+    int dev;
+
+    if (manager_thr_created) {
+        PINELOG_INFO(_("Shutting down X52 profile manager thread"));
+        pthread_cancel(manager_thr);
+        pthread_join(manager_thr, NULL);
+        manager_thr_created = false;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (manager_pipe[i] >= 0) {
+            close(manager_pipe[i]);
+            manager_pipe[i] = -1;
+        }
+    }
+
+    pthread_mutex_lock(&keymap_mutex);
+    /* Don't leave any keys pressed on the way out */
+    nevents = x52d_keymap_release_all(&keymap_state, events);
+    write_events(events, nevents);
+
+    for (dev = 0; dev < KEYMAP_DEV_MAX; dev++) {
+        if (keymap_uidev[dev] != NULL) {
+            libevdev_uinput_destroy(keymap_uidev[dev]);
+            keymap_uidev[dev] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&keymap_mutex);
+}
@@ -0,0 +1,339 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Key mapping engine test harness
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "x52d_keymap.h"
+
+/* Arbitrary event codes, the engine doesn't interpret them */
+#define CODE_A  30
+#define CODE_B  48
+#define CODE_C  46
+#define CODE_D  32
+
+struct test_state {
+    struct x52d_keymap map;
+    struct x52d_keymap_state st;
+    libx52io_report report;
+    struct x52d_keymap_event events[X52D_KEYMAP_MAX_EVENTS];
+    int nevents;
+    int flags;
+};
+
+static int test_setup(void **state)
+{
+    static struct test_state ts;
+
+    memset(&ts, 0, sizeof(ts));
+    x52d_keymap_init(&ts.map);
+    x52d_keymap_state_init(&ts.st);
+    ts.report.mode = 1;
+
+    *state = &ts;
+    return 0;
+}
+
+/* Set the button state and process the report */
+static void press(struct test_state *ts, libx52io_button button, bool pressed)
+{
+    ts->report.button[button] = pressed;
+    ts->flags = x52d_keymap_process(&ts->map, &ts->st, &ts->report,
+                                    ts->events, &ts->nevents);
+}
+
+static void assert_event(struct test_state *ts, int index, uint16_t code, int value)
+{
+    assert_true(index < ts->nevents);
+    assert_int_equal(ts->events[index].code, code);
+    assert_int_equal(ts->events[index].value, value);
+}
+
+static void test_keymap_set_invalid(void **state)
+{
+    struct test_state *ts = *state;
+
+    assert_int_equal(x52d_keymap_set(&ts->map, 0, false, LIBX52IO_BTN_FIRE, CODE_A), EINVAL);
+    assert_int_equal(x52d_keymap_set(&ts->map, 4, false, LIBX52IO_BTN_FIRE, CODE_A), EINVAL);
+    assert_int_equal(x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BUTTON_MAX, CODE_A), EINVAL);
+    assert_int_equal(x52d_keymap_set(&ts->map, 3, true, LIBX52IO_BTN_FIRE, CODE_A), 0);
+}
+
+static void test_keymap_compile_links(void **state)
+{
+    struct test_state *ts = *state;
+
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_FIRE, CODE_A);
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_A, CODE_B);
+    x52d_keymap_set(&ts->map, 2, false, LIBX52IO_BTN_FIRE, CODE_C);
+    x52d_keymap_set(&ts->map, 1, true, LIBX52IO_BTN_A, CODE_D);
+    x52d_keymap_set(&ts->map, 3, true, LIBX52IO_BTN_FIRE, X52D_KEYMAP_UNMAPPED);
+    x52d_keymap_compile(&ts->map);
+
+    /* Modes 2 and 3 link to mode 1 */
+    assert_int_equal(ts->map.code[0][0][LIBX52IO_BTN_FIRE], CODE_A);
+    assert_int_equal(ts->map.code[1][0][LIBX52IO_BTN_FIRE], CODE_C);
+    assert_int_equal(ts->map.code[2][0][LIBX52IO_BTN_FIRE], CODE_A);
+    assert_int_equal(ts->map.code[2][0][LIBX52IO_BTN_A], CODE_B);
+
+    /* Shifted keymaps link to their own mode */
+    assert_int_equal(ts->map.code[0][1][LIBX52IO_BTN_A], CODE_D);
+    assert_int_equal(ts->map.code[1][1][LIBX52IO_BTN_A], CODE_B);
+    assert_int_equal(ts->map.code[1][1][LIBX52IO_BTN_FIRE], CODE_C);
+    assert_int_equal(ts->map.code[2][1][LIBX52IO_BTN_FIRE], X52D_KEYMAP_UNMAPPED);
+
+    /* Unmapped buttons remain unmapped everywhere */
+    assert_int_equal(ts->map.code[0][0][LIBX52IO_BTN_B], X52D_KEYMAP_UNMAPPED);
+    assert_int_equal(ts->map.code[2][1][LIBX52IO_BTN_B], X52D_KEYMAP_UNMAPPED);
+}
+
+static void test_keymap_press_release(void **state)
+{
+    struct test_state *ts = *state;
+
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_FIRE, CODE_A);
+    x52d_keymap_compile(&ts->map);
+
+    press(ts, LIBX52IO_BTN_FIRE, true);
+    assert_int_equal(ts->nevents, 1);
+    assert_event(ts, 0, CODE_A, 1);
+
+    /* No change, no events */
+    press(ts, LIBX52IO_BTN_FIRE, true);
+    assert_int_equal(ts->nevents, 0);
+
+    /* Unmapped buttons don't generate events */
+    press(ts, LIBX52IO_BTN_B, true);
+    assert_int_equal(ts->nevents, 0);
+
+    press(ts, LIBX52IO_BTN_FIRE, false);
+    assert_int_equal(ts->nevents, 1);
+    assert_event(ts, 0, CODE_A, 0);
+    assert_int_equal(ts->flags, 0);
+}
+
+static void test_keymap_mode_change(void **state)
+{
+    struct test_state *ts = *state;
+
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_FIRE, CODE_A);
+    x52d_keymap_set(&ts->map, 2, false, LIBX52IO_BTN_FIRE, CODE_B);
+    x52d_keymap_compile(&ts->map);
+
+    press(ts, LIBX52IO_BTN_FIRE, true);
+    assert_event(ts, 0, CODE_A, 1);
+
+    /* Release goes to the key that was pressed, not the new mode's key */
+    ts->report.mode = 2;
+    press(ts, LIBX52IO_BTN_FIRE, false);
+    assert_int_equal(ts->nevents, 1);
+    assert_event(ts, 0, CODE_A, 0);
+
+    press(ts, LIBX52IO_BTN_FIRE, true);
+    assert_event(ts, 0, CODE_B, 1);
+}
+
+static void test_keymap_shift(void **state)
+{
+    struct test_state *ts = *state;
+
+    ts->map.shift_enabled = true;
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_FIRE, CODE_A);
+    x52d_keymap_set(&ts->map, 1, true, LIBX52IO_BTN_FIRE, CODE_B);
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_PINKY, CODE_C);
+    x52d_keymap_compile(&ts->map);
+
+    /* Pinky is the shift key, and doesn't send its own mapping */
+    press(ts, LIBX52IO_BTN_PINKY, true);
+    assert_int_equal(ts->nevents, 0);
+    assert_int_equal(ts->flags, X52D_KEYMAP_SHIFT_CHANGED);
+    assert_true(ts->st.shift);
+
+    press(ts, LIBX52IO_BTN_FIRE, true);
+    assert_event(ts, 0, CODE_B, 1);
+    press(ts, LIBX52IO_BTN_FIRE, false);
+
+    press(ts, LIBX52IO_BTN_PINKY, false);
+    assert_int_equal(ts->flags, X52D_KEYMAP_SHIFT_CHANGED);
+    assert_false(ts->st.shift);
+
+    press(ts, LIBX52IO_BTN_FIRE, true);
+    assert_event(ts, 0, CODE_A, 1);
+}
+
+static void test_keymap_shift_latched(void **state)
+{
+    struct test_state *ts = *state;
+
+    ts->map.shift_enabled = true;
+    ts->map.shift_latched = true;
+    x52d_keymap_compile(&ts->map);
+
+    press(ts, LIBX52IO_BTN_PINKY, true);
+    assert_true(ts->st.shift);
+    press(ts, LIBX52IO_BTN_PINKY, false);
+    assert_true(ts->st.shift);
+    assert_int_equal(ts->flags, 0);
+    press(ts, LIBX52IO_BTN_PINKY, true);
+    assert_false(ts->st.shift);
+    assert_int_equal(ts->flags, X52D_KEYMAP_SHIFT_CHANGED);
+}
+
+static void test_keymap_clutch(void **state)
+{
+    struct test_state *ts = *state;
+
+    ts->st.clutch_enabled = true;
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_FIRE, CODE_A);
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_A, CODE_B);
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_CLUTCH, CODE_C);
+    x52d_keymap_compile(&ts->map);
+
+    press(ts, LIBX52IO_BTN_FIRE, true);
+    assert_event(ts, 0, CODE_A, 1);
+
+    /* Entering clutch mode releases the held keys */
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    assert_int_equal(ts->flags, X52D_KEYMAP_CLUTCH_CHANGED);
+    assert_int_equal(ts->nevents, 1);
+    assert_event(ts, 0, CODE_A, 0);
+
+    /* Buttons are captured in clutch mode */
+    press(ts, LIBX52IO_BTN_A, true);
+    assert_int_equal(ts->nevents, 0);
+    press(ts, LIBX52IO_BTN_FIRE, false);
+    assert_int_equal(ts->nevents, 0);
+
+    /* Unlatched clutch exits on release */
+    press(ts, LIBX52IO_BTN_CLUTCH, false);
+    assert_int_equal(ts->flags, X52D_KEYMAP_CLUTCH_CHANGED);
+    assert_false(ts->st.clutch);
+    press(ts, LIBX52IO_BTN_A, false);
+    assert_int_equal(ts->nevents, 0);
+}
+
+static void test_keymap_clutch_latched(void **state)
+{
+    struct test_state *ts = *state;
+
+    ts->st.clutch_enabled = true;
+    ts->st.clutch_latched = true;
+    x52d_keymap_compile(&ts->map);
+
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    press(ts, LIBX52IO_BTN_CLUTCH, false);
+    assert_true(ts->st.clutch);
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    assert_false(ts->st.clutch);
+
+    /* Disabling the clutch exits clutch mode */
+    press(ts, LIBX52IO_BTN_CLUTCH, false);
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    assert_true(ts->st.clutch);
+    ts->st.clutch_enabled = false;
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    assert_false(ts->st.clutch);
+    assert_int_equal(ts->flags, X52D_KEYMAP_CLUTCH_CHANGED);
+}
+
+static void test_keymap_clutch_disabled(void **state)
+{
+    struct test_state *ts = *state;
+
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_CLUTCH, CODE_C);
+    x52d_keymap_compile(&ts->map);
+
+    /* The clutch button is a regular button when the clutch is disabled */
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    assert_int_equal(ts->flags, 0);
+    assert_event(ts, 0, CODE_C, 1);
+}
+
+static void test_keymap_clutch_hat(void **state)
+{
+    struct test_state *ts = *state;
+
+    ts->st.clutch_enabled = true;
+    x52d_keymap_compile(&ts->map);
+
+    /* Hat is ignored outside clutch mode */
+    ts->report.hat = 1;
+    press(ts, LIBX52IO_BTN_A, false);
+    assert_int_equal(ts->flags, 0);
+    ts->report.hat = 0;
+
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    ts->report.hat = 1;
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    assert_int_equal(ts->flags, X52D_KEYMAP_PROFILE_PREV);
+
+    /* Holding the hat doesn't repeat */
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    assert_int_equal(ts->flags, 0);
+
+    ts->report.hat = 5;
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    assert_int_equal(ts->flags, X52D_KEYMAP_PROFILE_NEXT);
+    ts->report.hat = 3;
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    assert_int_equal(ts->flags, X52D_KEYMAP_PROFILE_APPLY);
+    ts->report.hat = 7;
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    assert_int_equal(ts->flags, X52D_KEYMAP_PROFILE_CLEAR);
+    ts->report.hat = 8;
+    press(ts, LIBX52IO_BTN_CLUTCH, true);
+    assert_int_equal(ts->flags, 0);
+}
+
+static void test_keymap_release_all(void **state)
+{
+    struct test_state *ts = *state;
+
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_FIRE, CODE_A);
+    x52d_keymap_set(&ts->map, 1, false, LIBX52IO_BTN_A, CODE_B);
+    x52d_keymap_compile(&ts->map);
+
+    ts->report.button[LIBX52IO_BTN_A] = true;
+    press(ts, LIBX52IO_BTN_FIRE, true);
+    assert_int_equal(ts->nevents, 2);
+
+    ts->nevents = x52d_keymap_release_all(&ts->st, ts->events);
+    assert_int_equal(ts->nevents, 2);
+    assert_int_equal(ts->events[0].value, 0);
+    assert_int_equal(ts->events[1].value, 0);
+    assert_int_equal(x52d_keymap_release_all(&ts->st, ts->events), 0);
+}
+
+#define TEST(tc) cmocka_unit_test_setup(tc, test_setup)
+const struct CMUnitTest tests[] = {
+    TEST(test_keymap_set_invalid),
+    TEST(test_keymap_compile_links),
+    TEST(test_keymap_press_release),
+    TEST(test_keymap_mode_change),
+    TEST(test_keymap_shift),
+    TEST(test_keymap_shift_latched),
+    TEST(test_keymap_clutch),
+    TEST(test_keymap_clutch_latched),
+    TEST(test_keymap_clutch_disabled),
+    TEST(test_keymap_clutch_hat),
+    TEST(test_keymap_release_all),
+};
+#undef TEST
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, NULL, NULL);
+    return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Input latency instrumentation
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "x52d_latency.h"
+
+/*
+ * The histograms are updated by the I/O thread and read by the command
+ * thread. Relaxed atomics are sufficient, since a snapshot only needs to be
+ * approximately consistent.
+ */
+struct latency_hist {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t min;
+    atomic_uint_fast64_t max;
+    atomic_uint_fast64_t sum;
+    atomic_uint_fast64_t buckets[X52D_LAT_BUCKETS];
+};
+
+static struct latency_hist histograms[X52D_LAT_MAX];
+
+static const char *stage_names[X52D_LAT_MAX] = {
+    [X52D_LAT_PARSE] = "parse",
+    [X52D_LAT_DISPATCH] = "dispatch",
+    [X52D_LAT_UINPUT] = "uinput",
+    [X52D_LAT_TOTAL] = "total",
+    [X52D_LAT_DEVICE] = "device",
+};
+
+/* Timestamps of the report being processed by the I/O thread */
+static bool report_active;
+static uint64_t report_start;
+static uint64_t report_last;
+
+uint64_t x52d_latency_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int latency_bucket(uint64_t latency)
+{
+    uint64_t usec = latency / 1000;
+    int bucket = 0;
+
+    while (usec != 0 && bucket < X52D_LAT_BUCKETS - 1) {
+        usec >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static void latency_record(int stage, uint64_t latency)
+{
+    struct latency_hist *hist = &histograms[stage];
+    uint64_t count;
+
+    count = atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum, latency, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->buckets[latency_bucket(latency)], 1,
+                              memory_order_relaxed);
+
+    if (count == 0 || latency < atomic_load_explicit(&hist->min, memory_order_relaxed)) {
+        atomic_store_explicit(&hist->min, latency, memory_order_relaxed);
+    }
+    if (latency > atomic_load_explicit(&hist->max, memory_order_relaxed)) {
+        atomic_store_explicit(&hist->max, latency, memory_order_relaxed);
+    }
+}
+
+void x52d_latency_begin(uint64_t read_timestamp)
+{
+    report_active = (read_timestamp != 0);
+    report_start = read_timestamp;
+    report_last = read_timestamp;
+}
+
+void x52d_latency_mark(int stage)
+{
+    uint64_t now;
+
+    if (!report_active || stage < 0 || stage >= X52D_LAT_TOTAL) {
+        return;
+    }
+
+    now = x52d_latency_now();
+    latency_record(stage, now - report_last);
+    report_last = now;
+}
+
+void x52d_latency_end(void)
+{
+    if (!report_active) {
+        return;
+    }
+
+    latency_record(X52D_LAT_TOTAL, x52d_latency_now() - report_start);
+    report_active = false;
+}
+
+void x52d_latency_record(int stage, uint64_t latency)
+{
+    if (stage <= X52D_LAT_TOTAL || stage >= X52D_LAT_MAX) {
+        return;
+    }
+
+    latency_record(stage, latency);
+}
+
+int x52d_latency_stage(const char *name)
+{
+    for (int i = 0; i < X52D_LAT_MAX; i++) {
+        if (strcasecmp(stage_names[i], name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void x52d_latency_get(int stage, struct x52d_latency_stats *stats)
+{
+    struct latency_hist *hist = &histograms[stage];
+
+    stats->count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+    stats->min = atomic_load_explicit(&hist->min, memory_order_relaxed);
+    stats->max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    stats->sum = atomic_load_explicit(&hist->sum, memory_order_relaxed);
+
+    for (int i = 0; i < X52D_LAT_BUCKETS; i++) {
+        stats->buckets[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+    }
+}
+
+void x52d_latency_reset(void)
+{
+    for (int stage = 0; stage < X52D_LAT_MAX; stage++) {
+        struct latency_hist *hist = &histograms[stage];
+
+        atomic_store_explicit(&hist->count, 0, memory_order_relaxed);
+        atomic_store_explicit(&hist->min, 0, memory_order_relaxed);
+        atomic_store_explicit(&hist->max, 0, memory_order_relaxed);
+        atomic_store_explicit(&hist->sum, 0, memory_order_relaxed);
+
+        for (int i = 0; i < X52D_LAT_BUCKETS; i++) {
+            atomic_store_explicit(&hist->buckets[i], 0, memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t x52d_latency_percentile(const struct x52d_latency_stats *stats,
+                                 unsigned int permille)
+{
+    uint64_t target;
+    uint64_t seen = 0;
+    int i;
+
+    if (stats->count == 0) {
+        return 0;
+    }
+
+    // Smallest number of latencies that must be at or below the percentile
+    target = (stats->count * permille + 999) / 1000;
+    if (target == 0) {
+        target = 1;
+    }
+
+    for (i = 0; i < X52D_LAT_BUCKETS - 1; i++) {
+        seen += stats->buckets[i];
+        if (seen >= target) {
+            break;
+        }
+    }
+
+    // Bucket i holds latencies below 2^i microseconds
+    return (1ULL << i) * 1000;
+}
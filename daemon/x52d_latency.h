@@ -0,0 +1,73 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Input latency instrumentation
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#ifndef X52D_LATENCY_H
+#define X52D_LATENCY_H
+
+#include <stdint.h>
+
+/*
+ * Each stage measures the time since the previous stage of the same report,
+ * except for the total, which measures from the device read to the end of
+ * processing.
+ */
+enum {
+    /* Device read to report parsed */
+    X52D_LAT_PARSE,
+
+    /* Report parsed to dispatched to the report consumers */
+    X52D_LAT_DISPATCH,
+
+    /* Report dispatched to uinput events written */
+    X52D_LAT_UINPUT,
+
+    /* Device read to processing complete */
+    X52D_LAT_TOTAL,
+
+    /* Device update written over USB, measured by the device manager */
+    X52D_LAT_DEVICE,
+
+    X52D_LAT_MAX
+};
+
+/*
+ * Histogram bucket i counts latencies below 2^i microseconds, that were not
+ * counted in any lower bucket. The last bucket counts everything else.
+ */
+#define X52D_LAT_BUCKETS 24
+
+struct x52d_latency_stats {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t buckets[X52D_LAT_BUCKETS];
+};
+
+uint64_t x52d_latency_now(void);
+
+/* These must only be called from the I/O thread */
+void x52d_latency_begin(uint64_t read_timestamp);
+void x52d_latency_mark(int stage);
+void x52d_latency_end(void);
+
+/* Record a latency for a stage that is not part of the report processing */
+void x52d_latency_record(int stage, uint64_t latency);
+
+int x52d_latency_stage(const char *name);
+void x52d_latency_get(int stage, struct x52d_latency_stats *stats);
+void x52d_latency_reset(void);
+
+/*
+ * Approximate the given percentile, in tenths of a percent, as the upper
+ * bound of the histogram bucket that contains it.
+ */
+uint64_t x52d_latency_percentile(const struct x52d_latency_stats *stats,
+                                 unsigned int permille);
+
+#endif // !defined X52D_LATENCY_H
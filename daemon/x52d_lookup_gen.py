@@ -0,0 +1,321 @@
+#!/usr/bin/env python3
+# Lookup table generator for x52d
+#
+# Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+#
+# SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+"""
+Generator script to build case insensitive perfect hash tables for the
+configuration keys and the commands accepted by x52d
+"""
+
+import sys
+import re
+
+AUTOGEN_HEADER = """
+/*
+ * Autogenerated lookup tables for x52d
+ * Generated from %s and %s
+ */
+
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+
+#include "x52d_config.h"
+#include "x52d_command.h"
+
+#define FNV_BASIS   0x811C9DC5u
+#define FNV_PRIME   0x01000193u
+
+struct lookup_entry {
+    const char *first;
+    const char *second;
+    int id;
+};
+
+/* FNV-1a hash of the string, folding ASCII letters to lower case */
+static uint32_t hash_fold(uint32_t hash, const char *str)
+{
+    for (; *str != '\\0'; str++) {
+        unsigned char c = (unsigned char)*str;
+
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        hash = (hash ^ c) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static uint32_t hash_pair(const char *first, const char *second)
+{
+    uint32_t hash = hash_fold(FNV_BASIS, first);
+
+    hash = (hash ^ '.') * FNV_PRIME;
+    return hash_fold(hash, second);
+}
+
+/* Scramble the hash with the displacement of its bucket to find the slot */
+static uint32_t hash_slot(uint32_t hash, uint16_t disp, uint32_t slots)
+{
+    hash ^= disp * 0x9E3779B9u;
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+
+    return hash %% slots;
+}
+
+"""
+
+FNV_BASIS = 0x811C9DC5
+FNV_PRIME = 0x01000193
+MASK = 0xFFFFFFFF
+
+# Average number of keys in each bucket of the displacement table
+BUCKET_SIZE = 2
+
+# Largest displacement that fits in the table
+MAX_DISP = 0xFFFF
+
+
+def hash_fold(hval, string):
+    """FNV-1a hash of the string, folded to lower case"""
+    for char in bytearray(string.lower().encode('ascii')):
+        hval = ((hval ^ char) * FNV_PRIME) & MASK
+    return hval
+
+
+def hash_pair(first, second):
+    """Hash of a section/key or command/subcommand pair"""
+    hval = hash_fold(FNV_BASIS, first)
+    hval = ((hval ^ ord('.')) * FNV_PRIME) & MASK
+    return hash_fold(hval, second)
+
+
+def hash_slot(hval, disp, slots):
+    """Scramble the hash with the bucket displacement"""
+    hval ^= (disp * 0x9E3779B9) & MASK
+    hval ^= hval >> 16
+    hval = (hval * 0x85EBCA6B) & MASK
+    hval ^= hval >> 13
+    hval = (hval * 0xC2B2AE35) & MASK
+    hval ^= hval >> 16
+    return hval % slots
+
+
+class PerfectHash(object):
+    """
+    Minimal perfect hash, using the hash and displace method. The keys are
+    split into buckets, and each bucket gets a displacement that places all
+    of its keys into free slots.
+    """
+    def __init__(self, name, entries):
+        """entries is a list of (hash, first, second, id) tuples"""
+        self.name = name
+        self.slots = len(entries)
+        self.buckets = max(1, (self.slots + BUCKET_SIZE - 1) // BUCKET_SIZE)
+        self.disp = [0] * self.buckets
+        self.table = [None] * self.slots
+
+        hashes = {}
+        for entry in entries:
+            if entry[0] in hashes:
+                raise ValueError('Hash collision between %s and %s' %
+                                 (self.describe(hashes[entry[0]]),
+                                  self.describe(entry)))
+            hashes[entry[0]] = entry
+
+        buckets = [[] for _ in range(self.buckets)]
+        for entry in entries:
+            buckets[entry[0] % self.buckets].append(entry)
+
+        # Place the largest buckets first, while most slots are still free
+        order = sorted(range(self.buckets), key=lambda b: (-len(buckets[b]), b))
+        for bucket in order:
+            if buckets[bucket]:
+                self.place(bucket, buckets[bucket])
+
+    @staticmethod
+    def describe(entry):
+        """Printable name of an entry"""
+        if entry[2] is None:
+            return "'%s'" % entry[1]
+        return "'%s.%s'" % (entry[1], entry[2])
+
+    def place(self, bucket, entries):
+        """Find a displacement for the bucket"""
+        for disp in range(MAX_DISP + 1):
+            slots = [hash_slot(e[0], disp, self.slots) for e in entries]
+            if len(set(slots)) != len(slots):
+                continue
+            if any(self.table[s] is not None for s in slots):
+                continue
+
+            for slot, entry in zip(slots, entries):
+                self.table[slot] = entry
+            self.disp[bucket] = disp
+            return
+
+        raise ValueError('Unable to place %s entries in %s table' %
+                         (', '.join(self.describe(e) for e in entries), self.name))
+
+    def output(self):
+        """Output the displacement and entry tables as a list of lines"""
+        lines = ['#define %s_SLOTS %d' % (self.name.upper(), self.slots),
+                 '#define %s_BUCKETS %d' % (self.name.upper(), self.buckets),
+                 '']
+
+        lines.append('static const uint16_t %s_disp[%s_BUCKETS] = {' %
+                     (self.name, self.name.upper()))
+        for index in range(0, self.buckets, 8):
+            lines.append('\t' + ' '.join('%d,' % d for d in self.disp[index:index + 8]))
+        lines.extend(['};', ''])
+
+        lines.append('static const struct lookup_entry %s_table[%s_SLOTS] = {' %
+                     (self.name, self.name.upper()))
+        for entry in self.table:
+            second = 'NULL' if entry[2] is None else '"%s"' % entry[2]
+            lines.append('\t{ "%s", %s, %s },' % (entry[1], second, entry[3]))
+        lines.extend(['};', ''])
+
+        return lines
+
+
+LOOKUP_FUNCTIONS = """
+int x52d_config_lookup(const char *section, const char *key)
+{
+    const struct lookup_entry *entry;
+    uint32_t hash;
+
+    if (section == NULL || key == NULL) {
+        return -1;
+    }
+
+    hash = hash_pair(section, key);
+    entry = &config_table[hash_slot(hash, config_disp[hash %% CONFIG_BUCKETS], CONFIG_SLOTS)];
+    if (strcasecmp(entry->first, section) != 0 || strcasecmp(entry->second, key) != 0) {
+        return -1;
+    }
+
+    return entry->id;
+}
+
+int x52d_command_lookup(const char *command)
+{
+    const struct lookup_entry *entry;
+    uint32_t hash;
+
+    if (command == NULL) {
+        return -1;
+    }
+
+    hash = hash_fold(FNV_BASIS, command);
+    entry = &command_table[hash_slot(hash, command_disp[hash %% COMMAND_BUCKETS], COMMAND_SLOTS)];
+    if (strcasecmp(entry->first, command) != 0) {
+        return -1;
+    }
+
+    return entry->id;
+}
+
+static const char *command_names[X52D_CMD_MAX] = {
+%s
+};
+
+int x52d_subcommand_lookup(enum x52d_command_id command, const char *subcommand)
+{
+    const struct lookup_entry *entry;
+    uint32_t hash;
+
+    if ((unsigned int)command >= X52D_CMD_MAX || subcommand == NULL) {
+        return -1;
+    }
+
+    hash = hash_pair(command_names[command], subcommand);
+    entry = &subcommand_table[hash_slot(hash, subcommand_disp[hash %% SUBCOMMAND_BUCKETS],
+                                        SUBCOMMAND_SLOTS)];
+    if (strcasecmp(entry->first, command_names[command]) != 0 ||
+        strcasecmp(entry->second, subcommand) != 0) {
+        return -1;
+    }
+
+    return entry->id;
+}
+"""
+
+
+class DefFormatError(ValueError):
+    """
+    Error class for parser
+    """
+
+def parse_def(filename, macros):
+    """
+    Parse the X-macro invocations in a definition file, and return a list
+    of (macro, arguments) tuples for the given macros
+    """
+    pattern = re.compile(r'^\s*(%s)\s*\((.*)\)\s*$' % '|'.join(macros))
+    result = []
+
+    with open(filename, 'r') as infile:
+        for line in infile:
+            match = pattern.match(line)
+            if match is None:
+                continue
+
+            args = [a.strip() for a in match.group(2).split(',')]
+            for arg in args[:2]:
+                if not re.match(r'^[A-Za-z][A-Za-z0-9]*$', arg):
+                    raise DefFormatError('Invalid name "%s" in %s' % (arg, filename))
+            result.append((match.group(1), args))
+
+    return result
+
+def main():
+    """Generate the lookup tables"""
+    if len(sys.argv) != 4:
+        sys.stderr.write('Usage: %s <config-def> <command-def> <output-c-file>\n' %
+                         sys.argv[0])
+        sys.exit(1)
+
+    config = []
+    for _, args in parse_def(sys.argv[1], ['CFG']):
+        config.append((hash_pair(args[0], args[1]), args[0], args[1],
+                       'X52D_CFG_%s_%s' % (args[0], args[1])))
+
+    commands = []
+    subcommands = []
+    for macro, args in parse_def(sys.argv[2], ['COMMAND', 'SUBCOMMAND']):
+        if macro == 'COMMAND':
+            commands.append((hash_fold(FNV_BASIS, args[0]), args[0], None,
+                             'X52D_CMD_%s' % args[0]))
+        else:
+            if args[0] not in [c[1] for c in commands]:
+                raise DefFormatError('Subcommand "%s" of unknown command "%s"' %
+                                     (args[1], args[0]))
+            subcommands.append((hash_pair(args[0], args[1]), args[0], args[1],
+                                'X52D_CMD_%s_%s' % (args[0], args[1])))
+
+    if not config or not commands or not subcommands:
+        raise DefFormatError('No definitions found')
+
+    lines = []
+    for name, entries in [('config', config), ('command', commands),
+                          ('subcommand', subcommands)]:
+        lines.extend(PerfectHash(name, entries).output())
+
+    names = '\n'.join('\t[%s] = "%s",' % (c[3], c[1]) for c in commands)
+
+    with open(sys.argv[3], 'w') as outfile:
+        outfile.write(AUTOGEN_HEADER % (sys.argv[1], sys.argv[2]))
+        outfile.write('\n'.join(lines))
+        outfile.write(LOOKUP_FUNCTIONS % names)
+
+if __name__ == "__main__":
+    main()
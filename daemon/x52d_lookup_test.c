@@ -0,0 +1,97 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Lookup table test harness
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "x52d_config.h"
+#include "x52d_command.h"
+
+static void change_case(char *dst, const char *src, int (*fn)(int))
+{
+    while (*src != '\0') {
+        *dst++ = fn((unsigned char)*src++);
+    }
+    *dst = '\0';
+}
+
+static void test_config_keys(void **state)
+{
+    char section[NAME_MAX];
+    char key[NAME_MAX];
+
+    #define CFG(c_sec, c_key, name, type, def) \
+        assert_int_equal(x52d_config_lookup(#c_sec, #c_key), X52D_CFG_ ## c_sec ## _ ## c_key); \
+        change_case(section, #c_sec, toupper); \
+        change_case(key, #c_key, tolower); \
+        assert_int_equal(x52d_config_lookup(section, key), X52D_CFG_ ## c_sec ## _ ## c_key);
+    #include "x52d_config.def"
+}
+
+static void test_config_unknown(void **state)
+{
+    assert_int_equal(x52d_config_lookup("Clock", "Quaternary"), -1);
+    assert_int_equal(x52d_config_lookup("Mouse", "Secondary"), -1);
+    assert_int_equal(x52d_config_lookup("ClockEnabled", ""), -1);
+    assert_int_equal(x52d_config_lookup("", ""), -1);
+    assert_int_equal(x52d_config_lookup(NULL, "Enabled"), -1);
+    assert_int_equal(x52d_config_lookup("Clock", NULL), -1);
+}
+
+static void test_commands(void **state)
+{
+    char name[NAME_MAX];
+
+    #define COMMAND(cmd) \
+        assert_int_equal(x52d_command_lookup(#cmd), X52D_CMD_ ## cmd); \
+        change_case(name, #cmd, toupper); \
+        assert_int_equal(x52d_command_lookup(name), X52D_CMD_ ## cmd);
+    #define SUBCOMMAND(cmd, sub) \
+        assert_int_equal(x52d_subcommand_lookup(X52D_CMD_ ## cmd, #sub), \
+                         X52D_CMD_ ## cmd ## _ ## sub); \
+        change_case(name, #sub, toupper); \
+        assert_int_equal(x52d_subcommand_lookup(X52D_CMD_ ## cmd, name), \
+                         X52D_CMD_ ## cmd ## _ ## sub);
+    #include "x52d_command.def"
+}
+
+static void test_commands_unknown(void **state)
+{
+    assert_int_equal(x52d_command_lookup("configure"), -1);
+    assert_int_equal(x52d_command_lookup(""), -1);
+    assert_int_equal(x52d_command_lookup(NULL), -1);
+
+    // Subcommands are only found under their own command
+    assert_int_equal(x52d_subcommand_lookup(X52D_CMD_config, "framed"), -1);
+    assert_int_equal(x52d_subcommand_lookup(X52D_CMD_protocol, "framed"),
+                     X52D_CMD_protocol_framed);
+    assert_int_equal(x52d_subcommand_lookup(X52D_CMD_config, "loads"), -1);
+    assert_int_equal(x52d_subcommand_lookup(X52D_CMD_config, NULL), -1);
+    assert_int_equal(x52d_subcommand_lookup(X52D_CMD_MAX, "load"), -1);
+}
+
+const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_config_keys),
+    cmocka_unit_test(test_config_unknown),
+    cmocka_unit_test(test_commands),
+    cmocka_unit_test(test_commands_unknown),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, NULL, NULL);
+    return 0;
+}
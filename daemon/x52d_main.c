@@ -20,10 +20,14 @@
 #include "x52d_const.h"
 #include "x52d_config.h"
 #include "x52d_device.h"
+#include "x52d_gamepad.h"
 #include "x52d_io.h"
+#include "x52d_keymap.h"
 #include "x52d_mouse.h"
 #include "x52d_command.h"
 #include "x52d_notify.h"
+#include "x52d_state.h"
+#include "x52d_stats.h"
 #include "x52dcomm-internal.h"
 #include "x52dcomm.h"
 #include "pinelog.h"
@@ -92,7 +96,8 @@ static void usage(int exit_code)
               "\t[-l log-file] [-o override]\n"
               "\t[-c config-file] [-p pid-file]\n"
               "\t[-s command-socket-path]\n"
-              "\t[-b notify-socket-path]\n"),
+              "\t[-b notify-socket-path]\n"
+              "\t[-m state-path]\n"),
             X52D_APP_NAME);
     exit(exit_code);
 }
@@ -208,6 +213,7 @@ int main(int argc, char **argv)
     const char *pid_file = NULL;
     const char *command_sock = NULL;
     const char *notify_sock = NULL;
+    const char *state_path = NULL;
     int opt;
     int rc;
     sigset_t sigblockset;
@@ -235,8 +241,9 @@ int main(int argc, char **argv)
      * -p   path to PID file (only used if running in background)
      * -s   path to command socket
      * -b   path to notify socket
+     * -m   path to shared state page
      */
-    while ((opt = getopt(argc, argv, "fvql:o:c:p:s:b:h")) != -1) {
+    while ((opt = getopt(argc, argv, "fvql:o:c:p:s:b:m:h")) != -1) {
         switch (opt) {
         case 'f':
             foreground = true;
@@ -285,6 +292,10 @@ int main(int argc, char **argv)
             notify_sock = optarg;
             break;
 
+        case 'm':
+            state_path = optarg;
+            break;
+
         case 'h':
             usage(EXIT_SUCCESS);
             break;
@@ -303,6 +314,7 @@ int main(int argc, char **argv)
     PINELOG_DEBUG(_("PID file = %s"), pid_file);
     PINELOG_DEBUG(_("Command socket = %s"), command_sock);
     PINELOG_DEBUG(_("Notify socket = %s"), notify_sock);
+    PINELOG_DEBUG(_("State page = %s"), state_path);
 
     start_daemon(foreground, pid_file);
 
@@ -318,6 +330,8 @@ int main(int argc, char **argv)
     }
 
     // Start device threads
+    x52d_stats_init();
+    x52d_state_init(state_path);
     x52d_dev_init();
     x52d_clock_init();
     if (x52d_command_init(command_sock) < 0) {
@@ -325,6 +339,9 @@ int main(int argc, char **argv)
     }
     x52d_notify_init(notify_sock);
     #if defined(HAVE_EVDEV)
+    x52d_gamepad_evdev_init();
+    // The I/O thread posts requests to the profile manager as soon as it starts
+    x52d_keymap_evdev_init();
     x52d_io_init();
     x52d_mouse_evdev_init();
     #endif
@@ -338,10 +355,14 @@ int main(int argc, char **argv)
 
     // Apply configuration
     x52d_config_apply();
+    x52d_config_watch_init(conf_file);
 
     flag_quit = 0;
     while(!flag_quit) {
-        pause();
+        /* Wait for a signal, or for the configuration file to be modified */
+        if (x52d_config_watch_wait()) {
+            flag_reload = true;
+        }
 
         /* Check if we need to reload configuration */
         if (flag_reload) {
@@ -361,15 +382,21 @@ int main(int argc, char **argv)
     PINELOG_INFO(_("Received termination signal %s"), strsignal(flag_quit));
 
 cleanup:
+    x52d_config_watch_exit();
+
     // Stop device threads
     x52d_clock_exit();
     x52d_dev_exit();
     x52d_command_exit();
-    x52d_notify_exit();
     #if defined(HAVE_EVDEV)
-    x52d_mouse_evdev_exit();
+    // The I/O thread sends notifications and keymap requests, stop it first
     x52d_io_exit();
+    x52d_keymap_evdev_exit();
+    x52d_mouse_evdev_exit();
+    x52d_gamepad_evdev_exit();
     #endif
+    x52d_notify_exit();
+    x52d_state_exit();
 
     // Remove the PID file
     PINELOG_TRACE("Removing PID file %s", pid_file);
@@ -21,10 +21,12 @@
 #define MOUSE_DELAY_DELTA   5000
 #define MOUSE_DELAY_MIN     10000
 #define MAX_MOUSE_MULT 5
+#define MAX_MOUSE_ACCEL 100
 
 volatile int mouse_delay = DEFAULT_MOUSE_DELAY;
 volatile int mouse_mult = MOUSE_MULT_FACTOR;
 volatile int mouse_scroll_dir = 1;
+volatile int mouse_accel = 0;
 
 void x52d_cfg_set_Mouse_Enabled(bool enabled)
 {
@@ -73,3 +75,45 @@ void x52d_cfg_set_Mouse_ReverseScroll(bool enabled)
         mouse_scroll_dir = 1;
     }
 }
+
+void x52d_cfg_set_Mouse_Acceleration(int accel)
+{
+    if (accel < 0 || accel > MAX_MOUSE_ACCEL) {
+        PINELOG_INFO(_("Ignoring mouse acceleration %d outside supported range (0-%d)"),
+                     accel, MAX_MOUSE_ACCEL);
+        return;
+    }
+
+    PINELOG_DEBUG(_("Setting mouse acceleration to %d"), accel);
+    mouse_accel = accel;
+}
+
+/*
+ * Convert a thumbstick position into the pointer velocity, in pixels per
+ * second.
+ *
+ * The thumbstick reports a value from 0 to 15, with the midpoint at 8.
+ * Positions 7 and 8 are both treated as centered, giving a deflection of
+ * -7 to +7. At full deflection, the pointer moves by the speed multiplier
+ * once every mouse_delay microseconds, as the original polling driver did.
+ *
+ * The acceleration blends a linear response with a quadratic one, so that
+ * small deflections give finer control without reducing the top speed.
+ */
+double x52d_mouse_velocity(int axis_val)
+{
+    double x;
+    double mag;
+
+    if (axis_val >= 8) {
+        x = axis_val - 8;
+    } else {
+        x = axis_val - 7;
+    }
+
+    x /= 7;
+    mag = (x < 0) ? -x : x;
+    x *= ((MAX_MOUSE_ACCEL - mouse_accel) + mouse_accel * mag) / MAX_MOUSE_ACCEL;
+
+    return x * 7 * mouse_mult / MOUSE_MULT_FACTOR * 1000000.0 / mouse_delay;
+}
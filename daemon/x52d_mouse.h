@@ -15,9 +15,12 @@
 extern volatile int mouse_delay;
 extern volatile int mouse_mult;
 extern volatile int mouse_scroll_dir;
+extern volatile int mouse_accel;
 
 #define MOUSE_MULT_FACTOR  4
 
+double x52d_mouse_velocity(int axis_val);
+
 void x52d_mouse_evdev_thread_control(bool enabled);
 void x52d_mouse_evdev_init(void);
 void x52d_mouse_evdev_exit(void);
@@ -9,8 +9,14 @@
 #include "config.h"
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include "libevdev/libevdev.h"
 #include "libevdev/libevdev-uinput.h"
@@ -19,7 +25,11 @@
 #include "pinelog.h"
 #include "x52d_config.h"
 #include "x52d_const.h"
+#include "x52d_io.h"
+#include "x52d_latency.h"
 #include "x52d_mouse.h"
+#include "x52d_stats.h"
+#include "x52d_uinput.h"
 
 static pthread_t mouse_thr;
 static bool mouse_thr_enabled = false;
@@ -27,18 +37,41 @@ static bool mouse_thr_enabled = false;
 static struct libevdev_uinput *mouse_uidev;
 static bool mouse_uidev_created = false;
 
-static volatile libx52io_report old_report;
-static volatile libx52io_report new_report;
+/*
+ * The buttons are handled on the I/O thread, and the previous and current
+ * reports are only used by that thread. The mouse thread reads the
+ * thumbstick from the latest report slot of the I/O driver instead.
+ */
+static libx52io_report old_report;
+static libx52io_report new_report;
+
+/*
+ * The pointer is moved on every tick of an absolute timer, so that the tick
+ * rate doesn't drift with the time taken to process each tick. The timer is
+ * disarmed while the thumbstick is centered, and the thread sleeps on the
+ * wake descriptor until the I/O thread sees the thumbstick move.
+ */
+#define MOUSE_TICK_NSEC     5000000 /* 200 Hz */
+
+static int mouse_timer_fd = -1;
+static int mouse_wake_fd = -1;
+static atomic_bool mouse_idle;
+
+/* Fractional motion that has not been sent yet, in pixels */
+static double mouse_accum[2];
 
-static int report_button_change(int button, int index)
+/* Each detent of the scroll wheel, in high resolution units */
+#define WHEEL_HI_RES_DETENT 120
+
+static int report_button_change(struct x52d_uinput_frame *frame,
+                                int button, int index)
 {
     int rc = 1;
     bool old_button = old_report.button[index];
     bool new_button = new_report.button[index];
 
     if (old_button != new_button) {
-        rc = libevdev_uinput_write_event(mouse_uidev, EV_KEY, button,
-                                    (int)new_button);
+        rc = x52d_uinput_frame_add(frame, EV_KEY, button, (int)new_button);
         if (rc != 0) {
             PINELOG_ERROR(_("Error writing mouse button event (button %d, state %d)"),
                           button, (int)new_button);
@@ -48,7 +81,7 @@ static int report_button_change(int button, int index)
     return rc;
 }
 
-static int report_wheel(void)
+static int report_wheel(struct x52d_uinput_frame *frame)
 {
     int rc = 1;
     int wheel = 0;
@@ -64,7 +97,13 @@ static int report_wheel(void)
     }
 
     if (wheel != 0) {
-        rc = libevdev_uinput_write_event(mouse_uidev, EV_REL, REL_WHEEL, wheel);
+        rc = x52d_uinput_frame_add(frame, EV_REL, REL_WHEEL, wheel);
+        #if defined REL_WHEEL_HI_RES
+        if (rc == 0) {
+            rc = x52d_uinput_frame_add(frame, EV_REL, REL_WHEEL_HI_RES,
+                                       wheel * WHEEL_HI_RES_DETENT);
+        }
+        #endif
         if (rc != 0) {
             PINELOG_ERROR(_("Error writing mouse wheel event %d"), wheel);
         }
@@ -73,31 +112,30 @@ static int report_wheel(void)
     return rc;
 }
 
-static int report_axis(int axis, int index)
+static bool thumbstick_centered(const libx52io_report *report)
 {
-    int rc = 1;
-
-    int axis_val = new_report.axis[index];
+    return x52d_mouse_velocity(report->axis[LIBX52IO_AXIS_THUMBX]) == 0 &&
+           x52d_mouse_velocity(report->axis[LIBX52IO_AXIS_THUMBY]) == 0;
+}
 
-    /*
-     * Axis value ranges from 0 to 15, with the default midpoint at 8.
-     * We need to translate this to a range of -7 to +7. Since the midpoint
-     * is slightly off-center, we will shift the values left, and subtract
-     * 15, effectively, giving us a range of -15 to +15. Shifting right again
-     * will reduce the range to -7 to +7, and effectively ignore the reported
-     * values of 7 and 8.
-     */
-    axis_val = ((axis_val << 1) - 15) >> 1;
+static int report_axis(struct x52d_uinput_frame *frame,
+                       const libx52io_report *report, int axis, int index,
+                       double seconds)
+{
+    int rc = 1;
+    double *accum = &mouse_accum[axis == REL_Y];
+    int axis_val;
 
     /*
-     * Factor in the multiplicative factor for the axis. This deliberately
-     * uses integer division, since the uinput event only accepts integers.
-     * For the speed purposes, this should be good enough.
+     * Accumulate the motion at full precision, and only send the whole
+     * pixels, so that slow movements are not lost to rounding.
      */
-    axis_val = (axis_val * mouse_mult) / MOUSE_MULT_FACTOR;
+    *accum += x52d_mouse_velocity(report->axis[index]) * seconds;
+    axis_val = (int)*accum;
+    *accum -= axis_val;
 
     if (axis_val) {
-        rc = libevdev_uinput_write_event(mouse_uidev, EV_REL, axis, axis_val);
+        rc = x52d_uinput_frame_add(frame, EV_REL, axis, axis_val);
         if (rc != 0) {
             PINELOG_ERROR(_("Error writing mouse axis event (axis %d, value %d)"),
                           axis, axis_val);
@@ -107,41 +145,117 @@ static int report_axis(int axis, int index)
     return rc;
 }
 
-static void report_sync(void)
+static void report_sync(struct x52d_uinput_frame *frame)
 {
     int rc;
-    rc = libevdev_uinput_write_event(mouse_uidev, EV_SYN, SYN_REPORT, 0);
+    rc = x52d_uinput_frame_flush(frame);
     if (rc != 0) {
-        PINELOG_ERROR(_("Error writing mouse sync event"));
+        PINELOG_ERROR(_("Error %d writing mouse events: %s"), rc, strerror(rc));
     } else {
-        memcpy((void *)&old_report, (void *)&new_report, sizeof(old_report));
+        memcpy(&old_report, &new_report, sizeof(old_report));
     }
 }
 
 static void reset_reports(void)
 {
-    memset((void *)&old_report, 0, sizeof(old_report));
+    memset(&old_report, 0, sizeof(old_report));
     /* Set the default thumbstick values to the mid-point */
     old_report.axis[LIBX52IO_AXIS_THUMBX] = 8;
     old_report.axis[LIBX52IO_AXIS_THUMBY] = 8;
-    memcpy((void *)&new_report, (void *)&old_report, sizeof(new_report));
+    memcpy(&new_report, &old_report, sizeof(new_report));
+}
+
+static void mouse_timer_set(bool armed)
+{
+    struct itimerspec its = { 0 };
+
+    if (armed) {
+        clock_gettime(CLOCK_MONOTONIC, &its.it_value);
+        its.it_value.tv_nsec += MOUSE_TICK_NSEC;
+        if (its.it_value.tv_nsec >= 1000000000) {
+            its.it_value.tv_sec++;
+            its.it_value.tv_nsec -= 1000000000;
+        }
+        its.it_interval.tv_nsec = MOUSE_TICK_NSEC;
+    }
+
+    if (timerfd_settime(mouse_timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        PINELOG_ERROR(_("Error %d setting mouse timer: %s"),
+                      errno, strerror(errno));
+    }
+}
+
+/* Sleep until the thumbstick is moved away from the center */
+static void mouse_wait_active(void)
+{
+    libx52io_report report;
+    uint64_t count;
+
+    mouse_timer_set(false);
+    mouse_accum[0] = 0;
+    mouse_accum[1] = 0;
+
+    /*
+     * The I/O thread only signals the wake descriptor if it sees the idle
+     * flag, so check the thumbstick again after setting it, in case it moved
+     * in between.
+     */
+    atomic_store(&mouse_idle, true);
+    x52d_io_read_report(&report);
+    if (thumbstick_centered(&report)) {
+        PINELOG_TRACE("Mouse thread sleeping while the thumbstick is centered");
+        if (read(mouse_wake_fd, &count, sizeof(count)) < 0 && errno != EINTR) {
+            PINELOG_ERROR(_("Error %d waiting for mouse movement: %s"),
+                          errno, strerror(errno));
+        }
+    }
+    atomic_store(&mouse_idle, false);
 }
 
 static void * x52_mouse_thr(void *param)
 {
-    bool state_changed;
+    bool armed = false;
+    libx52io_report report;
+    uint64_t ticks;
+    double seconds;
+    struct x52d_uinput_frame frame;
+    int rc;
 
     PINELOG_INFO(_("Starting X52 virtual mouse driver thread"));
     for (;;) {
-        state_changed = false;
-        state_changed |= (0 == report_axis(REL_X, LIBX52IO_AXIS_THUMBX));
-        state_changed |= (0 == report_axis(REL_Y, LIBX52IO_AXIS_THUMBY));
+        x52d_stats_inc(X52D_STAT_WAKE_MOUSE);
+        x52d_io_read_report(&report);
+        if (thumbstick_centered(&report)) {
+            mouse_wait_active();
+            armed = false;
+            continue;
+        }
 
-        if (state_changed) {
-            report_sync();
+        if (!armed) {
+            mouse_timer_set(true);
+            armed = true;
         }
 
-        usleep(mouse_delay);
+        /* Missed ticks are made up for by moving further on this one */
+        if (read(mouse_timer_fd, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+            continue;
+        }
+
+        x52d_stats_add(X52D_STAT_MOUSE_TICKS, ticks);
+
+        /* Use the thumbstick position at the time of the tick */
+        x52d_io_read_report(&report);
+        seconds = ticks * MOUSE_TICK_NSEC / 1e9;
+
+        x52d_uinput_frame_init(&frame, mouse_uidev);
+        report_axis(&frame, &report, REL_X, LIBX52IO_AXIS_THUMBX, seconds);
+        report_axis(&frame, &report, REL_Y, LIBX52IO_AXIS_THUMBY, seconds);
+
+        rc = x52d_uinput_frame_flush(&frame);
+        if (rc != 0) {
+            PINELOG_ERROR(_("Error %d writing mouse events: %s"),
+                          rc, strerror(rc));
+        }
     }
 
     return NULL;
@@ -163,6 +277,7 @@ static void x52d_mouse_thr_exit(void)
 {
     PINELOG_INFO(_("Shutting down X52 virtual mouse driver thread"));
     pthread_cancel(mouse_thr);
+    pthread_join(mouse_thr, NULL);
 }
 
 void x52d_mouse_evdev_thread_control(bool enabled)
@@ -194,20 +309,33 @@ void x52d_mouse_evdev_thread_control(bool enabled)
 void x52d_mouse_report_event(libx52io_report *report)
 {
     bool state_changed;
+    struct x52d_uinput_frame frame;
+
     if (report) {
-        memcpy((void *)&new_report, report, sizeof(new_report));
+        memcpy(&new_report, report, sizeof(new_report));
 
         if (!mouse_uidev_created || !mouse_thr_enabled) {
             return;
         }
 
+        x52d_uinput_frame_init(&frame, mouse_uidev);
         state_changed = false;
-        state_changed |= (0 == report_button_change(BTN_LEFT, LIBX52IO_BTN_MOUSE_PRIMARY));
-        state_changed |= (0 == report_button_change(BTN_RIGHT, LIBX52IO_BTN_MOUSE_SECONDARY));
-        state_changed |= (0 == report_wheel());
+        state_changed |= (0 == report_button_change(&frame, BTN_LEFT, LIBX52IO_BTN_MOUSE_PRIMARY));
+        state_changed |= (0 == report_button_change(&frame, BTN_RIGHT, LIBX52IO_BTN_MOUSE_SECONDARY));
+        state_changed |= (0 == report_wheel(&frame));
 
         if (state_changed) {
-            report_sync();
+            report_sync(&frame);
+            x52d_latency_mark(X52D_LAT_UINPUT);
+        }
+
+        /* Wake up the mouse thread if it is sleeping */
+        if (!thumbstick_centered(report) && atomic_exchange(&mouse_idle, false)) {
+            uint64_t count = 1;
+            if (write(mouse_wake_fd, &count, sizeof(count)) < 0) {
+                PINELOG_ERROR(_("Error %d waking mouse thread: %s"),
+                              errno, strerror(errno));
+            }
         }
     } else {
         reset_reports();
@@ -219,6 +347,14 @@ void x52d_mouse_evdev_init(void)
     int rc;
     struct libevdev *dev;
 
+    mouse_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    mouse_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (mouse_timer_fd < 0 || mouse_wake_fd < 0) {
+        PINELOG_ERROR(_("Error %d creating mouse timer: %s"),
+                      errno, strerror(errno));
+        return;
+    }
+
     /* Create a new mouse device */
     dev = libevdev_new();
     libevdev_set_name(dev, "X52 virtual mouse");
@@ -226,6 +362,9 @@ void x52d_mouse_evdev_init(void)
     libevdev_enable_event_code(dev, EV_REL, REL_X, NULL);
     libevdev_enable_event_code(dev, EV_REL, REL_Y, NULL);
     libevdev_enable_event_code(dev, EV_REL, REL_WHEEL, NULL);
+    #if defined REL_WHEEL_HI_RES
+    libevdev_enable_event_code(dev, EV_REL, REL_WHEEL_HI_RES, NULL);
+    #endif
     libevdev_enable_event_type(dev, EV_KEY);
     libevdev_enable_event_code(dev, EV_KEY, BTN_LEFT, NULL);
     libevdev_enable_event_code(dev, EV_KEY, BTN_RIGHT, NULL);
@@ -243,6 +382,17 @@ void x52d_mouse_evdev_init(void)
 void x52d_mouse_evdev_exit(void)
 {
     x52d_mouse_evdev_thread_control(false);
-    mouse_uidev_created = false;
-    libevdev_uinput_destroy(mouse_uidev);
+    if (mouse_uidev_created) {
+        mouse_uidev_created = false;
+        libevdev_uinput_destroy(mouse_uidev);
+    }
+
+    if (mouse_timer_fd >= 0) {
+        close(mouse_timer_fd);
+        mouse_timer_fd = -1;
+    }
+    if (mouse_wake_fd >= 0) {
+        close(mouse_wake_fd);
+        mouse_wake_fd = -1;
+    }
 }
@@ -123,6 +123,51 @@ static void test_mouse_reverse_scroll_disabled(void **state)
     assert_int_equal(mouse_scroll_dir, 1);
 }
 
+static void test_mouse_acceleration_invalid(void **state)
+{
+    int orig_mouse_accel = mouse_accel;
+
+    x52d_cfg_set_Mouse_Acceleration(-1);
+    assert_int_equal(mouse_accel, orig_mouse_accel);
+    x52d_cfg_set_Mouse_Acceleration(101);
+    assert_int_equal(mouse_accel, orig_mouse_accel);
+}
+
+/* Velocity in pixels per second, within a rounding margin */
+#define assert_velocity(axis_val, expected) do { \
+    double v = x52d_mouse_velocity(axis_val); \
+    assert_true(v > (expected) - 0.001 && v < (expected) + 0.001); \
+} while (0)
+
+static void test_mouse_velocity_linear(void **state)
+{
+    x52d_cfg_set_Mouse_Speed(0);
+    x52d_cfg_set_Mouse_Acceleration(0);
+
+    /* Full deflection moves 100 pixels per second, or 7 pixels every 70ms */
+    assert_velocity(7, 0);
+    assert_velocity(8, 0);
+    assert_velocity(15, 100);
+    assert_velocity(0, -100);
+    assert_velocity(11, 300.0 / 7);
+    assert_velocity(4, -300.0 / 7);
+}
+
+static void test_mouse_velocity_accelerated(void **state)
+{
+    x52d_cfg_set_Mouse_Speed(0);
+    x52d_cfg_set_Mouse_Acceleration(100);
+
+    /* Top speed is unchanged, but smaller deflections are slower */
+    assert_velocity(7, 0);
+    assert_velocity(15, 100);
+    assert_velocity(0, -100);
+    assert_velocity(11, 900.0 / 49);
+    assert_velocity(4, -900.0 / 49);
+
+    x52d_cfg_set_Mouse_Acceleration(0);
+}
+
 const struct CMUnitTest tests[] = {
     cmocka_unit_test(test_mouse_thread_enabled),
     cmocka_unit_test(test_mouse_thread_disabled),
@@ -136,6 +181,9 @@ const struct CMUnitTest tests[] = {
     cmocka_unit_test(test_mouse_speed_above_max),
     cmocka_unit_test(test_mouse_reverse_scroll_enabled),
     cmocka_unit_test(test_mouse_reverse_scroll_disabled),
+    cmocka_unit_test(test_mouse_acceleration_invalid),
+    cmocka_unit_test(test_mouse_velocity_linear),
+    cmocka_unit_test(test_mouse_velocity_accelerated),
 };
 
 int main(void)
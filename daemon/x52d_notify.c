@@ -6,7 +6,10 @@
  * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
  */
 
+#include "config.h"
 #include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
 #include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
@@ -14,19 +17,168 @@
 #define PINELOG_MODULE X52D_MOD_NOTIFY
 #include "pinelog.h"
 #include "x52d_const.h"
+#include "x52d_config.h"
 #include "x52d_notify.h"
 #include "x52d_client.h"
+#include "x52d_notify_queue.h"
+#include "x52d_stats.h"
 #include "x52dcomm.h"
 #include "x52dcomm-internal.h"
+#include "usdt.h"
 
 static pthread_t notify_thr;
-static pthread_t notify_listen;
 static pthread_mutex_t notify_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static int notify_pipe[2];
-static int notify_sock;
+static int notify_pipe[2] = { -1, -1 };
+static int notify_sock = -1;
 
-static int client_fd[X52D_MAX_CLIENTS];
+/* Requests from notification clients never have more than a few arguments */
+#define MAX_ARGS    8
+
+atomic_uint x52d_notify_topics;
+
+static const char *topic_names[X52D_TOPIC_MAX] = {
+    [X52D_TOPIC_DEVICE] = "device",
+    [X52D_TOPIC_CONFIG] = "config",
+    [X52D_TOPIC_INPUT] = "input",
+};
+
+/* Notifications are written to the pipe with this header */
+struct notify_header {
+    uint16_t len;
+    uint16_t topic;
+};
+
+/* Per-client state, allocated by the client set */
+struct notify_client {
+    struct x52d_client base;
+    unsigned int topics;
+    struct x52d_notify_queue queue;
+    int slot;
+
+    /* Incomplete request frame, carried over to the next read */
+    int pending;
+    char partial[X52D_FRAME_HDRSZ + X52D_FRAME_MAX];
+};
+
+static struct x52d_client_set notify_clients;
+static struct x52d_client pipe_watch;
+
+/* Number of clients subscribed to each topic */
+static unsigned int topic_clients[X52D_TOPIC_MAX];
+
+/* Statistics, updated by the notification thread */
+static atomic_uint stat_clients;
+static atomic_uint stat_queued;
+static atomic_ullong stat_dropped;
+static atomic_ullong stat_coalesced;
+static atomic_ullong stat_disconnected;
+
+/*
+ * Queue depth and dropped notifications of each client, published by the
+ * notification thread, so that they can be read without locking. A slot is
+ * free while its descriptor is negative.
+ */
+struct client_slot {
+    atomic_int fd;
+    atomic_uint depth;
+    atomic_ullong dropped;
+};
+static struct client_slot client_slots[X52D_MAX_CLIENTS];
+
+/* Maximum rate of axis notifications on the input topic, in Hz */
+#define MAX_INPUT_RATE  1000
+static atomic_uint input_rate = 60;
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Change the topics of a client, and publish the topics that any client wants */
+static void set_topics(struct notify_client *client, unsigned int topics)
+{
+    unsigned int wanted = 0;
+
+    for (int t = 0; t < X52D_TOPIC_MAX; t++) {
+        if (client->topics & (1u << t)) {
+            topic_clients[t]--;
+        }
+        if (topics & (1u << t)) {
+            topic_clients[t]++;
+        }
+        if (topic_clients[t] != 0) {
+            wanted |= 1u << t;
+        }
+    }
+
+    client->topics = topics;
+    atomic_store_explicit(&x52d_notify_topics, wanted, memory_order_relaxed);
+}
+
+static void publish_client(struct notify_client *client)
+{
+    struct client_slot *slot;
+
+    if (client->slot < 0) {
+        return;
+    }
+
+    slot = &client_slots[client->slot];
+    atomic_store_explicit(&slot->depth, client->queue.count, memory_order_relaxed);
+    atomic_store_explicit(&slot->dropped, client->queue.dropped, memory_order_relaxed);
+}
+
+/* Only wait for the socket to be writable while there is something to send */
+static void update_events(struct notify_client *client)
+{
+    unsigned int events = X52D_CLIENT_READ;
+
+    if (!x52d_notify_queue_empty(&client->queue)) {
+        events |= X52D_CLIENT_WRITE;
+    }
+
+    x52d_client_set_events(&notify_clients, &client->base, events);
+}
+
+static void client_connected(struct x52d_client *base)
+{
+    struct notify_client *client = (struct notify_client *)base;
+
+    x52d_notify_queue_init(&client->queue, X52D_NOTIFY_DROP_OLDEST);
+    set_topics(client, X52D_TOPIC_DEFAULT);
+    atomic_fetch_add(&stat_clients, 1);
+
+    for (client->slot = 0; client->slot < X52D_MAX_CLIENTS; client->slot++) {
+        struct client_slot *slot = &client_slots[client->slot];
+
+        if (atomic_load_explicit(&slot->fd, memory_order_relaxed) < 0) {
+            publish_client(client);
+            atomic_store_explicit(&slot->fd, base->fd, memory_order_release);
+            return;
+        }
+    }
+
+    client->slot = -1;
+}
+
+static void client_disconnected(struct x52d_client *base)
+{
+    struct notify_client *client = (struct notify_client *)base;
+
+    atomic_fetch_sub(&stat_queued, client->queue.count);
+    x52d_notify_queue_clear(&client->queue);
+    set_topics(client, 0);
+    atomic_fetch_sub(&stat_clients, 1);
+
+    if (client->slot >= 0) {
+        atomic_store_explicit(&client_slots[client->slot].fd, -1, memory_order_release);
+    }
+}
+
+static void disconnect_client(struct notify_client *client)
+{
+    x52d_client_close(&notify_clients, &client->base);
+}
 
 /* Bind and listen to the notify socket */
 static int listen_notify(const char *notify_sock_path)
@@ -66,70 +218,405 @@ listen_failure:
     return -1;
 }
 
-static void * x52_notify_thr(void * param)
+static void flush_client(struct notify_client *client);
+
+/* Queue a notification to a client, and return false if it was disconnected */
+static bool queue_notification(struct notify_client *client, struct x52d_notify_msg *msg)
 {
-    char buffer[X52D_BUFSZ];
-    uint16_t bufsiz;
+    struct x52d_notify_queue *queue = &client->queue;
+    uint64_t dropped;
+    uint64_t coalesced;
+    unsigned int count;
     int rc;
 
-    for (;;) {
-read_pipe_size:
-        rc = read(notify_pipe[0], &bufsiz, sizeof(bufsiz));
-        if (rc < 0) {
-            if (errno == EINTR) {
-                goto read_pipe_size;
-            } else {
-                PINELOG_ERROR(_("Error %d reading from pipe: %s"),
-                              errno, strerror(errno));
-            }
+    /* The overflow policy only applies once the socket is full as well */
+    if (queue->count == X52D_NOTIFY_QUEUE_LEN) {
+        flush_client(client);
+        if (client->base.fd == INVALID_CLIENT) {
+            return false;
         }
+    }
 
-        if (rc < 0) {
-            // Error condition, try again
+    dropped = queue->dropped;
+    coalesced = queue->coalesced;
+    count = queue->count;
+    rc = x52d_notify_queue_push(queue, msg);
+    atomic_fetch_add(&stat_dropped, queue->dropped - dropped);
+    atomic_fetch_add(&stat_coalesced, queue->coalesced - coalesced);
+    atomic_fetch_add(&stat_queued, queue->count - count);
+    publish_client(client);
+
+    if (rc != 0) {
+        PINELOG_WARN(_("Notification queue full for client %d, disconnecting"),
+                     client->base.fd);
+        atomic_fetch_add(&stat_disconnected, 1);
+        disconnect_client(client);
+        return false;
+    }
+
+    return true;
+}
+
+static void queue_reply(struct notify_client *client, int argc, const char **argv)
+{
+    char buffer[X52D_BUFSZ];
+    struct x52d_notify_msg *msg;
+    int len;
+
+    len = x52d_format_command(argc, argv, buffer, sizeof(buffer));
+    if (len < 0) {
+        return;
+    }
+
+    msg = x52d_notify_msg_new(buffer, len);
+    if (msg != NULL) {
+        queue_notification(client, msg);
+        x52d_notify_msg_put(msg);
+    }
+}
+
+/* Send as much of the queue as the socket will accept, without blocking */
+static void flush_client(struct notify_client *client)
+{
+    struct iovec iov[X52D_NOTIFY_QUEUE_LEN];
+    struct msghdr msg = { 0 };
+    unsigned int count;
+    ssize_t rc;
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = x52d_notify_queue_iov(&client->queue, iov,
+                                           X52D_NOTIFY_QUEUE_LEN);
+    if (msg.msg_iovlen == 0) {
+        return;
+    }
+
+    do {
+        rc = sendmsg(client->base.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            PINELOG_ERROR(_("Error %d writing to notification client %d: %s"),
+                          errno, client->base.fd, strerror(errno));
+            disconnect_client(client);
+        }
+        return;
+    }
+
+    count = client->queue.count;
+    x52d_notify_queue_consume(&client->queue, rc);
+    atomic_fetch_sub(&stat_queued, count - client->queue.count);
+    publish_client(client);
+}
+
+static void broadcast(unsigned int topic, const char *payload, uint16_t len)
+{
+    struct x52d_notify_msg *msg;
+
+    msg = x52d_notify_msg_new(payload, len);
+    if (msg == NULL) {
+        PINELOG_ERROR(_("Error allocating notification"));
+        return;
+    }
+
+    X52_PROBE3(x52d, notify_broadcast, topic, len, payload);
+
+    for (struct x52d_client *c = x52d_client_next(&notify_clients, NULL); c != NULL;
+         c = x52d_client_next(&notify_clients, c)) {
+        struct notify_client *client = (struct notify_client *)c;
+
+        if (client->topics & (1u << topic)) {
+            queue_notification(client, msg);
+        }
+    }
+
+    x52d_notify_msg_put(msg);
+}
+
+static bool read_pipe(void *buffer, size_t len)
+{
+    ssize_t rc;
+
+    do {
+        rc = read(notify_pipe[0], buffer, len);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        PINELOG_ERROR(_("Error %d reading from pipe: %s"),
+                      errno, strerror(errno));
+    }
+
+    return rc == (ssize_t)len;
+}
+
+/* Queue all pending notifications, and send them to the clients */
+static void read_notifications(void)
+{
+    char buffer[X52D_BUFSZ];
+    struct notify_header header;
+
+    /*
+     * Each notification is written to the pipe in a single write, so it can
+     * be read in its entirety once the header is available.
+     */
+    while (read_pipe(&header, sizeof(header))) {
+        if (header.len > sizeof(buffer) || header.topic >= X52D_TOPIC_MAX ||
+            !read_pipe(buffer, header.len)) {
+            PINELOG_ERROR(_("Invalid notification of %u bytes in pipe"), header.len);
+            break;
+        }
+
+        broadcast(header.topic, buffer, header.len);
+    }
+
+    for (struct x52d_client *c = x52d_client_next(&notify_clients, NULL); c != NULL;
+         c = x52d_client_next(&notify_clients, c)) {
+        struct notify_client *client = (struct notify_client *)c;
+
+        if (!x52d_notify_queue_empty(&client->queue)) {
+            flush_client(client);
+            update_events(client);
+        }
+    }
+}
+
+/* Parse a list of topics into a mask, and return false if any are invalid */
+static bool parse_topics(int argc, char **argv, unsigned int *topics, char *error, size_t errlen)
+{
+    *topics = 0;
+
+    if (argc == 0) {
+        snprintf(error, errlen, "No topics given");
+        return false;
+    }
+
+    for (int i = 0; i < argc; i++) {
+        int t;
+
+        if (strcasecmp(argv[i], "all") == 0) {
+            *topics |= (1u << X52D_TOPIC_MAX) - 1;
             continue;
         }
 
-read_pipe_data:
-        rc = read(notify_pipe[0], buffer, bufsiz);
-        if (rc < 0) {
-            if (errno == EINTR) {
-                goto read_pipe_data;
-            } else {
-                PINELOG_ERROR(_("Error %d reading from pipe: %s"),
-                              errno, strerror(errno));
+        for (t = 0; t < X52D_TOPIC_MAX; t++) {
+            if (strcasecmp(argv[i], topic_names[t]) == 0) {
+                *topics |= 1u << t;
+                break;
             }
         }
 
-        if (rc < 0) {
-            continue;
+        if (t == X52D_TOPIC_MAX) {
+            snprintf(error, errlen, "Unknown topic '%s'", argv[i]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void handle_request(struct notify_client *client, char *request, int len)
+{
+    int argc = 0;
+    char *argv[MAX_ARGS];
+    char error[X52D_BUFSZ];
+    unsigned int topics;
+
+    x52d_split_args(&argc, argv, MAX_ARGS, request, len);
+    if (request[len - 1] != '\0') {
+        snprintf(error, sizeof(error), "Request is not NUL terminated");
+    } else if (argc > MAX_ARGS) {
+        snprintf(error, sizeof(error), "Too many arguments for request '%s'; got %d", argv[0], argc);
+    } else if (argc == 2 && strcasecmp(argv[0], "policy") == 0) {
+        int policy = x52d_notify_policy_parse(argv[1]);
+        if (policy < 0) {
+            snprintf(error, sizeof(error), "Unknown policy '%s'", argv[1]);
+        } else {
+            client->queue.policy = policy;
+            PINELOG_TRACE("Notification client %d set policy %s",
+                          client->base.fd, argv[1]);
+            queue_reply(client, 3, (const char *[]){"OK", "policy",
+                        x52d_notify_policy_name(policy)});
+            return;
         }
+    } else if (strcasecmp(argv[0], "subscribe") == 0 ||
+               strcasecmp(argv[0], "unsubscribe") == 0) {
+        if (parse_topics(argc - 1, argv + 1, &topics, error, sizeof(error))) {
+            const char *reply[MAX_ARGS + 1] = {"OK"};
 
-        for (int i = 0; i < X52D_MAX_CLIENTS; i++) {
-            // Broadcast to every connected client
-            if (client_fd[i] != INVALID_CLIENT) {
-write_client_notification:
-                rc = write(client_fd[i], buffer, bufsiz);
-                if (rc < 0 && errno == EINTR) {
-                    goto write_client_notification;
-                }
+            if (strcasecmp(argv[0], "subscribe") == 0) {
+                set_topics(client, client->topics | topics);
+            } else {
+                set_topics(client, client->topics & ~topics);
             }
+            PINELOG_TRACE("Notification client %d topics 0x%x",
+                          client->base.fd, client->topics);
+
+            memcpy(&reply[1], argv, argc * sizeof(argv[0]));
+            queue_reply(client, argc + 1, reply);
+            return;
+        }
+    } else {
+        snprintf(error, sizeof(error), "Unknown request '%s'", argv[0]);
+    }
+
+    queue_reply(client, 2, (const char *[]){"ERR", error});
+}
+
+static void read_requests(struct notify_client *client)
+{
+    char buffer[X52D_BUFSZ * 4];
+    uint32_t framelen;
+    int len = client->pending;
+    int pos = 0;
+    int rc;
+
+    memcpy(buffer, client->partial, len);
+    do {
+        rc = recv(client->base.fd, buffer + len, sizeof(buffer) - len, 0);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc <= 0) {
+        if (rc == 0) {
+            disconnect_client(client);
+        }
+        return;
+    }
+    len += rc;
+
+    while ((rc = x52d_frame_next(buffer + pos, len - pos, &framelen)) > 0) {
+        handle_request(client, buffer + pos + X52D_FRAME_HDRSZ, rc);
+        if (client->base.fd == INVALID_CLIENT) {
+            return;
+        }
+        pos += X52D_FRAME_HDRSZ + rc;
+    }
+
+    if (rc < 0) {
+        PINELOG_ERROR(_("Invalid frame length %u from notification client %d"),
+                      framelen, client->base.fd);
+        disconnect_client(client);
+        return;
+    }
+
+    client->pending = len - pos;
+    memcpy(client->partial, buffer + pos, client->pending);
+}
+
+void x52d_notify_get_stats(struct x52d_notify_stats *stats)
+{
+    stats->clients = atomic_load(&stat_clients);
+    stats->queued = atomic_load(&stat_queued);
+    stats->dropped = atomic_load(&stat_dropped);
+    stats->coalesced = atomic_load(&stat_coalesced);
+    stats->disconnected = atomic_load(&stat_disconnected);
+}
+
+int x52d_notify_get_client_stats(struct x52d_notify_client_stats *stats, int max)
+{
+    int count = 0;
+
+    for (int i = 0; i < X52D_MAX_CLIENTS && count < max; i++) {
+        struct client_slot *slot = &client_slots[i];
+        int fd = atomic_load_explicit(&slot->fd, memory_order_acquire);
+
+        if (fd >= 0) {
+            stats[count].fd = fd;
+            stats[count].depth = atomic_load_explicit(&slot->depth, memory_order_relaxed);
+            stats[count].dropped = atomic_load_explicit(&slot->dropped, memory_order_relaxed);
+            count++;
         }
     }
 
+    return count;
+}
+
+void x52d_cfg_set_Notify_InputRate(int rate)
+{
+    if (rate < 1 || rate > MAX_INPUT_RATE) {
+        PINELOG_INFO(_("Ignoring input notification rate %d outside supported range (1-%d)"),
+                     rate, MAX_INPUT_RATE);
+        return;
+    }
+
+    PINELOG_DEBUG(_("Setting input notification rate to %d Hz"), rate);
+    atomic_store(&input_rate, rate);
+}
+
+unsigned int x52d_notify_input_rate(void)
+{
+    return atomic_load(&input_rate);
+}
+
+static void client_handler(struct x52d_client *base, unsigned int ready)
+{
+    struct notify_client *client = (struct notify_client *)base;
+
+    if (base == &pipe_watch) {
+        read_notifications();
+        return;
+    }
+
+    if (ready & X52D_CLIENT_READ) {
+        read_requests(client);
+    }
+
+    if (client->base.fd != INVALID_CLIENT) {
+        flush_client(client);
+        update_events(client);
+    }
+}
+
+/*
+ * Single thread that accepts clients, and forwards notifications from the
+ * pipe to them. Clients are never written to unless the socket is ready, so
+ * a client that isn't reading only affects itself, as decided by its policy.
+ */
+static void * x52_notify_thr(void * param)
+{
+    for (;;) {
+        x52d_client_wait(&notify_clients, client_handler, -1);
+        x52d_stats_inc(X52D_STAT_WAKE_NOTIFY);
+    }
+
     return NULL;
 }
 
-void x52d_notify_send(int argc, const char **argv)
+void x52d_notify_send(enum x52d_notify_topic topic, int argc, const char **argv)
 {
-    char buffer[X52D_BUFSZ + sizeof(uint16_t)];
-    uint16_t bufsiz;
-    uint16_t written;
+    char buffer[X52D_BUFSZ + sizeof(struct notify_header)];
+    struct notify_header header;
+    size_t bufsiz;
+    size_t written;
+    int cancel_state;
+    int len;
     int rc;
 
-    bufsiz = (uint16_t)x52d_format_command(argc, argv, buffer + sizeof(uint16_t), X52D_BUFSZ);
-    memcpy(buffer, &bufsiz, sizeof(bufsiz));
+    len = x52d_format_command(argc, argv, buffer + sizeof(header), X52D_BUFSZ);
+    if (len < 0) {
+        PINELOG_ERROR(_("Error %d formatting notification: %s"),
+                      errno, strerror(errno));
+        return;
+    }
 
+    header.len = (uint16_t)len;
+    header.topic = (uint16_t)topic;
+    memcpy(buffer, &header, sizeof(header));
+    bufsiz = sizeof(header) + len;
+
+    /*
+     * The notification thread never blocks on clients, so the pipe is always
+     * drained promptly. The write is a cancellation point, and the sender
+     * must not be cancelled with the mutex held.
+     */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
     pthread_mutex_lock(&notify_mutex);
+    if (notify_pipe[1] < 0) {
+        // Notifications are no longer delivered once shutdown has started
+        pthread_mutex_unlock(&notify_mutex);
+        pthread_setcancelstate(cancel_state, NULL);
+        return;
+    }
+
     written = 0;
     while (written < bufsiz) {
         rc = write(notify_pipe[1], buffer + written, bufsiz - written);
@@ -139,37 +626,13 @@ void x52d_notify_send(int argc, const char **argv)
             }
             PINELOG_ERROR(_("Error %d writing notification pipe: %s"),
                           errno, strerror(errno));
+            break;
         } else {
             written += rc;
         }
     }
     pthread_mutex_unlock(&notify_mutex);
-}
-
-static void client_handler(int fd)
-{
-    char buffer[X52D_BUFSZ] = { 0 };
-    int rc;
-
-    rc = recv(fd, buffer, sizeof(buffer), 0);
-    PINELOG_TRACE("Received and discarded %d bytes from notification client %d", rc, fd);
-}
-
-static void * x52_notify_loop(void * param)
-{
-    struct pollfd pfd[MAX_CONN];
-    int rc;
-
-    for (;;) {
-        rc = x52d_client_poll(client_fd, pfd, notify_sock);
-        if (rc <= 0) {
-            continue;
-        }
-
-        x52d_client_handle(client_fd, pfd, notify_sock, client_handler);
-    }
-
-    return NULL;
+    pthread_setcancelstate(cancel_state, NULL);
 }
 
 void x52d_notify_init(const char *notify_sock_path)
@@ -177,7 +640,10 @@ void x52d_notify_init(const char *notify_sock_path)
     int rc;
 
     PINELOG_TRACE("Initializing notification manager");
-    x52d_client_init(client_fd);
+    atomic_init(&x52d_notify_topics, 0);
+    for (int i = 0; i < X52D_MAX_CLIENTS; i++) {
+        atomic_init(&client_slots[i].fd, -1);
+    }
 
     PINELOG_TRACE("Creating notifications pipe");
     rc = pipe(notify_pipe);
@@ -186,28 +652,44 @@ void x52d_notify_init(const char *notify_sock_path)
                       errno, strerror(errno));
     }
 
+    /* The notification thread drains the pipe until it is empty */
+    if (x52d_set_socket_nonblocking(notify_pipe[0]) < 0) {
+        PINELOG_FATAL(_("Error %d marking notification pipe as nonblocking: %s"),
+                      errno, strerror(errno));
+    }
+
     PINELOG_TRACE("Opening notification listener socket");
     notify_sock = listen_notify(notify_sock_path);
 
-    rc = pthread_create(&notify_thr, NULL, x52_notify_thr, NULL);
-    if (rc != 0) {
-        PINELOG_FATAL(_("Error %d initializing notify thread: %s"),
-                      rc, strerror(rc));
+    if (x52d_client_init(&notify_clients, notify_sock, sizeof(struct notify_client),
+                         client_connected, client_disconnected) < 0) {
+        PINELOG_FATAL(_("Error setting up notification socket"));
     }
 
-    rc = pthread_create(&notify_listen, NULL, x52_notify_loop, NULL);
+    pipe_watch.fd = notify_pipe[0];
+    pipe_watch.events = X52D_CLIENT_READ;
+    if (x52d_client_watch(&notify_clients, &pipe_watch) < 0) {
+        PINELOG_FATAL(_("Error setting up notification socket"));
+    }
+
+    rc = pthread_create(&notify_thr, NULL, x52_notify_thr, NULL);
     if (rc != 0) {
-        PINELOG_FATAL(_("Error %d initializing notify listener: %s"),
+        PINELOG_FATAL(_("Error %d initializing notify thread: %s"),
                       rc, strerror(rc));
     }
 }
 
 void x52d_notify_exit(void)
 {
+    pthread_cancel(notify_thr);
+    pthread_join(notify_thr, NULL);
+    x52d_client_exit(&notify_clients);
+
+    pthread_mutex_lock(&notify_mutex);
     close(notify_pipe[0]);
     close(notify_pipe[1]);
+    notify_pipe[0] = -1;
+    notify_pipe[1] = -1;
+    pthread_mutex_unlock(&notify_mutex);
     close(notify_sock);
-
-    pthread_cancel(notify_thr);
-    pthread_cancel(notify_listen);
 }
@@ -9,13 +9,66 @@
 #ifndef X52D_NOTIFY_H
 #define X52D_NOTIFY_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Notification topics. Clients only receive notifications for the topics they
+ * have subscribed to, and notifications are not generated at all unless some
+ * client has subscribed to their topic.
+ */
+enum x52d_notify_topic {
+    /* Device connection state */
+    X52D_TOPIC_DEVICE,
+
+    /* Configuration changes */
+    X52D_TOPIC_CONFIG,
+
+    /* Joystick button and axis changes, see x52d_input.h */
+    X52D_TOPIC_INPUT,
+
+    X52D_TOPIC_MAX
+};
+
+/* Topics for clients that have not subscribed to anything */
+#define X52D_TOPIC_DEFAULT  (1u << X52D_TOPIC_DEVICE)
+
+/* Union of the topics that all the connected clients have subscribed to */
+extern atomic_uint x52d_notify_topics;
+
+static inline bool x52d_notify_wanted(enum x52d_notify_topic topic)
+{
+    return atomic_load_explicit(&x52d_notify_topics, memory_order_relaxed) & (1u << topic);
+}
+
+struct x52d_notify_stats {
+    unsigned int clients;
+    unsigned int queued;
+    uint64_t dropped;
+    uint64_t coalesced;
+    uint64_t disconnected;
+};
+
+/* Queue of a single client */
+struct x52d_notify_client_stats {
+    int fd;
+    unsigned int depth;
+    uint64_t dropped;
+};
+
 void x52d_notify_init(const char *notify_sock_path);
 void x52d_notify_exit(void);
-void x52d_notify_send(int argc, const char **argv);
+void x52d_notify_send(enum x52d_notify_topic topic, int argc, const char **argv);
+void x52d_notify_get_stats(struct x52d_notify_stats *stats);
+int x52d_notify_get_client_stats(struct x52d_notify_client_stats *stats, int max);
+unsigned int x52d_notify_input_rate(void);
 
-#define X52D_NOTIFY(...) do { \
-    const char *argv ## __LINE__ [] = {__VA_ARGS__}; \
-    x52d_notify_send(sizeof(argv ## __LINE__ )/sizeof(argv ## __LINE__ [0]), argv ## __LINE__ ); \
+#define X52D_NOTIFY(topic, ...) do { \
+    if (x52d_notify_wanted(topic)) { \
+        const char *argv ## __LINE__ [] = {__VA_ARGS__}; \
+        x52d_notify_send(topic, sizeof(argv ## __LINE__ )/sizeof(argv ## __LINE__ [0]), argv ## __LINE__ ); \
+    } \
 } while(0)
 
 #endif // !defined X52D_NOTIFY_H
@@ -0,0 +1,378 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Notification client queues
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <arpa/inet.h>
+
+#include "x52d_notify_queue.h"
+#include "x52dcomm-internal.h"
+
+static const char *policy_names[X52D_NOTIFY_POLICY_MAX] = {
+    [X52D_NOTIFY_DROP_OLDEST] = "drop-oldest",
+    [X52D_NOTIFY_DISCONNECT] = "disconnect",
+    [X52D_NOTIFY_COALESCE] = "coalesce",
+};
+
+int x52d_notify_policy_parse(const char *name)
+{
+    for (int i = 0; i < X52D_NOTIFY_POLICY_MAX; i++) {
+        if (strcasecmp(name, policy_names[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+const char *x52d_notify_policy_name(enum x52d_notify_policy policy)
+{
+    if (policy >= X52D_NOTIFY_POLICY_MAX) {
+        return NULL;
+    }
+
+    return policy_names[policy];
+}
+
+/* Create a new notification, with a single reference held by the caller */
+struct x52d_notify_msg *x52d_notify_msg_new(const char *payload, size_t len)
+{
+    struct x52d_notify_msg *msg;
+    uint32_t header;
+
+    if (len == 0 || len > X52D_FRAME_MAX) {
+        return NULL;
+    }
+
+    msg = malloc(sizeof(*msg) + X52D_FRAME_HDRSZ + len);
+    if (msg == NULL) {
+        return NULL;
+    }
+
+    header = htonl((uint32_t)len);
+    memcpy(msg->data, &header, X52D_FRAME_HDRSZ);
+    memcpy(msg->data + X52D_FRAME_HDRSZ, payload, len);
+    msg->len = X52D_FRAME_HDRSZ + len;
+    msg->refs = 1;
+
+    return msg;
+}
+
+void x52d_notify_msg_put(struct x52d_notify_msg *msg)
+{
+    if (msg != NULL && --msg->refs == 0) {
+        free(msg);
+    }
+}
+
+struct msg_arg {
+    const char *str;
+    size_t len;
+};
+
+/* Every argument takes at least one byte, including its terminator */
+#define MSG_MAX_ARGS    X52D_FRAME_MAX
+
+/* Split the payload of a notification into its arguments */
+static int msg_args(const struct x52d_notify_msg *msg, struct msg_arg *args)
+{
+    const char *ptr = msg->data + X52D_FRAME_HDRSZ;
+    const char *end = msg->data + msg->len;
+    int argc = 0;
+
+    while (ptr < end && argc < MSG_MAX_ARGS) {
+        args[argc].str = ptr;
+        args[argc].len = strnlen(ptr, end - ptr);
+        ptr += args[argc].len + 1;
+        argc++;
+    }
+
+    return argc;
+}
+
+static bool arg_equal(const struct msg_arg *a, const struct msg_arg *b)
+{
+    return a->len == b->len && memcmp(a->str, b->str, a->len) == 0;
+}
+
+static bool arg_is(const struct msg_arg *arg, const char *str)
+{
+    return arg->len == strlen(str) && memcmp(arg->str, str, arg->len) == 0;
+}
+
+/*
+ * Notifications that report the latest value of a setting are superseded by
+ * a newer notification for the same setting, which is identified by the
+ * first few arguments. Any other notification, such as a button change or a
+ * reply to a request, is never superseded.
+ */
+static const struct {
+    const char *type;
+    int key_args;
+} coalesce_keys[] = {
+    { "CONFIG", 3 },    /* CONFIG section key value */
+};
+
+static bool same_key(const struct msg_arg *a, int argc_a,
+                     const struct msg_arg *b, int argc_b)
+{
+    size_t i;
+    int j;
+
+    for (i = 0; i < sizeof(coalesce_keys) / sizeof(coalesce_keys[0]); i++) {
+        int key_args = coalesce_keys[i].key_args;
+
+        if (argc_a < key_args || argc_b < key_args ||
+            !arg_is(&a[0], coalesce_keys[i].type) || !arg_is(&b[0], coalesce_keys[i].type)) {
+            continue;
+        }
+
+        for (j = 1; j < key_args; j++) {
+            if (!arg_equal(&a[j], &b[j])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    return false;
+}
+
+static bool is_axis(const struct msg_arg *args, int argc)
+{
+    return argc > 0 && arg_is(&args[0], "AXIS");
+}
+
+static bool append_arg(char *buffer, size_t *len, const struct msg_arg *arg)
+{
+    if (*len + arg->len + 1 > X52D_FRAME_MAX) {
+        return false;
+    }
+
+    memcpy(buffer + *len, arg->str, arg->len);
+    buffer[*len + arg->len] = '\0';
+    *len += arg->len + 1;
+    return true;
+}
+
+/* Find the value of the named axis in an AXIS notification */
+static const struct msg_arg *axis_value(const struct msg_arg *args, int argc,
+                                        const struct msg_arg *name)
+{
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (arg_equal(&args[i], name)) {
+            return &args[i + 1];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * AXIS notifications only carry the axes that changed, so an older one can't
+ * simply be discarded. Instead, merge it into a new notification, with the
+ * newer value of each axis. Returns NULL if the merged notification can't be
+ * created.
+ */
+static struct x52d_notify_msg *merge_axes(const struct msg_arg *old, int argc_old,
+                                          const struct msg_arg *new, int argc_new)
+{
+    char payload[X52D_FRAME_MAX];
+    const struct msg_arg *value;
+    size_t len = 0;
+    bool ok;
+    int i;
+
+    ok = append_arg(payload, &len, &new[0]);
+    for (i = 1; ok && i + 1 < argc_old; i += 2) {
+        value = axis_value(new, argc_new, &old[i]);
+        ok = append_arg(payload, &len, &old[i]) &&
+             append_arg(payload, &len, value ? value : &old[i + 1]);
+    }
+    for (i = 1; ok && i + 1 < argc_new; i += 2) {
+        if (axis_value(old, argc_old, &new[i]) == NULL) {
+            ok = append_arg(payload, &len, &new[i]) &&
+                 append_arg(payload, &len, &new[i + 1]);
+        }
+    }
+
+    return ok ? x52d_notify_msg_new(payload, len) : NULL;
+}
+
+#define SLOT(queue, idx) (((queue)->head + (idx)) % X52D_NOTIFY_QUEUE_LEN)
+
+void x52d_notify_queue_init(struct x52d_notify_queue *queue,
+                            enum x52d_notify_policy policy)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->policy = policy;
+}
+
+void x52d_notify_queue_clear(struct x52d_notify_queue *queue)
+{
+    for (int i = 0; i < queue->count; i++) {
+        x52d_notify_msg_put(queue->msg[SLOT(queue, i)]);
+    }
+
+    queue->head = 0;
+    queue->count = 0;
+    queue->sent = 0;
+}
+
+/* Remove the notification at the given index, shifting the newer ones down */
+static void queue_remove(struct x52d_notify_queue *queue, int idx)
+{
+    x52d_notify_msg_put(queue->msg[SLOT(queue, idx)]);
+
+    for (; idx < queue->count - 1; idx++) {
+        queue->msg[SLOT(queue, idx)] = queue->msg[SLOT(queue, idx + 1)];
+    }
+
+    queue->count--;
+}
+
+/*
+ * Discard or merge a queued notification that is superseded by the new one.
+ * If the notifications are merged, the merged notification replaces the new
+ * one, with the reference held by the caller. Returns true if a notification
+ * was removed from the queue.
+ */
+static bool queue_coalesce(struct x52d_notify_queue *queue, int oldest,
+                           struct x52d_notify_msg **msg)
+{
+    struct msg_arg new_args[MSG_MAX_ARGS];
+    struct msg_arg old_args[MSG_MAX_ARGS];
+    struct x52d_notify_msg *merged;
+    int argc_new;
+    int argc_old;
+
+    argc_new = msg_args(*msg, new_args);
+    for (int i = queue->count - 1; i >= oldest; i--) {
+        argc_old = msg_args(queue->msg[SLOT(queue, i)], old_args);
+
+        if (is_axis(new_args, argc_new) && is_axis(old_args, argc_old)) {
+            merged = merge_axes(old_args, argc_old, new_args, argc_new);
+            if (merged == NULL) {
+                return false;
+            }
+            queue_remove(queue, i);
+            *msg = merged;
+            return true;
+        }
+
+        if (same_key(old_args, argc_old, new_args, argc_new)) {
+            queue_remove(queue, i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Make room for a new notification in a full queue. The head notification
+ * cannot be removed once part of it has been sent, or the client would see a
+ * truncated frame.
+ */
+static int queue_make_room(struct x52d_notify_queue *queue,
+                           struct x52d_notify_msg **msg)
+{
+    int oldest = (queue->sent > 0) ? 1 : 0;
+
+    switch (queue->policy) {
+    case X52D_NOTIFY_DISCONNECT:
+        return EOVERFLOW;
+
+    case X52D_NOTIFY_COALESCE:
+        if (queue_coalesce(queue, oldest, msg)) {
+            queue->coalesced++;
+            return 0;
+        }
+        // Nothing was superseded, fall back to dropping the oldest
+        /* fall through */
+
+    case X52D_NOTIFY_DROP_OLDEST:
+    default:
+        if (oldest == 0) {
+            x52d_notify_msg_put(queue->msg[queue->head]);
+            queue->head = SLOT(queue, 1);
+            queue->count--;
+        } else {
+            queue_remove(queue, oldest);
+        }
+        queue->dropped++;
+        return 0;
+    }
+}
+
+/*
+ * Queue a notification, taking a new reference to it. Returns EOVERFLOW if
+ * the queue is full and the client should be disconnected.
+ */
+int x52d_notify_queue_push(struct x52d_notify_queue *queue,
+                           struct x52d_notify_msg *msg)
+{
+    struct x52d_notify_msg *queued = msg;
+    int rc;
+
+    if (queue->count == X52D_NOTIFY_QUEUE_LEN) {
+        rc = queue_make_room(queue, &queued);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    // A merged notification already has a reference for the queue
+    if (queued == msg) {
+        msg->refs++;
+    }
+    queue->msg[SLOT(queue, queue->count)] = queued;
+    queue->count++;
+
+    return 0;
+}
+
+/* Fill in iovecs for the unsent data, and return the number filled in */
+int x52d_notify_queue_iov(const struct x52d_notify_queue *queue,
+                          struct iovec *iov, int maxiov)
+{
+    int i;
+
+    for (i = 0; i < queue->count && i < maxiov; i++) {
+        struct x52d_notify_msg *msg = queue->msg[SLOT(queue, i)];
+        size_t skip = (i == 0) ? queue->sent : 0;
+
+        iov[i].iov_base = msg->data + skip;
+        iov[i].iov_len = msg->len - skip;
+    }
+
+    return i;
+}
+
+/* Release the notifications that have been completely sent */
+void x52d_notify_queue_consume(struct x52d_notify_queue *queue, size_t len)
+{
+    while (len > 0 && queue->count > 0) {
+        struct x52d_notify_msg *msg = queue->msg[queue->head];
+        size_t remaining = msg->len - queue->sent;
+
+        if (len < remaining) {
+            queue->sent += len;
+            return;
+        }
+
+        len -= remaining;
+        x52d_notify_msg_put(msg);
+        queue->head = SLOT(queue, 1);
+        queue->count--;
+        queue->sent = 0;
+    }
+}
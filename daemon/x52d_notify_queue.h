@@ -0,0 +1,82 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Notification client queues
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#ifndef X52D_NOTIFY_QUEUE_H
+#define X52D_NOTIFY_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* Maximum number of notifications waiting to be sent to a single client */
+#define X52D_NOTIFY_QUEUE_LEN   64
+
+/* What to do when a client's queue is full */
+enum x52d_notify_policy {
+    /* Discard the oldest queued notification */
+    X52D_NOTIFY_DROP_OLDEST,
+
+    /* Disconnect the client */
+    X52D_NOTIFY_DISCONNECT,
+
+    /*
+     * Discard a queued notification that has been superseded by the new one,
+     * such as a change to the same configuration parameter, or merge the
+     * axis changes into the new notification. If there is none, discard the
+     * oldest notification.
+     */
+    X52D_NOTIFY_COALESCE,
+
+    X52D_NOTIFY_POLICY_MAX
+};
+
+/*
+ * A notification, already framed for sending. It is shared by the queues of
+ * all the clients it is broadcast to, and freed when the last one releases it.
+ */
+struct x52d_notify_msg {
+    unsigned int refs;
+    size_t len;
+    char data[];
+};
+
+struct x52d_notify_queue {
+    struct x52d_notify_msg *msg[X52D_NOTIFY_QUEUE_LEN];
+    int head;
+    int count;
+
+    /* Number of bytes of the head notification that have been sent */
+    size_t sent;
+
+    enum x52d_notify_policy policy;
+    uint64_t dropped;
+    uint64_t coalesced;
+};
+
+struct x52d_notify_msg *x52d_notify_msg_new(const char *payload, size_t len);
+void x52d_notify_msg_put(struct x52d_notify_msg *msg);
+
+void x52d_notify_queue_init(struct x52d_notify_queue *queue,
+                            enum x52d_notify_policy policy);
+void x52d_notify_queue_clear(struct x52d_notify_queue *queue);
+int x52d_notify_queue_push(struct x52d_notify_queue *queue,
+                           struct x52d_notify_msg *msg);
+int x52d_notify_queue_iov(const struct x52d_notify_queue *queue,
+                          struct iovec *iov, int maxiov);
+void x52d_notify_queue_consume(struct x52d_notify_queue *queue, size_t len);
+
+static inline bool x52d_notify_queue_empty(const struct x52d_notify_queue *queue)
+{
+    return queue->count == 0;
+}
+
+int x52d_notify_policy_parse(const char *name);
+const char *x52d_notify_policy_name(enum x52d_notify_policy policy);
+
+#endif // !defined X52D_NOTIFY_QUEUE_H
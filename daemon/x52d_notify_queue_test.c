@@ -0,0 +1,306 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Notification queue test harness
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "x52d_notify_queue.h"
+#include "x52dcomm-internal.h"
+
+static struct x52d_notify_queue queue;
+
+/* Create a notification of the given type, and a sequence number */
+static struct x52d_notify_msg *make_msg(const char *type, int seq)
+{
+    char payload[64];
+    int len;
+
+    len = snprintf(payload, sizeof(payload), "%s", type) + 1;
+    len += snprintf(payload + len, sizeof(payload) - len, "%d", seq) + 1;
+
+    return x52d_notify_msg_new(payload, len);
+}
+
+static void push_msg(const char *type, int seq)
+{
+    struct x52d_notify_msg *msg = make_msg(type, seq);
+
+    assert_non_null(msg);
+    assert_int_equal(x52d_notify_queue_push(&queue, msg), 0);
+    x52d_notify_msg_put(msg);
+}
+
+/* Get the sequence number of the queued notification at the given index */
+static int queued_seq(int idx)
+{
+    struct iovec iov[X52D_NOTIFY_QUEUE_LEN];
+    const char *payload;
+    int count;
+
+    count = x52d_notify_queue_iov(&queue, iov, X52D_NOTIFY_QUEUE_LEN);
+    assert_true(idx < count);
+
+    payload = (const char *)iov[idx].iov_base;
+    if (idx == 0) {
+        payload -= queue.sent;
+    }
+    payload += X52D_FRAME_HDRSZ;
+    return atoi(payload + strlen(payload) + 1);
+}
+
+static int setup(void **state)
+{
+    x52d_notify_queue_init(&queue, X52D_NOTIFY_DROP_OLDEST);
+    return 0;
+}
+
+static int teardown(void **state)
+{
+    x52d_notify_queue_clear(&queue);
+    return 0;
+}
+
+static void test_msg_framing(void **state)
+{
+    struct x52d_notify_msg *msg = x52d_notify_msg_new("CONNECTED", 10);
+    int payload;
+
+    assert_non_null(msg);
+    assert_int_equal(msg->len, X52D_FRAME_HDRSZ + 10);
+    assert_int_equal(x52d_frame_next(msg->data, msg->len, NULL), 10);
+    assert_memory_equal(msg->data + X52D_FRAME_HDRSZ, "CONNECTED", 10);
+    x52d_notify_msg_put(msg);
+
+    /* Empty and oversized notifications are rejected */
+    assert_null(x52d_notify_msg_new("", 0));
+    payload = X52D_FRAME_MAX + 1;
+    assert_null(x52d_notify_msg_new("", payload));
+}
+
+static void test_queue_send(void **state)
+{
+    struct iovec iov[X52D_NOTIFY_QUEUE_LEN];
+    struct x52d_notify_msg *msg = make_msg("EVENT", 1);
+    size_t len = msg->len;
+
+    assert_true(x52d_notify_queue_empty(&queue));
+    assert_int_equal(x52d_notify_queue_push(&queue, msg), 0);
+    assert_int_equal(msg->refs, 2);
+    push_msg("EVENT", 2);
+    assert_int_equal(queue.count, 2);
+
+    assert_int_equal(x52d_notify_queue_iov(&queue, iov, X52D_NOTIFY_QUEUE_LEN), 2);
+    assert_ptr_equal(iov[0].iov_base, msg->data);
+    assert_int_equal(iov[0].iov_len, len);
+
+    /* A partial send resumes from where it left off */
+    x52d_notify_queue_consume(&queue, 3);
+    assert_int_equal(queue.sent, 3);
+    assert_int_equal(x52d_notify_queue_iov(&queue, iov, 1), 1);
+    assert_ptr_equal(iov[0].iov_base, msg->data + 3);
+    assert_int_equal(iov[0].iov_len, len - 3);
+
+    /* Completing the first notification releases it */
+    x52d_notify_queue_consume(&queue, len - 3 + 1);
+    assert_int_equal(msg->refs, 1);
+    assert_int_equal(queue.count, 1);
+    assert_int_equal(queue.sent, 1);
+    assert_int_equal(queued_seq(0), 2);
+
+    x52d_notify_msg_put(msg);
+}
+
+static void fill_queue(const char *type)
+{
+    for (int i = 0; i < X52D_NOTIFY_QUEUE_LEN; i++) {
+        push_msg(type, i);
+    }
+    assert_int_equal(queue.count, X52D_NOTIFY_QUEUE_LEN);
+}
+
+static void test_overflow_drop_oldest(void **state)
+{
+    fill_queue("EVENT");
+    push_msg("EVENT", 100);
+
+    assert_int_equal(queue.count, X52D_NOTIFY_QUEUE_LEN);
+    assert_int_equal(queue.dropped, 1);
+    assert_int_equal(queued_seq(0), 1);
+    assert_int_equal(queued_seq(X52D_NOTIFY_QUEUE_LEN - 1), 100);
+
+    /* A partially sent notification is never dropped */
+    x52d_notify_queue_consume(&queue, 1);
+    push_msg("EVENT", 101);
+    assert_int_equal(queue.dropped, 2);
+    assert_int_equal(queued_seq(0), 1);
+    assert_int_equal(queued_seq(1), 3);
+    assert_int_equal(queued_seq(X52D_NOTIFY_QUEUE_LEN - 1), 101);
+}
+
+static void test_overflow_disconnect(void **state)
+{
+    struct x52d_notify_msg *msg;
+
+    queue.policy = X52D_NOTIFY_DISCONNECT;
+    fill_queue("EVENT");
+
+    msg = make_msg("EVENT", 100);
+    assert_int_equal(x52d_notify_queue_push(&queue, msg), EOVERFLOW);
+    assert_int_equal(msg->refs, 1);
+    assert_int_equal(queue.dropped, 0);
+    x52d_notify_msg_put(msg);
+}
+
+static void push_payload(const char *payload, size_t len)
+{
+    struct x52d_notify_msg *msg = x52d_notify_msg_new(payload, len);
+
+    assert_non_null(msg);
+    assert_int_equal(x52d_notify_queue_push(&queue, msg), 0);
+    x52d_notify_msg_put(msg);
+}
+
+/* Check the payload of the queued notification at the given index */
+static void assert_queued(int idx, const char *payload, size_t len)
+{
+    struct iovec iov[X52D_NOTIFY_QUEUE_LEN];
+    int count;
+
+    count = x52d_notify_queue_iov(&queue, iov, X52D_NOTIFY_QUEUE_LEN);
+    assert_true(idx < count);
+    assert_true(idx > 0 || queue.sent == 0);
+    assert_int_equal(iov[idx].iov_len, X52D_FRAME_HDRSZ + len);
+    assert_memory_equal((const char *)iov[idx].iov_base + X52D_FRAME_HDRSZ, payload, len);
+}
+
+#define PUSH(payload)           push_payload(payload, sizeof(payload))
+#define ASSERT_QUEUED(idx, payload) assert_queued(idx, payload, sizeof(payload))
+
+/* Fill the queue with the given notification, followed by unrelated events */
+static void fill_after(const char *payload, size_t len)
+{
+    push_payload(payload, len);
+    for (int i = 1; i < X52D_NOTIFY_QUEUE_LEN; i++) {
+        push_msg("EVENT", i);
+    }
+}
+
+static void test_overflow_coalesce(void **state)
+{
+    queue.policy = X52D_NOTIFY_COALESCE;
+    PUSH("CONFIG\0Clock\0Enabled\0true");
+    for (int i = 1; i < X52D_NOTIFY_QUEUE_LEN - 1; i++) {
+        push_msg("EVENT", i);
+    }
+    PUSH("CONFIG\0Clock\0Enabled\0false");
+
+    /* The newest notification for the same parameter is replaced */
+    PUSH("CONFIG\0Clock\0Enabled\0true");
+    assert_int_equal(queue.coalesced, 1);
+    assert_int_equal(queue.dropped, 0);
+    ASSERT_QUEUED(0, "CONFIG\0Clock\0Enabled\0true");
+    ASSERT_QUEUED(X52D_NOTIFY_QUEUE_LEN - 1, "CONFIG\0Clock\0Enabled\0true");
+    assert_int_equal(queued_seq(X52D_NOTIFY_QUEUE_LEN - 2), X52D_NOTIFY_QUEUE_LEN - 2);
+
+    /* A change to a different parameter doesn't supersede it */
+    PUSH("CONFIG\0Clock\0PrimaryIsLocal\0true");
+    assert_int_equal(queue.coalesced, 1);
+    assert_int_equal(queue.dropped, 1);
+    assert_int_equal(queued_seq(0), 1);
+
+    /* Without a superseded notification, the oldest one is dropped */
+    push_msg("EVENT", 100);
+    assert_int_equal(queue.coalesced, 1);
+    assert_int_equal(queue.dropped, 2);
+    assert_int_equal(queued_seq(0), 2);
+}
+
+static void test_overflow_coalesce_edges(void **state)
+{
+    queue.policy = X52D_NOTIFY_COALESCE;
+    PUSH("BUTTON\0BTN_FIRE\0" "1");
+    for (int i = 1; i < X52D_NOTIFY_QUEUE_LEN; i++) {
+        PUSH("BUTTON\0BTN_A\0" "1");
+    }
+
+    /* Button changes are edges, and are never superseded */
+    PUSH("BUTTON\0BTN_A\0" "0");
+    assert_int_equal(queue.coalesced, 0);
+    assert_int_equal(queue.dropped, 1);
+    ASSERT_QUEUED(0, "BUTTON\0BTN_A\0" "1");
+    ASSERT_QUEUED(X52D_NOTIFY_QUEUE_LEN - 1, "BUTTON\0BTN_A\0" "0");
+}
+
+static void test_overflow_coalesce_axes(void **state)
+{
+    static const char axes[] = "AXIS\0AXIS_X\0" "10\0AXIS_Y\0" "20";
+
+    queue.policy = X52D_NOTIFY_COALESCE;
+    fill_after(axes, sizeof(axes));
+
+    /* The queued axes are merged into the new notification */
+    PUSH("AXIS\0AXIS_Y\0" "25\0AXIS_Z\0" "30");
+    assert_int_equal(queue.coalesced, 1);
+    assert_int_equal(queue.dropped, 0);
+    assert_int_equal(queued_seq(0), 1);
+    ASSERT_QUEUED(X52D_NOTIFY_QUEUE_LEN - 1,
+                  "AXIS\0AXIS_X\0" "10\0AXIS_Y\0" "25\0AXIS_Z\0" "30");
+
+    /* The merged notification can be merged again */
+    PUSH("AXIS\0AXIS_X\0" "5");
+    assert_int_equal(queue.coalesced, 2);
+    ASSERT_QUEUED(X52D_NOTIFY_QUEUE_LEN - 1,
+                  "AXIS\0AXIS_X\0" "5\0AXIS_Y\0" "25\0AXIS_Z\0" "30");
+
+    /* A partially sent notification is never merged */
+    x52d_notify_queue_clear(&queue);
+    fill_after(axes, sizeof(axes));
+    x52d_notify_queue_consume(&queue, 1);
+    PUSH("AXIS\0AXIS_X\0" "5");
+    assert_int_equal(queue.coalesced, 2);
+    assert_int_equal(queue.dropped, 1);
+    ASSERT_QUEUED(X52D_NOTIFY_QUEUE_LEN - 1, "AXIS\0AXIS_X\0" "5");
+}
+
+static void test_policy_names(void **state)
+{
+    for (int i = 0; i < X52D_NOTIFY_POLICY_MAX; i++) {
+        assert_int_equal(x52d_notify_policy_parse(x52d_notify_policy_name(i)), i);
+    }
+
+    assert_int_equal(x52d_notify_policy_parse("Coalesce"), X52D_NOTIFY_COALESCE);
+    assert_int_equal(x52d_notify_policy_parse("foo"), -1);
+    assert_null(x52d_notify_policy_name(X52D_NOTIFY_POLICY_MAX));
+}
+
+#define TEST(fn) cmocka_unit_test_setup_teardown(fn, setup, teardown)
+
+const struct CMUnitTest tests[] = {
+    TEST(test_msg_framing),
+    TEST(test_queue_send),
+    TEST(test_overflow_drop_oldest),
+    TEST(test_overflow_disconnect),
+    TEST(test_overflow_coalesce),
+    TEST(test_overflow_coalesce_edges),
+    TEST(test_overflow_coalesce_axes),
+    TEST(test_policy_names),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, NULL, NULL);
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Profile manager
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+
+#define PINELOG_MODULE X52D_MOD_KEYMAP
+#include "pinelog.h"
+#include "x52d_config.h"
+#include "x52d_const.h"
+#include "x52d_keymap.h"
+
+static char profile_dir[NAME_MAX];
+static char profile_name[NAME_MAX];
+static bool clutch_enabled;
+static bool clutch_latched;
+
+static void profile_reload(void)
+{
+    /* Wait until both the directory and name have been configured */
+    if (profile_dir[0] == '\0' || profile_name[0] == '\0') {
+        return;
+    }
+
+    #if defined HAVE_EVDEV
+    x52d_keymap_evdev_load(profile_dir, profile_name);
+    #endif
+}
+
+void x52d_cfg_set_Profiles_Directory(char *param)
+{
+    PINELOG_DEBUG(_("Setting profile directory to %s"), param);
+    strncpy(profile_dir, param, sizeof(profile_dir) - 1);
+    profile_reload();
+}
+
+void x52d_cfg_set_Profiles_Default(char *param)
+{
+    PINELOG_DEBUG(_("Setting default profile to %s"), param);
+    strncpy(profile_name, param, sizeof(profile_name) - 1);
+    profile_reload();
+}
+
+void x52d_cfg_set_Profiles_ClutchEnabled(bool param)
+{
+    PINELOG_DEBUG(_("Setting clutch enable to %s"),
+                  param ? _("on") : _("off"));
+    clutch_enabled = param;
+    #if defined HAVE_EVDEV
+    x52d_keymap_evdev_set_clutch(clutch_enabled, clutch_latched);
+    #endif
+}
+
+void x52d_cfg_set_Profiles_ClutchLatched(bool param)
+{
+    PINELOG_DEBUG(_("Setting clutch latch to %s"),
+                  param ? _("on") : _("off"));
+    clutch_latched = param;
+    #if defined HAVE_EVDEV
+    x52d_keymap_evdev_set_clutch(clutch_enabled, clutch_latched);
+    #endif
+}
@@ -0,0 +1,60 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Latest report slot
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <string.h>
+#include <sched.h>
+
+#include "x52d_report.h"
+
+void x52d_report_slot_init(struct x52d_report_slot *slot)
+{
+    atomic_init(&slot->seq, 0);
+    memset(&slot->report, 0, sizeof(slot->report));
+}
+
+/* Must only be called by a single thread */
+void x52d_report_slot_write(struct x52d_report_slot *slot,
+                            const libx52io_report *report)
+{
+    unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+    /* Mark the slot as being updated before touching the report */
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memcpy(&slot->report, report, sizeof(slot->report));
+
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+/*
+ * Copy the latest report, and return its sequence count, which readers can
+ * compare to tell if a new report has been written since their last read.
+ */
+unsigned int x52d_report_slot_read(struct x52d_report_slot *slot,
+                                   libx52io_report *report)
+{
+    unsigned int seq;
+
+    for (;;) {
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq & 1) {
+            /* The writer only holds the slot for the length of a copy */
+            sched_yield();
+            continue;
+        }
+
+        memcpy(report, &slot->report, sizeof(*report));
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq) {
+            return seq;
+        }
+    }
+}
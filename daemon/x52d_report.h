@@ -0,0 +1,34 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Latest report slot
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#ifndef X52D_REPORT_H
+#define X52D_REPORT_H
+
+#include <stdatomic.h>
+#include "libx52io.h"
+
+/*
+ * Single writer, multiple reader slot holding the latest report, protected
+ * by a sequence lock. The writer never waits, and copies each report into
+ * the slot exactly once. Readers never block the writer, and retry the copy
+ * if the writer updated the slot while they were reading it.
+ *
+ * The sequence count is odd while the writer is updating the slot.
+ */
+struct x52d_report_slot {
+    atomic_uint seq;
+    libx52io_report report;
+};
+
+void x52d_report_slot_init(struct x52d_report_slot *slot);
+void x52d_report_slot_write(struct x52d_report_slot *slot,
+                            const libx52io_report *report);
+unsigned int x52d_report_slot_read(struct x52d_report_slot *slot,
+                                   libx52io_report *report);
+
+#endif // !defined X52D_REPORT_H
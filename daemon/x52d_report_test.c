@@ -0,0 +1,131 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Latest report slot test harness
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "x52d_report.h"
+
+#define WRITE_COUNT 200000
+
+static struct x52d_report_slot slot;
+
+/* Every field of the report holds the same value, so a torn read is obvious */
+static void fill_report(libx52io_report *report, int value)
+{
+    int i;
+
+    for (i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        report->axis[i] = value;
+    }
+    for (i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        report->button[i] = value & 1;
+    }
+    report->mode = value & 0xFF;
+    report->hat = value & 0xFF;
+}
+
+static bool report_consistent(const libx52io_report *report)
+{
+    int value = report->axis[0];
+    int i;
+
+    for (i = 0; i < LIBX52IO_AXIS_MAX; i++) {
+        if (report->axis[i] != value) {
+            return false;
+        }
+    }
+    for (i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        if (report->button[i] != (value & 1)) {
+            return false;
+        }
+    }
+
+    return report->mode == (value & 0xFF) && report->hat == (value & 0xFF);
+}
+
+static void *writer_thr(void *param)
+{
+    libx52io_report report;
+    int i;
+
+    for (i = 1; i <= WRITE_COUNT; i++) {
+        fill_report(&report, i);
+        x52d_report_slot_write(&slot, &report);
+    }
+
+    return NULL;
+}
+
+static void test_report_slot_read_write(void **state)
+{
+    libx52io_report report;
+    unsigned int seq;
+
+    x52d_report_slot_init(&slot);
+    seq = x52d_report_slot_read(&slot, &report);
+    assert_int_equal(seq, 0);
+    assert_true(report_consistent(&report));
+
+    fill_report(&report, 42);
+    x52d_report_slot_write(&slot, &report);
+
+    memset(&report, 0, sizeof(report));
+    seq = x52d_report_slot_read(&slot, &report);
+    assert_int_equal(seq, 2);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 42);
+    assert_true(report_consistent(&report));
+}
+
+static void test_report_slot_concurrent(void **state)
+{
+    libx52io_report report;
+    pthread_t thr;
+    unsigned int seq;
+    unsigned int last_seq = 0;
+    int last_value = 0;
+    int torn = 0;
+
+    x52d_report_slot_init(&slot);
+    assert_int_equal(pthread_create(&thr, NULL, writer_thr, NULL), 0);
+
+    do {
+        seq = x52d_report_slot_read(&slot, &report);
+        if (!report_consistent(&report)) {
+            torn++;
+        }
+
+        /* Reports are never seen out of order */
+        assert_true(seq >= last_seq);
+        assert_true(report.axis[0] >= last_value);
+        last_seq = seq;
+        last_value = report.axis[0];
+    } while (last_value < WRITE_COUNT);
+
+    pthread_join(thr, NULL);
+    assert_int_equal(torn, 0);
+    assert_int_equal(last_seq, WRITE_COUNT * 2);
+}
+
+const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_report_slot_read_write),
+    cmocka_unit_test(test_report_slot_concurrent),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, NULL, NULL);
+    return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Shared state page
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PINELOG_MODULE X52D_MOD_DEVICE
+#include "pinelog.h"
+#include "x52d_const.h"
+#include "x52d_state.h"
+#include "x52dcomm-internal.h"
+
+_Static_assert(LIBX52IO_AXIS_MAX <= X52D_STATE_AXES, "Too many axes for state page");
+_Static_assert(LIBX52IO_BUTTON_MAX <= 64, "Too many buttons for state page");
+_Static_assert(LIBX52_LED_THROTTLE < X52D_STATE_LEDS, "Too many LEDs for state page");
+
+/* Mapped state page, or NULL if it could not be created */
+static struct x52d_state *state;
+static const char *state_path;
+
+/*
+ * Each section has a single writer at any time, so the sequence count only
+ * needs to be ordered against the section contents, as in x52d_report.c
+ */
+static void seq_begin(atomic_uint *seq)
+{
+    unsigned int val = atomic_load_explicit(seq, memory_order_relaxed);
+
+    atomic_store_explicit(seq, val + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void seq_end(atomic_uint *seq)
+{
+    unsigned int val = atomic_load_explicit(seq, memory_order_relaxed);
+
+    atomic_store_explicit(seq, val + 1, memory_order_release);
+}
+
+#define DEVICE_UPDATE(stmt) do { \
+    if (state != NULL) { \
+        seq_begin(&state->device_seq); \
+        stmt; \
+        seq_end(&state->device_seq); \
+    } \
+} while (0)
+
+int x52d_state_init(const char *path)
+{
+    struct x52d_state *page;
+    int fd;
+
+    state_path = x52d_state_path(path);
+    PINELOG_TRACE("Creating state page %s", state_path);
+
+    /*
+     * Readers of a previous daemon instance may still have the old page
+     * mapped, so replace the file rather than truncating it under them.
+     */
+    if (unlink(state_path) < 0 && errno != ENOENT) {
+        PINELOG_ERROR(_("Error %d removing state page %s: %s"),
+                      errno, state_path, strerror(errno));
+        return -1;
+    }
+
+    fd = open(state_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        PINELOG_ERROR(_("Error %d creating state page %s: %s"),
+                      errno, state_path, strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(fd, sizeof(*page)) < 0) {
+        PINELOG_ERROR(_("Error %d creating state page %s: %s"),
+                      errno, state_path, strerror(errno));
+        goto fail;
+    }
+
+    page = mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+        PINELOG_ERROR(_("Error %d mapping state page %s: %s"),
+                      errno, state_path, strerror(errno));
+        goto fail;
+    }
+    close(fd);
+
+    // The file is zero filled, so only the header needs to be written
+    page->version = X52D_STATE_VERSION;
+    page->size = sizeof(*page);
+    atomic_store_explicit(&page->magic, X52D_STATE_MAGIC, memory_order_release);
+
+    state = page;
+    return 0;
+
+fail:
+    close(fd);
+    unlink(state_path);
+    return -1;
+}
+
+void x52d_state_exit(void)
+{
+    if (state == NULL) {
+        return;
+    }
+
+    /*
+     * Tell any remaining readers that the page is no longer updated. The
+     * page stays mapped until the process exits, since the device thread is
+     * only cancelled, and may still be in the middle of an update.
+     */
+    atomic_store(&state->magic, 0);
+
+    PINELOG_TRACE("Removing state page %s", state_path);
+    unlink(state_path);
+}
+
+void x52d_state_set_connected(bool connected)
+{
+    DEVICE_UPDATE({
+        state->device.connected = connected;
+        if (connected) {
+            state->device.connects++;
+        }
+    });
+}
+
+void x52d_state_count_update(void)
+{
+    DEVICE_UPDATE(state->device.updates++);
+}
+
+void x52d_state_set_text(uint8_t line, const char *text, uint8_t length)
+{
+    if (line >= X52D_STATE_MFD_LINES) {
+        return;
+    }
+
+    if (length > X52D_STATE_MFD_LINE_SIZE) {
+        length = X52D_STATE_MFD_LINE_SIZE;
+    }
+
+    DEVICE_UPDATE({
+        memset(state->device.text[line], ' ', X52D_STATE_MFD_LINE_SIZE);
+        memcpy(state->device.text[line], text, length);
+        state->device.text_len[line] = length;
+    });
+}
+
+void x52d_state_set_led(libx52_led_id led, libx52_led_state led_state)
+{
+    if (led >= X52D_STATE_LEDS) {
+        return;
+    }
+
+    DEVICE_UPDATE(state->device.led[led] = led_state);
+}
+
+void x52d_state_set_brightness(uint8_t mfd, uint16_t brightness)
+{
+    DEVICE_UPDATE(state->device.brightness[mfd ? 0 : 1] = brightness);
+}
+
+void x52d_state_set_shift(uint8_t shift)
+{
+    DEVICE_UPDATE(state->device.shift = shift);
+}
+
+void x52d_state_set_blink(uint8_t blink)
+{
+    DEVICE_UPDATE(state->device.blink = blink);
+}
+
+void x52d_state_set_report(const libx52io_report *report, uint64_t timestamp)
+{
+    struct x52d_input_state *input;
+    uint64_t buttons = 0;
+
+    if (state == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < LIBX52IO_BUTTON_MAX; i++) {
+        if (report->button[i]) {
+            buttons |= UINT64_C(1) << i;
+        }
+    }
+
+    input = &state->input;
+    seq_begin(&state->input_seq);
+    input->timestamp = timestamp;
+    input->reports++;
+    input->buttons = buttons;
+    memcpy(input->axis, report->axis, sizeof(report->axis));
+    input->mode = report->mode;
+    input->hat = report->hat;
+    seq_end(&state->input_seq);
+}
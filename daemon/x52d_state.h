@@ -0,0 +1,35 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Shared state page
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#ifndef X52D_STATE_H
+#define X52D_STATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "libx52.h"
+#include "libx52io.h"
+
+int x52d_state_init(const char *state_path);
+void x52d_state_exit(void);
+
+/*
+ * Device state updates. These are serialized by the device manager, which
+ * calls them with the device mutex held.
+ */
+void x52d_state_set_connected(bool connected);
+void x52d_state_count_update(void);
+void x52d_state_set_text(uint8_t line, const char *text, uint8_t length);
+void x52d_state_set_led(libx52_led_id led, libx52_led_state led_state);
+void x52d_state_set_brightness(uint8_t mfd, uint16_t brightness);
+void x52d_state_set_shift(uint8_t shift);
+void x52d_state_set_blink(uint8_t blink);
+
+/* Input state updates. These must only be called from the I/O thread. */
+void x52d_state_set_report(const libx52io_report *report, uint64_t timestamp);
+
+#endif // !defined X52D_STATE_H
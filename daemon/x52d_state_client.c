@@ -0,0 +1,142 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Shared state page reader
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "x52dcomm-internal.h"
+#include "x52dcomm.h"
+
+struct x52d_state *x52d_state_open(const char *state_path)
+{
+    struct x52d_state *state;
+    struct stat st;
+    int fd;
+    int saved_errno;
+
+    fd = open(x52d_state_path(state_path), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        goto fail;
+    }
+
+    if ((size_t)st.st_size < sizeof(*state)) {
+        errno = EPROTO;
+        goto fail;
+    }
+
+    state = mmap(NULL, sizeof(*state), PROT_READ, MAP_SHARED, fd, 0);
+    if (state == MAP_FAILED) {
+        goto fail;
+    }
+    close(fd);
+
+    if (atomic_load_explicit(&state->magic, memory_order_acquire) != X52D_STATE_MAGIC ||
+        state->version != X52D_STATE_VERSION ||
+        state->size != sizeof(*state)) {
+        munmap(state, sizeof(*state));
+        errno = EPROTO;
+        return NULL;
+    }
+
+    return state;
+
+fail:
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return NULL;
+}
+
+void x52d_state_close(struct x52d_state *state)
+{
+    if (state != NULL) {
+        munmap(state, sizeof(*state));
+    }
+}
+
+#define READ_RETRIES    1000000
+
+/*
+ * Copy a section of the state page, retrying if the daemon updated it while
+ * it was being copied. The daemon only holds a section for the length of a
+ * short update, so readers simply spin, but give up eventually in case the
+ * daemon died in the middle of an update.
+ */
+static int read_section(struct x52d_state *state, atomic_uint *seqp,
+                        void *dst, const void *src, size_t len,
+                        unsigned int *seq)
+{
+    unsigned int start;
+    int retries;
+
+    for (retries = 0; ; retries++) {
+        if (retries == READ_RETRIES) {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        start = atomic_load_explicit(seqp, memory_order_acquire);
+        if (start & 1) {
+            continue;
+        }
+
+        memcpy(dst, src, len);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(seqp, memory_order_relaxed) == start) {
+            break;
+        }
+    }
+
+    if (atomic_load_explicit(&state->magic, memory_order_relaxed) != X52D_STATE_MAGIC) {
+        errno = ESTALE;
+        return -1;
+    }
+
+    if (seq != NULL) {
+        *seq = start;
+    }
+
+    return 0;
+}
+
+int x52d_state_read_device(struct x52d_state *state,
+                           struct x52d_device_state *device,
+                           unsigned int *seq)
+{
+    if (state == NULL || device == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return read_section(state, &state->device_seq, device, &state->device,
+                        sizeof(*device), seq);
+}
+
+int x52d_state_read_input(struct x52d_state *state,
+                          struct x52d_input_state *input,
+                          unsigned int *seq)
+{
+    if (state == NULL || input == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return read_section(state, &state->input_seq, input, &state->input,
+                        sizeof(*input), seq);
+}
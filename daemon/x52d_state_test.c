@@ -0,0 +1,174 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Shared state page test harness
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "x52d_state.h"
+#include "x52dcomm.h"
+
+#define WRITE_COUNT 200000
+
+static char state_path[] = "/tmp/x52d-state-test.XXXXXX";
+static struct x52d_state *state;
+
+static int setup(void **test_state)
+{
+    int fd = mkstemp(state_path);
+
+    assert_true(fd >= 0);
+    close(fd);
+
+    // The daemon replaces any existing file
+    assert_int_equal(x52d_state_init(state_path), 0);
+    state = x52d_state_open(state_path);
+    assert_non_null(state);
+    return 0;
+}
+
+static int teardown(void **test_state)
+{
+    x52d_state_close(state);
+    x52d_state_exit();
+    assert_int_equal(access(state_path, F_OK), -1);
+    strcpy(state_path + strlen(state_path) - 6, "XXXXXX");
+    return 0;
+}
+
+static void test_device_state(void **test_state)
+{
+    struct x52d_device_state device;
+    unsigned int seq;
+    unsigned int last_seq;
+
+    assert_int_equal(x52d_state_read_device(state, &device, &last_seq), 0);
+    assert_int_equal(device.connected, 0);
+    assert_int_equal(device.connects, 0);
+
+    x52d_state_set_connected(true);
+    x52d_state_set_text(1, "Hello", 5);
+    x52d_state_set_text(2, "This line is far too long", 25);
+    x52d_state_set_led(LIBX52_LED_A, LIBX52_LED_STATE_AMBER);
+    x52d_state_set_brightness(1, 96);
+    x52d_state_set_brightness(0, 32);
+    x52d_state_set_shift(1);
+    x52d_state_count_update();
+
+    assert_int_equal(x52d_state_read_device(state, &device, &seq), 0);
+    assert_true(seq != last_seq);
+    assert_int_equal(device.connected, 1);
+    assert_int_equal(device.connects, 1);
+    assert_int_equal(device.updates, 1);
+    assert_int_equal(device.text_len[1], 5);
+    assert_memory_equal(device.text[1], "Hello", 5);
+    assert_int_equal(device.text_len[2], X52D_STATE_MFD_LINE_SIZE);
+    assert_memory_equal(device.text[2], "This line is far", X52D_STATE_MFD_LINE_SIZE);
+    assert_int_equal(device.led[LIBX52_LED_A], LIBX52_LED_STATE_AMBER);
+    assert_int_equal(device.brightness[0], 96);
+    assert_int_equal(device.brightness[1], 32);
+    assert_int_equal(device.shift, 1);
+    assert_int_equal(device.blink, 0);
+
+    // The sequence count is unchanged until the next update
+    assert_int_equal(x52d_state_read_device(state, &device, &last_seq), 0);
+    assert_int_equal(seq, last_seq);
+
+    x52d_state_set_connected(false);
+    assert_int_equal(x52d_state_read_device(state, &device, NULL), 0);
+    assert_int_equal(device.connected, 0);
+    assert_int_equal(device.connects, 1);
+}
+
+static void test_stale_state(void **test_state)
+{
+    struct x52d_input_state input;
+
+    x52d_state_exit();
+    assert_int_equal(x52d_state_read_input(state, &input, NULL), -1);
+    assert_int_equal(errno, ESTALE);
+
+    // A new page can be opened while the old one is still mapped
+    assert_int_equal(x52d_state_init(state_path), 0);
+    x52d_state_close(state);
+    state = x52d_state_open(state_path);
+    assert_non_null(state);
+    assert_int_equal(x52d_state_read_input(state, &input, NULL), 0);
+}
+
+/* Every field of the report holds the same value, so a torn read is obvious */
+static void *writer_thr(void *param)
+{
+    libx52io_report report;
+
+    memset(&report, 0, sizeof(report));
+    for (int i = 1; i <= WRITE_COUNT; i++) {
+        for (int j = 0; j < LIBX52IO_AXIS_MAX; j++) {
+            report.axis[j] = i;
+        }
+        report.button[LIBX52IO_BTN_TRIGGER] = i & 1;
+        report.mode = i & 0xFF;
+        x52d_state_set_report(&report, i);
+    }
+
+    return NULL;
+}
+
+static void test_input_concurrent(void **test_state)
+{
+    struct x52d_input_state input;
+    pthread_t thr;
+    uint64_t last = 0;
+    int torn = 0;
+
+    assert_int_equal(pthread_create(&thr, NULL, writer_thr, NULL), 0);
+
+    do {
+        assert_int_equal(x52d_state_read_input(state, &input, NULL), 0);
+        for (int j = 0; j < LIBX52IO_AXIS_MAX; j++) {
+            if (input.axis[j] != (int32_t)input.timestamp) {
+                torn++;
+            }
+        }
+        if (input.reports != input.timestamp ||
+            input.buttons != (input.timestamp & 1) ||
+            input.mode != (input.timestamp & 0xFF)) {
+            torn++;
+        }
+
+        // Reports are never seen out of order
+        assert_true(input.timestamp >= last);
+        last = input.timestamp;
+    } while (last < WRITE_COUNT);
+
+    pthread_join(thr, NULL);
+    assert_int_equal(torn, 0);
+}
+
+#define TEST(fn) cmocka_unit_test_setup_teardown(fn, setup, teardown)
+
+const struct CMUnitTest tests[] = {
+    TEST(test_device_state),
+    TEST(test_stale_state),
+    TEST(test_input_concurrent),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, NULL, NULL);
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Daemon statistics
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "x52d_latency.h"
+#include "x52d_stats.h"
+
+struct x52d_stat_counter x52d_stats[X52D_STAT_MAX];
+
+/* Values recorded by the last reset, owned by the command thread */
+static uint64_t base_values[X52D_STAT_MAX];
+static struct x52d_latency_stats base_latency[X52D_LAT_MAX];
+
+static uint64_t start_time;
+static uint64_t reset_time;
+
+void x52d_stats_init(void)
+{
+    start_time = x52d_latency_now();
+    reset_time = start_time;
+}
+
+void x52d_stats_get(uint64_t values[X52D_STAT_MAX])
+{
+    for (int i = 0; i < X52D_STAT_MAX; i++) {
+        values[i] = atomic_load_explicit(&x52d_stats[i].value, memory_order_relaxed) -
+                    base_values[i];
+    }
+}
+
+void x52d_stats_get_latency(int stage, uint64_t *count, uint64_t *p50,
+                            uint64_t *p90, uint64_t *p99)
+{
+    struct x52d_latency_stats stats;
+    const struct x52d_latency_stats *base = &base_latency[stage];
+
+    x52d_latency_get(stage, &stats);
+
+    // The histogram may have been cleared by a latency reset since then
+    if (stats.count >= base->count) {
+        stats.count -= base->count;
+        for (int i = 0; i < X52D_LAT_BUCKETS; i++) {
+            stats.buckets[i] -= (stats.buckets[i] >= base->buckets[i]) ?
+                                base->buckets[i] : stats.buckets[i];
+        }
+    }
+
+    *count = stats.count;
+    *p50 = x52d_latency_percentile(&stats, 500);
+    *p90 = x52d_latency_percentile(&stats, 900);
+    *p99 = x52d_latency_percentile(&stats, 990);
+}
+
+void x52d_stats_reset(void)
+{
+    for (int i = 0; i < X52D_STAT_MAX; i++) {
+        base_values[i] = atomic_load_explicit(&x52d_stats[i].value, memory_order_relaxed);
+    }
+
+    for (int stage = 0; stage < X52D_LAT_MAX; stage++) {
+        x52d_latency_get(stage, &base_latency[stage]);
+    }
+
+    reset_time = x52d_latency_now();
+}
+
+uint64_t x52d_stats_uptime(void)
+{
+    return (x52d_latency_now() - start_time) / 1000000;
+}
+
+uint64_t x52d_stats_elapsed(void)
+{
+    return (x52d_latency_now() - reset_time) / 1000000;
+}
@@ -0,0 +1,77 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Daemon statistics
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#ifndef X52D_STATS_H
+#define X52D_STATS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+enum x52d_stat {
+    /* Loop iterations of each thread */
+    X52D_STAT_WAKE_DEVICE,
+    X52D_STAT_WAKE_CLOCK,
+    X52D_STAT_WAKE_IO,
+    X52D_STAT_WAKE_MOUSE,
+    X52D_STAT_WAKE_KEYMAP,
+    X52D_STAT_WAKE_COMMAND,
+    X52D_STAT_WAKE_NOTIFY,
+
+    /* Updates written to the device, counted with the device mutex held */
+    X52D_STAT_DEVICE_UPDATES,
+
+    /* Reports read, and read errors, counted by the I/O thread */
+    X52D_STAT_HID_REPORTS,
+    X52D_STAT_HID_ERRORS,
+
+    /* Timer ticks handled by the mouse thread */
+    X52D_STAT_MOUSE_TICKS,
+
+    X52D_STAT_MAX
+};
+
+/*
+ * Each counter has a single writer, and sits in its own cache line, so that
+ * counting is a plain load and store, and never contends with another thread.
+ */
+struct x52d_stat_counter {
+    _Alignas(64) atomic_uint_fast64_t value;
+};
+
+extern struct x52d_stat_counter x52d_stats[X52D_STAT_MAX];
+
+static inline void x52d_stats_add(enum x52d_stat stat, uint64_t n)
+{
+    atomic_uint_fast64_t *value = &x52d_stats[stat].value;
+
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline void x52d_stats_inc(enum x52d_stat stat)
+{
+    x52d_stats_add(stat, 1);
+}
+
+void x52d_stats_init(void);
+
+/*
+ * The counters are never cleared, since only their owners may write them.
+ * Instead, a reset records the current values, and they are subtracted when
+ * the statistics are read. These must only be called from the command thread.
+ */
+void x52d_stats_get(uint64_t values[X52D_STAT_MAX]);
+void x52d_stats_get_latency(int stage, uint64_t *count, uint64_t *p50,
+                            uint64_t *p90, uint64_t *p99);
+void x52d_stats_reset(void);
+
+/* Time since the daemon started, and since the last reset, in milliseconds */
+uint64_t x52d_stats_uptime(void);
+uint64_t x52d_stats_elapsed(void);
+
+#endif // !defined X52D_STATS_H
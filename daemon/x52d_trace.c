@@ -0,0 +1,195 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Binary event tracer
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "x52d_latency.h"
+#include "x52d_trace.h"
+
+/*
+ * Each ring has a single writer, its own thread, which fills in the record at
+ * the head and then advances the head. Once the ring is full, the oldest
+ * records are overwritten. Each slot has a sequence count, which is odd while
+ * the record is being written, and 2 * (index + 1) once record index is
+ * complete, so the dumper can tell if a slot was overwritten while it was
+ * being copied. Rings are never freed, since the threads that own them are
+ * cancelled asynchronously on exit, so the dumper can read them at any time.
+ */
+struct trace_slot {
+    atomic_uint_fast64_t seq;
+    struct x52d_trace_record record;
+};
+
+struct trace_ring {
+    struct trace_ring *next;
+    char name[X52D_TRACE_NAME_LEN];
+    atomic_uint_fast64_t head;
+    struct trace_slot slots[X52D_TRACE_RING_LEN];
+};
+
+#define RING_MASK   (X52D_TRACE_RING_LEN - 1)
+
+static _Thread_local struct trace_ring *thread_ring;
+
+/* List of all rings, only locked to add a ring, or to dump them */
+static struct trace_ring *rings;
+static unsigned int ring_count;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void x52d_trace_thread_init(const char *name)
+{
+    struct trace_ring *ring;
+
+    if (thread_ring != NULL) {
+        return;
+    }
+
+    ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        // Tracing is best effort, the thread simply won't be traced
+        return;
+    }
+
+    strncpy(ring->name, name, sizeof(ring->name) - 1);
+    atomic_init(&ring->head, 0);
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = rings;
+    rings = ring;
+    ring_count++;
+    pthread_mutex_unlock(&rings_mutex);
+
+    thread_ring = ring;
+}
+
+void x52d_trace(enum x52d_trace_event event, uint32_t arg0, uint32_t arg1, uint32_t arg2)
+{
+    struct trace_ring *ring = thread_ring;
+    struct trace_slot *slot;
+    struct x52d_trace_record *record;
+    uint64_t head;
+
+    if (ring == NULL) {
+        return;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    slot = &ring->slots[head & RING_MASK];
+
+    atomic_store_explicit(&slot->seq, 2 * head + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    record = &slot->record;
+    record->timestamp = x52d_latency_now();
+    record->event = (uint16_t)event;
+    record->reserved = 0;
+    record->arg[0] = arg0;
+    record->arg[1] = arg1;
+    record->arg[2] = arg2;
+
+    atomic_store_explicit(&slot->seq, 2 * head + 2, memory_order_release);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/*
+ * Copy the records of a ring, oldest first, and return the number of records
+ * copied. The writer may overwrite records while they are being copied, so
+ * a record is only kept if its slot had the same sequence count before and
+ * after the copy. Since the writer overwrites the oldest records first, any
+ * records copied before one that was overwritten are discarded too, so that
+ * the dump has no gaps.
+ */
+static uint32_t snapshot_ring(struct trace_ring *ring, struct x52d_trace_record *copy,
+                              uint64_t *lost)
+{
+    struct trace_slot *slot;
+    uint64_t head;
+    uint64_t start;
+    uint64_t seq;
+    uint64_t i;
+
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    start = (head > X52D_TRACE_RING_LEN) ? head - X52D_TRACE_RING_LEN : 0;
+
+    for (i = start; i < head; i++) {
+        slot = &ring->slots[i & RING_MASK];
+
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq == 2 * i + 2) {
+            copy[i - start] = slot->record;
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq) {
+                continue;
+            }
+        }
+
+        // Record i, and so everything before it, has been overwritten
+        start = i + 1;
+    }
+
+    *lost = start;
+    return (uint32_t)(head - start);
+}
+
+int x52d_trace_dump(const char *path)
+{
+    struct x52d_trace_file_header file_header = {
+        .magic = X52D_TRACE_MAGIC,
+        .version = X52D_TRACE_VERSION,
+    };
+    struct x52d_trace_ring_header ring_header;
+    struct x52d_trace_record *copy;
+    struct trace_ring *ring;
+    FILE *fp;
+    int rc = 0;
+
+    copy = malloc(sizeof(*copy) * X52D_TRACE_RING_LEN);
+    if (copy == NULL) {
+        return ENOMEM;
+    }
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        rc = errno;
+        free(copy);
+        return rc;
+    }
+
+    errno = 0;
+    pthread_mutex_lock(&rings_mutex);
+    file_header.rings = ring_count;
+    if (fwrite(&file_header, sizeof(file_header), 1, fp) != 1) {
+        rc = errno ? errno : EIO;
+    }
+
+    for (ring = rings; ring != NULL && rc == 0; ring = ring->next) {
+        memset(&ring_header, 0, sizeof(ring_header));
+        memcpy(ring_header.name, ring->name, sizeof(ring_header.name));
+        ring_header.count = snapshot_ring(ring, copy, &ring_header.lost);
+
+        if (fwrite(&ring_header, sizeof(ring_header), 1, fp) != 1 ||
+            fwrite(copy, sizeof(*copy), ring_header.count, fp) != ring_header.count) {
+            rc = errno ? errno : EIO;
+        }
+    }
+    pthread_mutex_unlock(&rings_mutex);
+
+    if (fclose(fp) != 0 && rc == 0) {
+        rc = errno;
+    }
+    free(copy);
+
+    return rc;
+}
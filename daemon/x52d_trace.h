@@ -0,0 +1,71 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Binary event tracer
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#ifndef X52D_TRACE_H
+#define X52D_TRACE_H
+
+#include <stdint.h>
+
+/* Trace event IDs, in the order of x52d_trace.def */
+enum x52d_trace_event {
+    #define TRACE(id, name, arg0, arg1, arg2) X52D_TRACE_ ## id,
+    #include "x52d_trace.def"
+
+    X52D_TRACE_MAX
+};
+
+/*
+ * Number of records in the ring of each thread, must be a power of 2. A dump
+ * leaves out any record that was overwritten while it was being copied.
+ */
+#define X52D_TRACE_RING_LEN     4096
+
+#define X52D_TRACE_NAME_LEN     16
+
+struct x52d_trace_record {
+    /* CLOCK_MONOTONIC time, in nanoseconds */
+    uint64_t timestamp;
+    uint16_t event;
+    uint16_t reserved;
+    uint32_t arg[3];
+};
+
+/*
+ * A trace dump starts with the file header, followed by each ring, which is
+ * a ring header and its records, oldest first. All fields are written in the
+ * byte order of the host.
+ */
+#define X52D_TRACE_MAGIC        "X52TRACE"
+#define X52D_TRACE_VERSION      1
+
+struct x52d_trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t rings;
+};
+
+struct x52d_trace_ring_header {
+    char name[X52D_TRACE_NAME_LEN];
+    uint32_t count;
+    uint32_t reserved;
+
+    /* Number of older records that were overwritten before the dump */
+    uint64_t lost;
+};
+
+/*
+ * Each thread that records events must first set up its own ring. Events
+ * from threads without a ring are ignored.
+ */
+void x52d_trace_thread_init(const char *name);
+void x52d_trace(enum x52d_trace_event event, uint32_t arg0, uint32_t arg1, uint32_t arg2);
+
+/* Write all the rings to the given file. Returns 0 or an errno value. */
+int x52d_trace_dump(const char *path);
+
+#endif // !defined X52D_TRACE_H
@@ -0,0 +1,184 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Trace ring test harness
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "x52d_trace.h"
+
+struct trace_dump {
+    struct x52d_trace_file_header header;
+    struct x52d_trace_ring_header ring;
+    struct x52d_trace_record records[X52D_TRACE_RING_LEN];
+};
+
+static char dump_path[] = "/tmp/x52d-trace-test-XXXXXX";
+
+static int group_setup(void **state)
+{
+    int fd = mkstemp(dump_path);
+
+    if (fd < 0) {
+        return -1;
+    }
+    close(fd);
+
+    return 0;
+}
+
+static int group_teardown(void **state)
+{
+    unlink(dump_path);
+    return 0;
+}
+
+/* Dump the trace, and read back the first ring */
+static void read_dump(struct trace_dump *dump)
+{
+    FILE *fp;
+
+    assert_int_equal(x52d_trace_dump(dump_path), 0);
+
+    fp = fopen(dump_path, "rb");
+    assert_non_null(fp);
+    memset(dump, 0, sizeof(*dump));
+    assert_int_equal(fread(&dump->header, sizeof(dump->header), 1, fp), 1);
+    assert_int_equal(fread(&dump->ring, sizeof(dump->ring), 1, fp), 1);
+    assert_true(dump->ring.count <= X52D_TRACE_RING_LEN);
+    assert_int_equal(fread(dump->records, sizeof(dump->records[0]), dump->ring.count, fp),
+                     dump->ring.count);
+    fclose(fp);
+}
+
+static void test_untraced_thread(void **state)
+{
+    struct x52d_trace_file_header header;
+    FILE *fp;
+
+    // Events are ignored until the thread has a ring
+    x52d_trace(X52D_TRACE_DISPATCH, 1, 2, 3);
+
+    assert_int_equal(x52d_trace_dump(dump_path), 0);
+    fp = fopen(dump_path, "rb");
+    assert_non_null(fp);
+    assert_int_equal(fread(&header, sizeof(header), 1, fp), 1);
+    assert_int_equal(fgetc(fp), EOF);
+    fclose(fp);
+
+    assert_memory_equal(header.magic, X52D_TRACE_MAGIC, sizeof(header.magic));
+    assert_int_equal(header.version, X52D_TRACE_VERSION);
+    assert_int_equal(header.rings, 0);
+}
+
+static void test_records(void **state)
+{
+    static struct trace_dump dump;
+
+    x52d_trace_thread_init("test");
+    x52d_trace(X52D_TRACE_VENDOR_COMMAND, 0x08, 0x51, 0);
+    x52d_trace(X52D_TRACE_DEVICE_UPDATE_END, (uint32_t)-1, 0, 0);
+
+    read_dump(&dump);
+    assert_int_equal(dump.header.rings, 1);
+    assert_string_equal(dump.ring.name, "test");
+    assert_int_equal(dump.ring.count, 2);
+    assert_int_equal(dump.ring.lost, 0);
+
+    assert_int_equal(dump.records[0].event, X52D_TRACE_VENDOR_COMMAND);
+    assert_int_equal(dump.records[0].arg[0], 0x08);
+    assert_int_equal(dump.records[0].arg[1], 0x51);
+    assert_int_equal(dump.records[1].event, X52D_TRACE_DEVICE_UPDATE_END);
+    assert_int_equal((int32_t)dump.records[1].arg[0], -1);
+    assert_true(dump.records[1].timestamp >= dump.records[0].timestamp);
+}
+
+static void test_wraparound(void **state)
+{
+    static struct trace_dump dump;
+    uint32_t i;
+
+    // Two records are left over from the previous test
+    for (i = 0; i < X52D_TRACE_RING_LEN + 8; i++) {
+        x52d_trace(X52D_TRACE_COMMAND, i, 0, 0);
+    }
+
+    // The oldest records were overwritten, and the rest are in order
+    read_dump(&dump);
+    assert_int_equal(dump.ring.count, X52D_TRACE_RING_LEN);
+    assert_int_equal(dump.ring.lost, 10);
+
+    for (i = 0; i < X52D_TRACE_RING_LEN; i++) {
+        assert_int_equal(dump.records[i].event, X52D_TRACE_COMMAND);
+        assert_int_equal(dump.records[i].arg[0], i + 8);
+    }
+}
+
+static void *writer_thread(void *param)
+{
+    x52d_trace_thread_init("writer");
+    for (uint32_t i = 0; i < 20 * X52D_TRACE_RING_LEN; i++) {
+        x52d_trace(X52D_TRACE_HID_READ, i, 0, 0);
+    }
+
+    return NULL;
+}
+
+static void test_concurrent_dump(void **state)
+{
+    static struct trace_dump dump;
+    pthread_t thr;
+    FILE *fp;
+
+    assert_int_equal(pthread_create(&thr, NULL, writer_thread, NULL), 0);
+    while (x52d_trace_dump(dump_path) == 0) {
+        // The newest ring is first in the dump
+        fp = fopen(dump_path, "rb");
+        assert_non_null(fp);
+        assert_int_equal(fread(&dump.header, sizeof(dump.header), 1, fp), 1);
+        assert_int_equal(fread(&dump.ring, sizeof(dump.ring), 1, fp), 1);
+        assert_int_equal(fread(dump.records, sizeof(dump.records[0]), dump.ring.count, fp),
+                         dump.ring.count);
+        fclose(fp);
+
+        if (dump.header.rings == 2) {
+            // Every record that was dumped must be intact and in sequence
+            for (uint32_t i = 0; i < dump.ring.count; i++) {
+                assert_int_equal(dump.records[i].event, X52D_TRACE_HID_READ);
+                assert_int_equal(dump.records[i].arg[0], dump.ring.lost + i);
+            }
+
+            if (dump.ring.lost + dump.ring.count == 20 * X52D_TRACE_RING_LEN) {
+                break;
+            }
+        }
+    }
+
+    pthread_join(thr, NULL);
+}
+
+const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_untraced_thread),
+    cmocka_unit_test(test_records),
+    cmocka_unit_test(test_wraparound),
+    cmocka_unit_test(test_concurrent_dump),
+};
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, group_setup, group_teardown);
+    return 0;
+}
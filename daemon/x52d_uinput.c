@@ -0,0 +1,92 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - uinput frame builder
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "libevdev/libevdev.h"
+#include "libevdev/libevdev-uinput.h"
+
+#include "x52d_uinput.h"
+
+void x52d_uinput_frame_init(struct x52d_uinput_frame *frame,
+                            struct libevdev_uinput *uidev)
+{
+    frame->uidev = uidev;
+    frame->count = 0;
+    frame->partial = false;
+}
+
+/*
+ * uinput accepts any number of events in a single write, and injects them in
+ * order. The kernel fills in the timestamps, so they are left as zero.
+ */
+static int frame_write(struct x52d_uinput_frame *frame)
+{
+    ssize_t size;
+    ssize_t rc;
+
+    size = frame->count * sizeof(frame->events[0]);
+    frame->count = 0;
+
+    rc = write(libevdev_uinput_get_fd(frame->uidev), frame->events, size);
+    if (rc < 0) {
+        return errno;
+    }
+    if (rc != size) {
+        return EIO;
+    }
+
+    return 0;
+}
+
+int x52d_uinput_frame_add(struct x52d_uinput_frame *frame,
+                          unsigned int type, unsigned int code, int value)
+{
+    struct input_event *ev;
+    int rc = 0;
+
+    if (frame->uidev == NULL) {
+        return ENODEV;
+    }
+
+    /* Always leave room for the SYN_REPORT */
+    if (frame->count == X52D_UINPUT_FRAME_MAX - 1) {
+        rc = frame_write(frame);
+        frame->partial = true;
+    }
+
+    ev = &frame->events[frame->count++];
+    memset(ev, 0, sizeof(*ev));
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+
+    return rc;
+}
+
+bool x52d_uinput_frame_pending(const struct x52d_uinput_frame *frame)
+{
+    return frame->count > 0 || frame->partial;
+}
+
+/* Terminate the frame with a SYN_REPORT, and write it to the device */
+int x52d_uinput_frame_flush(struct x52d_uinput_frame *frame)
+{
+    if (!x52d_uinput_frame_pending(frame)) {
+        return 0;
+    }
+
+    x52d_uinput_frame_add(frame, EV_SYN, SYN_REPORT, 0);
+    frame->partial = false;
+    return frame_write(frame);
+}
@@ -0,0 +1,45 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - uinput frame builder
+ *
+ * Copyright (C) 2021 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#ifndef X52D_UINPUT_H
+#define X52D_UINPUT_H
+
+#include <stdbool.h>
+#include "libevdev/libevdev-uinput.h"
+
+/*
+ * Largest number of events in a single write, including the SYN_REPORT.
+ * Frames with more events are split across multiple writes, but are still
+ * terminated by a single SYN_REPORT.
+ */
+#define X52D_UINPUT_FRAME_MAX   128
+
+/*
+ * A frame accumulates the events generated from a single report, and sends
+ * them to the virtual device with a single write, instead of one write per
+ * event. Frames are meant to be allocated on the stack of the thread that
+ * generates the events.
+ */
+struct x52d_uinput_frame {
+    struct libevdev_uinput *uidev;
+    int count;
+
+    /* Part of the frame has already been written to the device */
+    bool partial;
+
+    struct input_event events[X52D_UINPUT_FRAME_MAX];
+};
+
+void x52d_uinput_frame_init(struct x52d_uinput_frame *frame,
+                            struct libevdev_uinput *uidev);
+int x52d_uinput_frame_add(struct x52d_uinput_frame *frame,
+                          unsigned int type, unsigned int code, int value);
+bool x52d_uinput_frame_pending(const struct x52d_uinput_frame *frame);
+int x52d_uinput_frame_flush(struct x52d_uinput_frame *frame);
+
+#endif // !defined X52D_UINPUT_H
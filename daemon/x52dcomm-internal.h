@@ -9,18 +9,53 @@
 #ifndef X52DCOMM_INTERNAL_H
 #define X52DCOMM_INTERNAL_H
 
+#include <stdint.h>
+#include <stdatomic.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
+#include "x52dcomm.h"
+
 #define X52D_BUFSZ  1024
 
+/*
+ * Framed mode prefixes each command and response with its length, as a
+ * 32-bit integer in network byte order. The payload is never larger than
+ * X52D_BUFSZ.
+ */
+#define X52D_FRAME_HDRSZ    4
+#define X52D_FRAME_MAX      X52D_BUFSZ
+
+/*
+ * Layout of the shared state page. Each section is protected by its own
+ * sequence lock, since they are written by different threads, and is kept on
+ * its own cache line. The sequence count is odd while the section is being
+ * updated. The magic number is cleared when the daemon exits.
+ */
+#define X52D_STATE_MAGIC    0x58353253u /* X52S */
+#define X52D_STATE_VERSION  1
+
+struct x52d_state {
+    atomic_uint magic;
+    uint32_t version;
+    uint32_t size;
+
+    _Alignas(64) atomic_uint device_seq;
+    struct x52d_device_state device;
+
+    _Alignas(64) atomic_uint input_seq;
+    struct x52d_input_state input;
+};
+
 const char *x52d_command_sock_path(const char *sock_path);
 int x52d_setup_command_sock(const char *sock_path, struct sockaddr_un *remote);
 const char *x52d_notify_sock_path(const char *sock_path);
 int x52d_setup_notify_sock(const char *sock_path, struct sockaddr_un *remote);
+const char *x52d_state_path(const char *state_path);
 int x52d_set_socket_nonblocking(int sock_fd);
 int x52d_listen_socket(struct sockaddr_un *local, int len, int sock_fd);
-void x52d_split_args(int *argc, char **argv, char *buffer, int buflen);
+void x52d_split_args(int *argc, char **argv, int maxargs, char *buffer, int buflen);
+int x52d_frame_next(const char *buffer, int buflen, uint32_t *framelen);
 
 #endif // !defined X52DCOMM_INTERNAL_H
@@ -21,6 +21,7 @@
 #define X52DCOMM_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -123,11 +124,112 @@ int x52d_format_command(int argc, const char **argv, char *buffer, size_t buflen
  */
 int x52d_send_command(int sock_fd, char *buffer, size_t bufin, size_t bufout);
 
+/**
+ * @brief Switch a command connection to framed mode.
+ *
+ * By default, the daemon treats each \c recv on the command socket as exactly
+ * one command, so the client must wait for the response before sending the
+ * next command. In framed mode, each command and response is prefixed with
+ * its length, which allows the client to send several commands back to back
+ * with \ref x52d_send_frame, and read the responses in order with
+ * \ref x52d_recv_frame.
+ *
+ * Once switched, the connection remains in framed mode until it is closed,
+ * and \ref x52d_send_command must no longer be used on it.
+ *
+ * @param[in]   sock_fd Socket descriptor returned from
+ *                      \ref x52d_dial_command
+ *
+ * @returns 0 on success
+ * @returns -1 on an error condition, and \c errno is set accordingly.
+ *
+ * @exception EPROTONOSUPPORT returned if the daemon does not support framed
+ * mode
+ */
+int x52d_command_framed(int sock_fd);
+
+/**
+ * @brief Send a single command frame to the daemon.
+ *
+ * This sends the command in \p buffer, as formatted by
+ * \ref x52d_format_command, to a connection in framed mode. It does not wait
+ * for the response, which must be read using \ref x52d_recv_frame. Responses
+ * are returned in the same order as the commands were sent.
+ *
+ * Clients should not have more than a few dozen commands awaiting a response,
+ * as the daemon will stop reading commands if the client does not read the
+ * responses.
+ *
+ * @param[in]   sock_fd Socket descriptor in framed mode
+ * @param[in]   buffer  Pointer to the formatted command
+ * @param[in]   buflen  Length of the command, at most 1024 bytes
+ *
+ * @returns 0 on success
+ * @returns -1 on an error condition, and \c errno is set accordingly.
+ *
+ * @exception EMSGSIZE returned if the command is too long
+ */
+int x52d_send_frame(int sock_fd, const char *buffer, size_t buflen);
+
+/**
+ * @brief Receive a single response frame from the daemon.
+ *
+ * This is a blocking function and will not return until a complete response
+ * is received from the server, or an exception condition occurs. The
+ * response is in the same format as returned by \ref x52d_send_command.
+ *
+ * @param[in]   sock_fd Socket descriptor in framed mode
+ * @param[out]  buffer  Buffer to store the response
+ * @param[in]   buflen  Length of the buffer, which should be at least 1024
+ *                      bytes
+ *
+ * @returns number of bytes in the response
+ * @returns -1 on an error condition, and \c errno is set accordingly.
+ *
+ * @exception EMSGSIZE returned if the response does not fit in \p buffer. The
+ * response is discarded, and the next call will return the next response.
+ * @exception ECONNRESET returned if the daemon closed the connection
+ */
+int x52d_recv_frame(int sock_fd, char *buffer, size_t buflen);
+
 /**
  * @brief Notification callback function type
  */
 typedef int (* x52d_notify_callback_fn)(int argc, char **argv);
 
+/**
+ * @brief Send a request on the notify socket
+ *
+ * Clients may change how the daemon delivers notifications to them, by
+ * sending requests on the notify socket. The daemon acknowledges each request
+ * with a notification, which begins with either \c OK or \c ERR.
+ *
+ * The following requests are supported:
+ *
+ * - \c policy \a name - Select what the daemon does when the client does not
+ *   read notifications as fast as they are generated, and its queue of
+ *   pending notifications is full. \a name is one of \c drop-oldest (the
+ *   default), which discards the oldest queued notification, \c disconnect,
+ *   which closes the connection, or \c coalesce, which discards an older
+ *   queued notification that the new one supersedes, such as a change to the
+ *   same configuration parameter, and merges queued axis changes.
+ * - \c subscribe \a topic... - Receive notifications for the given topics, in
+ *   addition to the current subscriptions. The topic \c all subscribes to
+ *   every topic. Clients receive \c device notifications until they change
+ *   their subscriptions.
+ * - \c unsubscribe \a topic... - Stop receiving notifications for the given
+ *   topics.
+ *
+ * @param[in]   sock_fd     Socket descriptor returned from
+ *                          \ref x52d_dial_notify
+ * @param[in]   argc        Number of arguments in the request
+ * @param[in]   argv        Pointer to an array of arguments
+ *
+ * @returns 0 on success
+ * @returns -1 on an error condition, and \c errno is set accordingly.
+ */
+int x52d_notify_request(int sock_fd, int argc, const char **argv);
+
 /**
  * @brief Receive a notification from the daemon
  *
@@ -136,6 +238,9 @@ typedef int (* x52d_notify_callback_fn)(int argc, char **argv);
  * with the arguments as string pointers. It will return the return value of
  * the callback function, if it was called.
  *
+ * Notifications are framed in the same way as responses in framed mode on the
+ * command socket, so each call returns exactly one notification.
+ *
  * This is a blocking function and will not return until either a notification
  * is received from the server, or an exception condition occurs.
  *
@@ -149,6 +254,332 @@ typedef int (* x52d_notify_callback_fn)(int argc, char **argv);
  */
 int x52d_recv_notification(int sock_fd, x52d_notify_callback_fn callback);
 
+/**
+ * @brief Asynchronous connection to the daemon
+ *
+ * A connection object wraps a non-blocking socket to the daemon, and allows a
+ * client to use the daemon from its own event loop, instead of blocking in
+ * \ref x52d_send_command or \ref x52d_recv_notification. The client polls the
+ * descriptor returned by \ref x52d_conn_fd for the events returned by
+ * \ref x52d_conn_events, and calls \ref x52d_conn_process whenever the
+ * descriptor is ready. Responses and notifications are delivered through
+ * callbacks from \ref x52d_conn_process.
+ *
+ * Command connections use framed mode, so any number of commands may be
+ * submitted without waiting for their responses, and a single connection can
+ * be used for the lifetime of the client.
+ */
+struct x52d_conn;
+
+/**
+ * @brief Response callback function type
+ *
+ * Called once for each command submitted with \ref x52d_conn_submit.
+ *
+ * @param[in]   param   Parameter passed to \ref x52d_conn_submit
+ * @param[in]   ticket  Ticket returned by \ref x52d_conn_submit
+ * @param[in]   error   0 if a response was received, or an \c errno value if
+ *                      the connection failed before the response was received
+ * @param[in]   argc    Number of strings in the response, or 0 on error
+ * @param[in]   argv    Strings in the response, the first of which is \c OK,
+ *                      \c ERR or \c DATA. These are only valid until the
+ *                      callback returns.
+ */
+typedef void (* x52d_conn_response_fn)(void *param, int ticket, int error,
+                                       int argc, char **argv);
+
+/**
+ * @brief Asynchronous notification callback function type
+ *
+ * Called for each notification received on a notification connection.
+ *
+ * @param[in]   param   Parameter passed to \ref x52d_conn_dial_notify
+ * @param[in]   argc    Number of strings in the notification
+ * @param[in]   argv    Strings in the notification. These are only valid
+ *                      until the callback returns.
+ */
+typedef void (* x52d_conn_notify_fn)(void *param, int argc, char **argv);
+
+/**
+ * @brief Open an asynchronous connection to the daemon command socket.
+ *
+ * The \p sock_path parameter may be NULL, in which case, it will use the
+ * default socket path. The connection switches to framed mode as soon as it
+ * is processed, and commands submitted before the daemon acknowledges the
+ * switch are held until then.
+ *
+ * @param[in]   sock_path   Path to the daemon command socket.
+ *
+ * @returns Pointer to the connection on success.
+ * @returns NULL on failure, and set \c errno accordingly.
+ */
+struct x52d_conn *x52d_conn_dial_command(const char *sock_path);
+
+/**
+ * @brief Open an asynchronous connection to the daemon notify socket.
+ *
+ * The \p sock_path parameter may be NULL, in which case, it will use the
+ * default socket path. Requests may be sent on the connection with
+ * \ref x52d_conn_submit, and the acknowledgements are delivered to
+ * \p callback along with the notifications, as described in
+ * \ref x52d_notify_request.
+ *
+ * @param[in]   sock_path   Path to the daemon notify socket.
+ * @param[in]   callback    Function to call for each notification
+ * @param[in]   param       Parameter to pass to \p callback
+ *
+ * @returns Pointer to the connection on success.
+ * @returns NULL on failure, and set \c errno accordingly.
+ */
+struct x52d_conn *x52d_conn_dial_notify(const char *sock_path,
+                                        x52d_conn_notify_fn callback,
+                                        void *param);
+
+/**
+ * @brief Close an asynchronous connection.
+ *
+ * The callbacks of any commands still awaiting a response are called with
+ * \c ECANCELED. This must not be called from within a callback.
+ *
+ * @param[in]   conn    Connection to close, may be NULL
+ */
+void x52d_conn_close(struct x52d_conn *conn);
+
+/**
+ * @brief Get the descriptor of an asynchronous connection.
+ *
+ * The descriptor is non-blocking, and must only be used for polling. It
+ * remains valid until the connection is closed.
+ *
+ * @param[in]   conn    Connection returned by \ref x52d_conn_dial_command or
+ *                      \ref x52d_conn_dial_notify
+ *
+ * @returns socket file descriptor
+ */
+int x52d_conn_fd(struct x52d_conn *conn);
+
+/**
+ * @brief Get the events to poll for on an asynchronous connection.
+ *
+ * This is always \c POLLIN, and also \c POLLOUT while there is data waiting
+ * to be sent. The events change whenever a command is submitted or the
+ * connection is processed.
+ *
+ * @param[in]   conn    Connection to check
+ *
+ * @returns \c poll(2) events to wait for
+ */
+short x52d_conn_events(struct x52d_conn *conn);
+
+/**
+ * @brief Get the number of commands awaiting a response.
+ *
+ * @param[in]   conn    Connection to check
+ *
+ * @returns number of commands submitted whose callback has not been called
+ */
+int x52d_conn_pending(struct x52d_conn *conn);
+
+/**
+ * @brief Submit a command on an asynchronous connection.
+ *
+ * The command is queued, and sent when the connection is next processed. The
+ * callback is called from \ref x52d_conn_process when the response is
+ * received. Responses are always received in the order in which the commands
+ * were submitted.
+ *
+ * On a notification connection, the command is sent as a request, and
+ * \p callback must be NULL, since the daemon acknowledges requests with a
+ * notification.
+ *
+ * @param[in]   conn        Connection to send the command on
+ * @param[in]   argc        Number of arguments in the command
+ * @param[in]   argv        Pointer to an array of arguments
+ * @param[in]   callback    Function to call with the response, may be NULL
+ * @param[in]   param       Parameter to pass to \p callback
+ *
+ * @returns Non-negative ticket identifying the command on success. Tickets
+ * are assigned in increasing order, and wrap around to 0.
+ * @returns -1 on an error condition, and \c errno is set accordingly.
+ *
+ * @exception E2BIG returned if the command is too long
+ * @exception EINVAL returned if \p callback is not NULL on a notification
+ * connection
+ * @exception ENOTCONN returned if the connection has failed. The \c errno
+ * value for the failure was returned by \ref x52d_conn_process.
+ */
+int x52d_conn_submit(struct x52d_conn *conn, int argc, const char **argv,
+                     x52d_conn_response_fn callback, void *param);
+
+/**
+ * @brief Process an asynchronous connection.
+ *
+ * This sends as much of the queued commands as the socket accepts, and reads
+ * all the responses and notifications available, calling the callbacks for
+ * each of them. It never blocks, and may be called at any time, not only
+ * when \c poll(2) reports that the descriptor is ready. The callbacks may
+ * submit further commands.
+ *
+ * If the connection fails, the callbacks of all the commands awaiting a
+ * response are called with the error, and the client must close the
+ * connection.
+ *
+ * @param[in]   conn    Connection to process
+ *
+ * @returns 0 on success
+ * @returns -1 if the connection has failed, and \c errno is set accordingly.
+ *
+ * @exception ECONNRESET returned if the daemon closed the connection
+ * @exception EPROTO returned if the daemon sent an invalid frame
+ * @exception EPROTONOSUPPORT returned if the daemon does not support framed
+ * mode
+ */
+int x52d_conn_process(struct x52d_conn *conn);
+
+/**
+ * @brief Shared state page published by the daemon
+ *
+ * The daemon publishes a read-only snapshot of the device and input state in
+ * a shared memory file, which clients may map with \ref x52d_state_open.
+ * Reading the state is a copy from memory, which takes no system calls and
+ * never wakes up the daemon.
+ */
+struct x52d_state;
+
+/** Number of LED states in \ref x52d_device_state, indexed by LED ID */
+#define X52D_STATE_LEDS             24
+
+/** Number of MFD lines in \ref x52d_device_state */
+#define X52D_STATE_MFD_LINES        3
+
+/** Maximum length of an MFD line in \ref x52d_device_state */
+#define X52D_STATE_MFD_LINE_SIZE    16
+
+/** Number of axes in \ref x52d_input_state */
+#define X52D_STATE_AXES             16
+
+/**
+ * @brief Device state, as last written by the daemon
+ */
+struct x52d_device_state {
+    /** Number of times the device has been connected */
+    uint64_t connects;
+
+    /** Number of updates written to the device */
+    uint64_t updates;
+
+    /** MFD and LED brightness */
+    uint16_t brightness[2];
+
+    /** Non-zero if the device is connected */
+    uint8_t connected;
+
+    /** Shift indicator state */
+    uint8_t shift;
+
+    /** Blink state of the info and hat LEDs */
+    uint8_t blink;
+
+    /** LED states, indexed by \c libx52_led_id */
+    uint8_t led[X52D_STATE_LEDS];
+
+    /** Length of the text on each MFD line */
+    uint8_t text_len[X52D_STATE_MFD_LINES];
+
+    /** Text on each MFD line, not NUL terminated */
+    char text[X52D_STATE_MFD_LINES][X52D_STATE_MFD_LINE_SIZE];
+};
+
+/**
+ * @brief Latest input report read by the daemon
+ */
+struct x52d_input_state {
+    /** Time the report was read, in nanoseconds from \c CLOCK_MONOTONIC */
+    uint64_t timestamp;
+
+    /** Number of reports read */
+    uint64_t reports;
+
+    /** Pressed buttons, one bit per \c libx52io_button */
+    uint64_t buttons;
+
+    /** Axis values, indexed by \c libx52io_axis */
+    int32_t axis[X52D_STATE_AXES];
+
+    /** Current mode - 1, 2 or 3 */
+    uint8_t mode;
+
+    /** Hat position 0-8 */
+    uint8_t hat;
+};
+
+/**
+ * @brief Map the daemon shared state page.
+ *
+ * The \p state_path parameter may be NULL, in which case, it will use the
+ * default path. Once finished, the client must use \ref x52d_state_close to
+ * unmap the state page.
+ *
+ * @param[in]   state_path  Path to the daemon state page.
+ *
+ * @returns Pointer to the mapped state page on success.
+ * @returns NULL on failure, and set \c errno accordingly.
+ *
+ * @exception EPROTO returned if the file is not a state page of a compatible
+ * version
+ */
+struct x52d_state *x52d_state_open(const char *state_path);
+
+/**
+ * @brief Unmap the daemon shared state page.
+ *
+ * @param[in]   state   Pointer returned from \ref x52d_state_open
+ */
+void x52d_state_close(struct x52d_state *state);
+
+/**
+ * @brief Read a consistent snapshot of the device state.
+ *
+ * The daemon updates the state without waiting for readers, and the read is
+ * retried if the state changes while it is being copied. The sequence count
+ * changes whenever the state is updated, so that clients polling the state
+ * can skip unchanged snapshots.
+ *
+ * @param[in]   state   Pointer returned from \ref x52d_state_open
+ * @param[out]  device  Device state
+ * @param[out]  seq     Sequence count of the snapshot, may be NULL
+ *
+ * @returns 0 on success
+ * @returns -1 on failure, and set \c errno accordingly.
+ *
+ * @exception ESTALE returned if the daemon has exited, and the client must
+ * open the state page again.
+ * @exception EAGAIN returned if the state was being updated throughout the
+ * read, which should only happen if the daemon died during an update.
+ */
+int x52d_state_read_device(struct x52d_state *state,
+                           struct x52d_device_state *device,
+                           unsigned int *seq);
+
+/**
+ * @brief Read a consistent snapshot of the latest input report.
+ *
+ * This behaves in the same way as \ref x52d_state_read_device.
+ *
+ * @param[in]   state   Pointer returned from \ref x52d_state_open
+ * @param[out]  input   Input state
+ * @param[out]  seq     Sequence count of the snapshot, may be NULL
+ *
+ * @returns 0 on success
+ * @returns -1 on failure, and set \c errno accordingly.
+ *
+ * @exception ESTALE returned if the daemon has exited, and the client must
+ * open the state page again.
+ */
+int x52d_state_read_input(struct x52d_state *state,
+                          struct x52d_input_state *input,
+                          unsigned int *seq);
+
 /** @} */
 #ifdef __cplusplus
 }
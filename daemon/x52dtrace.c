@@ -0,0 +1,166 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Trace decoder
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+/**
+@page x52dtrace Trace decoder for the X52 daemon
+
+\htmlonly
+<b>x52dtrace</b> - Decode a trace dumped by the X52 daemon
+\endhtmlonly
+
+# SYNOPSIS
+<tt>\b x52dtrace \a trace-file</tt>
+
+# DESCRIPTION
+
+x52dtrace decodes a trace written by the `trace dump` command of the X52
+daemon, and prints the events from all the threads in the order in which they
+were recorded, one per line. Each line shows the time since the first event
+in seconds, the thread that recorded the event, the event name, and its
+arguments.
+
+The trace must be decoded on a machine with the same byte order as the one
+that recorded it.
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "x52d_const.h"
+#include "x52d_trace.h"
+
+#define APP_NAME "x52dtrace"
+
+struct event_info {
+    const char *name;
+    const char *args[3];
+};
+
+static const struct event_info events[X52D_TRACE_MAX] = {
+    #define TRACE(id, name, arg0, arg1, arg2) \
+        [X52D_TRACE_ ## id] = { name, { arg0, arg1, arg2 } },
+    #include "x52d_trace.def"
+};
+
+struct entry {
+    struct x52d_trace_record record;
+    const char *thread;
+};
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct entry *ea = a;
+    const struct entry *eb = b;
+
+    if (ea->record.timestamp < eb->record.timestamp) {
+        return -1;
+    }
+
+    return ea->record.timestamp > eb->record.timestamp;
+}
+
+static void print_entry(const struct entry *entry, uint64_t start)
+{
+    const struct x52d_trace_record *record = &entry->record;
+    uint64_t elapsed = record->timestamp - start;
+
+    printf("%llu.%09llu %-*s ", (unsigned long long)(elapsed / 1000000000),
+           (unsigned long long)(elapsed % 1000000000), X52D_TRACE_NAME_LEN, entry->thread);
+
+    if (record->event >= X52D_TRACE_MAX) {
+        printf("event_%u %u %u %u\n", record->event,
+               record->arg[0], record->arg[1], record->arg[2]);
+        return;
+    }
+
+    fputs(events[record->event].name, stdout);
+    for (int i = 0; i < 3; i++) {
+        if (*events[record->event].args[i] != '\0') {
+            printf(" %s=%d", events[record->event].args[i], (int32_t)record->arg[i]);
+        }
+    }
+    putchar('\n');
+}
+
+int main(int argc, char **argv)
+{
+    struct x52d_trace_file_header header;
+    struct x52d_trace_ring_header ring;
+    char (*names)[X52D_TRACE_NAME_LEN + 1] = NULL;
+    struct entry *entries = NULL;
+    size_t count = 0;
+    int rc = EXIT_FAILURE;
+    FILE *fp;
+
+    if (argc != 2) {
+        fprintf(stderr, _("Usage: %s trace-file\n"), APP_NAME);
+        return EXIT_FAILURE;
+    }
+
+    fp = fopen(argv[1], "rb");
+    if (fp == NULL) {
+        fprintf(stderr, _("Unable to open %s: %s\n"), argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, X52D_TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, _("%s is not an X52 daemon trace\n"), argv[1]);
+        goto cleanup;
+    }
+
+    if (header.version != X52D_TRACE_VERSION) {
+        fprintf(stderr, _("Unsupported trace version %u\n"), header.version);
+        goto cleanup;
+    }
+
+    names = calloc(header.rings, sizeof(*names));
+    entries = calloc((size_t)header.rings * X52D_TRACE_RING_LEN, sizeof(*entries));
+    if (header.rings != 0 && (names == NULL || entries == NULL)) {
+        fprintf(stderr, _("Unable to allocate memory for trace\n"));
+        goto cleanup;
+    }
+
+    for (uint32_t r = 0; r < header.rings; r++) {
+        if (fread(&ring, sizeof(ring), 1, fp) != 1 || ring.count > X52D_TRACE_RING_LEN) {
+            fprintf(stderr, _("Truncated trace in %s\n"), argv[1]);
+            goto cleanup;
+        }
+
+        memcpy(names[r], ring.name, X52D_TRACE_NAME_LEN);
+        if (ring.lost != 0) {
+            fprintf(stderr, _("Thread %s: %llu older events were overwritten\n"),
+                    names[r], (unsigned long long)ring.lost);
+        }
+
+        for (uint32_t i = 0; i < ring.count; i++) {
+            if (fread(&entries[count].record, sizeof(entries[count].record), 1, fp) != 1) {
+                fprintf(stderr, _("Truncated trace in %s\n"), argv[1]);
+                goto cleanup;
+            }
+            entries[count].thread = names[r];
+            count++;
+        }
+    }
+
+    qsort(entries, count, sizeof(*entries), compare_entries);
+    for (size_t i = 0; i < count; i++) {
+        print_entry(&entries[i], entries[0].record.timestamp);
+    }
+    rc = EXIT_SUCCESS;
+
+cleanup:
+    fclose(fp);
+    free(entries);
+    free(names);
+    return rc;
+}
@@ -0,0 +1,198 @@
+/*
+ * HIDAPI stub driver for testing the Saitek X52/X52 Pro
+ * Report script and capture file loader
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "libhidx52.h"
+#include "io_common.h"
+
+static struct stub_event *add_event(struct stub_event **events, int *count, int *alloc)
+{
+    struct stub_event *tmp;
+
+    if (*count == *alloc) {
+        int new_alloc = *alloc ? *alloc * 2 : 64;
+        tmp = realloc(*events, new_alloc * sizeof(*tmp));
+        if (tmp == NULL) {
+            return NULL;
+        }
+        *events = tmp;
+        *alloc = new_alloc;
+    }
+
+    tmp = &((*events)[*count]);
+    (*count)++;
+    memset(tmp, 0, sizeof(*tmp));
+    return tmp;
+}
+
+static uint16_t get_u16(const unsigned char *buf)
+{
+    return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+static uint64_t get_u64(const unsigned char *buf)
+{
+    uint64_t value = 0;
+
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | buf[i];
+    }
+
+    return value;
+}
+
+/*
+ * Capture files written by libx52io_capture_start. The delay of each report
+ * is the difference between its timestamp and that of the previous report,
+ * unless an explicit interval is given.
+ */
+static int load_capture(FILE *fp, uint64_t interval,
+                        struct stub_event **events, int *count, int *alloc)
+{
+    unsigned char header[X52IO_CAPTURE_HEADER_LEN];
+    unsigned char record[X52IO_CAPTURE_RECORD_LEN];
+    uint64_t last_ts = 0;
+    bool first = true;
+    struct stub_event *ev;
+
+    if (fread(header, sizeof(header), 1, fp) != 1 ||
+        get_u16(header + 8) != X52IO_CAPTURE_VERSION) {
+        return EINVAL;
+    }
+
+    while (fread(record, sizeof(record), 1, fp) == 1) {
+        uint64_t ts = get_u64(record);
+
+        ev = add_event(events, count, alloc);
+        if (ev == NULL) {
+            return ENOMEM;
+        }
+
+        ev->type = EVENT_REPORT;
+        ev->length = record[8];
+        if (ev->length == 0 || ev->length > MAX_REPORT_LEN ||
+            fread(ev->data, ev->length, 1, fp) != 1) {
+            (*count)--;
+            return EINVAL;
+        }
+
+        if (interval) {
+            ev->delay = interval;
+        } else if (!first && ts > last_ts) {
+            ev->delay = ts - last_ts;
+        }
+
+        first = false;
+        last_ts = ts;
+    }
+
+    return 0;
+}
+
+/*
+ * Report scripts are text files with one event per line. Blank lines and
+ * anything following a # are ignored. Each line is one of the following:
+ *
+ *      <hex bytes>         Raw report bytes, separated by whitespace
+ *      delay <ms>          Delay the next report by the given milliseconds
+ *      disconnect <ms>     Disconnect the device for the given milliseconds
+ */
+static int load_script(FILE *fp, uint64_t interval,
+                       struct stub_event **events, int *count, int *alloc)
+{
+    char line[256];
+    char *ptr;
+    char *end;
+    struct stub_event *ev;
+    unsigned long value;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        ptr = strchr(line, '#');
+        if (ptr != NULL) {
+            *ptr = '\0';
+        }
+
+        for (ptr = line; isspace((unsigned char)*ptr); ptr++);
+        if (*ptr == '\0') {
+            continue;
+        }
+
+        ev = add_event(events, count, alloc);
+        if (ev == NULL) {
+            return ENOMEM;
+        }
+
+        if (strncmp(ptr, "delay", 5) == 0 || strncmp(ptr, "disconnect", 10) == 0) {
+            ev->type = (ptr[1] == 'e') ? EVENT_DELAY : EVENT_DISCONNECT;
+            for (; *ptr && !isspace((unsigned char)*ptr); ptr++);
+
+            errno = 0;
+            value = strtoul(ptr, &end, 0);
+            if (errno != 0 || end == ptr) {
+                return EINVAL;
+            }
+            ev->delay = value * 1000000ULL;
+            continue;
+        }
+
+        ev->type = EVENT_REPORT;
+        ev->delay = interval;
+        for (;;) {
+            errno = 0;
+            value = strtoul(ptr, &end, 16);
+            if (end == ptr) {
+                break;
+            }
+            if (errno != 0 || value > 0xff || ev->length == MAX_REPORT_LEN) {
+                return EINVAL;
+            }
+            ev->data[ev->length++] = (unsigned char)value;
+            ptr = end;
+        }
+
+        for (; isspace((unsigned char)*ptr); ptr++);
+        if (*ptr != '\0' || ev->length == 0) {
+            return EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+int load_events(FILE *fp, uint64_t interval, struct stub_event **events, int *count)
+{
+    char magic[X52IO_CAPTURE_MAGIC_LEN];
+    int alloc = 0;
+    int rc;
+
+    *events = NULL;
+    *count = 0;
+
+    if (fread(magic, sizeof(magic), 1, fp) == 1 &&
+        memcmp(magic, X52IO_CAPTURE_MAGIC, sizeof(magic)) == 0) {
+        rewind(fp);
+        rc = load_capture(fp, interval, events, count, &alloc);
+    } else {
+        rewind(fp);
+        rc = load_script(fp, interval, events, count, &alloc);
+    }
+
+    if (rc != 0) {
+        free(*events);
+        *events = NULL;
+        *count = 0;
+    }
+
+    return rc;
+}
@@ -0,0 +1,373 @@
+/*
+ * HIDAPI stub driver for testing the Saitek X52/X52 Pro
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "libhidx52.h"
+
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC  1000000000ULL
+
+/* Simulated device list */
+static struct {
+    unsigned short vid;
+    unsigned short pid;
+} devices[MAX_DEVICES];
+static int num_devices;
+
+static wchar_t manufacturer_string[] = L"Saitek";
+static wchar_t product_string[] = L"Saitek X52 Flight Control System (simulated)";
+
+/* Report input */
+static struct stub_event *events;
+static int num_events;
+static int cursor;
+static bool loop_events;
+
+/* Time at which the last report was delivered, and delay since then */
+static uint64_t last_due;
+static uint64_t pending_delay;
+static bool started;
+
+/* Devices are absent until this time, and the generation identifies handles */
+static uint64_t absent_until;
+static unsigned int generation;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t delay)
+{
+    struct timespec ts;
+
+    ts.tv_sec = delay / NSEC_PER_SEC;
+    ts.tv_nsec = delay % NSEC_PER_SEC;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+/* Open file from environment variable */
+static FILE * fopen_env(const char *env, const char *env_default, const char *mode)
+{
+    // Get the filename from the environment. Use defaults if unset or empty
+    const char *filename = getenv(env);
+    if (filename == NULL || filename[0] == '\0') {
+        filename = env_default;
+    }
+
+    return fopen(filename, mode);
+}
+
+static uint64_t env_number(const char *env)
+{
+    const char *value = getenv(env);
+
+    if (value == NULL || value[0] == '\0') {
+        return 0;
+    }
+
+    return strtoull(value, NULL, 0);
+}
+
+int hid_init(void)
+{
+    FILE *fp;
+    unsigned int vid;
+    unsigned int pid;
+    uint64_t interval;
+    bool has_reports = false;
+
+    hid_exit();
+
+    fp = fopen_env(INPUT_DEVICE_LIST_ENV, DEFAULT_INPUT_DEVICE_LIST_FILE, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    while (num_devices < MAX_DEVICES && fscanf(fp, "%x %x", &vid, &pid) == 2) {
+        devices[num_devices].vid = vid;
+        devices[num_devices].pid = pid;
+        num_devices++;
+    }
+    fclose(fp);
+
+    /* A missing report file is not an error, the device simply stays idle */
+    fp = fopen_env(INPUT_REPORT_FILE_ENV, DEFAULT_INPUT_REPORT_FILE, "rb");
+    if (fp != NULL) {
+        interval = env_number(REPORT_INTERVAL_ENV) * 1000;
+        if (load_events(fp, interval, &events, &num_events) != 0) {
+            fprintf(stderr, "libhidx52: invalid report input\n");
+            fclose(fp);
+            return -1;
+        }
+        fclose(fp);
+    }
+
+    for (int i = 0; i < num_events; i++) {
+        if (events[i].type == EVENT_REPORT) {
+            has_reports = true;
+            break;
+        }
+    }
+
+    /* Looping over a file with no reports would never return */
+    loop_events = has_reports && env_number(REPORT_LOOP_ENV) != 0;
+
+    return 0;
+}
+
+int hid_exit(void)
+{
+    free(events);
+    events = NULL;
+    num_events = 0;
+    num_devices = 0;
+    cursor = 0;
+    loop_events = false;
+
+    last_due = 0;
+    pending_delay = 0;
+    started = false;
+    absent_until = 0;
+
+    return 0;
+}
+
+static bool device_absent(void)
+{
+    return absent_until != 0 && now_ns() < absent_until;
+}
+
+struct hid_device_info *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+    struct hid_device_info *head = NULL;
+    struct hid_device_info **tail = &head;
+    struct hid_device_info *dev;
+
+    if (device_absent()) {
+        return NULL;
+    }
+
+    for (int i = 0; i < num_devices; i++) {
+        if ((vendor_id != 0 && vendor_id != devices[i].vid) ||
+            (product_id != 0 && product_id != devices[i].pid)) {
+            continue;
+        }
+
+        dev = calloc(1, sizeof(*dev));
+        if (dev == NULL) {
+            break;
+        }
+
+        dev->path = malloc(32);
+        if (dev->path == NULL) {
+            free(dev);
+            break;
+        }
+        snprintf(dev->path, 32, "libhidx52:%d", i);
+
+        dev->vendor_id = devices[i].vid;
+        dev->product_id = devices[i].pid;
+        dev->release_number = 0x0100;
+        dev->manufacturer_string = manufacturer_string;
+        dev->product_string = product_string;
+        dev->usage_page = 0x01;
+        dev->usage = 0x04;
+
+        *tail = dev;
+        tail = &dev->next;
+    }
+
+    return head;
+}
+
+void hid_free_enumeration(struct hid_device_info *devs)
+{
+    struct hid_device_info *next;
+
+    while (devs != NULL) {
+        next = devs->next;
+        free(devs->path);
+        free(devs);
+        devs = next;
+    }
+}
+
+static hid_device *open_index(int index)
+{
+    hid_device *dev;
+
+    if (index < 0 || index >= num_devices || device_absent()) {
+        return NULL;
+    }
+
+    dev = calloc(1, sizeof(*dev));
+    if (dev == NULL) {
+        return NULL;
+    }
+
+    dev->index = index;
+    dev->blocking = true;
+    dev->generation = generation;
+
+    return dev;
+}
+
+hid_device *hid_open(unsigned short vendor_id, unsigned short product_id,
+                     const wchar_t *serial_number)
+{
+    (void)serial_number;
+
+    for (int i = 0; i < num_devices; i++) {
+        if (devices[i].vid == vendor_id && devices[i].pid == product_id) {
+            return open_index(i);
+        }
+    }
+
+    return NULL;
+}
+
+hid_device *hid_open_path(const char *path)
+{
+    int index;
+
+    if (path == NULL || sscanf(path, "libhidx52:%d", &index) != 1) {
+        return NULL;
+    }
+
+    return open_index(index);
+}
+
+void hid_close(hid_device *dev)
+{
+    free(dev);
+}
+
+int hid_set_nonblocking(hid_device *dev, int nonblock)
+{
+    dev->blocking = !nonblock;
+    return 0;
+}
+
+/*
+ * Wait for either the deadline or the read timeout, whichever is earlier.
+ * Returns true if the deadline was reached.
+ */
+static bool wait_until(uint64_t deadline, int milliseconds)
+{
+    uint64_t now = now_ns();
+    uint64_t timeout;
+
+    if (deadline <= now) {
+        return true;
+    }
+
+    if (milliseconds < 0) {
+        sleep_ns(deadline - now);
+        return true;
+    }
+
+    timeout = (uint64_t)milliseconds * NSEC_PER_MSEC;
+    if (deadline - now > timeout) {
+        sleep_ns(timeout);
+        return false;
+    }
+
+    sleep_ns(deadline - now);
+    return true;
+}
+
+int hid_read_timeout(hid_device *dev, unsigned char *data, size_t length,
+                     int milliseconds)
+{
+    struct stub_event *ev;
+    uint64_t due;
+
+    if (dev->generation != generation) {
+        /* Device was disconnected since it was opened */
+        return -1;
+    }
+
+    if (!started) {
+        last_due = now_ns();
+        started = true;
+    }
+
+    for (;;) {
+        if (cursor == num_events) {
+            if (!loop_events) {
+                /* Nothing more to report, idle until the timeout */
+                if (milliseconds < 0) {
+                    for (;;) {
+                        sleep_ns(NSEC_PER_SEC);
+                    }
+                }
+                sleep_ns((uint64_t)milliseconds * NSEC_PER_MSEC);
+                return 0;
+            }
+            cursor = 0;
+        }
+
+        ev = &events[cursor];
+        switch (ev->type) {
+        case EVENT_DELAY:
+            pending_delay += ev->delay;
+            cursor++;
+            break;
+
+        case EVENT_DISCONNECT:
+            due = last_due + pending_delay;
+            if (!wait_until(due, milliseconds)) {
+                return 0;
+            }
+
+            /* Invalidate all open handles, and hide the device */
+            absent_until = due + ev->delay;
+            last_due = absent_until;
+            pending_delay = 0;
+            generation++;
+            cursor++;
+            return -1;
+
+        case EVENT_REPORT:
+            due = last_due + pending_delay + ev->delay;
+            if (!wait_until(due, milliseconds)) {
+                return 0;
+            }
+
+            last_due = due;
+            pending_delay = 0;
+            cursor++;
+
+            if (length > (size_t)ev->length) {
+                length = ev->length;
+            }
+            memcpy(data, ev->data, length);
+            return (int)length;
+        }
+    }
+}
+
+int hid_read(hid_device *dev, unsigned char *data, size_t length)
+{
+    return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
+}
+
+const wchar_t *hid_error(hid_device *dev)
+{
+    (void)dev;
+    return L"libhidx52 simulated error";
+}
@@ -0,0 +1,99 @@
+/*
+ * HIDAPI stub driver for testing the Saitek X52/X52 Pro
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "hidapi.h"
+
+/* Maximum number of simulated devices */
+#define MAX_DEVICES     8
+
+/* Maximum size of a simulated report */
+#define MAX_REPORT_LEN  16
+
+struct hid_device_ {
+    /* Index into the device list */
+    int index;
+
+    /* Set if reads without a timeout should block */
+    bool blocking;
+
+    /* Connection generation at the time the device was opened */
+    unsigned int generation;
+};
+
+enum stub_event_type {
+    /* Deliver a report to the reader */
+    EVENT_REPORT,
+
+    /* Delay the next report by the given time */
+    EVENT_DELAY,
+
+    /* Disconnect the device for the given time */
+    EVENT_DISCONNECT,
+};
+
+struct stub_event {
+    enum stub_event_type type;
+
+    /* Delay in nanoseconds before this event takes effect */
+    uint64_t delay;
+
+    int length;
+    unsigned char data[MAX_REPORT_LEN];
+};
+
+/**
+ * @brief Device list file environment variable
+ *
+ * This is used by the test driver to create a temporary environment for
+ * the device list
+ */
+#define INPUT_DEVICE_LIST_ENV           "LIBHIDX52_DEVICE_LIST"
+
+/**
+ * @brief Default file location of the device list file
+ *
+ * This file contains a list of VIDs and PIDs in hexadecimal format separated
+ * by spaces. There must be an even number of entries, each pair corresponding
+ * to a (VID, PID) tuple identifying a single HID device.
+ */
+#define DEFAULT_INPUT_DEVICE_LIST_FILE  "/tmp/libhidx52_device_list"
+
+/**
+ * @brief Report input environment variable
+ *
+ * This points to either a report script, or a capture file written by
+ * libx52io_capture_start. The format is detected automatically.
+ */
+#define INPUT_REPORT_FILE_ENV           "LIBHIDX52_REPORTS"
+
+/**
+ * @brief Default file location of the report input file
+ */
+#define DEFAULT_INPUT_REPORT_FILE       "/tmp/libhidx52_reports"
+
+/**
+ * @brief Report interval environment variable
+ *
+ * If set, this is the interval in microseconds between subsequent reports.
+ * This overrides the timing recorded in a capture file.
+ */
+#define REPORT_INTERVAL_ENV             "LIBHIDX52_INTERVAL"
+
+/**
+ * @brief Report loop environment variable
+ *
+ * If set to a non-zero value, the report input is restarted from the
+ * beginning once it is exhausted.
+ */
+#define REPORT_LOOP_ENV                 "LIBHIDX52_LOOP"
+
+/* Load the report input into the event list */
+int load_events(FILE *fp, uint64_t interval, struct stub_event **events, int *count);
@@ -0,0 +1,244 @@
+/*
+ * HIDAPI stub driver - libx52io input path test suite
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libhidx52.h"
+#include "io_common.h"
+#include "usb-ids.h"
+
+static char device_list[] = "/tmp/hidx52-devices-XXXXXX";
+static char report_file[] = "/tmp/hidx52-reports-XXXXXX";
+static char capture_file[] = "/tmp/hidx52-capture-XXXXXX";
+
+static int make_temp(char *template)
+{
+    int fd = mkstemp(template);
+    if (fd < 0) {
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+static void write_file(const char *path, const char *contents)
+{
+    FILE *fp = fopen(path, "w");
+    assert_non_null(fp);
+    fputs(contents, fp);
+    fclose(fp);
+}
+
+/* 15 byte X52 Pro report with the X axis set to the given value */
+#define REPORT(x) #x " 00 00 00 00 00 00 00 00 00 00 00 00 00 00\n"
+
+static int group_setup(void **state)
+{
+    if (make_temp(device_list) || make_temp(report_file) || make_temp(capture_file)) {
+        return -1;
+    }
+
+    setenv(INPUT_DEVICE_LIST_ENV, device_list, 1);
+    setenv(INPUT_REPORT_FILE_ENV, report_file, 1);
+    return 0;
+}
+
+static int group_teardown(void **state)
+{
+    unlink(device_list);
+    unlink(report_file);
+    unlink(capture_file);
+    return 0;
+}
+
+static int test_setup(void **state)
+{
+    char buf[32];
+
+    snprintf(buf, sizeof(buf), "%04x %04x\n", VENDOR_SAITEK, X52_PROD_X52PRO);
+    write_file(device_list, buf);
+    write_file(report_file, "");
+    unsetenv(REPORT_INTERVAL_ENV);
+    unsetenv(REPORT_LOOP_ENV);
+
+    *state = NULL;
+    return 0;
+}
+
+static int test_teardown(void **state)
+{
+    libx52io_exit(*state);
+    return 0;
+}
+
+/* Initialize the library after the stub inputs have been written */
+static libx52io_context *open_context(void **state, int expected)
+{
+    libx52io_context *ctx;
+
+    assert_int_equal(libx52io_init(&ctx), LIBX52IO_SUCCESS);
+    *state = ctx;
+    assert_int_equal(libx52io_open(ctx), expected);
+    return ctx;
+}
+
+static void test_no_device(void **state)
+{
+    write_file(device_list, "");
+    open_context(state, LIBX52IO_ERROR_NO_DEVICE);
+}
+
+static void test_read_script(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+
+    write_file(report_file,
+               "# Comments and blank lines are ignored\n"
+               "\n"
+               REPORT(12)
+               REPORT(34));
+    ctx = open_context(state, LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_get_product_id(ctx), X52_PROD_X52PRO);
+
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x12);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x34);
+
+    /* Input is exhausted, so the device goes idle */
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_ERROR_TIMEOUT);
+}
+
+static void test_read_delay(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+
+    write_file(report_file, "delay 50\n" REPORT(56));
+    ctx = open_context(state, LIBX52IO_SUCCESS);
+
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_ERROR_TIMEOUT);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 1000), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x56);
+}
+
+static void test_read_interval(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+
+    setenv(REPORT_INTERVAL_ENV, "50000", 1);
+    write_file(report_file, REPORT(01) REPORT(02));
+    ctx = open_context(state, LIBX52IO_SUCCESS);
+
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_ERROR_TIMEOUT);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 1000), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x01);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_ERROR_TIMEOUT);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 1000), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x02);
+}
+
+static void test_read_loop(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+
+    setenv(REPORT_LOOP_ENV, "1", 1);
+    write_file(report_file, REPORT(01) REPORT(02));
+    ctx = open_context(state, LIBX52IO_SUCCESS);
+
+    for (int i = 0; i < 6; i++) {
+        assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_SUCCESS);
+        assert_int_equal(report.axis[LIBX52IO_AXIS_X], (i % 2) + 1);
+    }
+}
+
+static void test_disconnect(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+
+    write_file(report_file, REPORT(01) "disconnect 50\n" REPORT(02));
+    ctx = open_context(state, LIBX52IO_SUCCESS);
+
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_ERROR_IO);
+
+    /* Device stays disconnected for the given duration */
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_ERROR_IO);
+    assert_int_equal(libx52io_open(ctx), LIBX52IO_ERROR_NO_DEVICE);
+
+    usleep(100000);
+    assert_int_equal(libx52io_open(ctx), LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x02);
+}
+
+static void test_capture_replay(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+
+    /* Capture the reports from a script, and play them back through the stub */
+    write_file(report_file, REPORT(11) REPORT(22) REPORT(33));
+    ctx = open_context(state, LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_capture_start(ctx, capture_file), LIBX52IO_SUCCESS);
+    for (int i = 0; i < 3; i++) {
+        assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_SUCCESS);
+    }
+    libx52io_exit(ctx);
+
+    setenv(INPUT_REPORT_FILE_ENV, capture_file, 1);
+    ctx = open_context(state, LIBX52IO_SUCCESS);
+    setenv(INPUT_REPORT_FILE_ENV, report_file, 1);
+
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 1000), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x11);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 1000), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x22);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 1000), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x33);
+    assert_int_equal(libx52io_read_timeout(ctx, &report, 0), LIBX52IO_ERROR_TIMEOUT);
+}
+
+static void test_bad_script(void **state)
+{
+    libx52io_context *ctx;
+
+    write_file(report_file, "not a report\n");
+    assert_int_equal(libx52io_init(&ctx), LIBX52IO_ERROR_INIT_FAILURE);
+}
+
+#define TEST(tc) cmocka_unit_test_setup_teardown(tc, test_setup, test_teardown)
+const struct CMUnitTest tests[] = {
+    TEST(test_no_device),
+    TEST(test_read_script),
+    TEST(test_read_delay),
+    TEST(test_read_interval),
+    TEST(test_read_loop),
+    TEST(test_disconnect),
+    TEST(test_capture_replay),
+    TEST(test_bad_script),
+};
+#undef TEST
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, group_setup, group_teardown);
+    return 0;
+}
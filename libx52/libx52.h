@@ -658,6 +658,32 @@ int libx52_update(libx52_device *x52);
  */
 int libx52_vendor_command(libx52_device *x52, uint16_t index, uint16_t value);
 
+/**
+ * @brief Callback invoked after each vendor control packet
+ *
+ * @param[in]   param   Parameter passed to \ref libx52_set_command_hook
+ * @param[in]   index   wIndex in the USB packet
+ * @param[in]   value   wValue in the USB packet
+ * @param[in]   rc      \ref libx52_error_code returned for the packet
+ */
+typedef void (*libx52_command_hook)(void *param, uint16_t index, uint16_t value, int rc);
+
+/**
+ * @brief Set a callback to observe the vendor control packets
+ *
+ * The callback is invoked after every control packet written to the
+ * joystick, including those written by \ref libx52_update, in the thread
+ * that wrote the packet. It is intended for tracing, and must be cheap, as it
+ * is called while the update is in progress.
+ *
+ * @param[in]   x52     Pointer to the device context
+ * @param[in]   hook    Callback function, or NULL to remove the callback
+ * @param[in]   param   Parameter passed to the callback
+ *
+ * @returns \ref libx52_error_code indicating status
+ */
+int libx52_set_command_hook(libx52_device *x52, libx52_command_hook hook, void *param);
+
 /**
  * @brief Check if the device supports the given feature.
  *
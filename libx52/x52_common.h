@@ -54,6 +54,9 @@ struct libx52_device {
 
     libusb_hotplug_callback_handle hotplug_handle;
     int handle_registered;
+
+    libx52_command_hook command_hook;
+    void *command_hook_param;
 };
 
 /** Flag bits */
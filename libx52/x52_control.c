@@ -16,6 +16,7 @@
 #include "libx52.h"
 #include "x52_commands.h"
 #include "x52_common.h"
+#include "usdt.h"
 
 /* Translate a libusb error to a libx52 error */
 int _x52_translate_libusb_error(enum libusb_error errcode)
@@ -78,6 +79,8 @@ int libx52_vendor_command(libx52_device *x52, uint16_t index, uint16_t value)
         return LIBX52_ERROR_NO_DEVICE;
     }
 
+    X52_PROBE2(libx52, vendor_command_entry, index, value);
+
     /* Allow retry in case of failure */
     for (j = 0; j < 3; j++) {
         rc = libusb_control_transfer(x52->hdl,
@@ -97,7 +100,25 @@ int libx52_vendor_command(libx52_device *x52, uint16_t index, uint16_t value)
         (void)libx52_disconnect(x52);
     }
 
-    return _x52_translate_libusb_error(rc);
+    rc = _x52_translate_libusb_error(rc);
+    X52_PROBE3(libx52, vendor_command_return, index, value, rc);
+    if (x52->command_hook != NULL) {
+        x52->command_hook(x52->command_hook_param, index, value, rc);
+    }
+
+    return rc;
+}
+
+int libx52_set_command_hook(libx52_device *x52, libx52_command_hook hook, void *param)
+{
+    if (!x52) {
+        return LIBX52_ERROR_INVALID_PARAM;
+    }
+
+    x52->command_hook = hook;
+    x52->command_hook_param = param;
+
+    return LIBX52_SUCCESS;
 }
 
 static int _x52_write_shift(libx52_device *x52, uint32_t bit)
@@ -341,6 +362,8 @@ int libx52_update(libx52_device *x52)
     /* Reset the device update mask to 0 */
     x52->update_mask = 0;
 
+    X52_PROBE1(libx52, update_begin, update_mask);
+
     for (i = 0; i < 32; i++) {
         if (tst_bit(&update_mask, i)) {
             rc = LIBX52_SUCCESS;
@@ -359,5 +382,8 @@ int libx52_update(libx52_device *x52)
         }
     }
 
+    /* Any bits left in the mask were not written to the device */
+    X52_PROBE2(libx52, update_end, update_mask, rc);
+
     return rc;
 }
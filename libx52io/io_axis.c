@@ -54,7 +54,7 @@ int libx52io_get_axis_range(libx52io_context *ctx,
         return LIBX52IO_ERROR_INVALID;
     }
 
-    if (ctx->handle == NULL) {
+    if (!_x52io_is_connected(ctx)) {
         return LIBX52IO_ERROR_NO_DEVICE;
     }
 
@@ -0,0 +1,236 @@
+/*
+ * Saitek X52 IO driver - report capture and replay
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "io_common.h"
+
+/* Buffer size for the capture stream, this holds a few seconds of reports */
+#define CAPTURE_BUFFER_SIZE 65536
+
+uint64_t _x52io_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void put_u16(unsigned char *buf, uint16_t value)
+{
+    buf[0] = value & 0xff;
+    buf[1] = value >> 8;
+}
+
+static uint16_t get_u16(const unsigned char *buf)
+{
+    return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+static void put_u64(unsigned char *buf, uint64_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        buf[i] = (value >> (i * 8)) & 0xff;
+    }
+}
+
+static uint64_t get_u64(const unsigned char *buf)
+{
+    uint64_t value = 0;
+
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | buf[i];
+    }
+
+    return value;
+}
+
+int libx52io_capture_start(libx52io_context *ctx, const char *path)
+{
+    unsigned char header[X52IO_CAPTURE_HEADER_LEN];
+
+    if (ctx == NULL || path == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    if (!_x52io_is_connected(ctx)) {
+        return LIBX52IO_ERROR_NO_DEVICE;
+    }
+
+    /* Close any capture that is already in progress */
+    libx52io_capture_stop(ctx);
+
+    ctx->capture = fopen(path, "wb");
+    if (ctx->capture == NULL) {
+        return LIBX52IO_ERROR_IO;
+    }
+
+    /*
+     * Reports are small and frequent, use a large buffer so that the read
+     * path only does a memcpy in the common case.
+     */
+    setvbuf(ctx->capture, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    memcpy(header, X52IO_CAPTURE_MAGIC, X52IO_CAPTURE_MAGIC_LEN);
+    put_u16(header + 8, X52IO_CAPTURE_VERSION);
+    put_u16(header + 10, ctx->vid);
+    put_u16(header + 12, ctx->pid);
+    put_u16(header + 14, ctx->version);
+
+    if (fwrite(header, sizeof(header), 1, ctx->capture) != 1) {
+        libx52io_capture_stop(ctx);
+        return LIBX52IO_ERROR_IO;
+    }
+
+    return LIBX52IO_SUCCESS;
+}
+
+int libx52io_capture_stop(libx52io_context *ctx)
+{
+    int rc = LIBX52IO_SUCCESS;
+
+    if (ctx == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    if (ctx->capture != NULL) {
+        if (fclose(ctx->capture) != 0) {
+            rc = LIBX52IO_ERROR_IO;
+        }
+        ctx->capture = NULL;
+    }
+
+    return rc;
+}
+
+int _x52io_capture_write(libx52io_context *ctx, uint64_t timestamp,
+                         const unsigned char *data, int length)
+{
+    unsigned char record[X52IO_CAPTURE_RECORD_LEN];
+
+    if (ctx->capture == NULL) {
+        return LIBX52IO_SUCCESS;
+    }
+
+    if (length <= 0 || length > X52IO_REPORT_MAX) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    put_u64(record, timestamp);
+    record[8] = (unsigned char)length;
+
+    if (fwrite(record, sizeof(record), 1, ctx->capture) != 1 ||
+        fwrite(data, length, 1, ctx->capture) != 1) {
+        /* Stop capturing on the first error, rather than writing garbage */
+        libx52io_capture_stop(ctx);
+        return LIBX52IO_ERROR_IO;
+    }
+
+    return LIBX52IO_SUCCESS;
+}
+
+static void replay_wait(uint64_t start, uint64_t offset)
+{
+    uint64_t now = _x52io_timestamp();
+    uint64_t delay;
+    struct timespec ts;
+
+    if (now - start >= offset) {
+        /* We're already behind the original timing */
+        return;
+    }
+
+    delay = offset - (now - start);
+    ts.tv_sec = delay / 1000000000ULL;
+    ts.tv_nsec = delay % 1000000000ULL;
+
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+int libx52io_replay(libx52io_context *ctx, const char *path, bool realtime,
+                    libx52io_replay_callback callback, void *user_data)
+{
+    FILE *fp;
+    unsigned char header[X52IO_CAPTURE_HEADER_LEN];
+    unsigned char record[X52IO_CAPTURE_RECORD_LEN];
+    unsigned char data[X52IO_REPORT_MAX];
+    libx52io_report report;
+    uint64_t first_ts = 0;
+    uint64_t start_ts = 0;
+    bool first = true;
+    int rc;
+
+    if (ctx == NULL || path == NULL || callback == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    /* Replay reuses the context parser, which must not be in use */
+    if (_x52io_is_connected(ctx)) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return LIBX52IO_ERROR_IO;
+    }
+
+    if (fread(header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header, X52IO_CAPTURE_MAGIC, X52IO_CAPTURE_MAGIC_LEN) != 0 ||
+        get_u16(header + 8) != X52IO_CAPTURE_VERSION) {
+        fclose(fp);
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    /* Configure the parser and axis ranges for the captured device */
+    ctx->vid = get_u16(header + 10);
+    ctx->pid = get_u16(header + 12);
+    ctx->version = get_u16(header + 14);
+    _x52io_set_axis_range(ctx);
+    _x52io_set_report_parser(ctx);
+
+    memset(&report, 0, sizeof(report));
+    rc = LIBX52IO_SUCCESS;
+    while (fread(record, sizeof(record), 1, fp) == 1) {
+        uint64_t timestamp = get_u64(record);
+        int length = record[8];
+
+        if (length == 0 || length > X52IO_REPORT_MAX ||
+            fread(data, length, 1, fp) != 1) {
+            /* Truncated or corrupt record */
+            rc = LIBX52IO_ERROR_IO;
+            break;
+        }
+
+        if (first) {
+            first_ts = timestamp;
+            start_ts = _x52io_timestamp();
+            first = false;
+        } else if (realtime && timestamp > first_ts) {
+            replay_wait(start_ts, timestamp - first_ts);
+        }
+
+        rc = _x52io_parse_report(ctx, &report, data, length);
+        if (rc != LIBX52IO_SUCCESS) {
+            break;
+        }
+
+        if (callback(&report, timestamp, user_data) != 0) {
+            break;
+        }
+    }
+
+    fclose(fp);
+    _x52io_release_device_info(ctx);
+
+    return rc;
+}
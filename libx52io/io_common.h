@@ -10,6 +10,8 @@
 #define IO_COMMON_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include "libx52io.h"
 #include "hidapi.h"
 
@@ -19,6 +21,9 @@ typedef int (*x52_parse_report)(unsigned char *data, int length, libx52io_report
 struct libx52io_context {
     hid_device *handle;
 
+    /* Descriptor of the directly opened hidraw device, or -1 if not used */
+    int fd;
+
     int32_t axis_min[LIBX52IO_AXIS_MAX];
     int32_t axis_max[LIBX52IO_AXIS_MAX];
 
@@ -31,14 +36,64 @@ struct libx52io_context {
     char *serial_number;
 
     x52_parse_report parser;
+
+    FILE *capture;
+
+    /* Monotonic timestamp of the last report read from the device */
+    uint64_t report_timestamp;
+
+    struct x52io_reader *reader;
 };
 
+/*
+ * Capture file layout
+ *
+ * The capture file starts with a fixed 16 byte header, followed by zero or
+ * more report records. All multi-byte fields are little endian.
+ *
+ * Header:
+ *      8 bytes     Magic string "X52IOCAP"
+ *      2 bytes     File format version
+ *      2 bytes     Vendor ID of the captured device
+ *      2 bytes     Product ID of the captured device
+ *      2 bytes     Device version of the captured device
+ *
+ * Record:
+ *      8 bytes     Monotonic timestamp in nanoseconds
+ *      1 byte      Report length (N)
+ *      N bytes     Raw report data
+ */
+#define X52IO_CAPTURE_MAGIC         "X52IOCAP"
+#define X52IO_CAPTURE_MAGIC_LEN     8
+#define X52IO_CAPTURE_VERSION       1
+#define X52IO_CAPTURE_HEADER_LEN    16
+#define X52IO_CAPTURE_RECORD_LEN    9
+
+/* Maximum size of a raw X52 report */
+#define X52IO_REPORT_MAX    16
+
 void _x52io_set_axis_range(libx52io_context *ctx);
 void _x52io_set_report_parser(libx52io_context *ctx);
 int _x52io_parse_report(libx52io_context *ctx, libx52io_report *report,
                         unsigned char *data, int length);
 
+uint64_t _x52io_timestamp(void);
+int _x52io_capture_write(libx52io_context *ctx, uint64_t timestamp,
+                         const unsigned char *data, int length);
+
+bool _x52io_is_connected(libx52io_context *ctx);
+int _x52io_hidraw_open(libx52io_context *ctx, const char *path,
+                       uint16_t vid, uint16_t pid);
+void _x52io_hidraw_close(libx52io_context *ctx);
+int _x52io_read_raw(libx52io_context *ctx, unsigned char *data, size_t length,
+                    int timeout);
+
 void _x52io_save_device_info(libx52io_context *ctx, struct hid_device_info *dev);
 void _x52io_release_device_info(libx52io_context *ctx);
 
+#ifdef X52IO_READER_TESTING
+/* Called by the reader thread after it replaces a report when coalescing */
+extern void (*_x52io_reader_coalesce_hook)(libx52io_context *ctx);
+#endif
+
 #endif // !defined IO_COMMON_H
@@ -31,6 +31,7 @@ int libx52io_init(libx52io_context **ctx)
         return LIBX52IO_ERROR_INIT_FAILURE;
     }
 
+    tmp->fd = -1;
     *ctx = tmp;
 
     #if ENABLE_NLS
@@ -58,9 +59,14 @@ int libx52io_close(libx52io_context *ctx)
         return LIBX52IO_ERROR_INVALID;
     }
 
+    /* The reader thread uses both the handle and the capture file */
+    libx52io_reader_stop(ctx);
+    libx52io_capture_stop(ctx);
+
     if (ctx->handle != NULL) {
         hid_close(ctx->handle);
     }
+    _x52io_hidraw_close(ctx);
     _x52io_release_device_info(ctx);
 
     return LIBX52IO_SUCCESS;
@@ -86,10 +92,20 @@ int libx52io_open(libx52io_context *ctx)
         case X52_PROD_X52_1:
         case X52_PROD_X52_2:
         case X52_PROD_X52PRO:
-            ctx->handle = hid_open_path(cur_dev->path);
-            if (ctx->handle == NULL) {
-                rc = LIBX52IO_ERROR_CONN;
+            /*
+             * Prefer opening hidraw devices directly, and only fall back to
+             * hidapi for other backends.
+             */
+            rc = _x52io_hidraw_open(ctx, cur_dev->path, cur_dev->vendor_id,
+                                    cur_dev->product_id);
+            if (rc == LIBX52IO_ERROR_CONN) {
                 goto finally;
+            } else if (rc == LIBX52IO_ERROR_NO_DEVICE) {
+                ctx->handle = hid_open_path(cur_dev->path);
+                if (ctx->handle == NULL) {
+                    rc = LIBX52IO_ERROR_CONN;
+                    goto finally;
+                }
             }
 
             _x52io_save_device_info(ctx, cur_dev);
@@ -0,0 +1,141 @@
+/*
+ * Saitek X52 IO driver - direct hidraw backend
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#if HAVE_LINUX_HIDRAW_H
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+#endif
+
+#include "io_common.h"
+
+/* Prefix of the device paths returned by the hidapi hidraw backend */
+#define HIDRAW_PATH_PREFIX "/dev/hidraw"
+
+int _x52io_hidraw_open(libx52io_context *ctx, const char *path,
+                       uint16_t vid, uint16_t pid)
+{
+    #if HAVE_LINUX_HIDRAW_H
+    struct hidraw_devinfo info;
+    int fd;
+
+    if (strncmp(path, HIDRAW_PATH_PREFIX, strlen(HIDRAW_PATH_PREFIX)) != 0) {
+        /* Not a hidraw device, let hidapi handle it */
+        return LIBX52IO_ERROR_NO_DEVICE;
+    }
+
+    fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return LIBX52IO_ERROR_CONN;
+    }
+
+    /* Make sure that the node wasn't reassigned since it was enumerated */
+    if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0 ||
+        (uint16_t)info.vendor != vid || (uint16_t)info.product != pid) {
+        close(fd);
+        return LIBX52IO_ERROR_CONN;
+    }
+
+    ctx->fd = fd;
+    return LIBX52IO_SUCCESS;
+    #else
+    (void)ctx;
+    (void)path;
+    (void)vid;
+    (void)pid;
+    return LIBX52IO_ERROR_NO_DEVICE;
+    #endif
+}
+
+void _x52io_hidraw_close(libx52io_context *ctx)
+{
+    if (ctx->fd >= 0) {
+        close(ctx->fd);
+        ctx->fd = -1;
+    }
+}
+
+/*
+ * hidraw returns exactly one report per read, so there is no buffering
+ * required. The descriptor is non-blocking, so a zero timeout is a single
+ * read, which is the common case when the application polls the descriptor
+ * returned by libx52io_get_fd.
+ */
+static int hidraw_read(int fd, unsigned char *data, size_t length, int timeout)
+{
+    struct pollfd pfd;
+    ssize_t rc;
+    int prc;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    for (;;) {
+        if (timeout != 0) {
+            prc = poll(&pfd, 1, timeout);
+            if (prc == 0) {
+                return 0;
+            } else if (prc < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+        }
+
+        rc = read(fd, data, length);
+        if (rc > 0) {
+            return (int)rc;
+        } else if (rc == 0) {
+            /* End of file, the device is gone */
+            return -1;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (timeout == 0) {
+                return 0;
+            }
+            /* Spurious wakeup, wait again */
+            continue;
+        }
+
+        return -1;
+    }
+}
+
+int _x52io_read_raw(libx52io_context *ctx, unsigned char *data, size_t length,
+                    int timeout)
+{
+    if (ctx->fd >= 0) {
+        return hidraw_read(ctx->fd, data, length, timeout);
+    }
+
+    return hid_read_timeout(ctx->handle, data, length, timeout);
+}
+
+bool _x52io_is_connected(libx52io_context *ctx)
+{
+    return ctx->handle != NULL || ctx->fd >= 0;
+}
+
+int libx52io_get_fd(libx52io_context *ctx)
+{
+    if (ctx == NULL) {
+        return -1;
+    }
+
+    return ctx->fd;
+}
@@ -6,9 +6,11 @@
  * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
  */
 
+#include "config.h"
 #include <stdint.h>
 #include "io_common.h"
 #include "usb-ids.h"
+#include "usdt.h"
 
 static void map_hat(uint8_t hat, libx52io_report *report)
 {
@@ -269,11 +271,16 @@ void _x52io_set_report_parser(libx52io_context *ctx)
 int _x52io_parse_report(libx52io_context *ctx, libx52io_report *report,
                         unsigned char *data, int length)
 {
+    int rc;
+
     if (ctx->parser == NULL) {
         return LIBX52IO_ERROR_NO_DEVICE;
     }
 
-    return (ctx->parser)(data, length, report);
+    rc = (ctx->parser)(data, length, report);
+    X52_PROBE2(libx52io, parse_report, length, rc);
+
+    return rc;
 }
 
 int libx52io_read(libx52io_context *ctx, libx52io_report *report)
@@ -284,17 +291,17 @@ int libx52io_read(libx52io_context *ctx, libx52io_report *report)
 int libx52io_read_timeout(libx52io_context *ctx, libx52io_report *report, int timeout)
 {
     int rc;
-    unsigned char data[16];
+    unsigned char data[X52IO_REPORT_MAX];
 
     if (ctx == NULL || report == NULL) {
         return LIBX52IO_ERROR_INVALID;
     }
 
-    if (ctx->handle == NULL) {
+    if (!_x52io_is_connected(ctx)) {
         return LIBX52IO_ERROR_NO_DEVICE;
     }
 
-    rc = hid_read_timeout(ctx->handle, data, sizeof(data), timeout);
+    rc = _x52io_read_raw(ctx, data, sizeof(data), timeout);
     if (rc == 0) {
         return LIBX52IO_ERROR_TIMEOUT;
     } else if (rc < 0) {
@@ -302,5 +309,15 @@ int libx52io_read_timeout(libx52io_context *ctx, libx52io_report *report, int ti
     }
 
     // rc > 0
+    ctx->report_timestamp = _x52io_timestamp();
+    if (ctx->capture != NULL) {
+        _x52io_capture_write(ctx, ctx->report_timestamp, data, rc);
+    }
+
     return _x52io_parse_report(ctx, report, data, rc);
 }
+
+uint64_t libx52io_get_report_timestamp(libx52io_context *ctx)
+{
+    return (ctx ? ctx->report_timestamp : 0);
+}
@@ -0,0 +1,450 @@
+/*
+ * Saitek X52 IO driver - background reader thread
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#include "io_common.h"
+
+/* Interval at which the reader thread checks for a stop request */
+#define READER_POLL_TIMEOUT 100 /* milliseconds */
+
+/* Upper limit on the queue size, which is about 3 seconds of reports at 1ms */
+#define READER_QUEUE_MAX 4096
+
+/* Padding to keep the producer and consumer state on separate cache lines */
+#define CACHE_LINE_SIZE 64
+
+/*
+ * Each slot is protected by a sequence lock. The producer increments the
+ * version to an odd value before updating the slot, and to an even value
+ * after, so the consumer can detect and retry a torn read. The index is the
+ * absolute position of the report in the queue, which allows the consumer to
+ * detect that a slot was overwritten by the producer.
+ */
+struct reader_slot {
+    atomic_uint version;
+    uint64_t index;
+    uint64_t timestamp;
+    libx52io_report report;
+};
+
+#ifdef X52IO_READER_TESTING
+void (*_x52io_reader_coalesce_hook)(libx52io_context *ctx);
+#endif
+
+struct x52io_reader {
+    libx52io_context *ctx;
+    pthread_t thread;
+    atomic_bool stop;
+
+    /* Set by the reader thread once it stops due to a device error */
+    atomic_int error;
+
+    libx52io_queue_policy policy;
+    libx52io_reader_callback callback;
+    void *user_data;
+
+    /* Notification descriptors, both are the same for an eventfd */
+    int notify_rd;
+    int notify_wr;
+
+    uint32_t size;
+    struct reader_slot *slots;
+
+    /* Number of reports published by the reader thread */
+    char pad0[CACHE_LINE_SIZE];
+    atomic_uint_fast64_t head;
+    atomic_uint_fast64_t received;
+    atomic_uint_fast64_t coalesced;
+    atomic_uint_fast64_t parse_errors;
+    atomic_uint high_water;
+
+    /* Number of reports consumed by the application */
+    char pad1[CACHE_LINE_SIZE];
+    atomic_uint_fast64_t tail;
+
+    /* Slot version of the last report consumed, written before the tail */
+    atomic_uint read_version;
+    atomic_uint_fast64_t delivered;
+    atomic_uint_fast64_t dropped;
+    char pad2[CACHE_LINE_SIZE];
+};
+
+static void slot_write(struct reader_slot *slot, uint64_t index,
+                       uint64_t timestamp, const libx52io_report *report)
+{
+    unsigned int version = atomic_load_explicit(&slot->version, memory_order_relaxed);
+
+    atomic_store_explicit(&slot->version, version + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->index = index;
+    slot->timestamp = timestamp;
+    memcpy(&slot->report, report, sizeof(*report));
+
+    atomic_store_explicit(&slot->version, version + 2, memory_order_release);
+}
+
+static uint64_t slot_read(struct reader_slot *slot, unsigned int *version,
+                          uint64_t *timestamp, libx52io_report *report)
+{
+    unsigned int v1;
+    unsigned int v2;
+    uint64_t index;
+
+    for (;;) {
+        v1 = atomic_load_explicit(&slot->version, memory_order_acquire);
+        if (v1 & 1) {
+            /* Producer is updating the slot, this is only a few stores */
+            continue;
+        }
+
+        index = slot->index;
+        *timestamp = slot->timestamp;
+        memcpy(report, &slot->report, sizeof(*report));
+
+        atomic_thread_fence(memory_order_acquire);
+        v2 = atomic_load_explicit(&slot->version, memory_order_relaxed);
+        if (v1 == v2) {
+            *version = v1;
+            return index;
+        }
+    }
+}
+
+static void reader_notify(struct x52io_reader *reader)
+{
+    #if HAVE_SYS_EVENTFD_H
+    uint64_t value = 1;
+    #else
+    unsigned char value = 1;
+    #endif
+
+    ssize_t rc;
+
+    /* A full pipe or eventfd already has a pending notification */
+    rc = write(reader->notify_wr, &value, sizeof(value));
+    (void)rc;
+
+    if (reader->callback != NULL) {
+        (reader->callback)(reader->ctx, reader->user_data);
+    }
+}
+
+static void reader_clear(struct x52io_reader *reader)
+{
+    unsigned char buf[64];
+
+    while (read(reader->notify_rd, buf, sizeof(buf)) > 0);
+}
+
+static void reader_push(struct x52io_reader *reader, uint64_t timestamp,
+                        const libx52io_report *report)
+{
+    uint32_t mask = reader->size - 1;
+    uint64_t head = atomic_load_explicit(&reader->head, memory_order_relaxed);
+    uint64_t tail = atomic_load(&reader->tail);
+    struct reader_slot *slot;
+    uint32_t depth;
+
+    if (head - tail >= reader->size && reader->policy == LIBX52IO_QUEUE_COALESCE) {
+        slot = &reader->slots[(head - 1) & mask];
+        slot_write(slot, head - 1, timestamp, report);
+
+        #ifdef X52IO_READER_TESTING
+        if (_x52io_reader_coalesce_hook != NULL) {
+            _x52io_reader_coalesce_hook(reader->ctx);
+        }
+        #endif
+
+        /*
+         * If the application retrieved the previous report before it was
+         * replaced, then there is room for this report, and it must be
+         * published as usual so that it is not lost. However, if the
+         * application read the slot after it was replaced, then it already
+         * has this report, and publishing it again would duplicate it.
+         */
+        if (atomic_load(&reader->tail) != head ||
+            atomic_load(&reader->read_version) ==
+                atomic_load_explicit(&slot->version, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&reader->coalesced, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    /*
+     * For LIBX52IO_QUEUE_DROP_OLDEST, this may overwrite the oldest report,
+     * which the consumer detects from the slot index.
+     */
+    slot_write(&reader->slots[head & mask], head, timestamp, report);
+    atomic_store(&reader->head, head + 1);
+
+    depth = (uint32_t)(head + 1 - tail);
+    if (depth > reader->size) {
+        depth = reader->size;
+    }
+    if (depth > atomic_load_explicit(&reader->high_water, memory_order_relaxed)) {
+        atomic_store_explicit(&reader->high_water, depth, memory_order_relaxed);
+    }
+
+    /* Only notify if the application has drained the queue */
+    if (atomic_load(&reader->tail) == head) {
+        reader_notify(reader);
+    }
+}
+
+static void *reader_thr(void *param)
+{
+    struct x52io_reader *reader = param;
+    libx52io_context *ctx = reader->ctx;
+    unsigned char data[X52IO_REPORT_MAX];
+    libx52io_report report;
+    uint64_t timestamp;
+    int rc;
+
+    memset(&report, 0, sizeof(report));
+
+    while (!atomic_load_explicit(&reader->stop, memory_order_relaxed)) {
+        rc = _x52io_read_raw(ctx, data, sizeof(data), READER_POLL_TIMEOUT);
+        if (rc == 0) {
+            continue;
+        } else if (rc < 0) {
+            atomic_store(&reader->error, LIBX52IO_ERROR_IO);
+            reader_notify(reader);
+            break;
+        }
+
+        timestamp = _x52io_timestamp();
+        atomic_fetch_add_explicit(&reader->received, 1, memory_order_relaxed);
+
+        if (ctx->capture != NULL) {
+            _x52io_capture_write(ctx, timestamp, data, rc);
+        }
+
+        if (_x52io_parse_report(ctx, &report, data, rc) != LIBX52IO_SUCCESS) {
+            atomic_fetch_add_explicit(&reader->parse_errors, 1, memory_order_relaxed);
+            continue;
+        }
+
+        reader_push(reader, timestamp, &report);
+    }
+
+    return NULL;
+}
+
+static int reader_open_notify(struct x52io_reader *reader)
+{
+    #if HAVE_SYS_EVENTFD_H
+    reader->notify_rd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reader->notify_rd < 0) {
+        return -1;
+    }
+    reader->notify_wr = reader->notify_rd;
+    #else
+    int fds[2];
+
+    if (pipe(fds) < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    reader->notify_rd = fds[0];
+    reader->notify_wr = fds[1];
+    #endif
+
+    return 0;
+}
+
+static void reader_free(struct x52io_reader *reader)
+{
+    if (reader->notify_rd >= 0) {
+        close(reader->notify_rd);
+    }
+    if (reader->notify_wr >= 0 && reader->notify_wr != reader->notify_rd) {
+        close(reader->notify_wr);
+    }
+
+    free(reader->slots);
+    free(reader);
+}
+
+int libx52io_reader_start(libx52io_context *ctx, uint32_t queue_size,
+                          libx52io_queue_policy policy,
+                          libx52io_reader_callback callback, void *user_data)
+{
+    struct x52io_reader *reader;
+    uint32_t size;
+
+    if (ctx == NULL || ctx->reader != NULL ||
+        queue_size < 2 || queue_size > READER_QUEUE_MAX ||
+        (policy != LIBX52IO_QUEUE_DROP_OLDEST && policy != LIBX52IO_QUEUE_COALESCE)) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    if (!_x52io_is_connected(ctx)) {
+        return LIBX52IO_ERROR_NO_DEVICE;
+    }
+
+    /* Round up to a power of 2, so that the slot is a simple mask */
+    for (size = 2; size < queue_size; size <<= 1);
+
+    reader = calloc(1, sizeof(*reader));
+    if (reader == NULL) {
+        return LIBX52IO_ERROR_INIT_FAILURE;
+    }
+
+    reader->notify_rd = -1;
+    reader->notify_wr = -1;
+    reader->slots = calloc(size, sizeof(*reader->slots));
+    if (reader->slots == NULL || reader_open_notify(reader) != 0) {
+        reader_free(reader);
+        return LIBX52IO_ERROR_INIT_FAILURE;
+    }
+
+    reader->ctx = ctx;
+    reader->size = size;
+    reader->policy = policy;
+    reader->callback = callback;
+    reader->user_data = user_data;
+
+    if (pthread_create(&reader->thread, NULL, reader_thr, reader) != 0) {
+        reader_free(reader);
+        return LIBX52IO_ERROR_INIT_FAILURE;
+    }
+
+    ctx->reader = reader;
+    return LIBX52IO_SUCCESS;
+}
+
+int libx52io_reader_stop(libx52io_context *ctx)
+{
+    if (ctx == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    if (ctx->reader != NULL) {
+        atomic_store(&ctx->reader->stop, true);
+        pthread_join(ctx->reader->thread, NULL);
+        reader_free(ctx->reader);
+        ctx->reader = NULL;
+    }
+
+    return LIBX52IO_SUCCESS;
+}
+
+int libx52io_reader_pop(libx52io_context *ctx, libx52io_report *report,
+                        uint64_t *timestamp)
+{
+    struct x52io_reader *reader;
+    bool cleared = false;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t index;
+    uint64_t ts;
+    unsigned int version;
+    int error;
+
+    if (ctx == NULL || report == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    reader = ctx->reader;
+    if (reader == NULL) {
+        return LIBX52IO_ERROR_NO_DEVICE;
+    }
+
+    for (;;) {
+        tail = atomic_load_explicit(&reader->tail, memory_order_relaxed);
+        head = atomic_load(&reader->head);
+
+        if (head == tail) {
+            if (!cleared) {
+                /*
+                 * Clear the notification before checking the queue again,
+                 * so that a report pushed in between is not missed.
+                 */
+                reader_clear(reader);
+                cleared = true;
+                continue;
+            }
+
+            error = atomic_load(&reader->error);
+            if (atomic_load(&reader->head) != tail) {
+                continue;
+            }
+            return error ? error : LIBX52IO_ERROR_TIMEOUT;
+        }
+
+        index = slot_read(&reader->slots[tail & (reader->size - 1)], &version, &ts, report);
+        if (index != tail) {
+            /*
+             * The producer has lapped us, and the slot now contains a newer
+             * report. Anything older than a full queue behind it is gone.
+             */
+            atomic_fetch_add_explicit(&reader->dropped, index + 1 - reader->size - tail,
+                                      memory_order_relaxed);
+            atomic_store(&reader->tail, index + 1 - reader->size);
+            continue;
+        }
+
+        atomic_store(&reader->read_version, version);
+        atomic_store(&reader->tail, tail + 1);
+        atomic_fetch_add_explicit(&reader->delivered, 1, memory_order_relaxed);
+
+        if (timestamp != NULL) {
+            *timestamp = ts;
+        }
+        return LIBX52IO_SUCCESS;
+    }
+}
+
+int libx52io_reader_get_fd(libx52io_context *ctx)
+{
+    if (ctx == NULL || ctx->reader == NULL) {
+        return -1;
+    }
+
+    return ctx->reader->notify_rd;
+}
+
+int libx52io_reader_get_stats(libx52io_context *ctx, libx52io_reader_stats *stats)
+{
+    struct x52io_reader *reader;
+
+    if (ctx == NULL || stats == NULL) {
+        return LIBX52IO_ERROR_INVALID;
+    }
+
+    reader = ctx->reader;
+    if (reader == NULL) {
+        return LIBX52IO_ERROR_NO_DEVICE;
+    }
+
+    stats->received = atomic_load_explicit(&reader->received, memory_order_relaxed);
+    stats->delivered = atomic_load_explicit(&reader->delivered, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&reader->dropped, memory_order_relaxed);
+    stats->coalesced = atomic_load_explicit(&reader->coalesced, memory_order_relaxed);
+    stats->parse_errors = atomic_load_explicit(&reader->parse_errors, memory_order_relaxed);
+    stats->high_water = atomic_load_explicit(&reader->high_water, memory_order_relaxed);
+
+    return LIBX52IO_SUCCESS;
+}
@@ -377,6 +377,40 @@ int libx52io_read_timeout(libx52io_context *ctx, libx52io_report *report, int ti
  */
 int libx52io_read(libx52io_context *ctx, libx52io_report *report);
 
+/**
+ * @brief Get the timestamp of the last report
+ *
+ * This returns the time at which the last report returned by
+ * \ref libx52io_read_timeout was read from the device, before it was parsed.
+ * The timestamp is taken from the monotonic clock, and can be compared with
+ * \c clock_gettime(CLOCK_MONOTONIC) to measure the input processing latency.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ *
+ * @returns Timestamp in nanoseconds, or 0 if no report has been read
+ */
+uint64_t libx52io_get_report_timestamp(libx52io_context *ctx);
+
+/**
+ * @brief Get the file descriptor of the connected device
+ *
+ * On Linux, libx52io opens hidraw devices directly, bypassing hidapi. In this
+ * case, the application may add the file descriptor to its own event loop
+ * using poll, select or epoll. When the descriptor becomes readable, calling
+ * \ref libx52io_read_timeout with a timeout of 0 reads and parses the report
+ * with a single system call.
+ *
+ * The application must not read from or close the descriptor, and it is
+ * only valid until the device is closed. It must not be used while the
+ * background reader is running.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ *
+ * @returns File descriptor of the device, or -1 if the device is not
+ * connected, or is connected through hidapi.
+ */
+int libx52io_get_fd(libx52io_context *ctx);
+
 /**
  * @brief Retrieve the range of an axis
  *
@@ -396,6 +430,263 @@ int libx52io_read(libx52io_context *ctx, libx52io_report *report);
  */
 int libx52io_get_axis_range(libx52io_context *ctx, libx52io_axis axis, int32_t *min, int32_t *max);
 
+/**
+ * @brief Start capturing raw HID reports to a file
+ *
+ * This function opens the given file and records every raw HID report that
+ * is subsequently read by \ref libx52io_read_timeout, along with a monotonic
+ * timestamp. The capture is buffered, and is flushed to disk when it is
+ * stopped by \ref libx52io_capture_stop, or when the device is closed.
+ *
+ * The capture file can be replayed using \ref libx52io_replay, which allows
+ * the input pipeline to be exercised without the joystick attached.
+ *
+ * If a capture is already in progress, it is stopped before the new capture
+ * is started.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ * @param[in]   path    Path to the capture file. Any existing file is
+ *                      overwritten.
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS if the capture was started
+ * - \ref LIBX52IO_ERROR_INVALID if the context or path pointers are not valid
+ * - \ref LIBX52IO_ERROR_NO_DEVICE if the device is not connected
+ * - \ref LIBX52IO_ERROR_IO if the capture file could not be written
+ */
+int libx52io_capture_start(libx52io_context *ctx, const char *path);
+
+/**
+ * @brief Stop capturing raw HID reports
+ *
+ * This function flushes and closes any capture file opened by \ref
+ * libx52io_capture_start. It is acceptable to call this function if no
+ * capture is in progress.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on success, or if no capture is in progress
+ * - \ref LIBX52IO_ERROR_INVALID if the context pointer is not valid
+ * - \ref LIBX52IO_ERROR_IO if the capture file could not be flushed
+ */
+int libx52io_capture_stop(libx52io_context *ctx);
+
+/**
+ * @brief Replay callback function type
+ *
+ * This is called by \ref libx52io_replay for every report in the capture
+ * file. The report pointer is only valid for the duration of the callback.
+ *
+ * @param[in]   report      Parsed HID report
+ * @param[in]   timestamp   Monotonic timestamp of the original report, in
+ *                          nanoseconds
+ * @param[in]   user_data   Pointer passed to \ref libx52io_replay
+ *
+ * @returns 0 to continue the replay, non-zero to stop it.
+ */
+typedef int (*libx52io_replay_callback)(libx52io_report *report,
+                                        uint64_t timestamp,
+                                        void *user_data);
+
+/**
+ * @brief Replay a file of captured HID reports
+ *
+ * This function reads a capture file written by \ref libx52io_capture_start,
+ * parses each report using the parser for the captured device and calls the
+ * callback function with the parsed report. This goes through the same
+ * parsing path as \ref libx52io_read_timeout, which allows the input
+ * pipeline to be benchmarked and tested offline.
+ *
+ * While the replay is in progress, the context behaves as if the captured
+ * device was connected, so \ref libx52io_get_product_id and related
+ * functions return the captured values. The context must not have an open
+ * device connection.
+ *
+ * @param[in]   ctx         Pointer to the device context
+ * @param[in]   path        Path to the capture file
+ * @param[in]   realtime    If true, reports are delivered with the same
+ *                          timing as they were captured. If false, reports
+ *                          are delivered as fast as possible.
+ * @param[in]   callback    Function to call for every report
+ * @param[in]   user_data   Pointer to pass to the callback function
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS if the replay completed, or was stopped by the
+ *   callback function
+ * - \ref LIBX52IO_ERROR_INVALID if the pointers are not valid, the file is
+ *   not a capture file, or the context has an open device connection
+ * - \ref LIBX52IO_ERROR_NO_DEVICE if the captured device is not supported
+ * - \ref LIBX52IO_ERROR_IO if the capture file could not be read, or contains
+ *   a corrupt report
+ */
+int libx52io_replay(libx52io_context *ctx, const char *path, bool realtime,
+                    libx52io_replay_callback callback, void *user_data);
+
+/**
+ * @brief Overflow policy for the background reader queue
+ *
+ * This determines what happens when the background reader receives a report
+ * while the queue is full, because the application is not consuming reports
+ * fast enough. The reader never blocks on a full queue.
+ */
+typedef enum {
+    /** Discard the oldest queued report to make room for the new report */
+    LIBX52IO_QUEUE_DROP_OLDEST,
+
+    /**
+     * Replace the most recently queued report with the new report. This
+     * preserves the oldest reports, and ensures that the last queued report
+     * is always the latest state of the joystick.
+     */
+    LIBX52IO_QUEUE_COALESCE,
+} libx52io_queue_policy;
+
+/**
+ * @brief Background reader notification callback
+ *
+ * This is called from the background reader thread whenever the queue goes
+ * from empty to non-empty, and when the reader stops due to a device error.
+ * The callback must not block, and should only signal the application to
+ * drain the queue with \ref libx52io_reader_pop.
+ *
+ * @param[in]   ctx         Pointer to the device context
+ * @param[in]   user_data   Pointer passed to \ref libx52io_reader_start
+ */
+typedef void (*libx52io_reader_callback)(libx52io_context *ctx, void *user_data);
+
+/**
+ * @brief Background reader statistics
+ *
+ * Counters are cumulative since the reader was started.
+ */
+typedef struct {
+    /** Number of reports read from the device */
+    uint64_t received;
+
+    /** Number of reports retrieved by the application */
+    uint64_t delivered;
+
+    /** Number of reports discarded due to \ref LIBX52IO_QUEUE_DROP_OLDEST */
+    uint64_t dropped;
+
+    /** Number of reports merged due to \ref LIBX52IO_QUEUE_COALESCE */
+    uint64_t coalesced;
+
+    /** Number of reports that failed to parse */
+    uint64_t parse_errors;
+
+    /** Maximum number of reports that were waiting in the queue */
+    uint32_t high_water;
+} libx52io_reader_stats;
+
+/**
+ * @brief Start the background reader thread
+ *
+ * This starts a thread owned by the library which reads and parses reports
+ * from the connected joystick, and pushes them along with a monotonic
+ * timestamp into a bounded lock-free queue. The application retrieves the
+ * reports with \ref libx52io_reader_pop, and may be notified of new reports
+ * either through the callback function, or by polling the file descriptor
+ * returned by \ref libx52io_reader_get_fd.
+ *
+ * The queue has a single producer (the reader thread) and a single consumer,
+ * so \ref libx52io_reader_pop must not be called from multiple threads
+ * simultaneously. While the reader is running, the application must not call
+ * \ref libx52io_read_timeout, \ref libx52io_capture_start or
+ * \ref libx52io_capture_stop. Any capture started before the reader is
+ * continued by the reader thread.
+ *
+ * If the reader encounters an error reading from the device, it stops
+ * reading and notifies the application. Once the queued reports have been
+ * retrieved, \ref libx52io_reader_pop returns the error, and the application
+ * should stop the reader and reconnect to the device.
+ *
+ * @param[in]   ctx         Pointer to the device context
+ * @param[in]   queue_size  Number of reports in the queue, rounded up to a
+ *                          power of 2. This must be at least 2.
+ * @param[in]   policy      Overflow policy when the queue is full
+ * @param[in]   callback    Notification function, may be NULL
+ * @param[in]   user_data   Pointer to pass to the callback function
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS if the reader was started
+ * - \ref LIBX52IO_ERROR_INVALID if the arguments are not valid, or the
+ *   reader is already running
+ * - \ref LIBX52IO_ERROR_NO_DEVICE if the device is not connected
+ * - \ref LIBX52IO_ERROR_INIT_FAILURE if the reader could not be created
+ */
+int libx52io_reader_start(libx52io_context *ctx, uint32_t queue_size,
+                          libx52io_queue_policy policy,
+                          libx52io_reader_callback callback, void *user_data);
+
+/**
+ * @brief Stop the background reader thread
+ *
+ * This stops the background reader and discards any queued reports. The
+ * reader polls for the stop request, so this may take up to 100ms. It is
+ * acceptable to call this function if the reader is not running. The reader
+ * is also stopped when the device is closed.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on success, or if the reader is not running
+ * - \ref LIBX52IO_ERROR_INVALID if the context pointer is not valid
+ */
+int libx52io_reader_stop(libx52io_context *ctx);
+
+/**
+ * @brief Retrieve the oldest report from the background reader queue
+ *
+ * This function never blocks. When the queue is empty, it also clears the
+ * notification on the file descriptor returned by \ref libx52io_reader_get_fd,
+ * so the application should retrieve reports until this returns
+ * \ref LIBX52IO_ERROR_TIMEOUT before waiting on the descriptor again.
+ *
+ * @param[in]   ctx         Pointer to the device context
+ * @param[out]  report      Pointer to save the decoded HID report
+ * @param[out]  timestamp   Pointer to save the monotonic timestamp of the
+ *                          report in nanoseconds, may be NULL
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS if a report was retrieved
+ * - \ref LIBX52IO_ERROR_INVALID if the pointers are not valid
+ * - \ref LIBX52IO_ERROR_NO_DEVICE if the reader is not running
+ * - \ref LIBX52IO_ERROR_TIMEOUT if the queue is empty
+ * - \ref LIBX52IO_ERROR_IO if the queue is empty and the reader stopped due
+ *   to an error reading from the device
+ */
+int libx52io_reader_pop(libx52io_context *ctx, libx52io_report *report,
+                        uint64_t *timestamp);
+
+/**
+ * @brief Get the notification file descriptor of the background reader
+ *
+ * The returned file descriptor becomes readable when the queue goes from
+ * empty to non-empty, or the reader stops due to an error. This is an
+ * eventfd where available, or the read end of a pipe otherwise. The
+ * application must not read from or close the descriptor.
+ *
+ * @param[in]   ctx     Pointer to the device context
+ *
+ * @returns File descriptor on success, or -1 if the reader is not running
+ */
+int libx52io_reader_get_fd(libx52io_context *ctx);
+
+/**
+ * @brief Get the background reader statistics
+ *
+ * @param[in]   ctx     Pointer to the device context
+ * @param[out]  stats   Pointer to save the statistics
+ *
+ * @returns
+ * - \ref LIBX52IO_SUCCESS on success
+ * - \ref LIBX52IO_ERROR_INVALID if the pointers are not valid
+ * - \ref LIBX52IO_ERROR_NO_DEVICE if the reader is not running
+ */
+int libx52io_reader_get_stats(libx52io_context *ctx, libx52io_reader_stats *stats);
+
 /**
  * @brief Get the string representation of an error code
  *
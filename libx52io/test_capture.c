@@ -0,0 +1,258 @@
+/*
+ * Saitek X52 IO driver - Capture and replay test suite
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "io_common.h"
+#include "usb-ids.h"
+
+static char capture_file[] = "/tmp/x52io-capture-XXXXXX";
+
+/* Data for the replay callback */
+struct replay_data {
+    int count;
+    int stop_after;
+    uint64_t last_timestamp;
+    libx52io_report last_report;
+};
+
+static int replay_cb(libx52io_report *report, uint64_t timestamp, void *user_data)
+{
+    struct replay_data *data = user_data;
+
+    data->count++;
+    data->last_timestamp = timestamp;
+    memcpy(&data->last_report, report, sizeof(*report));
+
+    return (data->stop_after && data->count >= data->stop_after);
+}
+
+static int group_setup(void **state)
+{
+    libx52io_context *ctx;
+    int rc;
+    int fd;
+
+    rc = libx52io_init(&ctx);
+    if (rc != LIBX52IO_SUCCESS) {
+        return rc;
+    }
+
+    fd = mkstemp(capture_file);
+    if (fd < 0) {
+        return -1;
+    }
+    close(fd);
+
+    *state = ctx;
+    return 0;
+}
+
+static int test_setup(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    /* Create a dummy X52 Pro handle so that the capture can be started */
+    ctx->handle = (void *)(uintptr_t)(-1);
+    ctx->vid = VENDOR_SAITEK;
+    ctx->pid = X52_PROD_X52PRO;
+    _x52io_set_report_parser(ctx);
+
+    return 0;
+}
+
+static int test_teardown(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    libx52io_capture_stop(ctx);
+    ctx->handle = NULL;
+    _x52io_release_device_info(ctx);
+    return 0;
+}
+
+static int group_teardown(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    unlink(capture_file);
+    ctx->handle = NULL;
+    libx52io_exit(ctx);
+    return 0;
+}
+
+/* Write count X52 Pro reports, with the X axis set to the report index */
+static void write_capture(libx52io_context *ctx, int count)
+{
+    unsigned char data[15] = { 0 };
+    int rc;
+
+    rc = libx52io_capture_start(ctx, capture_file);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+
+    for (int i = 0; i < count; i++) {
+        data[0] = i & 0xff;
+        data[8] = (i & 1); // Trigger on alternate reports
+        rc = _x52io_capture_write(ctx, 1000 + i, data, sizeof(data));
+        assert_int_equal(rc, LIBX52IO_SUCCESS);
+    }
+
+    rc = libx52io_capture_stop(ctx);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+
+    /* Replay requires that the device is not connected */
+    ctx->handle = NULL;
+    _x52io_release_device_info(ctx);
+}
+
+static void test_capture_no_device(void **state)
+{
+    libx52io_context *ctx = *state;
+    int rc;
+
+    ctx->handle = NULL;
+    rc = libx52io_capture_start(ctx, capture_file);
+    assert_int_equal(rc, LIBX52IO_ERROR_NO_DEVICE);
+}
+
+static void test_capture_invalid(void **state)
+{
+    libx52io_context *ctx = *state;
+
+    assert_int_equal(libx52io_capture_start(NULL, capture_file), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_capture_start(ctx, NULL), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_capture_stop(NULL), LIBX52IO_ERROR_INVALID);
+}
+
+static void test_replay_all(void **state)
+{
+    libx52io_context *ctx = *state;
+    struct replay_data data = { 0 };
+    int rc;
+
+    write_capture(ctx, 10);
+
+    rc = libx52io_replay(ctx, capture_file, false, replay_cb, &data);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(data.count, 10);
+    assert_int_equal(data.last_timestamp, 1009);
+    assert_int_equal(data.last_report.axis[LIBX52IO_AXIS_X], 9);
+    assert_int_equal(data.last_report.button[LIBX52IO_BTN_TRIGGER], true);
+
+    /* Replay must leave the context disconnected */
+    assert_int_equal(libx52io_get_product_id(ctx), 0);
+}
+
+static void test_replay_stop(void **state)
+{
+    libx52io_context *ctx = *state;
+    struct replay_data data = { 0 };
+    int rc;
+
+    write_capture(ctx, 10);
+
+    data.stop_after = 4;
+    rc = libx52io_replay(ctx, capture_file, false, replay_cb, &data);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(data.count, 4);
+    assert_int_equal(data.last_report.axis[LIBX52IO_AXIS_X], 3);
+    assert_int_equal(data.last_report.button[LIBX52IO_BTN_TRIGGER], true);
+}
+
+static void test_replay_realtime(void **state)
+{
+    libx52io_context *ctx = *state;
+    struct replay_data data = { 0 };
+    int rc;
+
+    /* Timestamps are 1ns apart, so this should complete immediately */
+    write_capture(ctx, 3);
+
+    rc = libx52io_replay(ctx, capture_file, true, replay_cb, &data);
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(data.count, 3);
+}
+
+static void test_replay_connected(void **state)
+{
+    libx52io_context *ctx = *state;
+    struct replay_data data = { 0 };
+    int rc;
+
+    rc = libx52io_replay(ctx, capture_file, false, replay_cb, &data);
+    assert_int_equal(rc, LIBX52IO_ERROR_INVALID);
+    assert_int_equal(data.count, 0);
+}
+
+static void test_replay_bad_file(void **state)
+{
+    libx52io_context *ctx = *state;
+    struct replay_data data = { 0 };
+    FILE *fp;
+    int rc;
+
+    fp = fopen(capture_file, "wb");
+    assert_non_null(fp);
+    fputs("This is not a capture file", fp);
+    fclose(fp);
+
+    ctx->handle = NULL;
+    rc = libx52io_replay(ctx, capture_file, false, replay_cb, &data);
+    assert_int_equal(rc, LIBX52IO_ERROR_INVALID);
+    assert_int_equal(data.count, 0);
+}
+
+static void test_replay_truncated(void **state)
+{
+    libx52io_context *ctx = *state;
+    struct replay_data data = { 0 };
+    long size;
+    FILE *fp;
+    int rc;
+
+    write_capture(ctx, 5);
+
+    /* Chop off the last few bytes of the final report */
+    fp = fopen(capture_file, "rb");
+    assert_non_null(fp);
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fclose(fp);
+    assert_int_equal(truncate(capture_file, size - 4), 0);
+
+    rc = libx52io_replay(ctx, capture_file, false, replay_cb, &data);
+    assert_int_equal(rc, LIBX52IO_ERROR_IO);
+    assert_int_equal(data.count, 4);
+}
+
+#define TEST(tc) cmocka_unit_test_setup_teardown(tc, test_setup, test_teardown)
+const struct CMUnitTest tests[] = {
+    TEST(test_capture_no_device),
+    TEST(test_capture_invalid),
+    TEST(test_replay_all),
+    TEST(test_replay_stop),
+    TEST(test_replay_realtime),
+    TEST(test_replay_connected),
+    TEST(test_replay_bad_file),
+    TEST(test_replay_truncated),
+};
+#undef TEST
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, group_setup, group_teardown);
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Saitek X52 IO driver - Direct device read test suite
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "io_common.h"
+#include "usb-ids.h"
+
+/*
+ * A datagram socket preserves message boundaries just like hidraw, so it is
+ * used to stand in for the device node.
+ */
+struct test_state {
+    libx52io_context *ctx;
+    int peer;
+};
+
+static int group_setup(void **state)
+{
+    static struct test_state ts;
+    int rc;
+
+    rc = libx52io_init(&ts.ctx);
+    if (rc != LIBX52IO_SUCCESS) {
+        return rc;
+    }
+
+    *state = &ts;
+    return 0;
+}
+
+static int test_setup(void **state)
+{
+    struct test_state *ts = *state;
+    libx52io_context *ctx = ts->ctx;
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0) {
+        return -1;
+    }
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+
+    ctx->fd = sv[0];
+    ctx->vid = VENDOR_SAITEK;
+    ctx->pid = X52_PROD_X52PRO;
+    _x52io_set_report_parser(ctx);
+    ts->peer = sv[1];
+
+    return 0;
+}
+
+static int test_teardown(void **state)
+{
+    struct test_state *ts = *state;
+
+    if (ts->peer >= 0) {
+        close(ts->peer);
+    }
+    libx52io_close(ts->ctx);
+    return 0;
+}
+
+static int group_teardown(void **state)
+{
+    struct test_state *ts = *state;
+
+    libx52io_exit(ts->ctx);
+    free(ts->ctx);
+    return 0;
+}
+
+static void send_report(struct test_state *ts, unsigned char x)
+{
+    unsigned char data[15] = { 0 };
+
+    data[0] = x;
+    assert_int_equal(write(ts->peer, data, sizeof(data)), sizeof(data));
+}
+
+static void test_get_fd(void **state)
+{
+    struct test_state *ts = *state;
+
+    assert_int_equal(libx52io_get_fd(ts->ctx), ts->ctx->fd);
+    assert_int_equal(libx52io_get_fd(NULL), -1);
+    assert_int_equal(libx52io_get_report_timestamp(NULL), 0);
+}
+
+static void test_read_nonblocking(void **state)
+{
+    struct test_state *ts = *state;
+    libx52io_report report;
+
+    assert_int_equal(libx52io_read_timeout(ts->ctx, &report, 0), LIBX52IO_ERROR_TIMEOUT);
+
+    send_report(ts, 0x12);
+    send_report(ts, 0x34);
+
+    /* Each read returns exactly one report */
+    assert_int_equal(libx52io_read_timeout(ts->ctx, &report, 0), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x12);
+    assert_true(libx52io_get_report_timestamp(ts->ctx) != 0);
+    assert_true(libx52io_get_report_timestamp(ts->ctx) <= _x52io_timestamp());
+    assert_int_equal(libx52io_read_timeout(ts->ctx, &report, 0), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x34);
+    assert_int_equal(libx52io_read_timeout(ts->ctx, &report, 0), LIBX52IO_ERROR_TIMEOUT);
+}
+
+static void test_read_timeout(void **state)
+{
+    struct test_state *ts = *state;
+    libx52io_report report;
+
+    assert_int_equal(libx52io_read_timeout(ts->ctx, &report, 10), LIBX52IO_ERROR_TIMEOUT);
+
+    send_report(ts, 0x56);
+    assert_int_equal(libx52io_read(ts->ctx, &report), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 0x56);
+}
+
+static void test_read_disconnect(void **state)
+{
+    struct test_state *ts = *state;
+    libx52io_report report;
+    int fds[2];
+
+    /* A pipe returns end of file once the writer closes, like a removed device */
+    assert_int_equal(pipe(fds), 0);
+    close(ts->ctx->fd);
+    close(fds[1]);
+    ts->ctx->fd = fds[0];
+
+    assert_int_equal(libx52io_read_timeout(ts->ctx, &report, 10), LIBX52IO_ERROR_IO);
+}
+
+static void test_close(void **state)
+{
+    struct test_state *ts = *state;
+    libx52io_report report;
+
+    assert_int_equal(libx52io_close(ts->ctx), LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_get_fd(ts->ctx), -1);
+    assert_int_equal(libx52io_read_timeout(ts->ctx, &report, 0), LIBX52IO_ERROR_NO_DEVICE);
+}
+
+#define TEST(tc) cmocka_unit_test_setup_teardown(tc, test_setup, test_teardown)
+const struct CMUnitTest tests[] = {
+    TEST(test_get_fd),
+    TEST(test_read_nonblocking),
+    TEST(test_read_timeout),
+    TEST(test_read_disconnect),
+    TEST(test_close),
+};
+#undef TEST
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, group_setup, group_teardown);
+    return 0;
+}
@@ -0,0 +1,363 @@
+/*
+ * Saitek X52 IO driver - Background reader test suite
+ *
+ * Copyright (C) 2012-2020 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdatomic.h>
+
+#include "io_common.h"
+#include "libhidx52.h"
+#include "usb-ids.h"
+
+static char device_list[] = "/tmp/x52io-devices-XXXXXX";
+static char report_file[] = "/tmp/x52io-reports-XXXXXX";
+
+static int make_temp(char *template)
+{
+    int fd = mkstemp(template);
+    if (fd < 0) {
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+/* Write count X52 Pro reports, with the X axis set to the report index */
+static void write_reports(int count, const char *trailer)
+{
+    FILE *fp = fopen(report_file, "w");
+    assert_non_null(fp);
+
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "%02x 00 00 00 00 00 00 00 00 00 00 00 00 00 00\n", i);
+    }
+    if (trailer != NULL) {
+        fputs(trailer, fp);
+    }
+
+    fclose(fp);
+}
+
+/* Open the stub device with the reports that have been written */
+static libx52io_context *open_context(void **state)
+{
+    libx52io_context *ctx;
+
+    assert_int_equal(libx52io_init(&ctx), LIBX52IO_SUCCESS);
+    *state = ctx;
+    assert_int_equal(libx52io_open(ctx), LIBX52IO_SUCCESS);
+    return ctx;
+}
+
+/* Wait for the reader thread to receive the given number of reports */
+static void wait_received(libx52io_context *ctx, uint64_t count)
+{
+    libx52io_reader_stats stats;
+
+    for (int i = 0; i < 200; i++) {
+        assert_int_equal(libx52io_reader_get_stats(ctx, &stats), LIBX52IO_SUCCESS);
+        if (stats.received >= count) {
+            return;
+        }
+        usleep(10000);
+    }
+
+    fail_msg("Reader received %lu of %lu reports", (unsigned long)stats.received,
+             (unsigned long)count);
+}
+
+static void wait_notify(libx52io_context *ctx)
+{
+    struct pollfd pfd;
+
+    pfd.fd = libx52io_reader_get_fd(ctx);
+    pfd.events = POLLIN;
+    assert_true(pfd.fd >= 0);
+    assert_int_equal(poll(&pfd, 1, 2000), 1);
+}
+
+static int group_setup(void **state)
+{
+    char buf[32];
+    FILE *fp;
+
+    if (make_temp(device_list) || make_temp(report_file)) {
+        return -1;
+    }
+
+    fp = fopen(device_list, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+    snprintf(buf, sizeof(buf), "%04x %04x\n", VENDOR_SAITEK, X52_PROD_X52PRO);
+    fputs(buf, fp);
+    fclose(fp);
+
+    setenv(INPUT_DEVICE_LIST_ENV, device_list, 1);
+    setenv(INPUT_REPORT_FILE_ENV, report_file, 1);
+    return 0;
+}
+
+static int group_teardown(void **state)
+{
+    unlink(device_list);
+    unlink(report_file);
+    return 0;
+}
+
+static int test_setup(void **state)
+{
+    *state = NULL;
+    return 0;
+}
+
+static int test_teardown(void **state)
+{
+    libx52io_exit(*state);
+    free(*state);
+    return 0;
+}
+
+static void test_reader_invalid(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+    libx52io_reader_stats stats;
+
+    write_reports(0, NULL);
+    assert_int_equal(libx52io_init(&ctx), LIBX52IO_SUCCESS);
+    *state = ctx;
+
+    assert_int_equal(libx52io_reader_start(NULL, 8, LIBX52IO_QUEUE_DROP_OLDEST, NULL, NULL),
+                     LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_reader_start(ctx, 1, LIBX52IO_QUEUE_DROP_OLDEST, NULL, NULL),
+                     LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_reader_start(ctx, 8, 10, NULL, NULL),
+                     LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_reader_start(ctx, 8, LIBX52IO_QUEUE_DROP_OLDEST, NULL, NULL),
+                     LIBX52IO_ERROR_NO_DEVICE);
+
+    assert_int_equal(libx52io_reader_pop(ctx, &report, NULL), LIBX52IO_ERROR_NO_DEVICE);
+    assert_int_equal(libx52io_reader_pop(ctx, NULL, NULL), LIBX52IO_ERROR_INVALID);
+    assert_int_equal(libx52io_reader_get_stats(ctx, &stats), LIBX52IO_ERROR_NO_DEVICE);
+    assert_int_equal(libx52io_reader_get_fd(ctx), -1);
+    assert_int_equal(libx52io_reader_stop(ctx), LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_reader_stop(NULL), LIBX52IO_ERROR_INVALID);
+
+    /* Only one reader may be running at a time */
+    assert_int_equal(libx52io_open(ctx), LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_reader_start(ctx, 8, LIBX52IO_QUEUE_DROP_OLDEST, NULL, NULL),
+                     LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_reader_start(ctx, 8, LIBX52IO_QUEUE_DROP_OLDEST, NULL, NULL),
+                     LIBX52IO_ERROR_INVALID);
+}
+
+static void test_reader_pop(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+    libx52io_reader_stats stats;
+    uint64_t timestamp;
+    uint64_t last = 0;
+
+    write_reports(10, NULL);
+    ctx = open_context(state);
+    assert_int_equal(libx52io_reader_start(ctx, 16, LIBX52IO_QUEUE_DROP_OLDEST, NULL, NULL),
+                     LIBX52IO_SUCCESS);
+
+    for (int i = 0; i < 10; i++) {
+        int rc = libx52io_reader_pop(ctx, &report, &timestamp);
+        if (rc == LIBX52IO_ERROR_TIMEOUT) {
+            wait_notify(ctx);
+            i--;
+            continue;
+        }
+
+        assert_int_equal(rc, LIBX52IO_SUCCESS);
+        assert_int_equal(report.axis[LIBX52IO_AXIS_X], i);
+        assert_true(timestamp >= last);
+        last = timestamp;
+    }
+
+    assert_int_equal(libx52io_reader_pop(ctx, &report, NULL), LIBX52IO_ERROR_TIMEOUT);
+    assert_int_equal(libx52io_reader_get_stats(ctx, &stats), LIBX52IO_SUCCESS);
+    assert_int_equal(stats.received, 10);
+    assert_int_equal(stats.delivered, 10);
+    assert_int_equal(stats.dropped, 0);
+    assert_int_equal(stats.coalesced, 0);
+}
+
+static void test_reader_drop_oldest(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+    libx52io_reader_stats stats;
+
+    write_reports(100, NULL);
+    ctx = open_context(state);
+    assert_int_equal(libx52io_reader_start(ctx, 8, LIBX52IO_QUEUE_DROP_OLDEST, NULL, NULL),
+                     LIBX52IO_SUCCESS);
+    wait_received(ctx, 100);
+
+    /* Only the latest reports remain */
+    for (int i = 92; i < 100; i++) {
+        assert_int_equal(libx52io_reader_pop(ctx, &report, NULL), LIBX52IO_SUCCESS);
+        assert_int_equal(report.axis[LIBX52IO_AXIS_X], i);
+    }
+    assert_int_equal(libx52io_reader_pop(ctx, &report, NULL), LIBX52IO_ERROR_TIMEOUT);
+
+    assert_int_equal(libx52io_reader_get_stats(ctx, &stats), LIBX52IO_SUCCESS);
+    assert_int_equal(stats.delivered, 8);
+    assert_int_equal(stats.dropped, 92);
+    assert_int_equal(stats.high_water, 8);
+}
+
+static void test_reader_coalesce(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+    libx52io_reader_stats stats;
+
+    write_reports(100, NULL);
+    ctx = open_context(state);
+    assert_int_equal(libx52io_reader_start(ctx, 8, LIBX52IO_QUEUE_COALESCE, NULL, NULL),
+                     LIBX52IO_SUCCESS);
+    wait_received(ctx, 100);
+
+    /* The oldest reports are kept, and the last one is the latest state */
+    for (int i = 0; i < 7; i++) {
+        assert_int_equal(libx52io_reader_pop(ctx, &report, NULL), LIBX52IO_SUCCESS);
+        assert_int_equal(report.axis[LIBX52IO_AXIS_X], i);
+    }
+    assert_int_equal(libx52io_reader_pop(ctx, &report, NULL), LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 99);
+    assert_int_equal(libx52io_reader_pop(ctx, &report, NULL), LIBX52IO_ERROR_TIMEOUT);
+
+    assert_int_equal(libx52io_reader_get_stats(ctx, &stats), LIBX52IO_SUCCESS);
+    assert_int_equal(stats.delivered, 8);
+    assert_int_equal(stats.dropped, 0);
+    assert_int_equal(stats.coalesced, 92);
+}
+
+/* Reports read by the coalesce hook, as the X axis values */
+static int hook_reads[4];
+static int hook_count;
+
+/* Drain the queue after the reader replaced a report, but before it checks */
+static void drain_hook(libx52io_context *ctx)
+{
+    libx52io_report report;
+
+    _x52io_reader_coalesce_hook = NULL;
+    while (libx52io_reader_pop(ctx, &report, NULL) == LIBX52IO_SUCCESS) {
+        hook_reads[hook_count++] = report.axis[LIBX52IO_AXIS_X];
+    }
+}
+
+static void test_reader_coalesce_no_duplicate(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+    int rc;
+
+    /*
+     * The third report replaces the second in a full queue, and is read
+     * before the reader thread checks if the second was consumed, so it must
+     * not be published again. The fourth report is then queued as usual.
+     */
+    hook_count = 0;
+    _x52io_reader_coalesce_hook = drain_hook;
+    write_reports(4, NULL);
+    ctx = open_context(state);
+    assert_int_equal(libx52io_reader_start(ctx, 2, LIBX52IO_QUEUE_COALESCE, NULL, NULL),
+                     LIBX52IO_SUCCESS);
+    wait_received(ctx, 4);
+
+    assert_null(_x52io_reader_coalesce_hook);
+    assert_int_equal(hook_count, 2);
+    assert_int_equal(hook_reads[0], 0);
+    assert_int_equal(hook_reads[1], 2);
+
+    while ((rc = libx52io_reader_pop(ctx, &report, NULL)) == LIBX52IO_ERROR_TIMEOUT) {
+        wait_notify(ctx);
+    }
+    assert_int_equal(rc, LIBX52IO_SUCCESS);
+    assert_int_equal(report.axis[LIBX52IO_AXIS_X], 3);
+    assert_int_equal(libx52io_reader_pop(ctx, &report, NULL), LIBX52IO_ERROR_TIMEOUT);
+}
+
+static void notify_cb(libx52io_context *ctx, void *user_data)
+{
+    atomic_int *count = user_data;
+    atomic_fetch_add(count, 1);
+}
+
+static void test_reader_callback(void **state)
+{
+    libx52io_context *ctx;
+    atomic_int count = 0;
+
+    write_reports(5, NULL);
+    ctx = open_context(state);
+    assert_int_equal(libx52io_reader_start(ctx, 8, LIBX52IO_QUEUE_DROP_OLDEST, notify_cb, &count),
+                     LIBX52IO_SUCCESS);
+    wait_received(ctx, 5);
+
+    /* Nothing has been consumed, so only the first report notifies */
+    assert_int_equal(atomic_load(&count), 1);
+    libx52io_reader_stop(ctx);
+}
+
+static void test_reader_disconnect(void **state)
+{
+    libx52io_context *ctx;
+    libx52io_report report;
+
+    write_reports(1, "disconnect 1000\n");
+    ctx = open_context(state);
+    assert_int_equal(libx52io_reader_start(ctx, 8, LIBX52IO_QUEUE_DROP_OLDEST, NULL, NULL),
+                     LIBX52IO_SUCCESS);
+    wait_received(ctx, 1);
+
+    /* Queued reports are delivered before the error */
+    assert_int_equal(libx52io_reader_pop(ctx, &report, NULL), LIBX52IO_SUCCESS);
+    while (libx52io_reader_pop(ctx, &report, NULL) == LIBX52IO_ERROR_TIMEOUT) {
+        wait_notify(ctx);
+    }
+    assert_int_equal(libx52io_reader_pop(ctx, &report, NULL), LIBX52IO_ERROR_IO);
+
+    /* Closing the device stops the reader */
+    assert_int_equal(libx52io_close(ctx), LIBX52IO_SUCCESS);
+    assert_int_equal(libx52io_reader_get_fd(ctx), -1);
+}
+
+#define TEST(tc) cmocka_unit_test_setup_teardown(tc, test_setup, test_teardown)
+const struct CMUnitTest tests[] = {
+    TEST(test_reader_invalid),
+    TEST(test_reader_pop),
+    TEST(test_reader_drop_oldest),
+    TEST(test_reader_coalesce),
+    TEST(test_reader_coalesce_no_duplicate),
+    TEST(test_reader_callback),
+    TEST(test_reader_disconnect),
+};
+#undef TEST
+
+int main(void)
+{
+    cmocka_set_message_output(CM_OUTPUT_TAP);
+    cmocka_run_group_tests(tests, group_setup, group_teardown);
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * Saitek X52 Pro MFD & LED driver - Static tracepoints
+ *
+ * Copyright (C) 2022 Nirenjan Krishnan (nirenjan@nirenjan.org)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only WITH Classpath-exception-2.0
+ */
+
+/*
+ * USDT probes for perf, bpftrace and SystemTap. Each probe compiles to a
+ * single nop instruction and a note in the ELF file, so it costs nothing
+ * until a tracer attaches to it. The arguments must be integers or
+ * pointers. If sys/sdt.h is not available, the probes compile to nothing,
+ * but the arguments are still referenced to avoid unused variable warnings.
+ *
+ * The following probes are defined:
+ *
+ *  libx52:vendor_command_entry     wIndex, wValue
+ *  libx52:vendor_command_return    wIndex, wValue, rc
+ *  libx52:update_begin             update mask
+ *  libx52:update_end               update mask not written, rc
+ *  libx52io:parse_report           report length, rc
+ *  x52d:command                    command ID, argc, command name
+ *  x52d:notify_broadcast           topic, payload length, payload
+ */
+#ifndef USDT_H
+#define USDT_H
+
+#include "config.h"
+
+#if HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define X52_PROBE0(provider, name) \
+    DTRACE_PROBE(provider, name)
+#define X52_PROBE1(provider, name, a1) \
+    DTRACE_PROBE1(provider, name, a1)
+#define X52_PROBE2(provider, name, a1, a2) \
+    DTRACE_PROBE2(provider, name, a1, a2)
+#define X52_PROBE3(provider, name, a1, a2, a3) \
+    DTRACE_PROBE3(provider, name, a1, a2, a3)
+#else
+#define X52_PROBE0(provider, name) \
+    do { } while (0)
+#define X52_PROBE1(provider, name, a1) \
+    do { (void)(a1); } while (0)
+#define X52_PROBE2(provider, name, a1, a2) \
+    do { (void)(a1); (void)(a2); } while (0)
+#define X52_PROBE3(provider, name, a1, a2, a3) \
+    do { (void)(a1); (void)(a2); (void)(a3); } while (0)
+#endif
+
+#endif // !defined USDT_H